@@ -43,6 +43,10 @@ android {
     buildFeatures {
         compose = true
     }
+    androidResources {
+        // Models are mapped from the APK, not inflated (ModelSource.fromRawResources), so they are stored uncompressed
+        noCompress += listOf("_param", "_bin")
+    }
 
     ndkVersion = "29.0.14206865"
     externalNativeBuild {
@@ -0,0 +1,191 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "ModelSource.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        struct Mapping
+        {
+            void *const address;
+            const size_t length;
+
+            Mapping(void *address, size_t length) : address{address}, length{length}
+            {
+            }
+
+            Mapping(const Mapping &) = delete;
+
+            Mapping &operator=(const Mapping &) = delete;
+
+            ~Mapping()
+            {
+                munmap(address, length);
+            }
+        };
+
+        std::runtime_error systemError(const std::string &what)
+        {
+            return std::runtime_error(what + ": " + std::strerror(errno));
+        }
+
+        /// An anonymous file in memory holding buffer. Called through syscall(), as bionic only wraps it from API 30
+        int createMemoryFile(const char *name, const ModelBuffer &buffer)
+        {
+            const int fd = static_cast<int>(syscall(SYS_memfd_create, name, MFD_CLOEXEC));
+            if (fd < 0)
+            {
+                throw systemError(std::string("Cannot create in-memory file ") + name);
+            }
+            const std::byte *data = buffer.data();
+            size_t left = buffer.size();
+            while (left > 0)
+            {
+                const ssize_t written = write(fd, data, left);
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (written <= 0)
+                {
+                    const std::runtime_error error = systemError(std::string("Cannot write in-memory file ") + name);
+                    close(fd);
+                    throw error;
+                }
+                data += written;
+                left -= static_cast<size_t>(written);
+            }
+            return fd;
+        }
+
+        std::filesystem::path memoryFilePath(int fd)
+        {
+            return std::filesystem::path{"/proc/self/fd"} / std::to_string(fd);
+        }
+    }
+
+    ModelBuffer::ModelBuffer(std::shared_ptr<const std::byte> data, size_t size) : data_{std::move(data)}, size_{size}
+    {
+    }
+
+    ModelBuffer ModelBuffer::mapFile(const std::filesystem::path &path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw systemError("Cannot open model file " + path.string());
+        }
+        struct stat file_stat{};
+        if (fstat(fd, &file_stat) != 0)
+        {
+            const std::runtime_error error = systemError("Cannot access model file " + path.string());
+            close(fd);
+            throw error;
+        }
+        try
+        {
+            ModelBuffer buffer = mapFileRange(fd, 0, file_stat.st_size);
+            close(fd);
+            return buffer;
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+    }
+
+    ModelBuffer ModelBuffer::mapFileRange(int fd, int64_t offset, int64_t length)
+    {
+        if (offset < 0 || length <= 0)
+        {
+            throw std::runtime_error("Empty or invalid model file range");
+        }
+        // mmap() takes page-aligned offsets only. Map from the page the range starts in
+        const int64_t page_size = sysconf(_SC_PAGESIZE);
+        const int64_t page_offset = offset % page_size;
+        const auto map_length = static_cast<size_t>(length + page_offset);
+        void *address = mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(offset - page_offset));
+        if (address == MAP_FAILED)
+        {
+            throw systemError("Cannot map model file");
+        }
+        auto mapping = std::make_shared<Mapping>(address, map_length);
+        // Aliasing constructor: the bytes keep the whole mapping alive
+        std::shared_ptr<const std::byte> data{mapping, static_cast<const std::byte *>(address) + page_offset};
+        return ModelBuffer{std::move(data), static_cast<size_t>(length)};
+    }
+
+    ModelBuffer ModelBuffer::wrap(const void *data, size_t size, std::shared_ptr<const void> owner)
+    {
+        return ModelBuffer{std::shared_ptr<const std::byte>{std::move(owner), static_cast<const std::byte *>(data)}, size};
+    }
+
+    struct ModelSource::Files
+    {
+        std::filesystem::path param_path;
+        std::filesystem::path bin_path;
+        /// In-memory files behind the paths, -1 for files on storage
+        int param_fd = -1;
+        int bin_fd = -1;
+
+        Files() = default;
+
+        Files(const Files &) = delete;
+
+        Files &operator=(const Files &) = delete;
+
+        ~Files()
+        {
+            for (const int fd: {param_fd, bin_fd})
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+        }
+    };
+
+    ModelSource::ModelSource(std::shared_ptr<const Files> files) : files_{std::move(files)}
+    {
+    }
+
+    ModelSource ModelSource::fromFiles(const std::filesystem::path &param_path, const std::filesystem::path &bin_path)
+    {
+        auto files = std::make_shared<Files>();
+        files->param_path = param_path;
+        files->bin_path = bin_path;
+        return ModelSource{std::move(files)};
+    }
+
+    ModelSource ModelSource::fromBuffers(const ModelBuffer &param, const ModelBuffer &bin)
+    {
+        auto files = std::make_shared<Files>();
+        files->param_fd = createMemoryFile("model_param", param);
+        files->bin_fd = createMemoryFile("model_bin", bin);
+        files->param_path = memoryFilePath(files->param_fd);
+        files->bin_path = memoryFilePath(files->bin_fd);
+        return ModelSource{std::move(files)};
+    }
+
+    const std::filesystem::path &ModelSource::paramPath() const
+    {
+        return files_->param_path;
+    }
+
+    const std::filesystem::path &ModelSource::binPath() const
+    {
+        return files_->bin_path;
+    }
+
+} // ase_ultrasound_watermark
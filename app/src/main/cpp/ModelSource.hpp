@@ -0,0 +1,80 @@
+#ifndef ULTRASOUNDWATERMARK_MODELSOURCE_HPP
+#define ULTRASOUNDWATERMARK_MODELSOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+namespace ase_ultrasound_watermark
+{
+    /// Read-only bytes of a model file held in memory. Copies share the same memory
+    class ModelBuffer
+    {
+    public:
+        /**
+         * Map a whole file read-only.
+         * @throw std::runtime_error if the file cannot be mapped
+         */
+        static ModelBuffer mapFile(const std::filesystem::path &path);
+
+        /**
+         * Map length bytes at offset of an open file read-only, e.g. an uncompressed resource inside the APK.
+         * The offset need not be page-aligned. fd may be closed once this returns.
+         * @throw std::runtime_error if the range cannot be mapped
+         */
+        static ModelBuffer mapFileRange(int fd, int64_t offset, int64_t length);
+
+        /// Refer to memory owned by someone else, e.g. an AAsset buffer, kept alive by owner
+        static ModelBuffer wrap(const void *data, size_t size, std::shared_ptr<const void> owner);
+
+        [[nodiscard]] const std::byte *data() const
+        {
+            return data_.get();
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return size_;
+        }
+
+    private:
+        ModelBuffer(std::shared_ptr<const std::byte> data, size_t size);
+
+        std::shared_ptr<const std::byte> data_;
+        size_t size_;
+    };
+
+    /**
+     * The param and bin files of one model, given either as files or as buffers in memory (an APK resource, an asset,
+     * a download), without copying them to storage first.
+     *
+     * WatermarkGenerator and WatermarkDetector only load from paths, so buffers are exposed to them through anonymous
+     * in-memory files (memfd), readable at paramPath() and binPath() for as long as the source exists. That costs one
+     * copy in memory when the source is created, but no storage I/O. Copies of a ModelSource share the buffers and
+     * the in-memory files, so every instance created from one source loads from the same memory.
+     */
+    class ModelSource
+    {
+    public:
+        /// The files themselves, loaded from where they are
+        static ModelSource fromFiles(const std::filesystem::path &param_path, const std::filesystem::path &bin_path);
+
+        /// @throw std::runtime_error if the in-memory files cannot be created
+        static ModelSource fromBuffers(const ModelBuffer &param, const ModelBuffer &bin);
+
+        [[nodiscard]] const std::filesystem::path &paramPath() const;
+
+        [[nodiscard]] const std::filesystem::path &binPath() const;
+
+    private:
+        struct Files;
+
+        explicit ModelSource(std::shared_ptr<const Files> files);
+
+        std::shared_ptr<const Files> files_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_MODELSOURCE_HPP
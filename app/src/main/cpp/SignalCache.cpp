@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <ase/utilities/AudioBufferOperations.hpp>
+#include "SignalCache.hpp"
+#include "dsp/PolyphaseResampler.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        constexpr uint16_t WAVE_FORMAT_PCM = 0x0001;
+        constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+        /// Input frames the resampler takes per call when converting a decoded signal
+        constexpr size_t CONVERT_BLOCK_FRAMES = 4096;
+
+        struct MappedFile
+        {
+            void *const address;
+            const size_t length;
+
+            MappedFile(void *address, size_t length) : address{address}, length{length}
+            {
+            }
+
+            MappedFile(const MappedFile &) = delete;
+
+            MappedFile &operator=(const MappedFile &) = delete;
+
+            ~MappedFile()
+            {
+                munmap(address, length);
+            }
+        };
+
+        template<typename T>
+        T readLittleEndian(const uint8_t *data)
+        {
+            T value{};
+            std::memcpy(&value, data, sizeof(T)); // Android and Linux targets are little-endian
+            return value;
+        }
+
+        bool readAt(int fd, size_t offset, uint8_t *buffer, size_t size)
+        {
+            return pread(fd, buffer, size, static_cast<off_t>(offset)) == static_cast<ssize_t>(size);
+        }
+
+        /// Byte range of a WAV file's samples
+        struct DataChunk
+        {
+            size_t offset;
+            size_t size;
+        };
+
+        /**
+         * Find the data chunk of a WAV file of the given length, if the file is 16-bit PCM in the expected format and
+         * the chunk lies within the file. Only the headers are read
+         */
+        std::optional<DataChunk> findPcmData(int fd, size_t length, int expected_sample_rate, int expected_channels)
+        {
+            uint8_t riff[12];
+            if (length < sizeof(riff) || !readAt(fd, 0, riff, sizeof(riff)) ||
+                std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0)
+            {
+                return std::nullopt;
+            }
+            bool format_matches = false;
+            for (size_t offset = sizeof(riff); offset + 8 <= length;)
+            {
+                uint8_t chunk[8];
+                if (!readAt(fd, offset, chunk, sizeof(chunk)))
+                {
+                    return std::nullopt;
+                }
+                const auto chunk_size = readLittleEndian<uint32_t>(chunk + 4);
+                const size_t body = offset + sizeof(chunk);
+                if (chunk_size > length - body)
+                {
+                    // Truncated, left to the decoder
+                    return std::nullopt;
+                }
+                if (std::memcmp(chunk, "fmt ", 4) == 0)
+                {
+                    // Up to the sub-format tag of WAVE_FORMAT_EXTENSIBLE
+                    uint8_t format[26]{};
+                    if (chunk_size < 16 || !readAt(fd, body, format, std::min<size_t>(chunk_size, sizeof(format))))
+                    {
+                        return std::nullopt;
+                    }
+                    const auto format_tag = readLittleEndian<uint16_t>(format);
+                    const auto channels = readLittleEndian<uint16_t>(format + 2);
+                    const auto sample_rate = readLittleEndian<uint32_t>(format + 4);
+                    const auto bits_per_sample = readLittleEndian<uint16_t>(format + 14);
+                    bool is_pcm = format_tag == WAVE_FORMAT_PCM;
+                    if (format_tag == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 40)
+                    {
+                        // The first two bytes of the sub-format GUID carry the actual format tag
+                        is_pcm = readLittleEndian<uint16_t>(format + 24) == WAVE_FORMAT_PCM;
+                    }
+                    format_matches = is_pcm && bits_per_sample == 16 &&
+                                     channels == expected_channels &&
+                                     static_cast<int64_t>(sample_rate) == expected_sample_rate;
+                } else if (std::memcmp(chunk, "data", 4) == 0)
+                {
+                    // int16_t samples must be 2-byte aligned to be read in place
+                    const size_t frame_bytes = sizeof(int16_t) * static_cast<size_t>(expected_channels);
+                    if (!format_matches || body % alignof(int16_t) != 0 || chunk_size < frame_bytes)
+                    {
+                        return std::nullopt;
+                    }
+                    return DataChunk{body, chunk_size - chunk_size % frame_bytes};
+                }
+                // Chunks are padded to an even size
+                offset = body + chunk_size + (chunk_size & 1u);
+            }
+            return std::nullopt;
+        }
+
+        /**
+         * Convert decoded samples to the expected format in place, the way WavFileInputDevice matches channels, and
+         * return the new length in frames
+         */
+        size_t convert(ase::aligned_unique_ptr<int16_t[]> &buffer, size_t length, int sample_rate, int channels,
+                       int expected_sample_rate, int expected_channels)
+        {
+            std::vector<float> remixed(length * static_cast<size_t>(expected_channels));
+            for (size_t i = 0; i < length; ++i)
+            {
+                const int16_t *frame = buffer.get() + i * static_cast<size_t>(channels);
+                for (int c = 0; c < expected_channels; ++c)
+                {
+                    remixed[i * expected_channels + c] = static_cast<float>(frame[std::min(c, channels - 1)]) * dsp::PCM16_TO_FLOAT;
+                }
+            }
+            std::vector<float> resampled;
+            if (sample_rate == expected_sample_rate)
+            {
+                resampled = std::move(remixed);
+            } else
+            {
+                // The passband is narrowed to what the lower rate can carry, as for batch input
+                const float passband_hz = std::min(dsp::PolyphaseResampler::DEFAULT_PASSBAND_HZ,
+                                                   0.45f * static_cast<float>(std::min(sample_rate, expected_sample_rate)));
+                dsp::PolyphaseResampler resampler{sample_rate, expected_sample_rate, expected_channels, CONVERT_BLOCK_FRAMES, passband_hz};
+                const size_t output_frames = resampler.maxOutputFrames(length);
+                resampled.resize(output_frames * expected_channels);
+                // Followed by the filter's look-ahead in silence, which completes the last output frames
+                const std::vector<float> silence(CONVERT_BLOCK_FRAMES * expected_channels, 0.0f);
+                size_t produced = 0;
+                size_t consumed = 0;
+                const size_t input_frames = length + static_cast<size_t>(resampler.latencyInputFrames());
+                while (produced < output_frames && consumed < input_frames)
+                {
+                    const size_t frames = std::min(CONVERT_BLOCK_FRAMES, input_frames - consumed);
+                    const float *in = consumed < length ? remixed.data() + consumed * expected_channels : silence.data();
+                    const size_t block = consumed < length ? std::min(frames, length - consumed) : frames;
+                    produced += resampler.process(in, block, resampled.data() + produced * expected_channels, output_frames - produced);
+                    consumed += block;
+                }
+                resampled.resize(produced * expected_channels);
+            }
+            const size_t frames = resampled.size() / static_cast<size_t>(expected_channels);
+            if (frames == 0)
+            {
+                throw std::runtime_error("Signal is too short to convert to " + std::to_string(expected_sample_rate) + " Hz");
+            }
+            buffer = ase::aligned_unique_ptr<int16_t[]>(resampled.size());
+            dsp::floatToInt16(resampled.data(), buffer.get(), resampled.size());
+            return frames;
+        }
+    }
+
+    SignalCache::Signal SignalCache::get(const std::filesystem::path &path, int expected_sample_rate, int expected_channels)
+    {
+        if (expected_sample_rate <= 0 || expected_channels <= 0)
+        {
+            throw std::runtime_error("Invalid signal format of " + std::to_string(expected_sample_rate) + " Hz and " +
+                                     std::to_string(expected_channels) + " channels");
+        }
+        std::error_code error;
+        const auto modification_time = std::filesystem::last_write_time(path, error);
+        const auto file_size = std::filesystem::file_size(path, error);
+        if (error)
+        {
+            throw std::runtime_error("Cannot access signal file " + path.string() + ": " + error.message());
+        }
+
+        std::lock_guard lock{mutex_};
+        auto it = entries_.find(path.string());
+        if (it != entries_.end() &&
+            it->second.modification_time == modification_time &&
+            it->second.file_size == file_size &&
+            it->second.expected_sample_rate == expected_sample_rate &&
+            it->second.expected_channels == expected_channels)
+        {
+            return it->second.signal;
+        }
+
+        auto mapped = map(path, expected_sample_rate, expected_channels);
+        Signal signal = mapped ? std::move(*mapped) : decode(path, expected_sample_rate, expected_channels);
+        entries_[path.string()] = Entry{modification_time, file_size, expected_sample_rate, expected_channels, signal};
+        return signal;
+    }
+
+    void SignalCache::clear()
+    {
+        std::lock_guard lock{mutex_};
+        entries_.clear();
+    }
+
+    std::optional<SignalCache::Signal> SignalCache::map(const std::filesystem::path &path, int expected_sample_rate, int expected_channels)
+    {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return std::nullopt;
+        }
+        struct stat file_stat{};
+        std::optional<DataChunk> data;
+        if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+        {
+            data = findPcmData(fd, static_cast<size_t>(file_stat.st_size), expected_sample_rate, expected_channels);
+        }
+        if (!data)
+        {
+            close(fd);
+            return std::nullopt;
+        }
+        // Only the pages holding the samples. Populate the page tables now, so that the audio callback does not take
+        // page faults on first playback
+        const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t map_offset = data->offset / page_size * page_size;
+        const size_t map_length = data->offset + data->size - map_offset;
+        void *address = mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, static_cast<off_t>(map_offset));
+        close(fd);
+        if (address == MAP_FAILED)
+        {
+            return std::nullopt;
+        }
+        auto mapping = std::make_shared<MappedFile>(address, map_length);
+        // Aliasing constructor: the samples keep the whole mapping alive
+        const auto *first = reinterpret_cast<const int16_t *>(static_cast<const uint8_t *>(address) + (data->offset - map_offset));
+        std::shared_ptr<const int16_t> samples{mapping, first};
+        const size_t frames = data->size / (sizeof(int16_t) * static_cast<size_t>(expected_channels));
+        return Signal{std::move(samples), frames, expected_sample_rate, expected_channels, true};
+    }
+
+    SignalCache::Signal SignalCache::decode(const std::filesystem::path &path, int expected_sample_rate, int expected_channels)
+    {
+        int fs = 0;
+        int ch = 0;
+        size_t length = 0;
+        auto buffer = ase::readBufferFromWavFile<int16_t>(path, fs, ch, length);
+        if (!buffer || length == 0 || fs <= 0 || ch <= 0)
+        {
+            throw std::runtime_error("Cannot read signal file " + path.string());
+        }
+        if (fs != expected_sample_rate || ch != expected_channels)
+        {
+            length = convert(buffer, length, fs, ch, expected_sample_rate, expected_channels);
+        }
+        // __cpp_lib_shared_ptr_arrays has not been migrated in to NDK's clang. Same workaround as OboeLoopPlayer.
+        int16_t *raw_ptr = buffer.release();
+        std::shared_ptr<const int16_t> samples{raw_ptr, buffer.get_deleter()};
+        return Signal{std::move(samples), length, expected_sample_rate, expected_channels, false};
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,68 @@
+#ifndef ULTRASOUNDWATERMARK_SIGNALCACHE_HPP
+#define ULTRASOUNDWATERMARK_SIGNALCACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Cache of 16-bit PCM signals loaded from WAV files, keyed by path and modification time.
+     *
+     * When the file already holds 16-bit PCM in the requested sample rate and channel count, which is checked from its
+     * headers before anything is mapped, the signal is played from a read-only memory mapping of its data chunk.
+     * Otherwise it is decoded once with ase::readBufferFromWavFile() and converted to the requested format: channels
+     * are duplicated or dropped, and the rate is converted with a PolyphaseResampler. Either way, later requests for an
+     * unchanged file return the same buffer.
+     */
+    class SignalCache
+    {
+    public:
+        struct Signal
+        {
+            /// Interleaved samples. Keeps the mapping or decoded buffer alive
+            std::shared_ptr<const int16_t> samples;
+            size_t size_in_frames;
+            /// Always the requested sample rate and channel count
+            int sample_rate;
+            int channels;
+            /// True if samples point into a memory mapping of the file
+            bool memory_mapped;
+        };
+
+        /**
+         * Get the signal stored in a WAV file, loading it if it is not cached or the file has changed.
+         * @param expected_sample_rate Sample rate the caller will play the signal at
+         * @param expected_channels Channel count the caller will play the signal with
+         * @throw std::runtime_error if the file cannot be read, or the expected format is not positive
+         */
+        Signal get(const std::filesystem::path &path, int expected_sample_rate, int expected_channels);
+
+        void clear();
+
+    private:
+        struct Entry
+        {
+            std::filesystem::file_time_type modification_time;
+            uintmax_t file_size;
+            int expected_sample_rate;
+            int expected_channels;
+            Signal signal;
+        };
+
+        std::mutex mutex_;
+        std::unordered_map<std::string, Entry> entries_;
+
+        static std::optional<Signal> map(const std::filesystem::path &path, int expected_sample_rate, int expected_channels);
+
+        static Signal decode(const std::filesystem::path &path, int expected_sample_rate, int expected_channels);
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_SIGNALCACHE_HPP
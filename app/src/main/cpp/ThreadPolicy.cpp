@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <android/log.h>
+#include "ThreadPolicy.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        constexpr int MAX_CPUS = 64;
+        constexpr char LOG_TAG[] = "ThreadPolicy";
+    }
+
+    void ThreadPolicy::applyToCurrentThread() const
+    {
+        if (cpu_mask != 0)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (int cpu = 0; cpu < MAX_CPUS; ++cpu)
+            {
+                if (cpu_mask & (uint64_t{1} << cpu))
+                {
+                    CPU_SET(cpu, &cpus);
+                }
+            }
+            if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+            {
+                throw std::runtime_error(std::string("Cannot set thread affinity: ") + std::strerror(errno));
+            }
+        }
+        // On Linux, PRIO_PROCESS with a thread id sets the priority of that thread only
+        if (nice != KEEP_NICE && setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), nice) != 0)
+        {
+            throw std::runtime_error("Cannot set thread priority to nice " + std::to_string(nice) + ": " + std::strerror(errno));
+        }
+    }
+
+    void runWithThreadPolicy(const ThreadPolicy &policy, const std::function<void()> &task)
+    {
+        if (policy.keepsAll())
+        {
+            task();
+            return;
+        }
+        std::exception_ptr error;
+        std::thread runner{[&] {
+            try
+            {
+                // Tuning only. Devices differ in what they permit, and the pipeline works without it
+                try
+                {
+                    policy.applyToCurrentThread();
+                }
+                catch (const std::exception &e)
+                {
+                    __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "Running without the thread policy: %s", e.what());
+                }
+                task();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+        }};
+        runner.join();
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    CpuTopology CpuTopology::detect()
+    {
+        const long configured = sysconf(_SC_NPROCESSORS_CONF);
+        const int cpus = static_cast<int>(std::clamp<long>(configured, 1, MAX_CPUS));
+        std::vector<int64_t> max_khz(static_cast<size_t>(cpus), 0);
+        uint64_t all = 0;
+        for (int cpu = 0; cpu < cpus; ++cpu)
+        {
+            all |= uint64_t{1} << cpu;
+            std::ifstream file{"/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/cpuinfo_max_freq"};
+            file >> max_khz[static_cast<size_t>(cpu)];
+        }
+        int64_t slowest = std::numeric_limits<int64_t>::max();
+        for (const int64_t khz: max_khz)
+        {
+            if (khz > 0)
+            {
+                slowest = std::min(slowest, khz);
+            }
+        }
+        uint64_t performance = 0;
+        uint64_t efficiency = 0;
+        for (int cpu = 0; cpu < cpus; ++cpu)
+        {
+            const int64_t khz = max_khz[static_cast<size_t>(cpu)];
+            // CPUs without a frequency (offline, or no cpufreq) are not placed in either cluster
+            if (khz > slowest)
+            {
+                performance |= uint64_t{1} << cpu;
+            }
+            else if (khz == slowest)
+            {
+                efficiency |= uint64_t{1} << cpu;
+            }
+        }
+        if (performance == 0)
+        {
+            // Homogeneous, or no frequencies at all
+            return CpuTopology{all, all, all};
+        }
+        return CpuTopology{all, performance, efficiency};
+    }
+
+} // ase_ultrasound_watermark
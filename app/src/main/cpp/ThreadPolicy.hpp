@@ -0,0 +1,66 @@
+#ifndef ULTRASOUNDWATERMARK_THREADPOLICY_HPP
+#define ULTRASOUNDWATERMARK_THREADPOLICY_HPP
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+
+namespace ase_ultrasound_watermark
+{
+    /// Where a thread may run and at which priority. The default leaves both as the thread inherited them
+    struct ThreadPolicy
+    {
+        constexpr static int KEEP_NICE = std::numeric_limits<int>::min();
+
+        /// CPUs the thread may run on, bit n for CPU n. 0 keeps the inherited affinity
+        uint64_t cpu_mask = 0;
+        /// Nice value, -20 (highest priority) to 19, e.g. -16 for Android's THREAD_PRIORITY_URGENT_AUDIO.
+        /// Values below the inherited one need the system to allow it
+        int nice = KEEP_NICE;
+
+        [[nodiscard]] bool keepsAll() const
+        {
+            return cpu_mask == 0 && nice == KEEP_NICE;
+        }
+
+        /**
+         * Apply to the calling thread. Threads it creates afterwards inherit the policy.
+         * @throw std::runtime_error if the mask names no online CPU or the priority is not permitted
+         */
+        void applyToCurrentThread() const;
+    };
+
+    /// Thread policies of a caller's or callee's pipeline
+    struct PipelineThreadConfig
+    {
+        /// Worker running the generator or detector
+        ThreadPolicy inference;
+        /// KCP client or server I/O thread, which also runs the callee's receive path
+        ThreadPolicy network;
+    };
+
+    /**
+     * Run task on a short-lived thread that has policy applied, so that threads the task creates inherit the policy
+     * (e.g. a library's I/O thread) while the calling thread is left as it is. Waits for the task and rethrows what
+     * it throws. A policy that keeps everything runs the task on the calling thread.
+     * A policy the system does not permit is logged and the task runs without it.
+     */
+    void runWithThreadPolicy(const ThreadPolicy &policy, const std::function<void()> &task);
+
+    /// CPU masks of a heterogeneous (big.LITTLE) processor, by the maximum frequency of each core
+    struct CpuTopology
+    {
+        /// All CPUs the system has
+        uint64_t all_mask;
+        /// CPUs faster than the slowest cluster. Same as all_mask on homogeneous processors
+        uint64_t performance_mask;
+        /// CPUs of the slowest cluster
+        uint64_t efficiency_mask;
+
+        /// Read from /sys/devices/system/cpu. Where frequencies are unavailable, every CPU counts as both kinds
+        static CpuTopology detect();
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_THREADPOLICY_HPP
@@ -1,15 +1,24 @@
 #include <jni.h>
+#include <algorithm>
 #include <string>
 #include <memory>
 #include <filesystem>
 #include <map>
+#include <mutex>
+#include <vector>
 #include <stdexcept>
 
+#include "ModelSource.hpp"
+#include "ThreadPolicy.hpp"
 #include "WatermarkCaller.hpp"
 #include "WatermarkCallee.hpp"
+#include "WatermarkResultDispatcher.hpp"
+
+#include <oboe/Oboe.h>
 
 // for logging
 #include <android/log.h>
+#include <android/asset_manager_jni.h>
 #define APPNAME "UltrasoundWatermarkJNI"
 
 static JavaVM *g_jvm = nullptr;
@@ -21,6 +30,92 @@ void throw_java_exception(JNIEnv *env, const char *message) {
     }
 }
 
+// Null, with a WatermarkNativeException pending, if the class lacks the method, e.g. after its signature changed
+jmethodID get_method_id(JNIEnv *env, jclass clazz, const char *name, const char *signature) {
+    jmethodID method = env->GetMethodID(clazz, name, signature);
+    if (!method) {
+        // Replaces the pending NoSuchMethodError with the exception the Kotlin side expects from native calls
+        env->ExceptionClear();
+        throw_java_exception(env, (std::string("Missing method ") + name + signature).c_str());
+    }
+    return method;
+}
+
+jobjectArray to_java_latency_report(JNIEnv *env, const std::vector<ase_ultrasound_watermark::LatencyTracer::StageLatency> &report) {
+    jclass stage_class = env->FindClass("com/csr460/ultrasoundwatermark/StageLatency");
+    if (!stage_class) {
+        return nullptr;
+    }
+    jmethodID constructor = get_method_id(env, stage_class, "<init>", "(Ljava/lang/String;JJJJJ)V");
+    if (!constructor) {
+        return nullptr;
+    }
+    jobjectArray result = env->NewObjectArray(static_cast<jsize>(report.size()), stage_class, nullptr);
+    for (size_t i = 0; i < report.size(); ++i) {
+        const auto &latency = report[i].latency;
+        jstring stage = env->NewStringUTF(report[i].stage.c_str());
+        jobject element = env->NewObject(stage_class, constructor, stage,
+                                         static_cast<jlong>(latency.count), static_cast<jlong>(latency.p50_us),
+                                         static_cast<jlong>(latency.p90_us), static_cast<jlong>(latency.p99_us),
+                                         static_cast<jlong>(latency.max_us));
+        env->SetObjectArrayElement(result, static_cast<jsize>(i), element);
+        env->DeleteLocalRef(element);
+        env->DeleteLocalRef(stage);
+    }
+    return result;
+}
+
+jobjectArray to_java_stream_stats(JNIEnv *env, const std::vector<ase_android::OboeStreamStats> &streams) {
+    jclass stats_class = env->FindClass("com/csr460/ultrasoundwatermark/StreamStats");
+    if (!stats_class) {
+        return nullptr;
+    }
+    jmethodID constructor = get_method_id(env, stats_class, "<init>", "(ZIZZIIJJJJJJI)V");
+    if (!constructor) {
+        return nullptr;
+    }
+    jobjectArray result = env->NewObjectArray(static_cast<jsize>(streams.size()), stats_class, nullptr);
+    for (size_t i = 0; i < streams.size(); ++i) {
+        const auto &stats = streams[i];
+        jobject element = env->NewObject(stats_class, constructor,
+                                         static_cast<jboolean>(stats.direction == oboe::Direction::Input),
+                                         static_cast<jint>(stats.device_id),
+                                         static_cast<jboolean>(stats.performance_mode == oboe::PerformanceMode::LowLatency),
+                                         static_cast<jboolean>(stats.sharing_mode == oboe::SharingMode::Exclusive),
+                                         static_cast<jint>(stats.sample_rate), static_cast<jint>(stats.xruns),
+                                         static_cast<jlong>(stats.callbacks), static_cast<jlong>(stats.late_callbacks),
+                                         static_cast<jlong>(stats.stalled_callbacks),
+                                         static_cast<jlong>(stats.callback_jitter.p50_us),
+                                         static_cast<jlong>(stats.callback_jitter.p99_us),
+                                         static_cast<jlong>(stats.callback_jitter.max_us), static_cast<jint>(stats.fallbacks));
+        env->SetObjectArrayElement(result, static_cast<jsize>(i), element);
+        env->DeleteLocalRef(element);
+    }
+    return result;
+}
+
+static ase_ultrasound_watermark::PipelineThreadConfig to_thread_config(jlong inference_cpu_mask, jint inference_nice,
+                                                                       jlong network_cpu_mask, jint network_nice) {
+    ase_ultrasound_watermark::PipelineThreadConfig config;
+    config.inference.cpu_mask = static_cast<uint64_t>(inference_cpu_mask);
+    config.inference.nice = inference_nice;
+    config.network.cpu_mask = static_cast<uint64_t>(network_cpu_mask);
+    config.network.nice = network_nice;
+    return config;
+}
+
+/// Pilot tones are passed as frequency and amplitude pairs, see PilotTone.kt
+static std::vector<ase_ultrasound_watermark::dsp::Tone> to_tones(JNIEnv *env, jfloatArray tone_pairs) {
+    const jsize length = env->GetArrayLength(tone_pairs);
+    std::vector<jfloat> values(static_cast<size_t>(length));
+    env->GetFloatArrayRegion(tone_pairs, 0, length, values.data());
+    std::vector<ase_ultrasound_watermark::dsp::Tone> tones;
+    for (size_t i = 0; i + 1 < values.size(); i += 2) {
+        tones.push_back(ase_ultrasound_watermark::dsp::Tone{values[i], values[i + 1]});
+    }
+    return tones;
+}
+
 jint JNI_OnLoad(JavaVM *vm, void *reserved)
 {
     g_jvm = vm;
@@ -30,13 +125,203 @@ jint JNI_OnLoad(JavaVM *vm, void *reserved)
 extern "C"
 {
 
+// ModelSource JNI
+JNIEXPORT jlong JNICALL
+Java_com_csr460_ultrasoundwatermark_ModelSource_nativeFromFiles(JNIEnv *env, jclass clazz, jstring param_path, jstring bin_path)
+{
+    const char *param_path_str = env->GetStringUTFChars(param_path, nullptr);
+    const char *bin_path_str = env->GetStringUTFChars(bin_path, nullptr);
+    jlong result = 0;
+    try {
+        result = reinterpret_cast<jlong>(new ase_ultrasound_watermark::ModelSource(ase_ultrasound_watermark::ModelSource::fromFiles(param_path_str, bin_path_str)));
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+    env->ReleaseStringUTFChars(param_path, param_path_str);
+    env->ReleaseStringUTFChars(bin_path, bin_path_str);
+    return result;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_csr460_ultrasoundwatermark_ModelSource_nativeFromFileRanges(JNIEnv *env, jclass clazz,
+                                                                     jint param_fd, jlong param_offset, jlong param_length,
+                                                                     jint bin_fd, jlong bin_offset, jlong bin_length)
+{
+    try {
+        using ase_ultrasound_watermark::ModelBuffer;
+        const ModelBuffer param = ModelBuffer::mapFileRange(param_fd, param_offset, param_length);
+        const ModelBuffer bin = ModelBuffer::mapFileRange(bin_fd, bin_offset, bin_length);
+        return reinterpret_cast<jlong>(new ase_ultrasound_watermark::ModelSource(ase_ultrasound_watermark::ModelSource::fromBuffers(param, bin)));
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+        return 0;
+    }
+}
+
+static ase_ultrasound_watermark::ModelBuffer open_asset_buffer(AAssetManager *asset_manager, const char *name) {
+    AAsset *asset = AAssetManager_open(asset_manager, name, AASSET_MODE_BUFFER);
+    if (!asset) {
+        throw std::runtime_error(std::string("Cannot open asset ") + name);
+    }
+    // An uncompressed asset's buffer is mapped from the APK, a compressed one is inflated into memory
+    std::shared_ptr<AAsset> owner{asset, AAsset_close};
+    const void *buffer = AAsset_getBuffer(asset);
+    if (!buffer) {
+        throw std::runtime_error(std::string("Cannot read asset ") + name);
+    }
+    return ase_ultrasound_watermark::ModelBuffer::wrap(buffer, static_cast<size_t>(AAsset_getLength64(asset)), std::move(owner));
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_csr460_ultrasoundwatermark_ModelSource_nativeFromAssets(JNIEnv *env, jclass clazz, jobject asset_manager, jstring param_name, jstring bin_name)
+{
+    const char *param_name_str = env->GetStringUTFChars(param_name, nullptr);
+    const char *bin_name_str = env->GetStringUTFChars(bin_name, nullptr);
+    jlong result = 0;
+    try {
+        AAssetManager *manager = AAssetManager_fromJava(env, asset_manager);
+        const auto param = open_asset_buffer(manager, param_name_str);
+        const auto bin = open_asset_buffer(manager, bin_name_str);
+        result = reinterpret_cast<jlong>(new ase_ultrasound_watermark::ModelSource(ase_ultrasound_watermark::ModelSource::fromBuffers(param, bin)));
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+    env->ReleaseStringUTFChars(param_name, param_name_str);
+    env->ReleaseStringUTFChars(bin_name, bin_name_str);
+    return result;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_csr460_ultrasoundwatermark_ModelSource_nativeFromBuffers(JNIEnv *env, jclass clazz, jobject param_buffer, jobject bin_buffer)
+{
+    try {
+        using ase_ultrasound_watermark::ModelBuffer;
+        // Only read while the source is created, so the Java buffers need not outlive this call
+        const ModelBuffer param = ModelBuffer::wrap(env->GetDirectBufferAddress(param_buffer),
+                                                    static_cast<size_t>(env->GetDirectBufferCapacity(param_buffer)), nullptr);
+        const ModelBuffer bin = ModelBuffer::wrap(env->GetDirectBufferAddress(bin_buffer),
+                                                  static_cast<size_t>(env->GetDirectBufferCapacity(bin_buffer)), nullptr);
+        if (!param.data() || !bin.data()) {
+            throw std::runtime_error("Model buffers must be direct");
+        }
+        return reinterpret_cast<jlong>(new ase_ultrasound_watermark::ModelSource(ase_ultrasound_watermark::ModelSource::fromBuffers(param, bin)));
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+        return 0;
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_ModelSource_nativeDelete(JNIEnv *env, jclass clazz, jlong native_ptr)
+{
+    delete reinterpret_cast<ase_ultrasound_watermark::ModelSource *>(native_ptr);
+}
+
+// WatermarkResultRing JNI
+JNIEXPORT jint JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkResultRing_nativeCapacity(JNIEnv *env, jclass clazz, jlong native_ring)
+{
+    const auto *ring = reinterpret_cast<const ase_ultrasound_watermark::WatermarkResultRing *>(native_ring);
+    return ring ? static_cast<jint>(ring->capacity()) : 0;
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkResultRing_nativeWriteIndex(JNIEnv *env, jclass clazz, jlong native_ring)
+{
+    const auto *ring = reinterpret_cast<const ase_ultrasound_watermark::WatermarkResultRing *>(native_ring);
+    return ring ? static_cast<jlong>(ring->writeIndex()) : 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkResultRing_nativeRead(JNIEnv *env, jclass clazz, jlong native_ring, jlongArray cursor,
+                                                                   jlongArray long_fields, jfloatArray float_fields)
+{
+    const auto *ring = reinterpret_cast<const ase_ultrasound_watermark::WatermarkResultRing *>(native_ring);
+    if (!ring)
+    {
+        return 0;
+    }
+    jlong next_index = 0;
+    env->GetLongArrayRegion(cursor, 0, 1, &next_index);
+    const auto max_records = static_cast<size_t>(std::min(env->GetArrayLength(long_fields), env->GetArrayLength(float_fields)) / 2);
+    std::vector<ase_ultrasound_watermark::WatermarkResultRecord> records(std::min<size_t>(max_records, ring->capacity()));
+    auto index = static_cast<uint64_t>(next_index);
+    const size_t count = ring->read(index, records.data(), records.size());
+    std::vector<jlong> longs(2 * count);
+    std::vector<jfloat> floats(2 * count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        longs[2 * i] = records[i].window_index;
+        longs[2 * i + 1] = records[i].timestamp_ns;
+        floats[2 * i] = records[i].instantaneous;
+        floats[2 * i + 1] = records[i].average;
+    }
+    env->SetLongArrayRegion(long_fields, 0, static_cast<jsize>(longs.size()), longs.data());
+    env->SetFloatArrayRegion(float_fields, 0, static_cast<jsize>(floats.size()), floats.data());
+    next_index = static_cast<jlong>(index);
+    env->SetLongArrayRegion(cursor, 0, 1, &next_index);
+    return static_cast<jint>(count);
+}
+
+// AudioStreamDefaults JNI
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_AudioStreamDefaults_nativeSetDefaultStreamValues(JNIEnv *env, jclass clazz, jint sample_rate,
+                                                                                     jint frames_per_burst)
+{
+    // Values the platform does not report keep oboe's defaults
+    if (sample_rate > 0)
+    {
+        oboe::DefaultStreamValues::SampleRate = sample_rate;
+    }
+    if (frames_per_burst > 0)
+    {
+        oboe::DefaultStreamValues::FramesPerBurst = frames_per_burst;
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_AudioStreamDefaults_nativeOpenStreamProfileStore(JNIEnv *env, jclass clazz, jstring path,
+                                                                                     jstring fingerprint)
+{
+    const char *path_chars = env->GetStringUTFChars(path, nullptr);
+    const char *fingerprint_chars = env->GetStringUTFChars(fingerprint, nullptr);
+    ase_android::StreamProfileStore::instance().open(path_chars, fingerprint_chars);
+    env->ReleaseStringUTFChars(path, path_chars);
+    env->ReleaseStringUTFChars(fingerprint, fingerprint_chars);
+}
+
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_AudioStreamDefaults_nativeClearStreamProfiles(JNIEnv *env, jclass clazz)
+{
+    ase_android::StreamProfileStore::instance().clear();
+}
+
+// ThreadConfig JNI
+JNIEXPORT jlongArray JNICALL
+Java_com_csr460_ultrasoundwatermark_ThreadConfig_nativeDetectCpuMasks(JNIEnv *env, jclass clazz)
+{
+    const auto topology = ase_ultrasound_watermark::CpuTopology::detect();
+    const jlong masks[] = {
+            static_cast<jlong>(topology.all_mask),
+            static_cast<jlong>(topology.performance_mask),
+            static_cast<jlong>(topology.efficiency_mask)
+    };
+    jlongArray result = env->NewLongArray(3);
+    env->SetLongArrayRegion(result, 0, 3, masks);
+    return result;
+}
+
 JNIEXPORT jlong JNICALL
-Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeCreate(JNIEnv *env, jobject thiz, jstring param_path, jstring model_path)
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeCreate(JNIEnv *env, jobject thiz, jstring param_path, jstring model_path,
+                                                              jlong inference_cpu_mask, jint inference_nice,
+                                                              jlong network_cpu_mask, jint network_nice)
 {
     try {
         const char *param_path_str = env->GetStringUTFChars(param_path, nullptr);
         const char *model_path_str = env->GetStringUTFChars(model_path, nullptr);
-        auto *caller = new ase_ultrasound_watermark::WatermarkCaller(param_path_str, model_path_str);
+        const auto threads = to_thread_config(inference_cpu_mask, inference_nice, network_cpu_mask, network_nice);
+        auto *caller = new ase_ultrasound_watermark::WatermarkCaller(param_path_str, model_path_str,
+                                                                     ase_ultrasound_watermark::OverflowPolicy::DropOldest, threads);
         env->ReleaseStringUTFChars(param_path, param_path_str);
         env->ReleaseStringUTFChars(model_path, model_path_str);
         return reinterpret_cast<jlong>(caller);
@@ -46,6 +331,21 @@ Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeCreate(JNIEnv *env, jo
     }
 }
 
+JNIEXPORT jlong JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeCreateFromModel(JNIEnv *env, jobject thiz, jlong model_ptr,
+                                                                       jlong inference_cpu_mask, jint inference_nice,
+                                                                       jlong network_cpu_mask, jint network_nice)
+{
+    try {
+        const auto &model = *reinterpret_cast<ase_ultrasound_watermark::ModelSource *>(model_ptr);
+        const auto threads = to_thread_config(inference_cpu_mask, inference_nice, network_cpu_mask, network_nice);
+        return reinterpret_cast<jlong>(new ase_ultrasound_watermark::WatermarkCaller(model, ase_ultrasound_watermark::OverflowPolicy::DropOldest, threads));
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+        return 0;
+    }
+}
+
 JNIEXPORT void JNICALL
 Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeStartCall(JNIEnv *env, jobject thiz, jlong native_ptr, jstring host, jint play_device_id, jint record_device_id, jstring signal_path)
 {
@@ -65,6 +365,67 @@ Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeStartCall(JNIEnv *env,
     }
 }
 
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeStartCallWithTones(JNIEnv *env, jobject thiz, jlong native_ptr, jstring host, jint play_device_id, jint record_device_id, jfloatArray tone_pairs)
+{
+    try {
+        auto *caller = reinterpret_cast<ase_ultrasound_watermark::WatermarkCaller *>(native_ptr);
+        if (caller)
+        {
+            const char *host_str = env->GetStringUTFChars(host, nullptr);
+            std::string host_std_str = host_str;
+            env->ReleaseStringUTFChars(host, host_str);
+            caller->StartCall(host_std_str, play_device_id, record_device_id, to_tones(env, tone_pairs));
+        }
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeSetPilotTones(JNIEnv *env, jobject thiz, jlong native_ptr, jfloatArray tone_pairs)
+{
+    try {
+        auto *caller = reinterpret_cast<ase_ultrasound_watermark::WatermarkCaller *>(native_ptr);
+        if (caller)
+        {
+            caller->SetPilotTones(to_tones(env, tone_pairs));
+        }
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+}
+
+JNIEXPORT jfloatArray JNICALL
+Java_com_csr460_ultrasoundwatermark_PilotTone_nativeDefaultPilotTones(JNIEnv *env, jclass clazz)
+{
+    std::vector<jfloat> pairs;
+    for (const auto &tone: ase_ultrasound_watermark::WatermarkCaller::DefaultPilotTones())
+    {
+        pairs.push_back(tone.frequency_hz);
+        pairs.push_back(tone.amplitude);
+    }
+    jfloatArray result = env->NewFloatArray(static_cast<jsize>(pairs.size()));
+    env->SetFloatArrayRegion(result, 0, static_cast<jsize>(pairs.size()), pairs.data());
+    return result;
+}
+
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativePreloadSignal(JNIEnv *env, jobject thiz, jlong native_ptr, jstring signal_path)
+{
+    try {
+        auto *caller = reinterpret_cast<ase_ultrasound_watermark::WatermarkCaller *>(native_ptr);
+        if (caller)
+        {
+            const char *signal_path_str = env->GetStringUTFChars(signal_path, nullptr);
+            caller->PreloadSignal(signal_path_str);
+            env->ReleaseStringUTFChars(signal_path, signal_path_str);
+        }
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+}
+
 JNIEXPORT void JNICALL
 Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeStopCall(JNIEnv *env, jobject thiz, jlong native_ptr)
 {
@@ -79,6 +440,82 @@ Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeStopCall(JNIEnv *env,
     }
 }
 
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeEnterStandby(JNIEnv *env, jobject thiz, jlong native_ptr, jstring host, jint play_device_id, jint record_device_id)
+{
+    try {
+        auto *caller = reinterpret_cast<ase_ultrasound_watermark::WatermarkCaller *>(native_ptr);
+        if (caller)
+        {
+            const char *host_str = env->GetStringUTFChars(host, nullptr);
+            const std::string host_std_str = host_str;
+            env->ReleaseStringUTFChars(host, host_str);
+            caller->EnterStandby(host_std_str, play_device_id, record_device_id);
+        }
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeExitStandby(JNIEnv *env, jobject thiz, jlong native_ptr)
+{
+    try {
+        auto *caller = reinterpret_cast<ase_ultrasound_watermark::WatermarkCaller *>(native_ptr);
+        if (caller)
+        {
+            caller->ExitStandby();
+        }
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeGetCallStartupStats(JNIEnv *env, jobject thiz, jlong native_ptr)
+{
+    auto *caller = reinterpret_cast<ase_ultrasound_watermark::WatermarkCaller *>(native_ptr);
+    if (!caller)
+    {
+        return nullptr;
+    }
+    jclass stats_class = env->FindClass("com/csr460/ultrasoundwatermark/CallStartupStats");
+    if (!stats_class)
+    {
+        return nullptr;
+    }
+    jmethodID constructor = get_method_id(env, stats_class, "<init>", "(ZJJ)V");
+    if (!constructor)
+    {
+        return nullptr;
+    }
+    const ase_ultrasound_watermark::CallStartupStats stats = caller->GetCallStartupStats();
+    return env->NewObject(stats_class, constructor, static_cast<jboolean>(stats.from_standby),
+                          static_cast<jlong>(stats.setup_ns), static_cast<jlong>(stats.first_packet_ns));
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeGetLatencyReport(JNIEnv *env, jobject thiz, jlong native_ptr)
+{
+    auto *caller = reinterpret_cast<ase_ultrasound_watermark::WatermarkCaller *>(native_ptr);
+    if (!caller)
+    {
+        return nullptr;
+    }
+    return to_java_latency_report(env, caller->GetLatencyReport());
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeGetStreamStats(JNIEnv *env, jobject thiz, jlong native_ptr)
+{
+    auto *caller = reinterpret_cast<ase_ultrasound_watermark::WatermarkCaller *>(native_ptr);
+    if (!caller)
+    {
+        return nullptr;
+    }
+    return to_java_stream_stats(env, caller->GetStreamStats());
+}
+
 JNIEXPORT void JNICALL
 Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeDelete(JNIEnv *env, jobject thiz, jlong native_ptr)
 {
@@ -90,21 +527,78 @@ Java_com_csr460_ultrasoundwatermark_WatermarkCaller_nativeDelete(JNIEnv *env, jo
 }
 
 // WatermarkCallee JNI
-struct CalleeCallback
-{
-    jobject callback_obj;
-    jmethodID on_watermark_results;
-};
+// Results are delivered to Java by a dispatcher thread that stays attached to the JVM, so the detector thread never
+// attaches itself or calls into Java
+static thread_local JNIEnv *t_dispatcher_env = nullptr;
 
-static std::map<ase_ultrasound_watermark::WatermarkCallee*, CalleeCallback*> g_callee_callbacks;
+// Set and erased from whichever Java threads configure and delete callees
+static std::mutex g_callee_dispatchers_mutex;
+static std::map<ase_ultrasound_watermark::WatermarkCallee*, std::shared_ptr<ase_ultrasound_watermark::WatermarkResultDispatcher>> g_callee_dispatchers;
+
+// Null, with a WatermarkNativeException pending, if callback has no onWatermarkResults(Float, Float)
+static std::shared_ptr<ase_ultrasound_watermark::WatermarkResultDispatcher> make_result_dispatcher(JNIEnv *env, jobject callback, float max_rate_hz) {
+    jclass callback_class = env->GetObjectClass(callback);
+    jmethodID on_watermark_results = get_method_id(env, callback_class, "onWatermarkResults", "(FF)V");
+    env->DeleteLocalRef(callback_class);
+    if (!on_watermark_results) {
+        return nullptr;
+    }
+    jobject callback_obj = env->NewGlobalRef(callback);
+    try {
+        return std::make_shared<ase_ultrasound_watermark::WatermarkResultDispatcher>(
+                [callback_obj, on_watermark_results](float instantaneous, float average) {
+                    if (!t_dispatcher_env) {
+                        return;
+                    }
+                    t_dispatcher_env->CallVoidMethod(callback_obj, on_watermark_results, instantaneous, average);
+                    if (t_dispatcher_env->ExceptionCheck()) {
+                        // Nothing on this thread would ever clear it
+                        t_dispatcher_env->ExceptionDescribe();
+                        t_dispatcher_env->ExceptionClear();
+                    }
+                },
+                [] {
+                    if (g_jvm->AttachCurrentThread(&t_dispatcher_env, nullptr) != JNI_OK) {
+                        __android_log_print(ANDROID_LOG_ERROR, APPNAME, "Failed to attach result dispatcher thread");
+                        t_dispatcher_env = nullptr;
+                    }
+                },
+                [callback_obj] {
+                    // The global ref outlives every delivery, so it is released here rather than by the JNI caller
+                    if (t_dispatcher_env) {
+                        t_dispatcher_env->DeleteGlobalRef(callback_obj);
+                        g_jvm->DetachCurrentThread();
+                        t_dispatcher_env = nullptr;
+                        return;
+                    }
+                    // Attaching failed at the start, but the ref must still be released
+                    JNIEnv *exit_env = nullptr;
+                    if (g_jvm->AttachCurrentThread(&exit_env, nullptr) == JNI_OK) {
+                        exit_env->DeleteGlobalRef(callback_obj);
+                        g_jvm->DetachCurrentThread();
+                    } else {
+                        __android_log_print(ANDROID_LOG_ERROR, APPNAME, "Failed to release the result callback");
+                    }
+                },
+                max_rate_hz);
+    } catch (...) {
+        // No dispatcher thread runs the exit hook
+        env->DeleteGlobalRef(callback_obj);
+        throw;
+    }
+}
 
 JNIEXPORT jlong JNICALL
-Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeCreate(JNIEnv *env, jobject thiz, jstring param_path, jstring model_path)
+Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeCreate(JNIEnv *env, jobject thiz, jstring param_path, jstring model_path,
+                                                              jlong inference_cpu_mask, jint inference_nice,
+                                                              jlong network_cpu_mask, jint network_nice)
 {
     try {
         const char *param_path_str = env->GetStringUTFChars(param_path, nullptr);
         const char *model_path_str = env->GetStringUTFChars(model_path, nullptr);
-        auto *callee = new ase_ultrasound_watermark::WatermarkCallee(param_path_str, model_path_str);
+        const auto threads = to_thread_config(inference_cpu_mask, inference_nice, network_cpu_mask, network_nice);
+        auto *callee = new ase_ultrasound_watermark::WatermarkCallee(param_path_str, model_path_str,
+                                                                     ase_ultrasound_watermark::OverflowPolicy::LatestWins, threads);
         env->ReleaseStringUTFChars(param_path, param_path_str);
         env->ReleaseStringUTFChars(model_path, model_path_str);
         return reinterpret_cast<jlong>(callee);
@@ -114,6 +608,22 @@ Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeCreate(JNIEnv *env, jo
     }
 }
 
+JNIEXPORT jlong JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeCreateFromModel(JNIEnv *env, jobject thiz, jlong model_ptr,
+                                                                       jlong inference_cpu_mask, jint inference_nice,
+                                                                       jlong network_cpu_mask, jint network_nice)
+{
+    try {
+        const auto &model = *reinterpret_cast<ase_ultrasound_watermark::ModelSource *>(model_ptr);
+        const auto threads = to_thread_config(inference_cpu_mask, inference_nice, network_cpu_mask, network_nice);
+        return reinterpret_cast<jlong>(new ase_ultrasound_watermark::WatermarkCallee(model, ase_ultrasound_watermark::OverflowPolicy::LatestWins,
+                                                                                     threads));
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+        return 0;
+    }
+}
+
 JNIEXPORT void JNICALL
 Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeStartServer(JNIEnv *env, jobject thiz, jlong native_ptr, jint play_device_id)
 {
@@ -129,50 +639,25 @@ Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeStartServer(JNIEnv *en
 }
 
 JNIEXPORT void JNICALL
-Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeSetOnWatermarkResultsCallback(JNIEnv *env, jobject thiz, jlong native_ptr, jobject callback)
+Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeSetOnWatermarkResultsCallback(JNIEnv *env, jobject thiz, jlong native_ptr, jobject callback, jfloat max_rate_hz)
 {
     try {
         auto *callee = reinterpret_cast<ase_ultrasound_watermark::WatermarkCallee *>(native_ptr);
         if (callee)
         {
-            auto it = g_callee_callbacks.find(callee);
-            if (it != g_callee_callbacks.end()) {
-                env->DeleteGlobalRef(it->second->callback_obj);
-                delete it->second;
-                g_callee_callbacks.erase(it);
+            auto dispatcher = make_result_dispatcher(env, callback, max_rate_hz);
+            if (!dispatcher)
+            {
+                return;
             }
-
-            auto *callback_holder = new CalleeCallback();
-            callback_holder->callback_obj = env->NewGlobalRef(callback);
-            jclass callback_class = env->GetObjectClass(callback);
-            callback_holder->on_watermark_results = env->GetMethodID(callback_class, "onWatermarkResults", "(FF)V");
-
-            g_callee_callbacks[callee] = callback_holder;
-
-            callee->SetOnWatermarkResultsCallback([callback_holder](float instantaneous, float average) {
-                JNIEnv *env;
-                int getEnvStat = g_jvm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6);
-                if (getEnvStat == JNI_EDETACHED)
-                {
-                    if (g_jvm->AttachCurrentThread(&env, nullptr) != 0)
-                    {
-                        __android_log_print(ANDROID_LOG_ERROR, APPNAME, "Failed to attach current thread");
-                        return;
-                    }
-                }
-                else if (getEnvStat == JNI_EVERSION)
-                {
-                    __android_log_print(ANDROID_LOG_ERROR, APPNAME, "Unsupported JNI version");
-                    return;
-                }
-
-                env->CallVoidMethod(callback_holder->callback_obj, callback_holder->on_watermark_results, instantaneous, average);
-
-                if (getEnvStat == JNI_EDETACHED)
-                {
-                    g_jvm->DetachCurrentThread();
-                }
+            // The detector callback shares ownership, so a result being posted as the callback is replaced still
+            // finds its dispatcher. The old dispatcher stops once neither holds it
+            callee->SetOnWatermarkResultsCallback([dispatcher](float instantaneous, float average) {
+                dispatcher->post(instantaneous, average);
             });
+            // The replaced dispatcher, if any, is released after the lock, as stopping it waits for its thread
+            std::lock_guard lock{g_callee_dispatchers_mutex};
+            g_callee_dispatchers[callee].swap(dispatcher);
         }
     } catch (const std::runtime_error& e) {
         throw_java_exception(env, e.what());
@@ -193,19 +678,86 @@ Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeStop(JNIEnv *env, jobj
     }
 }
 
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeEnterStandby(JNIEnv *env, jobject thiz, jlong native_ptr, jint play_device_id)
+{
+    try {
+        auto *callee = reinterpret_cast<ase_ultrasound_watermark::WatermarkCallee *>(native_ptr);
+        if (callee)
+        {
+            callee->EnterStandby(play_device_id);
+        }
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeExitStandby(JNIEnv *env, jobject thiz, jlong native_ptr)
+{
+    try {
+        auto *callee = reinterpret_cast<ase_ultrasound_watermark::WatermarkCallee *>(native_ptr);
+        if (callee)
+        {
+            callee->ExitStandby();
+        }
+    } catch (const std::runtime_error& e) {
+        throw_java_exception(env, e.what());
+    }
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeGetLatencyReport(JNIEnv *env, jobject thiz, jlong native_ptr)
+{
+    auto *callee = reinterpret_cast<ase_ultrasound_watermark::WatermarkCallee *>(native_ptr);
+    if (!callee)
+    {
+        return nullptr;
+    }
+    return to_java_latency_report(env, callee->GetLatencyReport());
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeGetStreamStats(JNIEnv *env, jobject thiz, jlong native_ptr)
+{
+    auto *callee = reinterpret_cast<ase_ultrasound_watermark::WatermarkCallee *>(native_ptr);
+    if (!callee)
+    {
+        return nullptr;
+    }
+    return to_java_stream_stats(env, callee->GetStreamStats());
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeGetResultRing(JNIEnv *env, jobject thiz, jlong native_ptr)
+{
+    auto *callee = reinterpret_cast<ase_ultrasound_watermark::WatermarkCallee *>(native_ptr);
+    if (!callee)
+    {
+        return 0;
+    }
+    // Valid until nativeDelete
+    return reinterpret_cast<jlong>(&callee->GetResultRing());
+}
+
 JNIEXPORT void JNICALL
 Java_com_csr460_ultrasoundwatermark_WatermarkCallee_nativeDelete(JNIEnv *env, jobject thiz, jlong native_ptr)
 {
     auto *callee = reinterpret_cast<ase_ultrasound_watermark::WatermarkCallee *>(native_ptr);
     if (callee)
     {
-        auto it = g_callee_callbacks.find(callee);
-        if (it != g_callee_callbacks.end()) {
-            env->DeleteGlobalRef(it->second->callback_obj);
-            delete it->second;
-            g_callee_callbacks.erase(it);
-        }
+        // Stops the detector first, which releases its reference to the dispatcher
         delete callee;
+        std::shared_ptr<ase_ultrasound_watermark::WatermarkResultDispatcher> dispatcher;
+        {
+            std::lock_guard lock{g_callee_dispatchers_mutex};
+            auto it = g_callee_dispatchers.find(callee);
+            if (it != g_callee_dispatchers.end())
+            {
+                dispatcher = std::move(it->second);
+                g_callee_dispatchers.erase(it);
+            }
+        }
     }
 }
 
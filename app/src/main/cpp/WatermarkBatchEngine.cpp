@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "WatermarkBatchEngine.hpp"
+#include "WatermarkDetector.hpp"
+#include "WatermarkGenerator.hpp"
+#include "batch/WavFileStream.hpp"
+#include "stream/FloatToInt16Stream.hpp"
+#include "stream/Int16ToFloatBlockStream.hpp"
+#include "stream/ResampleStream.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        /// Writes the generator output to a WAV file, up to a number of frames so that padding is not written
+        class WavWriterSink : public ase::AudioDataStreamBase<int16_t>
+        {
+        public:
+            WavWriterSink(WavFileWriter &writer, int64_t max_frames)
+                    : ase::AudioDataStreamBase<int16_t>{WatermarkGenerator::OUTPUT_FS, 1},
+                      writer_{writer},
+                      remaining_frames_{max_frames}
+            {
+            }
+
+            void consume(const int16_t *samples, size_t size) override
+            {
+                const auto take = static_cast<size_t>(std::min<int64_t>(remaining_frames_, static_cast<int64_t>(size)));
+                writer_.write(samples, take);
+                remaining_frames_ -= static_cast<int64_t>(take);
+            }
+
+        private:
+            WavFileWriter &writer_;
+            int64_t remaining_frames_;
+        };
+
+        /**
+         * Input at another rate than the model's enters the graph through a resampler to it, with the passband narrowed
+         * to what the lower rate can carry. nullptr if the rates match
+         */
+        std::shared_ptr<ResampleStream<int16_t>> makeResampler(const WavFileReader &reader, int model_rate, size_t max_block_frames,
+                                                               const std::shared_ptr<Int16ToFloatBlockStream> &next)
+        {
+            if (reader.getSampleRate() == model_rate)
+            {
+                return nullptr;
+            }
+            const float passband_hz = std::min(dsp::PolyphaseResampler::DEFAULT_PASSBAND_HZ,
+                                               0.45f * static_cast<float>(std::min(reader.getSampleRate(), model_rate)));
+            auto resampler = std::make_shared<ResampleStream<int16_t>>(reader.getSampleRate(), model_rate, 1,
+                                                                       static_cast<int>(max_block_frames), passband_hz);
+            resampler->attachConsumer(next);
+            return resampler;
+        }
+
+        BatchJob makeJob(const std::filesystem::path &input, const std::filesystem::path &relative,
+                         const std::filesystem::path &output_dir, BatchMode mode)
+        {
+            std::filesystem::path output = output_dir / relative;
+            output.replace_extension(WatermarkBatchEngine::OutputExtension(mode));
+            return BatchJob{input, output};
+        }
+    }
+
+    WatermarkBatchEngine::WatermarkBatchEngine(const ModelSource &model, BatchMode mode, int num_threads, int chunk_windows)
+            : model_{model},
+              mode_{mode},
+              num_threads_{num_threads > 0 ? num_threads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))},
+              chunk_windows_{std::max(chunk_windows, 1)}
+    {
+    }
+
+    std::vector<BatchFileResult> WatermarkBatchEngine::Run(const std::vector<BatchJob> &jobs, const FileCallback &on_file) const
+    {
+        std::vector<BatchFileResult> results(jobs.size());
+        std::atomic<size_t> next_job{0};
+        std::mutex callback_mutex;
+        auto work = [&] {
+            for (size_t index = next_job.fetch_add(1); index < jobs.size(); index = next_job.fetch_add(1))
+            {
+                processFile(jobs[index], results[index]);
+                if (on_file)
+                {
+                    std::lock_guard lock{callback_mutex};
+                    on_file(results[index]);
+                }
+            }
+        };
+        const auto threads = static_cast<size_t>(std::min<int64_t>(num_threads_, static_cast<int64_t>(jobs.size())));
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back(work);
+        }
+        for (auto &worker: workers)
+        {
+            worker.join();
+        }
+        return results;
+    }
+
+    void WatermarkBatchEngine::processFile(const BatchJob &job, BatchFileResult &result) const
+    {
+        const auto start = std::chrono::steady_clock::now();
+        result = BatchFileResult{job.input, job.output, {}, 0, 0, 0, 0.0f, 0.0f, 0.0};
+        std::filesystem::path partial = job.output;
+        partial += ".partial";
+        try
+        {
+            if (job.output.has_parent_path())
+            {
+                std::filesystem::create_directories(job.output.parent_path());
+            }
+            if (mode_ == BatchMode::Watermark)
+            {
+                watermarkFile(job, partial, result);
+            }
+            else
+            {
+                verifyFile(job, partial, result);
+            }
+            std::filesystem::rename(partial, job.output);
+        }
+        catch (const std::exception &e)
+        {
+            // Includes std::filesystem::filesystem_error and std::bad_alloc
+            result.error = *e.what() ? e.what() : "Unknown error";
+        }
+        catch (...)
+        {
+            // Escaping a worker thread would terminate the whole run
+            result.error = "Unknown error";
+        }
+        if (!result.error.empty())
+        {
+            std::error_code ignored;
+            std::filesystem::remove(partial, ignored);
+        }
+        result.elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void WatermarkBatchEngine::watermarkFile(const BatchJob &job, const std::filesystem::path &partial, BatchFileResult &result) const
+    {
+        WavFileReader reader{job.input};
+        result.sample_rate = reader.getSampleRate();
+        // The output is mono, so the other channels would be lost without a trace
+        if (reader.getChannels() != 1)
+        {
+            throw std::runtime_error("Watermark mode takes mono input, got " + std::to_string(reader.getChannels()) + " channels");
+        }
+        WavFileWriter writer{partial, WatermarkGenerator::OUTPUT_FS, 1};
+
+        const size_t chunk_frames = static_cast<size_t>(chunk_windows_) * WatermarkGenerator::WINDOW_STEP;
+        auto converter_in = std::make_shared<Int16ToFloatBlockStream>(WatermarkGenerator::INPUT_FS, 1, WatermarkGenerator::WINDOW_STEP);
+        auto resampler = makeResampler(reader, WatermarkGenerator::INPUT_FS, chunk_frames, converter_in);
+        auto generator = std::make_shared<WatermarkGenerator>(model_.paramPath(), model_.binPath());
+        auto converter_out = std::make_shared<FloatToInt16Stream>(WatermarkGenerator::OUTPUT_FS, 1, WatermarkGenerator::WINDOW_STEP);
+        // The output covers the input exactly; the padding of the last window is not written
+        const int64_t input_frames = resampler ? resampler->outputFramesFor(reader.getFrames()) : reader.getFrames();
+        const int64_t output_frames = input_frames * WatermarkGenerator::OUTPUT_FS / WatermarkGenerator::INPUT_FS;
+        converter_in->attachConsumer(generator);
+        generator->attachConsumer(converter_out);
+        converter_out->attachConsumer(std::make_shared<WavWriterSink>(writer, output_frames));
+
+        std::vector<int16_t> chunk(chunk_frames);
+        for (size_t frames; (frames = reader.read(chunk.data(), chunk_frames)) > 0;)
+        {
+            if (resampler)
+            {
+                resampler->consume(chunk.data(), frames);
+            }
+            else
+            {
+                converter_in->consume(chunk.data(), frames);
+            }
+            result.frames += static_cast<int64_t>(frames);
+        }
+        if (resampler)
+        {
+            resampler->drain();
+        }
+        // Complete the last window with silence
+        const int64_t padding = (WatermarkGenerator::WINDOW_STEP - input_frames % WatermarkGenerator::WINDOW_STEP) % WatermarkGenerator::WINDOW_STEP;
+        std::fill_n(chunk.begin(), padding, int16_t{0});
+        converter_in->consume(chunk.data(), static_cast<size_t>(padding));
+        result.windows = (input_frames + padding) / WatermarkGenerator::WINDOW_STEP;
+        writer.close();
+    }
+
+    void WatermarkBatchEngine::verifyFile(const BatchJob &job, const std::filesystem::path &partial, BatchFileResult &result) const
+    {
+        WavFileReader reader{job.input};
+        result.sample_rate = reader.getSampleRate();
+        std::ofstream csv{partial, std::ios::trunc};
+        if (!csv)
+        {
+            throw std::runtime_error("Cannot create " + partial.string());
+        }
+        csv << "window,instantaneous,average\n";
+
+        auto converter_in = std::make_shared<Int16ToFloatBlockStream>(WatermarkDetector::INPUT_FS, 1, WatermarkDetector::WINDOW_STEP);
+        auto detector = std::make_shared<WatermarkDetector>(model_.paramPath(), model_.binPath());
+        double sum_instantaneous = 0.0;
+        detector->setCallback([&](float instantaneous, float average) {
+            char line[64];
+            const int length = std::snprintf(line, sizeof(line), "%lld,%.6f,%.6f\n", static_cast<long long>(result.windows),
+                                             instantaneous, average);
+            csv.write(line, length);
+            sum_instantaneous += instantaneous;
+            result.final_average = average;
+            ++result.windows;
+        });
+        converter_in->attachConsumer(detector);
+
+        // A trailing partial window stays in the converter and is not detected
+        const size_t chunk_frames = static_cast<size_t>(chunk_windows_) * WatermarkDetector::WINDOW_STEP;
+        auto resampler = makeResampler(reader, WatermarkDetector::INPUT_FS, chunk_frames, converter_in);
+        std::vector<int16_t> chunk(chunk_frames);
+        for (size_t frames; (frames = reader.read(chunk.data(), chunk_frames)) > 0;)
+        {
+            if (resampler)
+            {
+                resampler->consume(chunk.data(), frames);
+            }
+            else
+            {
+                converter_in->consume(chunk.data(), frames);
+            }
+            result.frames += static_cast<int64_t>(frames);
+        }
+        if (resampler)
+        {
+            resampler->drain();
+        }
+        if (result.windows > 0)
+        {
+            result.mean_instantaneous = static_cast<float>(sum_instantaneous / static_cast<double>(result.windows));
+        }
+        csv.close();
+        if (!csv)
+        {
+            throw std::runtime_error("Write error");
+        }
+    }
+
+    const char *WatermarkBatchEngine::OutputExtension(BatchMode mode)
+    {
+        return mode == BatchMode::Watermark ? ".wav" : ".csv";
+    }
+
+    std::vector<BatchJob> WatermarkBatchEngine::JobsFromDirectory(const std::filesystem::path &input_dir,
+                                                                  const std::filesystem::path &output_dir, BatchMode mode)
+    {
+        std::vector<BatchJob> jobs;
+        for (const auto &entry: std::filesystem::recursive_directory_iterator{input_dir})
+        {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (entry.is_regular_file() && extension == ".wav")
+            {
+                jobs.push_back(makeJob(entry.path(), entry.path().lexically_relative(input_dir), output_dir, mode));
+            }
+        }
+        // Directory order is arbitrary; sorting makes runs and their outputs reproducible
+        std::sort(jobs.begin(), jobs.end(), [](const BatchJob &a, const BatchJob &b) { return a.input < b.input; });
+        return jobs;
+    }
+
+    std::vector<BatchJob> WatermarkBatchEngine::JobsFromManifest(const std::filesystem::path &manifest,
+                                                                 const std::filesystem::path &output_dir, BatchMode mode)
+    {
+        std::ifstream file{manifest};
+        if (!file)
+        {
+            throw std::runtime_error("Cannot read manifest " + manifest.string());
+        }
+        const std::filesystem::path base = manifest.parent_path();
+        std::vector<BatchJob> jobs;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if (line.empty() || line.front() == '#')
+            {
+                continue;
+            }
+            const size_t tab = line.find('\t');
+            const std::filesystem::path input = base / line.substr(0, tab);
+            if (tab != std::string::npos)
+            {
+                jobs.push_back(BatchJob{input, base / line.substr(tab + 1)});
+                continue;
+            }
+            std::filesystem::path relative = input.lexically_relative(base);
+            if (relative.empty() || *relative.begin() == "..")
+            {
+                relative = input.filename();
+            }
+            jobs.push_back(makeJob(input, relative, output_dir, mode));
+        }
+        return jobs;
+    }
+
+} // ase_ultrasound_watermark
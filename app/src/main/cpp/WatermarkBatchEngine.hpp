@@ -0,0 +1,112 @@
+#ifndef ULTRASOUNDWATERMARK_WATERMARKBATCHENGINE_HPP
+#define ULTRASOUNDWATERMARK_WATERMARKBATCHENGINE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+#include "ModelSource.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    enum class BatchMode
+    {
+        /// Run WatermarkGenerator and write the watermarked audio as PCM16 WAV
+        Watermark,
+        /// Run WatermarkDetector and write its per-window probabilities as CSV
+        Verify
+    };
+
+    struct BatchJob
+    {
+        std::filesystem::path input;
+        std::filesystem::path output;
+    };
+
+    struct BatchFileResult
+    {
+        std::filesystem::path input;
+        std::filesystem::path output;
+        /// Empty if the file was processed, otherwise why it was not. Nothing is written to output then
+        std::string error;
+        /// Input frames read, at sample_rate
+        int64_t frames;
+        int sample_rate;
+        /// Windows processed. In Verify mode a partial window at the end is not
+        int64_t windows;
+        /// Verify mode: mean of the instantaneous probabilities, and the last running average
+        float mean_instantaneous;
+        float final_average;
+        double elapsed_seconds;
+    };
+
+    /**
+     * Offline counterpart of WatermarkCaller and WatermarkCallee: watermarks or verifies a corpus of WAV files, one file
+     * per thread on as many threads as requested.
+     *
+     * Each file gets its own generator or detector, loaded from the shared ModelSource, so that no state (e.g. the
+     * detector's running average) carries over between files, and results do not depend on the order or the
+     * parallelism. Files are streamed in chunks of windows, so memory use is bounded by the number of threads
+     * regardless of file length. Input must be PCM16; files at another rate than the model's input rate are
+     * resampled to it on the way in (see ResampleStream). Watermark mode fails multichannel files, as its output is
+     * mono; Verify mode detects on their first channel.
+     *
+     * Outputs are written next to their final name and renamed once complete, so an interrupted run never leaves a
+     * truncated output behind. Verify mode writes one line per window: window,instantaneous,average.
+     */
+    class WatermarkBatchEngine
+    {
+    public:
+        using FileCallback = std::function<void(const BatchFileResult &result)>;
+
+        constexpr static int DEFAULT_CHUNK_WINDOWS = 16;
+
+        /**
+         * @param model The generator in Watermark mode, the detector in Verify mode
+         * @param num_threads Files processed at once. 0 uses every hardware thread
+         * @param chunk_windows Windows read, processed and written at a time
+         */
+        WatermarkBatchEngine(const ModelSource &model, BatchMode mode, int num_threads = 0,
+                             int chunk_windows = DEFAULT_CHUNK_WINDOWS);
+
+        /**
+         * Process all jobs. Failures are reported per file and do not stop the others.
+         * @param on_file Called as each file completes, one call at a time, from the worker threads
+         * @return One result per job, in job order
+         */
+        std::vector<BatchFileResult> Run(const std::vector<BatchJob> &jobs, const FileCallback &on_file = {}) const;
+
+        /// Output file extension for a mode, including the dot
+        static const char *OutputExtension(BatchMode mode);
+
+        /// Jobs for every .wav file under input_dir, with the directory structure mirrored under output_dir
+        static std::vector<BatchJob> JobsFromDirectory(const std::filesystem::path &input_dir,
+                                                       const std::filesystem::path &output_dir, BatchMode mode);
+
+        /**
+         * Jobs from a manifest with one input per line, optionally followed by a tab and the output path. Relative
+         * paths are relative to the manifest's directory; blank lines and lines starting with # are skipped.
+         * Outputs not given are placed under output_dir with the input's path relative to the manifest's directory,
+         * or its file name if it is outside of it.
+         * @throw std::runtime_error if the manifest cannot be read
+         */
+        static std::vector<BatchJob> JobsFromManifest(const std::filesystem::path &manifest,
+                                                      const std::filesystem::path &output_dir, BatchMode mode);
+
+    private:
+        const ModelSource model_;
+        const BatchMode mode_;
+        const int num_threads_;
+        const int chunk_windows_;
+
+        void processFile(const BatchJob &job, BatchFileResult &result) const;
+
+        void watermarkFile(const BatchJob &job, const std::filesystem::path &partial, BatchFileResult &result) const;
+
+        void verifyFile(const BatchJob &job, const std::filesystem::path &partial, BatchFileResult &result) const;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_WATERMARKBATCHENGINE_HPP
@@ -3,18 +3,83 @@
 //
 
 #include "WatermarkCallee.hpp"
+#include "tracing/LatencyTapStream.hpp"
 
 using namespace ase;
 using namespace ase_android;
 
 namespace ase_ultrasound_watermark
 {
-    WatermarkCallee::WatermarkCallee(const std::filesystem::path &param_path, const std::filesystem::path &model_path)
-            : is_running_{false}
+    namespace
     {
-        detector_ = std::make_shared<WatermarkDetector>(param_path, model_path);
-        converter_ = std::make_shared<FormatConversionStream<int16_t, float>>(WatermarkDetector::INPUT_FS, 1);
-        model_flex_sizer_ = std::make_shared<FlexibleSizeStreamProducer<int16_t>>(WatermarkDetector::INPUT_FS, 1, WatermarkDetector::WINDOW_STEP, 16);
+        class PlaybackLatencyObserver : public PlaybackObserver
+        {
+        public:
+            PlaybackLatencyObserver(LatencyTracer &tracer, LatencyHistogram &histogram)
+                    : tracer_{tracer}, histogram_{histogram}, last_position_frames_{0}
+            {
+            }
+
+            void onFramesPlayed(int64_t position_frames) override
+            {
+                // Callbacks that only played silence, e.g. in standby, played nothing that was captured
+                if (position_frames == last_position_frames_)
+                {
+                    return;
+                }
+                last_position_frames_ = position_frames;
+                tracer_.record(histogram_, position_frames);
+            }
+
+        private:
+            LatencyTracer &tracer_;
+            LatencyHistogram &histogram_;
+            int64_t last_position_frames_;
+        };
+    }
+
+    WatermarkCallee::WatermarkCallee(const std::filesystem::path &param_path, const std::filesystem::path &model_path,
+                                     OverflowPolicy detector_queue_policy,
+                                     const PipelineThreadConfig &threads)
+            : WatermarkCallee(ModelSource::fromFiles(param_path, model_path), detector_queue_policy, threads)
+    {
+    }
+
+    WatermarkCallee::WatermarkCallee(const ModelSource &model,
+                                     OverflowPolicy detector_queue_policy,
+                                     const PipelineThreadConfig &threads)
+            : is_running_{false},
+              is_ready_{false},
+              standby_{false},
+              standby_play_device_id_{0},
+              ready_play_device_id_{0},
+              threads_{threads},
+              detected_windows_{0},
+              instantaneous_sum_{0.0},
+              dropped_frames_base_{0},
+              converter_dropped_frames_{0}
+    {
+        server_gate_ = std::make_shared<StreamGate<int16_t>>(WatermarkDetector::INPUT_FS, 1, KcpServerStreamProducer::L3_MTU / sizeof(int16_t) + 1);
+        detector_ = std::make_shared<WatermarkDetector>(model.paramPath(), model.binPath());
+        // Converts each window straight into the block handed to the detector
+        converter_ = std::make_shared<Int16ToFloatBlockStream>(WatermarkDetector::INPUT_FS, 1, WatermarkDetector::WINDOW_STEP);
+        // Inference runs on the queue's worker thread so that it never holds up KCP receive and playback.
+        // The worker also reblocks the received audio into windows
+        detector_queue_ = std::make_shared<AsyncStreamStage<int16_t>>(WatermarkDetector::INPUT_FS, 1, WatermarkDetector::WINDOW_STEP,
+                                                                      DETECTOR_QUEUE_BLOCKS, detector_queue_policy);
+        detector_queue_->setWorkerPolicy(threads_.inference);
+        // Create the latency stages up front so that reports list them in pipeline order
+        for (const char *stage: {"kcp_receive", "handoff", "format_in", "detector", "playback"})
+        {
+            tracer_.stage(stage);
+        }
+        detector_latency_ = &tracer_.stage("detector");
+        // Prime the model with a window of silence while nothing is attached, so that the first window of a call
+        // does not pay for lazy allocations. Its result is dropped, and the average reported starts over in prepareLocked()
+        detector_->setCallback([](float, float) {});
+        const std::vector<float> silence(WatermarkDetector::WINDOW_STEP, 0.0f);
+        detector_->consume(silence.data(), silence.size());
+        detector_->setCallback(makeDetectorCallback(nullptr));
     }
 
     void WatermarkCallee::StartServer(int play_device_id)
@@ -28,47 +93,214 @@ namespace ase_ultrasound_watermark
         {
             return;
         }
-        server_ = std::make_shared<KcpServerStreamProducer>(WatermarkDetector::INPUT_FS, KcpServerStreamProducer::L3_MTU / sizeof(float) + 1, 32);
-
-        player_ = std::make_shared<OboeStreamConsumerPlayer<int16_t>>(
-                play_device_id,
-                WatermarkDetector::INPUT_FS,
-                1,
-                oboe::PerformanceMode::LowLatency,
-                PLAYER_CALLBACK_SIZE,
-                PLAYER_CALLBACK_BUFFER_SIZE
-        );
-        player_->start();
-        // Connect everything
-        server_->attachConsumer(player_);
-        server_->attachConsumer(model_flex_sizer_);
-        model_flex_sizer_->attachConsumer(converter_);
-        converter_->attachConsumer(detector_);
+        if (!is_ready_ || ready_play_device_id_ != play_device_id)
+        {
+            releaseLocked();
+            prepareLocked(play_device_id);
+        }
+        // Nothing downstream of the gate runs while it is closed. Stream positions carry on from standby,
+        // only the sequence starts over in case the caller did
+        frame_decoder_->restartSequence();
+        tracer_.reset();
+        server_gate_->open();
         is_running_ = true;
     }
 
+    void WatermarkCallee::EnterStandby(int play_device_id)
+    {
+        std::lock_guard lock{state_mutex_};
+        standby_ = true;
+        standby_play_device_id_ = play_device_id;
+        if (!is_running_ && (!is_ready_ || ready_play_device_id_ != play_device_id))
+        {
+            releaseLocked();
+            prepareLocked(play_device_id);
+        }
+    }
+
+    void WatermarkCallee::ExitStandby()
+    {
+        std::lock_guard lock{state_mutex_};
+        standby_ = false;
+        if (!is_running_)
+        {
+            releaseLocked();
+        }
+    }
+
     void WatermarkCallee::Stop()
     {
-        if (!state_mutex_.try_lock())
+        // Unlike starting, stopping must not be skipped while another call holds the state, e.g. a stats query
+        std::lock_guard lock{state_mutex_};
+        if (!is_running_)
         {
             return;
         }
-        std::lock_guard lock{state_mutex_, std::adopt_lock};
-        if (!is_running_)
+        is_running_ = false;
+        if (!standby_ || ready_play_device_id_ != standby_play_device_id_)
         {
+            releaseLocked();
+            if (standby_)
+            {
+                prepareLocked(standby_play_device_id_);
+            }
             return;
         }
-        player_->stop();
+        // Back to standby: discard what arrives and let the detector finish what is already queued
+        server_gate_->close();
+        detector_queue_->stop();
+        // Without the tail of this call's last window, which would otherwise open the first window of the next one
+        converter_dropped_frames_ += converter_->reset();
+        detector_queue_->start();
+    }
+
+    void WatermarkCallee::prepareLocked(int play_device_id)
+    {
+        try
+        {
+            tracer_.reset();
+            detected_windows_ = 0;
+            instantaneous_sum_ = 0.0;
+            dropped_frames_base_ = detector_queue_->getDroppedFrames();
+            converter_dropped_frames_ = 0;
+            // The server's I/O thread inherits the network policy
+            runWithThreadPolicy(threads_.network, [this] {
+                server_ = std::make_shared<KcpServerStreamProducer>(WatermarkDetector::INPUT_FS, KcpServerStreamProducer::L3_MTU / sizeof(int16_t) + 1, 32);
+            });
+            frame_decoder_ = std::make_shared<KcpFrameDecoder>(WatermarkDetector::INPUT_FS, &tracer_);
+
+            player_ = std::make_shared<OboeStreamConsumerPlayer<int16_t>>(
+                    play_device_id,
+                    WatermarkDetector::INPUT_FS,
+                    1,
+                    oboe::PerformanceMode::LowLatency,
+                    PLAYER_CALLBACK_SIZE,
+                    PLAYER_CALLBACK_BUFFER_SIZE
+            );
+            player_->setPlaybackObserver(std::make_shared<PlaybackLatencyObserver>(tracer_, tracer_.stage("playback")));
+            player_->start();
+            // Connect everything. Latency taps go first so that they see each block when its stage emits it
+            using Tap = LatencyTapStream<int16_t>;
+            using FloatTap = LatencyTapStream<float>;
+            server_->attachConsumer(server_gate_);
+            server_gate_->attachConsumer(frame_decoder_);
+            frame_decoder_->attachConsumer(player_);
+            frame_decoder_->attachConsumer(detector_queue_);
+            // Past the queue, stream positions lag by the windows it skipped
+            auto queue_skipped_frames = [this] { return detector_queue_->getDroppedFrames() - dropped_frames_base_; };
+            detector_queue_->attachConsumer(std::make_shared<Tap>(tracer_, "handoff", WatermarkDetector::INPUT_FS, 1, Tap::Mode::Measure, queue_skipped_frames));
+            detector_queue_->attachConsumer(converter_);
+            converter_->attachConsumer(std::make_shared<FloatTap>(tracer_, "format_in", WatermarkDetector::INPUT_FS, 1, FloatTap::Mode::Measure,
+                                                                  [this] { return detectorSkippedFrames(); }));
+            converter_->attachConsumer(detector_);
+            detector_queue_->start();
+        }
+        catch (...)
+        {
+            releaseLocked();
+            throw;
+        }
+        ready_play_device_id_ = play_device_id;
+        is_ready_ = true;
+    }
+
+    void WatermarkCallee::releaseLocked()
+    {
+        if (player_)
+        {
+            player_->stop();
+        }
+        server_gate_->close();
         server_.reset();
+        server_gate_->detachAllConsumers();
+        detector_queue_->stop();
+        if (frame_decoder_)
+        {
+            frame_decoder_->detachAllConsumers();
+            frame_decoder_.reset();
+        }
         player_.reset();
-        model_flex_sizer_->detachAllConsumers();
+        detector_queue_->detachAllConsumers();
         converter_->detachAllConsumers();
-        is_running_ = false;
+        converter_->reset();
+        is_ready_ = false;
     }
 
     void WatermarkCallee::SetOnWatermarkResultsCallback(std::function<void(float, float)> callback)
     {
         std::lock_guard lock{state_mutex_};
-        detector_->setCallback(callback);
+        detector_->setCallback(makeDetectorCallback(std::move(callback)));
+    }
+
+    JitterBufferStats WatermarkCallee::GetJitterBufferStats()
+    {
+        std::lock_guard lock{state_mutex_};
+        if (!player_)
+        {
+            return JitterBufferStats{};
+        }
+        return player_->getJitterBufferStats();
+    }
+
+    std::vector<OboeStreamStats> WatermarkCallee::GetStreamStats()
+    {
+        std::lock_guard lock{state_mutex_};
+        if (!player_)
+        {
+            return {};
+        }
+        return {player_->getStreamStats()};
+    }
+
+    KcpReceiveStats WatermarkCallee::GetKcpReceiveStats()
+    {
+        std::lock_guard lock{state_mutex_};
+        if (!frame_decoder_)
+        {
+            return KcpReceiveStats{};
+        }
+        return frame_decoder_->getStats();
+    }
+
+    AsyncStageStats WatermarkCallee::GetDetectorQueueStats() const
+    {
+        return detector_queue_->getStats();
+    }
+
+    std::vector<LatencyTracer::StageLatency> WatermarkCallee::GetLatencyReport() const
+    {
+        return tracer_.snapshot();
+    }
+
+    const WatermarkResultRing &WatermarkCallee::GetResultRing() const
+    {
+        return result_ring_;
+    }
+
+    int64_t WatermarkCallee::detectorSkippedFrames() const
+    {
+        return detector_queue_->getDroppedFrames() - dropped_frames_base_ + converter_dropped_frames_;
+    }
+
+    std::function<void(float, float)> WatermarkCallee::makeDetectorCallback(std::function<void(float, float)> callback)
+    {
+        // The detector's own running average cannot be started over, and would include the warm-up window
+        return [this, callback = std::move(callback)](float instantaneous, float) {
+            // Window k is complete once (k + 1) * WINDOW_STEP samples have been received, not counting skipped windows.
+            // Callbacks run on the queue's worker, which is also the thread that skips windows
+            const int64_t windows = detected_windows_.fetch_add(1, std::memory_order_relaxed) + 1;
+            const int64_t position_frames = windows * WatermarkDetector::WINDOW_STEP + detectorSkippedFrames();
+            instantaneous_sum_ += instantaneous;
+            const auto average = static_cast<float>(instantaneous_sum_ / static_cast<double>(windows));
+            tracer_.record(*detector_latency_, position_frames);
+            const auto now = std::chrono::steady_clock::now().time_since_epoch();
+            result_ring_.append(WatermarkResultRecord{position_frames / WatermarkDetector::WINDOW_STEP - 1,
+                                                      std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+                                                      instantaneous, average});
+            if (callback)
+            {
+                callback(instantaneous, average);
+            }
+        };
     }
-} // ase_ultrasound_watermark
\ No newline at end of file
+} // ase_ultrasound_watermark
@@ -5,10 +5,17 @@
 #ifndef ULTRASOUNDWATERMARK_WATERMARKCALLEE_HPP
 #define ULTRASOUNDWATERMARK_WATERMARKCALLEE_HPP
 
-#include "ase/stream/FormatConversionStream.hpp"
 #include "oboe/OboeStreamConsumerPlayer.hpp"
+#include "ModelSource.hpp"
+#include "ThreadPolicy.hpp"
 #include "WatermarkDetector.hpp"
+#include "WatermarkResultRing.hpp"
 #include "KcpServerStreamProducer.hpp"
+#include "kcp/KcpFrameDecoder.hpp"
+#include "stream/AsyncStreamStage.hpp"
+#include "stream/Int16ToFloatBlockStream.hpp"
+#include "stream/StreamGate.hpp"
+#include "tracing/LatencyTracer.hpp"
 
 namespace ase_ultrasound_watermark
 {
@@ -17,27 +24,112 @@ namespace ase_ultrasound_watermark
     {
     public:
         constexpr static int PLAYER_CALLBACK_SIZE = 512;
+        /// Capacity of the playback jitter buffer. The actual latency follows the adaptive target, this only bounds it
         constexpr static int PLAYER_CALLBACK_BUFFER_SIZE = 64 * PLAYER_CALLBACK_SIZE;
+        /// Windows queued for the detector. When it falls further behind, all but the latest window are skipped
+        constexpr static int DETECTOR_QUEUE_BLOCKS = 4;
 
-        WatermarkCallee(const std::filesystem::path &param_path, const std::filesystem::path &model_path);
+        /**
+         * @param detector_queue_policy What to do when inference falls behind the network. The default skips stale
+         * windows; OverflowPolicy::Block is lossless for offline use
+         * @param threads Affinity and priority of the detector worker and of the KCP server's I/O thread, which also
+         * runs frame decoding. Policies the system does not permit are logged and skipped
+         * @throw std::runtime_error if the models cannot be loaded
+         */
+        WatermarkCallee(const std::filesystem::path &param_path, const std::filesystem::path &model_path,
+                        OverflowPolicy detector_queue_policy = OverflowPolicy::LatestWins,
+                        const PipelineThreadConfig &threads = {});
 
+        /// Load the detector from model, e.g. buffers mapped from the APK, which may be shared with other instances
+        explicit WatermarkCallee(const ModelSource &model,
+                                 OverflowPolicy detector_queue_policy = OverflowPolicy::LatestWins,
+                                 const PipelineThreadConfig &threads = {});
+
+        /**
+         * Start detecting and playing the audio received from a caller. In standby for the same device this only opens
+         * the gate in front of the decoder; otherwise the KCP server, the player and the stream graph are set up first.
+         */
         void StartServer(int play_device_id);
 
+        /**
+         * Keep the KCP server bound, the player stream open (playing silence) and the stream graph wired between
+         * calls, discarding whatever arrives. StartServer() for the same device then starts almost at once.
+         * If the server is running, it stays in standby once it stops.
+         */
+        void EnterStandby(int play_device_id);
+
+        /// Release what standby keeps open. A running server is not affected, but no longer returns to standby
+        void ExitStandby();
+
         /// Set callback when the watermark detection result is available
         /// \param callback first float is watermarking probability of current window (instantaneous probability),
-        /// second float is probability of current frame (Overall average)
+        /// second float is probability of current frame (Overall average, of the windows detected since the server was set up)
         void SetOnWatermarkResultsCallback(std::function<void(float, float)> callback);
 
+        /// Stop detecting. Returns to standby if EnterStandby() was called, otherwise releases server and player
         void Stop();
 
+        /// Playback jitter buffer counters. All zeros when the server is not set up.
+        ase_android::JitterBufferStats GetJitterBufferStats();
+
+        /// Profile, xruns and callback jitter of the player since it started. Empty when the server is not set up.
+        std::vector<ase_android::OboeStreamStats> GetStreamStats();
+
+        /// Frames received from the caller and gaps in their sequence. All zeros when the server is not set up.
+        KcpReceiveStats GetKcpReceiveStats();
+
+        /// Depth and skip counters of the queue between the KCP receive thread and the detector
+        AsyncStageStats GetDetectorQueueStats() const;
+
+        /**
+         * Per-stage latency from capture on the caller, accumulated since the server started.
+         * Absolute values assume caller and callee share a monotonic clock, see KcpFrameDecoder.
+         */
+        std::vector<LatencyTracer::StageLatency> GetLatencyReport() const;
+
+        /// Every detection result, also those the callback is not called for. Lives as long as the callee
+        const WatermarkResultRing &GetResultRing() const;
+
     private:
         bool is_running_;
+        /// Server bound, player open and graph wired, whether or not the server is running
+        bool is_ready_;
+        /// Stay ready between calls, for standby_play_device_id_
+        bool standby_;
+        int standby_play_device_id_;
+        int ready_play_device_id_;
+        const PipelineThreadConfig threads_;
         std::mutex state_mutex_;
         std::shared_ptr<ase_android::OboeStreamConsumerPlayer<int16_t>> player_;
         std::shared_ptr<WatermarkDetector> detector_;
-        std::shared_ptr<ase::FormatConversionStream<int16_t, float>> converter_;
-        std::shared_ptr<ase::FlexibleSizeStreamProducer<int16_t>> model_flex_sizer_;
+        std::shared_ptr<Int16ToFloatBlockStream> converter_;
+        std::shared_ptr<AsyncStreamStage<int16_t>> detector_queue_;
+        std::shared_ptr<KcpFrameDecoder> frame_decoder_;
         std::shared_ptr<KcpServerStreamProducer> server_;
+        /// Passes received audio on while running, discards it in standby
+        std::shared_ptr<StreamGate<int16_t>> server_gate_;
+        LatencyTracer tracer_;
+        LatencyHistogram *detector_latency_;
+        std::atomic<int64_t> detected_windows_;
+        /// Of the windows counted in detected_windows_, for the average reported. Worker thread only
+        double instantaneous_sum_;
+        /// Frames the detector queue had dropped when stream positions last started over, in prepareLocked(). The
+        /// queue outlives the server, so its own count includes earlier calls
+        int64_t dropped_frames_base_;
+        /// Frames of partial windows converter_ dropped on returning to standby since then
+        int64_t converter_dropped_frames_;
+        WatermarkResultRing result_ring_;
+
+        /// Frames received since stream positions started over that never reached the detector. Worker thread only
+        [[nodiscard]] int64_t detectorSkippedFrames() const;
+
+        std::function<void(float, float)> makeDetectorCallback(std::function<void(float, float)> callback);
+
+        /// Bind the server, open the player and wire the graph, leaving the gate closed
+        void prepareLocked(int play_device_id);
+
+        /// Undo prepareLocked()
+        void releaseLocked();
 
     };
 
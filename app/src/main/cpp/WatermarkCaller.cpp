@@ -3,8 +3,8 @@
 //
 
 #include <ase/utilities/AudioBufferOperations.hpp>
-#include <ase/utilities/WaveformGenerator.hpp>
 #include "WatermarkCaller.hpp"
+#include "tracing/LatencyTapStream.hpp"
 
 using namespace ase;
 using namespace ase_android;
@@ -12,15 +12,70 @@ using namespace ase_android;
 namespace ase_ultrasound_watermark
 {
     WatermarkCaller::WatermarkCaller(const std::filesystem::path &param_path,
-                                     const std::filesystem::path &model_path)
-            : is_running_{false}
+                                     const std::filesystem::path &model_path,
+                                     OverflowPolicy generator_queue_policy,
+                                     const PipelineThreadConfig &threads)
+            : WatermarkCaller(ModelSource::fromFiles(param_path, model_path), generator_queue_policy, threads)
     {
-        converter_in_ = std::make_shared<FormatConversionStream<int16_t, float>>(WatermarkGenerator::INPUT_FS, 1);
-        generator_ = std::make_shared<WatermarkGenerator>(param_path, model_path);
-        converter_out_ = std::make_shared<FormatConversionStream<float, int16_t>>(WatermarkGenerator::OUTPUT_FS, 1);
+    }
+
+    WatermarkCaller::WatermarkCaller(const ModelSource &model, OverflowPolicy generator_queue_policy, const PipelineThreadConfig &threads)
+            : is_running_{false},
+              is_ready_{false},
+              standby_{false},
+              synthesized_pilot_{false},
+              standby_play_device_id_{0},
+              standby_record_device_id_{0},
+              ready_play_device_id_{0},
+              ready_record_device_id_{0},
+              kcp_codec_{KcpCodecConfig::raw()},
+              encoder_outdated_{false},
+              converter_dropped_frames_{0},
+              startup_stats_{false, 0, -1},
+              threads_{threads}
+    {
+        recorder_gate_ = std::make_shared<StreamGate<int16_t>>(WatermarkGenerator::INPUT_FS, 1, WatermarkGenerator::WINDOW_STEP);
+        // Inference runs on the queue's worker thread instead of the recorder callback
+        generator_queue_ = std::make_shared<AsyncStreamStage<int16_t>>(WatermarkGenerator::INPUT_FS, 1, WatermarkGenerator::WINDOW_STEP,
+                                                                       GENERATOR_QUEUE_BLOCKS, generator_queue_policy);
+        generator_queue_->setWorkerPolicy(threads_.inference);
+        converter_in_ = std::make_shared<Int16ToFloatBlockStream>(WatermarkGenerator::INPUT_FS, 1, WatermarkGenerator::WINDOW_STEP);
+        generator_ = std::make_shared<WatermarkGenerator>(model.paramPath(), model.binPath());
+        converter_out_ = std::make_shared<FloatToInt16Stream>(WatermarkGenerator::OUTPUT_FS, 1, WatermarkGenerator::WINDOW_STEP);
+        first_packet_probe_ = std::make_shared<FirstBlockProbe<int16_t>>(WatermarkGenerator::OUTPUT_FS, 1);
+        // Prime the model with a window of silence while nothing is attached, so that the first window of a call
+        // does not pay for lazy allocations
+        const std::vector<float> silence(WatermarkGenerator::WINDOW_STEP, 0.0f);
+        generator_->consume(silence.data(), silence.size());
+        // Create the latency stages up front so that reports list them in pipeline order
+        for (const char *stage: {"capture", "handoff", "format_in", "generator", "format_out", "kcp_send"})
+        {
+            tracer_.stage(stage);
+        }
     }
 
     void WatermarkCaller::StartCall(std::string &host, int play_device_id, int record_device_id, const std::filesystem::path &signal_path)
+    {
+        const int64_t start_ns = LatencyTracer::nowNanoseconds();
+        // Resolved before taking the state lock. A cached or memory-mapped signal costs no file I/O here
+        const SignalCache::Signal signal = signal_cache_.get(signal_path, WatermarkGenerator::INPUT_FS, 1);
+        startCall(start_ns, host, play_device_id, record_device_id, false, [&] {
+            player_->setBuffer(signal.samples, signal.size_in_frames);
+        });
+    }
+
+    void WatermarkCaller::StartCall(std::string &host, int play_device_id, int record_device_id, const std::vector<dsp::Tone> &pilot_tones)
+    {
+        const int64_t start_ns = LatencyTracer::nowNanoseconds();
+        // Checked before anything is set up, so that setTones() cannot fail halfway through
+        dsp::OscillatorBank::validateTones(pilot_tones, WatermarkGenerator::INPUT_FS);
+        startCall(start_ns, host, play_device_id, record_device_id, true, [&] {
+            tone_player_->setTones(pilot_tones);
+        });
+    }
+
+    void WatermarkCaller::startCall(int64_t start_ns, std::string &host, int play_device_id, int record_device_id, bool synthesized_pilot,
+                                    const std::function<void()> &start_pilot)
     {
         if (!state_mutex_.try_lock())
         {
@@ -31,57 +86,334 @@ namespace ase_ultrasound_watermark
         {
             return;
         }
-        // Create kcp client
-        kcp_client_ = std::make_shared<KcpClientStreamConsumer>(WatermarkGenerator::OUTPUT_FS);
-        kcp_client_->connect(host);
-        // Create new streams if needed
-        if (player_ == nullptr || player_->getDeviceId() != play_device_id)
+        const bool from_standby = isReadyForLocked(host, play_device_id, record_device_id);
+        const bool switch_player = synthesized_pilot != synthesized_pilot_;
+        synthesized_pilot_ = synthesized_pilot;
+        if (!from_standby)
         {
-            player_ = std::make_shared<OboeLoopPlayer<int16_t>>(play_device_id, WatermarkGenerator::INPUT_FS, 1,
-                                                                oboe::PerformanceMode::None, WatermarkGenerator::INPUT_FS / 2);
+            releaseLocked();
+            prepareLocked(host, play_device_id, record_device_id);
         }
-        if (recorder_ == nullptr || recorder_->getDeviceId() != record_device_id)
+        else
         {
-            recorder_ = std::make_shared<OboeRecorder<int16_t>>(record_device_id, WatermarkGenerator::INPUT_FS, 1, oboe::PerformanceMode::LowLatency, WatermarkGenerator::WINDOW_STEP, 16);
+            if (switch_player)
+            {
+                // Standby opened the other kind of player. The recorder, KCP and the graph stay as they are
+                try
+                {
+                    openPlayerLocked(play_device_id);
+                    pilotPlayerLocked()->start();
+                }
+                catch (...)
+                {
+                    releaseLocked();
+                    throw;
+                }
+            }
+            if (encoder_outdated_)
+            {
+                wireGraphLocked();
+            }
         }
-        // Connect everything
-        recorder_->attachConsumer(converter_in_);
-        converter_in_->attachConsumer(generator_);
-        generator_->attachConsumer(converter_out_);
-        converter_out_->attachConsumer(kcp_client_);
-        // Read signal from file
-        int fs = 0;
-        int ch = 0;
-        size_t player_buffer_len = 0;
-        auto play_buffer = readBufferFromWavFile<int16_t>(signal_path, fs, ch, player_buffer_len);
-        // Start
-        player_->start();
-        player_->setBuffer(std::move(play_buffer), player_buffer_len);
-        recorder_->start();
+        // Nothing downstream of the gate runs while it is closed
+        tracer_.reset();
+        first_packet_probe_->arm(start_ns);
+        start_pilot();
+        recorder_gate_->open();
         is_running_ = true;
+        startup_stats_ = CallStartupStats{from_standby, LatencyTracer::nowNanoseconds() - start_ns, -1};
     }
 
-    void WatermarkCaller::StopCall()
+    void WatermarkCaller::SetPilotTones(const std::vector<dsp::Tone> &pilot_tones)
     {
-        if (!state_mutex_.try_lock())
+        dsp::OscillatorBank::validateTones(pilot_tones, WatermarkGenerator::INPUT_FS);
+        std::lock_guard lock{state_mutex_};
+        if (is_running_ && synthesized_pilot_)
         {
-            return;
+            tone_player_->setTones(pilot_tones);
         }
-        std::lock_guard lock{state_mutex_, std::adopt_lock};
+    }
+
+    std::vector<dsp::Tone> WatermarkCaller::DefaultPilotTones()
+    {
+        std::vector<dsp::Tone> tones;
+        tones.reserve(MULTI_TONE.size());
+        for (const int frequency: MULTI_TONE)
+        {
+            tones.push_back(dsp::Tone{static_cast<float>(frequency), PILOT_TONE_AMPLITUDE});
+        }
+        return tones;
+    }
+
+    void WatermarkCaller::EnterStandby(const std::string &host, int play_device_id, int record_device_id)
+    {
+        std::lock_guard lock{state_mutex_};
+        standby_ = true;
+        standby_host_ = host;
+        standby_play_device_id_ = play_device_id;
+        standby_record_device_id_ = record_device_id;
+        if (!is_running_ && !isReadyForLocked(host, play_device_id, record_device_id))
+        {
+            releaseLocked();
+            prepareLocked(host, play_device_id, record_device_id);
+        }
+    }
+
+    void WatermarkCaller::ExitStandby()
+    {
+        std::lock_guard lock{state_mutex_};
+        standby_ = false;
         if (!is_running_)
         {
+            releaseLocked();
+        }
+    }
+
+    void WatermarkCaller::prepareLocked(const std::string &host, int play_device_id, int record_device_id)
+    {
+        try
+        {
+            // Create kcp client. Its I/O thread inherits the network policy
+            runWithThreadPolicy(threads_.network, [&] {
+                kcp_client_ = std::make_shared<KcpClientStreamConsumer>(WatermarkGenerator::OUTPUT_FS);
+                kcp_client_->connect(host);
+            });
+            // Create new streams if needed
+            openPlayerLocked(play_device_id);
+            if (recorder_ == nullptr || recorder_->getDeviceId() != record_device_id)
+            {
+                recorder_ = std::make_shared<OboeRecorder<int16_t>>(record_device_id, WatermarkGenerator::INPUT_FS, 1, oboe::PerformanceMode::LowLatency, WatermarkGenerator::WINDOW_STEP, 16);
+            }
+            wireGraphLocked();
+            recorder_->attachConsumer(recorder_gate_);
+            // Start. The player plays silence until a call sets the signal
+            pilotPlayerLocked()->start();
+            recorder_->start();
+        }
+        catch (...)
+        {
+            releaseLocked();
+            throw;
+        }
+        ready_host_ = host;
+        ready_play_device_id_ = play_device_id;
+        ready_record_device_id_ = record_device_id;
+        is_ready_ = true;
+    }
+
+    void WatermarkCaller::openPlayerLocked(int play_device_id)
+    {
+        if (synthesized_pilot_)
+        {
+            if (player_)
+            {
+                player_->stop();
+                player_.reset();
+            }
+            if (tone_player_ == nullptr || tone_player_->getDeviceId() != play_device_id)
+            {
+                tone_player_ = std::make_shared<OboeTonePlayer<int16_t>>(play_device_id, WatermarkGenerator::INPUT_FS, 1, oboe::PerformanceMode::None,
+                                                                         SIGNAL_CALLBACK_FRAMES, SIGNAL_CROSSFADE_FRAMES);
+            }
             return;
         }
+        if (tone_player_)
+        {
+            tone_player_->stop();
+            tone_player_.reset();
+        }
+        if (player_ == nullptr || player_->getDeviceId() != play_device_id)
+        {
+            player_ = std::make_shared<OboeLoopPlayer<int16_t>>(play_device_id, WatermarkGenerator::INPUT_FS, 1,
+                                                                oboe::PerformanceMode::None, SIGNAL_CALLBACK_FRAMES);
+            player_->setCrossfadeFrames(SIGNAL_CROSSFADE_FRAMES);
+        }
+    }
+
+    std::shared_ptr<OboePlayerBase<int16_t>> WatermarkCaller::pilotPlayerLocked() const
+    {
+        if (synthesized_pilot_)
+        {
+            return tone_player_;
+        }
+        return player_;
+    }
+
+    bool WatermarkCaller::isReadyForLocked(const std::string &host, int play_device_id, int record_device_id) const
+    {
+        return is_ready_ && ready_host_ == host && ready_play_device_id_ == play_device_id && ready_record_device_id_ == record_device_id;
+    }
+
+    void WatermarkCaller::wireGraphLocked()
+    {
+        generator_queue_->stop();
+        if (frame_encoder_)
+        {
+            frame_encoder_->flushPending();
+            frame_encoder_->detachAllConsumers();
+        }
+        converter_out_->detachAllConsumers();
+        generator_->detachAllConsumers();
+        converter_in_->detachAllConsumers();
+        converter_in_->reset();
+        generator_queue_->detachAllConsumers();
+        recorder_gate_->detachAllConsumers();
+        frame_encoder_ = std::make_shared<KcpFrameEncoder>(WatermarkGenerator::OUTPUT_FS, &tracer_, kcp_codec_,
+                                                           KcpFramingConfig::forMtu(KcpServerStreamProducer::L3_MTU, KCP_FLUSH_DEADLINE));
+        encoder_outdated_ = false;
+        converter_dropped_frames_ = 0;
+        // Connect everything. Latency taps go first so that they see each block when its stage emits it.
+        // The taps are created along with the encoder so that all stream positions start from zero together
+        using Tap = LatencyTapStream<int16_t>;
+        using FloatTap = LatencyTapStream<float>;
+        recorder_gate_->attachConsumer(std::make_shared<Tap>(tracer_, "capture", WatermarkGenerator::INPUT_FS, 1, Tap::Mode::Capture));
+        recorder_gate_->attachConsumer(generator_queue_);
+        generator_queue_->attachConsumer(std::make_shared<Tap>(tracer_, "handoff", WatermarkGenerator::INPUT_FS, 1, Tap::Mode::Measure));
+        generator_queue_->attachConsumer(converter_in_);
+        // Past the input converter, stream positions lag by the partial windows it dropped
+        auto converter_skipped_frames = [this] { return converter_dropped_frames_; };
+        converter_in_->attachConsumer(std::make_shared<FloatTap>(tracer_, "format_in", WatermarkGenerator::INPUT_FS, 1, FloatTap::Mode::Measure,
+                                                                 converter_skipped_frames));
+        converter_in_->attachConsumer(generator_);
+        generator_->attachConsumer(std::make_shared<FloatTap>(tracer_, "generator", WatermarkGenerator::OUTPUT_FS, 1, FloatTap::Mode::Measure,
+                                                              converter_skipped_frames));
+        generator_->attachConsumer(converter_out_);
+        converter_out_->attachConsumer(std::make_shared<Tap>(tracer_, "format_out", WatermarkGenerator::OUTPUT_FS, 1, Tap::Mode::Measure,
+                                                             converter_skipped_frames));
+        converter_out_->attachConsumer(frame_encoder_);
+        frame_encoder_->attachConsumer(first_packet_probe_);
+        frame_encoder_->attachConsumer(kcp_client_);
+        generator_queue_->start();
+    }
+
+    void WatermarkCaller::releaseLocked()
+    {
         // Stop audio I/O
-        recorder_->stop();
-        player_->stop();
+        if (recorder_)
+        {
+            recorder_->stop();
+            recorder_->detachAllConsumers();
+        }
+        if (player_)
+        {
+            player_->stop();
+        }
+        if (tone_player_)
+        {
+            tone_player_->stop();
+        }
+        recorder_gate_->close();
+        // Let the worker drain what the recorder has already queued
+        generator_queue_->stop();
+        if (frame_encoder_)
+        {
+            // Send the tail of the last window rather than waiting out the flush deadline
+            frame_encoder_->flushPending();
+            frame_encoder_->detachAllConsumers();
+            frame_encoder_.reset();
+        }
         // Disconnect everything
         converter_out_->detachAllConsumers();
         generator_->detachAllConsumers();
         converter_in_->detachAllConsumers();
-        recorder_->detachAllConsumers();
+        converter_in_->reset();
+        generator_queue_->detachAllConsumers();
+        recorder_gate_->detachAllConsumers();
         // Release KCP Client
         kcp_client_.reset();
+        is_ready_ = false;
+    }
+
+    void WatermarkCaller::SetKcpCodec(const KcpCodecConfig &codec)
+    {
+        std::lock_guard lock{state_mutex_};
+        kcp_codec_ = codec;
+        encoder_outdated_ = true;
+    }
+
+    void WatermarkCaller::PreloadSignal(const std::filesystem::path &signal_path)
+    {
+        signal_cache_.get(signal_path, WatermarkGenerator::INPUT_FS, 1);
+    }
+
+    std::vector<LatencyTracer::StageLatency> WatermarkCaller::GetLatencyReport() const
+    {
+        return tracer_.snapshot();
+    }
+
+    AsyncStageStats WatermarkCaller::GetGeneratorQueueStats() const
+    {
+        return generator_queue_->getStats();
+    }
+
+    KcpSendStats WatermarkCaller::GetKcpSendStats()
+    {
+        std::lock_guard lock{state_mutex_};
+        if (!frame_encoder_)
+        {
+            return KcpSendStats{};
+        }
+        return frame_encoder_->getStats();
+    }
+
+    CallStartupStats WatermarkCaller::GetCallStartupStats()
+    {
+        std::lock_guard lock{state_mutex_};
+        CallStartupStats stats = startup_stats_;
+        stats.first_packet_ns = first_packet_probe_->getElapsedNanoseconds();
+        return stats;
+    }
+
+    std::vector<OboeStreamStats> WatermarkCaller::GetStreamStats()
+    {
+        std::lock_guard lock{state_mutex_};
+        std::vector<OboeStreamStats> stats;
+        if (recorder_)
+        {
+            stats.push_back(recorder_->getStreamStats());
+        }
+        if (const auto player = pilotPlayerLocked())
+        {
+            stats.push_back(player->getStreamStats());
+        }
+        return stats;
+    }
+
+    void WatermarkCaller::StopCall()
+    {
+        // Unlike starting, stopping must not be skipped while another call holds the state, e.g. a stats query
+        std::lock_guard lock{state_mutex_};
+        if (!is_running_)
+        {
+            return;
+        }
         is_running_ = false;
+        if (!standby_ || !isReadyForLocked(standby_host_, standby_play_device_id_, standby_record_device_id_))
+        {
+            releaseLocked();
+            if (standby_)
+            {
+                prepareLocked(standby_host_, standby_play_device_id_, standby_record_device_id_);
+            }
+            return;
+        }
+        // Back to standby: discard the recorded audio again and let the worker drain what is already queued
+        recorder_gate_->close();
+        if (synthesized_pilot_)
+        {
+            tone_player_->clearTones();
+        }
+        else
+        {
+            player_->clearBuffer();
+        }
+        generator_queue_->stop();
+        // Send the tail of the last window rather than waiting out the flush deadline
+        frame_encoder_->flushPending();
+        // Without the tail of this call's last window, which would otherwise open the first window of the next one
+        const int64_t dropped_frames = converter_in_->reset();
+        converter_dropped_frames_ += dropped_frames;
+        frame_encoder_->skipFrames(dropped_frames);
+        generator_queue_->start();
     }
-} // ase_ultrasound_watermark
\ No newline at end of file
+} // ase_ultrasound_watermark
@@ -5,34 +5,194 @@
 #ifndef ULTRASOUNDWATERMARK_WATERMARKCALLER_HPP
 #define ULTRASOUNDWATERMARK_WATERMARKCALLER_HPP
 
-#include "ase/stream/FormatConversionStream.hpp"
 #include "oboe/OboeLoopPlayer.hpp"
 #include "oboe/OboeRecorder.hpp"
+#include "oboe/OboeTonePlayer.hpp"
 #include "KcpClientStreamConsumer.hpp"
+#include "KcpServerStreamProducer.hpp"
+#include "ModelSource.hpp"
 #include "WatermarkGenerator.hpp"
+#include "SignalCache.hpp"
+#include "ThreadPolicy.hpp"
+#include "kcp/KcpFrameEncoder.hpp"
+#include "stream/AsyncStreamStage.hpp"
+#include "stream/FloatToInt16Stream.hpp"
+#include "stream/Int16ToFloatBlockStream.hpp"
+#include "stream/StreamGate.hpp"
+#include "tracing/FirstBlockProbe.hpp"
+#include "tracing/LatencyTracer.hpp"
 
 namespace ase_ultrasound_watermark
 {
+    struct CallStartupStats
+    {
+        /// Whether the call was started from standby
+        bool from_standby;
+        /// Time spent in StartCall()
+        int64_t setup_ns;
+        /// Time from entering StartCall() until the first watermarked frame was handed to KCP. -1 until it is
+        int64_t first_packet_ns;
+    };
+
     class WatermarkCaller
     {
     public:
-        WatermarkCaller(const std::filesystem::path &param_path, const std::filesystem::path &model_path);
+        /// Frequencies of the ultrasonic signal the callee's detector listens for
+        constexpr static std::array<int, 6> MULTI_TONE = {16000, 16300, 16600, 16900, 17200, 17500};
+        /// Amplitude of each MULTI_TONE tone in DefaultPilotTones(). Both are those of res/raw/multitone.wav, which
+        /// the synthesized pilot replaces; test/PilotToneTest.cpp compares them with the recording
+        constexpr static float PILOT_TONE_AMPLITUDE = 0.15f;
 
+        /**
+         * @param generator_queue_policy What to do when inference falls behind the recorder. The default keeps the most
+         * recent audio; OverflowPolicy::Block is lossless for offline use where the recorder is not a realtime stream
+         * @param threads Affinity and priority of the generator worker and of the KCP client's I/O thread.
+         * Policies the system does not permit are logged and skipped
+         * @throw std::runtime_error if the models cannot be loaded
+         */
+        WatermarkCaller(const std::filesystem::path &param_path, const std::filesystem::path &model_path,
+                        OverflowPolicy generator_queue_policy = OverflowPolicy::DropOldest,
+                        const PipelineThreadConfig &threads = {});
+
+        /// Load the generator from model, e.g. buffers mapped from the APK, which may be shared with other instances
+        explicit WatermarkCaller(const ModelSource &model, OverflowPolicy generator_queue_policy = OverflowPolicy::DropOldest,
+                                 const PipelineThreadConfig &threads = {});
+
+        /**
+         * Start sending watermarked audio to host. In standby for the same host and devices this only routes the
+         * recorded audio into the generator and the signal into the player; otherwise the streams, the KCP client and
+         * the stream graph are set up first.
+         */
         void StartCall(std::string &host, int play_device_id, int record_device_id, const std::filesystem::path &signal_path);
 
+        /**
+         * Start a call like the other overload, but play pilot_tones synthesized in the player's callback instead of
+         * a signal file. Nothing is loaded and no buffer of the signal (1.1 MB for multitone.wav) is kept, at the cost
+         * of computing it: about 60 times the CPU time of looping the file, ~107 us rather than 1.7 us per 500 ms
+         * callback on x86 (ultrasound_watermark_pilot_bench). Both are far inside the callback's budget.
+         * @throw std::runtime_error if the tone set is not valid (see dsp::OscillatorBank::validateTones())
+         */
+        void StartCall(std::string &host, int play_device_id, int record_device_id, const std::vector<dsp::Tone> &pilot_tones);
+
+        /**
+         * Change the tones of a call started with pilot tones. Unchanged tones keep playing without a glitch; the
+         * others fade in and out over the signal crossfade. No effect on other calls
+         * @throw std::runtime_error if the tone set is not valid
+         */
+        void SetPilotTones(const std::vector<dsp::Tone> &pilot_tones);
+
+        /// MULTI_TONE at PILOT_TONE_AMPLITUDE each
+        static std::vector<dsp::Tone> DefaultPilotTones();
+
+        /// Stop sending. Returns to standby if EnterStandby() was called, otherwise releases streams and connection
         void StopCall();
 
+        /**
+         * Keep everything a call needs running between calls: the audio streams stay open, playing silence and
+         * recording into a gate that discards the audio, the KCP client stays connected to host, and the stream
+         * graph stays wired. StartCall() for the same host and devices then starts almost at once.
+         * If a call is running, it stays in standby for these parameters once it stops.
+         */
+        void EnterStandby(const std::string &host, int play_device_id, int record_device_id);
+
+        /// Release what standby keeps open. A running call is not affected, but no longer returns to standby
+        void ExitStandby();
+
+        /**
+         * Payload encoding of the audio sent to the callee, from the next StartCall(). Raw PCM16 by default, which
+         * every callee reads. There is no negotiation on the link, so only select a codec once the callee is known to
+         * decode it
+         */
+        void SetKcpCodec(const KcpCodecConfig &codec);
+
+        /// Load the signal into the signal cache ahead of StartCall(), keeping file I/O off the call start path
+        void PreloadSignal(const std::filesystem::path &signal_path);
+
+        /// Per-stage latency from capture, accumulated since the current (or last) call started
+        std::vector<LatencyTracer::StageLatency> GetLatencyReport() const;
+
+        /// Depth and drop counters of the queue between the recorder callback and the generator
+        AsyncStageStats GetGeneratorQueueStats() const;
+
+        /// Frames and words sent to the callee since the connection was set up. All zeros when not connected.
+        KcpSendStats GetKcpSendStats();
+
+        /// Setup time of the current (or last) call
+        CallStartupStats GetCallStartupStats();
+
+        /// Profile, xruns and callback jitter of the recorder and the pilot player since they last started. Empty when
+        /// neither was created
+        std::vector<ase_android::OboeStreamStats> GetStreamStats();
+
     private:
-        constexpr static std::array<int, 6> MULTI_TONE = {16000, 16300, 16600, 16900, 17200, 17500};
+        /// Fade between signals (and from silence into the first one) over 10 ms to avoid clicks
+        constexpr static int SIGNAL_CROSSFADE_FRAMES = WatermarkGenerator::INPUT_FS / 100;
+        /// The signal player fills half a second per callback; the signal is known ahead, so latency does not matter
+        constexpr static int SIGNAL_CALLBACK_FRAMES = WatermarkGenerator::INPUT_FS / 2;
+        /// Windows queued between the recorder callback and the generator before the oldest ones are dropped
+        constexpr static int GENERATOR_QUEUE_BLOCKS = 8;
+        /// Longest a partial KCP frame waits to be filled. Small next to a generator window, so the tail of each window
+        /// is sent almost at once instead of waiting for the next one
+        constexpr static std::chrono::microseconds KCP_FLUSH_DEADLINE{2000};
 
         bool is_running_;
+        /// Streams open, KCP connected and graph wired, whether or not a call is running
+        bool is_ready_;
+        /// Stay ready between calls, for the standby_ parameters
+        bool standby_;
+        /// The pilot is synthesized by tone_player_ rather than played from a file by player_. Kept from the last
+        /// call, so that standby opens the player the next call most likely uses
+        bool synthesized_pilot_;
+        std::string standby_host_;
+        int standby_play_device_id_;
+        int standby_record_device_id_;
+        std::string ready_host_;
+        int ready_play_device_id_;
+        int ready_record_device_id_;
+        KcpCodecConfig kcp_codec_;
+        /// The codec changed since frame_encoder_ was created
+        bool encoder_outdated_;
+        /// Frames of partial windows converter_in_ dropped on returning to standby since the graph was wired.
+        /// Written while generator_queue_ is stopped, read on its worker
+        int64_t converter_dropped_frames_;
+        CallStartupStats startup_stats_;
+        const PipelineThreadConfig threads_;
         std::mutex state_mutex_;
         std::shared_ptr<ase_android::OboeLoopPlayer<int16_t>> player_;
+        std::shared_ptr<ase_android::OboeTonePlayer<int16_t>> tone_player_;
         std::shared_ptr<ase_android::OboeRecorder<int16_t>> recorder_;
-        std::shared_ptr<ase::FormatConversionStream<int16_t, float>> converter_in_;
+        /// Routes the recorded audio into the generator during calls, discards it in standby
+        std::shared_ptr<StreamGate<int16_t>> recorder_gate_;
+        std::shared_ptr<AsyncStreamStage<int16_t>> generator_queue_;
+        std::shared_ptr<Int16ToFloatBlockStream> converter_in_;
         std::shared_ptr<WatermarkGenerator> generator_;
-        std::shared_ptr<ase::FormatConversionStream<float, int16_t>> converter_out_;
+        std::shared_ptr<FloatToInt16Stream> converter_out_;
+        std::shared_ptr<KcpFrameEncoder> frame_encoder_;
         std::shared_ptr<KcpClientStreamConsumer> kcp_client_;
+        std::shared_ptr<FirstBlockProbe<int16_t>> first_packet_probe_;
+        SignalCache signal_cache_;
+        LatencyTracer tracer_;
+
+        /// Common part of the StartCall() overloads. start_pilot gives the player its signal
+        void startCall(int64_t start_ns, std::string &host, int play_device_id, int record_device_id, bool synthesized_pilot,
+                       const std::function<void()> &start_pilot);
+
+        /// Create the player synthesized_pilot_ calls for if there is none for play_device_id, releasing the other one
+        void openPlayerLocked(int play_device_id);
+
+        /// The player synthesized_pilot_ calls for
+        [[nodiscard]] std::shared_ptr<ase_android::OboePlayerBase<int16_t>> pilotPlayerLocked() const;
+
+        /// Open the streams, connect to host and wire the graph, leaving the gate closed
+        void prepareLocked(const std::string &host, int play_device_id, int record_device_id);
+
+        [[nodiscard]] bool isReadyForLocked(const std::string &host, int play_device_id, int record_device_id) const;
+
+        /// (Re)wire everything downstream of the gate with a new frame encoder. The gate must be closed
+        void wireGraphLocked();
+
+        /// Undo prepareLocked()
+        void releaseLocked();
     };
 
 } // ase_ultrasound_watermark
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include "WatermarkResultDispatcher.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        int64_t intervalNanoseconds(double max_rate_hz)
+        {
+            return max_rate_hz > 0.0 ? static_cast<int64_t>(1e9 / max_rate_hz) : 0;
+        }
+    }
+
+    WatermarkResultDispatcher::State::State(Deliver deliver, ThreadHook on_thread_start, ThreadHook on_thread_exit, int64_t min_interval_ns)
+            : deliver{std::move(deliver)},
+              on_thread_start{std::move(on_thread_start)},
+              on_thread_exit{std::move(on_thread_exit)},
+              queue{QUEUE_RESULTS},
+              min_interval_ns{min_interval_ns},
+              running{true},
+              wake_sequence{0},
+              posted{0},
+              delivered{0},
+              coalesced{0},
+              dropped{0}
+    {
+    }
+
+    void WatermarkResultDispatcher::State::wake()
+    {
+        wake_sequence.fetch_add(1, std::memory_order_release);
+        wake_sequence.notify_one();
+    }
+
+    WatermarkResultDispatcher::WatermarkResultDispatcher(Deliver deliver, ThreadHook on_thread_start, ThreadHook on_thread_exit,
+                                                         double max_rate_hz)
+            : state_{std::make_shared<State>(std::move(deliver), std::move(on_thread_start), std::move(on_thread_exit),
+                                             intervalNanoseconds(max_rate_hz))}
+    {
+        thread_ = std::thread(&WatermarkResultDispatcher::run, state_);
+    }
+
+    WatermarkResultDispatcher::~WatermarkResultDispatcher()
+    {
+        state_->running.store(false, std::memory_order_release);
+        state_->wake();
+        if (thread_.get_id() == std::this_thread::get_id())
+        {
+            // Destroyed by a delivery. Joining would deadlock; the thread holds the state and stops after the delivery
+            thread_.detach();
+            return;
+        }
+        thread_.join();
+    }
+
+    void WatermarkResultDispatcher::post(float instantaneous, float average)
+    {
+        state_->posted.fetch_add(1, std::memory_order_relaxed);
+        const Result result{instantaneous, average};
+        if (state_->queue.write(&result, 1) == 0)
+        {
+            state_->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        state_->wake();
+    }
+
+    void WatermarkResultDispatcher::setMaxRate(double max_rate_hz)
+    {
+        state_->min_interval_ns.store(intervalNanoseconds(max_rate_hz), std::memory_order_relaxed);
+    }
+
+    ResultDispatcherStats WatermarkResultDispatcher::getStats() const
+    {
+        return ResultDispatcherStats{
+                state_->posted.load(std::memory_order_relaxed),
+                state_->delivered.load(std::memory_order_relaxed),
+                state_->coalesced.load(std::memory_order_relaxed),
+                state_->dropped.load(std::memory_order_relaxed)
+        };
+    }
+
+    void WatermarkResultDispatcher::run(const std::shared_ptr<State> &state)
+    {
+        if (state->on_thread_start)
+        {
+            state->on_thread_start();
+        }
+        using clock = std::chrono::steady_clock;
+        // Long enough ago that the first result is delivered at once
+        clock::time_point last_delivery = clock::now() - std::chrono::hours{1};
+        Result pending{};
+        bool has_pending = false;
+        while (true)
+        {
+            // Load the sequence before checking the queue so that a wake() in between is not lost
+            const uint32_t sequence = state->wake_sequence.load(std::memory_order_acquire);
+            const bool running = state->running.load(std::memory_order_acquire);
+            const std::chrono::nanoseconds min_interval{state->min_interval_ns.load(std::memory_order_relaxed)};
+            Result result{};
+            while (state->queue.read(&result, 1) == 1)
+            {
+                if (min_interval.count() == 0 && !has_pending)
+                {
+                    state->deliver(result.instantaneous, result.average);
+                    state->delivered.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (has_pending)
+                {
+                    pending.instantaneous = std::max(pending.instantaneous, result.instantaneous);
+                    pending.average = result.average;
+                    state->coalesced.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                {
+                    pending = result;
+                    has_pending = true;
+                }
+            }
+            if (has_pending)
+            {
+                const clock::time_point now = clock::now();
+                const clock::time_point next_slot = last_delivery + min_interval;
+                if (now >= next_slot || !running)
+                {
+                    state->deliver(pending.instantaneous, pending.average);
+                    state->delivered.fetch_add(1, std::memory_order_relaxed);
+                    last_delivery = now;
+                    has_pending = false;
+                }
+                else
+                {
+                    // Keep merging whatever arrives until the slot opens
+                    std::this_thread::sleep_until(std::min(next_slot, now + MAX_SLOT_WAIT));
+                }
+                continue;
+            }
+            if (!running)
+            {
+                break;
+            }
+            state->wake_sequence.wait(sequence, std::memory_order_acquire);
+        }
+        if (state->on_thread_exit)
+        {
+            state->on_thread_exit();
+        }
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,105 @@
+#ifndef ULTRASOUNDWATERMARK_WATERMARKRESULTDISPATCHER_HPP
+#define ULTRASOUNDWATERMARK_WATERMARKRESULTDISPATCHER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include "oboe/SpscRingBuffer.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    struct ResultDispatcherStats
+    {
+        /// Results passed to post()
+        int64_t posted;
+        /// Calls to the deliver callback
+        int64_t delivered;
+        /// Results merged into another one by rate limiting
+        int64_t coalesced;
+        /// Results lost because the queue was full
+        int64_t dropped;
+    };
+
+    /**
+     * Hands detection results from the detector thread to a long-lived dispatcher thread, which delivers them.
+     *
+     * post() only writes into an SpscRingBuffer and wakes the dispatcher, so the detector never runs the deliver
+     * callback itself. on_thread_start and on_thread_exit run once on the dispatcher thread around all deliveries,
+     * e.g. to attach it to the JVM once instead of per result.
+     *
+     * With a max_rate_hz above 0, at most that many results are delivered per second. A result arriving after a quiet
+     * period is delivered at once; those arriving within the following period are merged into one, carrying the
+     * highest instantaneous probability among them (so a short detection is not lost) and the latest average.
+     *
+     * post() must be called from a single thread at a time. The dispatcher may be destroyed from within a delivery,
+     * e.g. when the callback replaces itself; its thread then finishes the queue on its own instead of being joined.
+     */
+    class WatermarkResultDispatcher
+    {
+    public:
+        using Deliver = std::function<void(float instantaneous, float average)>;
+        using ThreadHook = std::function<void()>;
+
+        /// Results queued before post() drops them, far more than the detector produces while the dispatcher is busy
+        constexpr static size_t QUEUE_RESULTS = 256;
+
+        explicit WatermarkResultDispatcher(Deliver deliver, ThreadHook on_thread_start = nullptr, ThreadHook on_thread_exit = nullptr,
+                                           double max_rate_hz = 0.0);
+
+        WatermarkResultDispatcher(const WatermarkResultDispatcher &) = delete;
+
+        WatermarkResultDispatcher &operator=(const WatermarkResultDispatcher &) = delete;
+
+        /// Delivers what is still queued, then stops the dispatcher thread. Does not wait when called from that thread
+        ~WatermarkResultDispatcher();
+
+        /// Detector side. Never blocks
+        void post(float instantaneous, float average);
+
+        /// Maximum deliveries per second, 0 for every result. Takes effect with the next result
+        void setMaxRate(double max_rate_hz);
+
+        [[nodiscard]] ResultDispatcherStats getStats() const;
+
+    private:
+        struct Result
+        {
+            float instantaneous;
+            float average;
+        };
+
+        /// Everything the dispatcher thread uses. The thread shares ownership, so that it can outlive the dispatcher
+        struct State
+        {
+            State(Deliver deliver, ThreadHook on_thread_start, ThreadHook on_thread_exit, int64_t min_interval_ns);
+
+            const Deliver deliver;
+            const ThreadHook on_thread_start;
+            const ThreadHook on_thread_exit;
+            ase_android::SpscRingBuffer<Result> queue;
+            std::atomic<int64_t> min_interval_ns;
+            std::atomic<bool> running;
+            std::atomic<uint32_t> wake_sequence;
+            std::atomic<int64_t> posted;
+            std::atomic<int64_t> delivered;
+            std::atomic<int64_t> coalesced;
+            std::atomic<int64_t> dropped;
+
+            void wake();
+        };
+
+        /// How long to sleep at most while waiting for the next rate-limited slot, so that stopping is not delayed
+        constexpr static std::chrono::milliseconds MAX_SLOT_WAIT{20};
+
+        const std::shared_ptr<State> state_;
+        std::thread thread_;
+
+        static void run(const std::shared_ptr<State> &state);
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_WATERMARKRESULTDISPATCHER_HPP
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <bit>
+#include <memory>
+#include "WatermarkResultRing.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    WatermarkResultRing::WatermarkResultRing(uint32_t capacity)
+            : capacity_{std::bit_ceil(std::max<uint32_t>(capacity, 2))},
+              slots_{std::make_unique<Slot[]>(capacity_)},
+              write_index_{0}
+    {
+    }
+
+    void WatermarkResultRing::append(const WatermarkResultRecord &record)
+    {
+        const uint64_t index = write_index_.load(std::memory_order_relaxed);
+        Slot *target = slot(index);
+        target->commit.store(0, std::memory_order_relaxed);
+        // Readers that see any of the new fields also see the cleared commit
+        std::atomic_thread_fence(std::memory_order_release);
+        target->window_index.store(record.window_index, std::memory_order_relaxed);
+        target->timestamp_ns.store(record.timestamp_ns, std::memory_order_relaxed);
+        target->instantaneous.store(record.instantaneous, std::memory_order_relaxed);
+        target->average.store(record.average, std::memory_order_relaxed);
+        target->commit.store(index + 1, std::memory_order_release);
+        write_index_.store(index + 1, std::memory_order_release);
+    }
+
+    size_t WatermarkResultRing::read(uint64_t &next_index, WatermarkResultRecord *records, size_t max_records) const
+    {
+        const uint64_t write_index = writeIndex();
+        if (write_index > capacity_)
+        {
+            next_index = std::max(next_index, write_index - capacity_);
+        }
+        size_t count = 0;
+        for (; next_index < write_index && count < max_records; ++next_index)
+        {
+            const Slot *source = slot(next_index);
+            if (source->commit.load(std::memory_order_acquire) != next_index + 1)
+            {
+                continue;
+            }
+            const WatermarkResultRecord record{
+                    source->window_index.load(std::memory_order_relaxed),
+                    source->timestamp_ns.load(std::memory_order_relaxed),
+                    source->instantaneous.load(std::memory_order_relaxed),
+                    source->average.load(std::memory_order_relaxed)
+            };
+            // The fields must be read before commit is checked again
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (source->commit.load(std::memory_order_relaxed) != next_index + 1)
+            {
+                continue;
+            }
+            records[count++] = record;
+        }
+        return count;
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,90 @@
+#ifndef ULTRASOUNDWATERMARK_WATERMARKRESULTRING_HPP
+#define ULTRASOUNDWATERMARK_WATERMARKRESULTRING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace ase_ultrasound_watermark
+{
+    struct WatermarkResultRecord
+    {
+        /// Window position in the received stream, counting windows the detector skipped
+        int64_t window_index;
+        /// steady_clock (CLOCK_MONOTONIC, System.nanoTime() on Android) when the result was written
+        int64_t timestamp_ns;
+        float instantaneous;
+        float average;
+    };
+
+    /**
+     * History of detection results, written by the detector thread and read without locks by any number of readers,
+     * Kotlin ones through one JNI call per batch of read().
+     *
+     * Record n lives in slot n % capacity, next to a commit word that holds n + 1 once the record is complete and 0
+     * while the slot is being rewritten. The writer clears commit, writes the fields, sets commit and then advances the
+     * write index, each step ordered by release stores. A reader that has read up to record next loads the write
+     * index w, then for each n in [max(next, w - capacity), w) loads commit, the fields and commit again, and keeps the
+     * record only if both commits equal n + 1. Otherwise the writer has lapped the reader and the slot already holds a
+     * newer record.
+     */
+    class WatermarkResultRing
+    {
+    public:
+        /// About 100 s of results at one per 100 ms window
+        constexpr static uint32_t DEFAULT_CAPACITY = 1024;
+
+        /// @param capacity Records kept, rounded up to a power of two
+        explicit WatermarkResultRing(uint32_t capacity = DEFAULT_CAPACITY);
+
+        WatermarkResultRing(const WatermarkResultRing &) = delete;
+
+        WatermarkResultRing &operator=(const WatermarkResultRing &) = delete;
+
+        /// Writer side. Must be called from a single thread at a time
+        void append(const WatermarkResultRecord &record);
+
+        /**
+         * Reader side, which Kotlin readers also go through.
+         * @param next_index First record not read yet, 0 initially. Advanced past the records returned and past any
+         * that were overwritten before they could be read
+         * @return Number of records copied into records
+         */
+        size_t read(uint64_t &next_index, WatermarkResultRecord *records, size_t max_records) const;
+
+        /// Records written so far
+        [[nodiscard]] uint64_t writeIndex() const
+        {
+            return write_index_.load(std::memory_order_acquire);
+        }
+
+        [[nodiscard]] uint32_t capacity() const
+        {
+            return capacity_;
+        }
+
+    private:
+        /// Never straddles a cache line
+        struct alignas(32) Slot
+        {
+            std::atomic<int64_t> window_index;
+            std::atomic<int64_t> timestamp_ns;
+            std::atomic<float> instantaneous;
+            std::atomic<float> average;
+            std::atomic<uint64_t> commit;
+        };
+
+        const uint32_t capacity_;
+        const std::unique_ptr<Slot[]> slots_;
+        std::atomic<uint64_t> write_index_;
+
+        [[nodiscard]] Slot *slot(uint64_t index) const
+        {
+            return &slots_[index & (capacity_ - 1)];
+        }
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_WATERMARKRESULTRING_HPP
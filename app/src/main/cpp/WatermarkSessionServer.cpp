@@ -0,0 +1,142 @@
+#include <stdexcept>
+#include <string>
+#include "WatermarkSessionServer.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    WatermarkSessionServer::WatermarkSessionServer(const std::filesystem::path &param_path, const std::filesystem::path &model_path,
+                                                   int num_workers)
+            : WatermarkSessionServer(ModelSource::fromFiles(param_path, model_path), num_workers)
+    {
+    }
+
+    WatermarkSessionServer::WatermarkSessionServer(const ModelSource &model, int num_workers)
+            : WatermarkSessionServer([model] { return std::make_shared<WatermarkDetector>(model.paramPath(), model.binPath()); },
+                                     num_workers)
+    {
+    }
+
+    WatermarkSessionServer::WatermarkSessionServer(DetectorFactory detector_factory, int num_workers)
+            : detector_factory_{std::move(detector_factory)},
+              pool_{num_workers}
+    {
+    }
+
+    WatermarkSessionServer::~WatermarkSessionServer()
+    {
+        std::lock_guard lock{sessions_mutex_};
+        for (auto &[id, opened]: sessions_)
+        {
+            closeSession(opened);
+        }
+    }
+
+    void WatermarkSessionServer::SetOnWatermarkResultsCallback(ResultsCallback callback)
+    {
+        auto shared = std::make_shared<const ResultsCallback>(std::move(callback));
+        std::lock_guard lock{callback_mutex_};
+        callback_ = std::move(shared);
+    }
+
+    void WatermarkSessionServer::OpenSession(uint32_t session_id, std::shared_ptr<ase::AudioDataStreamProducer<int16_t, true>> transport)
+    {
+        if (!transport)
+        {
+            throw std::invalid_argument("Session " + std::to_string(session_id) + " has no transport");
+        }
+        openSession(session_id, std::move(transport));
+    }
+
+    std::shared_ptr<ase::AudioDataStreamBase<int16_t>> WatermarkSessionServer::OpenSession(uint32_t session_id)
+    {
+        return openSession(session_id, nullptr)->getIngress();
+    }
+
+    std::shared_ptr<DetectionSession> WatermarkSessionServer::openSession(uint32_t session_id,
+                                                                          std::shared_ptr<ase::AudioDataStreamProducer<int16_t, true>> transport)
+    {
+        {
+            std::lock_guard lock{sessions_mutex_};
+            if (sessions_.count(session_id) != 0)
+            {
+                throw std::runtime_error("Session " + std::to_string(session_id) + " is already open");
+            }
+        }
+        // Loading the detector may take a while, keep it outside the lock
+        auto session = DetectionSession::create(
+                session_id, detector_factory_(), pool_, DEFAULT_SESSION_QUEUE_WINDOWS, DEFAULT_MAX_BATCH,
+                [this](uint32_t id, float instantaneous, float average) { dispatchResult(id, instantaneous, average); });
+        std::lock_guard lock{sessions_mutex_};
+        if (!sessions_.emplace(session_id, OpenedSession{session, transport}).second)
+        {
+            throw std::runtime_error("Session " + std::to_string(session_id) + " is already open");
+        }
+        if (transport)
+        {
+            transport->attachConsumer(session->getIngress());
+        }
+        return session;
+    }
+
+    void WatermarkSessionServer::CloseSession(uint32_t session_id)
+    {
+        OpenedSession opened;
+        {
+            std::lock_guard lock{sessions_mutex_};
+            auto it = sessions_.find(session_id);
+            if (it == sessions_.end())
+            {
+                return;
+            }
+            opened = std::move(it->second);
+            sessions_.erase(it);
+        }
+        closeSession(opened);
+    }
+
+    void WatermarkSessionServer::closeSession(OpenedSession &opened)
+    {
+        // A drain task still queued on the pool keeps the session alive until it has run
+        opened.session->close();
+        if (opened.transport)
+        {
+            opened.transport->detachAllConsumers();
+        }
+    }
+
+    std::vector<SessionStats> WatermarkSessionServer::GetSessionStats() const
+    {
+        std::lock_guard lock{sessions_mutex_};
+        std::vector<SessionStats> stats;
+        stats.reserve(sessions_.size());
+        for (const auto &[id, opened]: sessions_)
+        {
+            stats.push_back(opened.session->getStats());
+        }
+        return stats;
+    }
+
+    int WatermarkSessionServer::GetWorkerCount() const
+    {
+        return pool_.getWorkerCount();
+    }
+
+    int64_t WatermarkSessionServer::GetBusyNanoseconds() const
+    {
+        return pool_.getBusyNanoseconds();
+    }
+
+    void WatermarkSessionServer::dispatchResult(uint32_t session_id, float instantaneous, float average)
+    {
+        std::shared_ptr<const ResultsCallback> callback;
+        {
+            std::lock_guard lock{callback_mutex_};
+            callback = callback_;
+        }
+        if (callback && *callback)
+        {
+            (*callback)(session_id, instantaneous, average);
+        }
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,109 @@
+#ifndef ULTRASOUNDWATERMARK_WATERMARKSESSIONSERVER_HPP
+#define ULTRASOUNDWATERMARK_WATERMARKSESSIONSERVER_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <ase/stream/AudioDataStreamProducer.hpp>
+#include "ModelSource.hpp"
+#include "WatermarkDetector.hpp"
+#include "session/DetectionSession.hpp"
+#include "session/DetectorWorkerPool.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Server mode of the callee: verifies many concurrent callers in one process.
+     *
+     * Each session is keyed by a caller-chosen id (e.g. the KCP conversation id) and has its own detector, but all
+     * sessions share one fixed-size DetectorWorkerPool, so CPU use is bounded by the pool size rather than the number
+     * of callers. Unlike WatermarkCallee there is no playback: the server only reports detection results.
+     *
+     * Two parts of a full multi-caller server are missing, as both need changes to the DSP core:
+     * - Weights are not shared. Every session's WatermarkDetector loads and keeps its own copy of the model, because
+     *   the detector can only load from a param/bin pair; memory and load time grow with the number of sessions.
+     * - There is no demultiplexing by KCP conversation id. KcpServerStreamProducer serves a single conversation, so
+     *   each session reads from its own transport, e.g. a KcpServerStreamProducer per caller (or, in tests, a
+     *   KcpFrameEncoder), which the caller of OpenSession() sets up. OpenSession() attaches it and CloseSession()
+     *   detaches it again.
+     */
+    class WatermarkSessionServer
+    {
+    public:
+        using DetectorFactory = std::function<std::shared_ptr<WatermarkDetector>()>;
+        using ResultsCallback = DetectionSession::ResultsCallback;
+
+        constexpr static int DEFAULT_SESSION_QUEUE_WINDOWS = 16;
+        constexpr static int DEFAULT_MAX_BATCH = 8;
+
+        /**
+         * @param num_workers Detection threads shared by all sessions, typically the number of cores to devote
+         */
+        WatermarkSessionServer(const std::filesystem::path &param_path, const std::filesystem::path &model_path, int num_workers);
+
+        /// Same as above, loading every session's detector from model. Each detector still parses its own copy
+        WatermarkSessionServer(const ModelSource &model, int num_workers);
+
+        /// Same as above, with a custom way of creating each session's detector
+        WatermarkSessionServer(DetectorFactory detector_factory, int num_workers);
+
+        /// Closes all sessions and joins the worker pool
+        ~WatermarkSessionServer();
+
+        /// Set callback for detection results of all sessions. Called on pool threads, concurrently for different sessions
+        void SetOnWatermarkResultsCallback(ResultsCallback callback);
+
+        /**
+         * Create a session and its detector, and feed it the KcpFrameEncoder-framed PCM16 the transport produces.
+         * The server keeps the transport until the session is closed. Throws if the id is already open
+         */
+        void OpenSession(uint32_t session_id, std::shared_ptr<ase::AudioDataStreamProducer<int16_t, true>> transport);
+
+        /**
+         * Create a session and its detector, for a transport managed elsewhere.
+         * @return The session's ingress for KcpFrameEncoder-framed PCM16. Throws if the id is already open
+         */
+        std::shared_ptr<ase::AudioDataStreamBase<int16_t>> OpenSession(uint32_t session_id);
+
+        /// Results stop at once and the transport is detached. An ingress handed out stays valid, and ignores input
+        void CloseSession(uint32_t session_id);
+
+        std::vector<SessionStats> GetSessionStats() const;
+
+        [[nodiscard]] int GetWorkerCount() const;
+
+        /// Total worker time spent on detection so far. Divided by wall time, the number of cores in use
+        [[nodiscard]] int64_t GetBusyNanoseconds() const;
+
+    private:
+        struct OpenedSession
+        {
+            std::shared_ptr<DetectionSession> session;
+            /// nullptr if managed elsewhere
+            std::shared_ptr<ase::AudioDataStreamProducer<int16_t, true>> transport;
+        };
+
+        const DetectorFactory detector_factory_;
+        mutable std::mutex sessions_mutex_;
+        std::map<uint32_t, OpenedSession> sessions_;
+        std::mutex callback_mutex_;
+        std::shared_ptr<const ResultsCallback> callback_;
+        // Declared last so that the workers are joined before the sessions and the callback are destroyed
+        DetectorWorkerPool pool_;
+
+        std::shared_ptr<DetectionSession> openSession(uint32_t session_id,
+                                                      std::shared_ptr<ase::AudioDataStreamProducer<int16_t, true>> transport);
+
+        /// Stop delivering results and feeding the session
+        static void closeSession(OpenedSession &opened);
+
+        void dispatchResult(uint32_t session_id, float instantaneous, float average);
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_WATERMARKSESSIONSERVER_HPP
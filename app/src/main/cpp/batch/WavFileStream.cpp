@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "WavFileStream.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        constexpr uint16_t FORMAT_PCM = 1;
+        constexpr uint16_t FORMAT_EXTENSIBLE = 0xFFFE;
+        constexpr size_t HEADER_BYTES = 44;
+        /// Frames converted from interleaved to mono per pass
+        constexpr size_t INTERLEAVED_FRAMES = 4096;
+
+        uint16_t readU16(const uint8_t *bytes)
+        {
+            return static_cast<uint16_t>(bytes[0] | bytes[1] << 8);
+        }
+
+        uint32_t readU32(const uint8_t *bytes)
+        {
+            return static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 |
+                   static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+        }
+
+        void writeU16(uint8_t *bytes, uint16_t value)
+        {
+            bytes[0] = static_cast<uint8_t>(value);
+            bytes[1] = static_cast<uint8_t>(value >> 8);
+        }
+
+        void writeU32(uint8_t *bytes, uint32_t value)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+            }
+        }
+    }
+
+    WavFileReader::WavFileReader(const std::filesystem::path &path)
+            : file_{path, std::ios::binary},
+              sample_rate_{0},
+              channels_{0},
+              frames_{0},
+              remaining_frames_{0}
+    {
+        if (!file_)
+        {
+            throw std::runtime_error("Cannot open " + path.string());
+        }
+        std::array<uint8_t, 12> riff{};
+        if (!file_.read(reinterpret_cast<char *>(riff.data()), riff.size()) ||
+            std::memcmp(riff.data(), "RIFF", 4) != 0 || std::memcmp(riff.data() + 8, "WAVE", 4) != 0)
+        {
+            throw std::runtime_error(path.string() + " is not a WAV file");
+        }
+        const auto file_size = static_cast<int64_t>(std::filesystem::file_size(path));
+
+        bool has_format = false;
+        while (true)
+        {
+            std::array<uint8_t, 8> chunk{};
+            if (!file_.read(reinterpret_cast<char *>(chunk.data()), chunk.size()))
+            {
+                throw std::runtime_error(path.string() + " has no data chunk");
+            }
+            const uint32_t chunk_size = readU32(chunk.data() + 4);
+            if (std::memcmp(chunk.data(), "fmt ", 4) == 0)
+            {
+                std::array<uint8_t, 16> format{};
+                if (chunk_size < format.size() || !file_.read(reinterpret_cast<char *>(format.data()), format.size()))
+                {
+                    throw std::runtime_error(path.string() + " has a truncated format chunk");
+                }
+                const uint16_t format_tag = readU16(format.data());
+                const uint16_t bits = readU16(format.data() + 14);
+                if ((format_tag != FORMAT_PCM && format_tag != FORMAT_EXTENSIBLE) || bits != 16)
+                {
+                    throw std::runtime_error(path.string() + " is not PCM16");
+                }
+                channels_ = readU16(format.data() + 2);
+                sample_rate_ = static_cast<int>(readU32(format.data() + 4));
+                if (channels_ <= 0 || sample_rate_ <= 0)
+                {
+                    throw std::runtime_error(path.string() + " has an invalid format");
+                }
+                has_format = true;
+                file_.seekg(chunk_size - format.size() + (chunk_size & 1u), std::ios::cur);
+            }
+            else if (std::memcmp(chunk.data(), "data", 4) == 0)
+            {
+                if (!has_format)
+                {
+                    throw std::runtime_error(path.string() + " has data before its format");
+                }
+                const int64_t available = file_size - static_cast<int64_t>(file_.tellg());
+                const int64_t data_bytes = std::min<int64_t>(chunk_size, available);
+                frames_ = data_bytes / (static_cast<int64_t>(channels_) * static_cast<int64_t>(sizeof(int16_t)));
+                remaining_frames_ = frames_;
+                break;
+            }
+            else
+            {
+                file_.seekg(chunk_size + (chunk_size & 1u), std::ios::cur);
+            }
+        }
+        if (channels_ > 1)
+        {
+            interleaved_.resize(INTERLEAVED_FRAMES * channels_);
+        }
+    }
+
+    size_t WavFileReader::read(int16_t *samples, size_t max_frames)
+    {
+        const auto frames = static_cast<size_t>(std::min<int64_t>(remaining_frames_, static_cast<int64_t>(max_frames)));
+        if (channels_ == 1)
+        {
+            file_.read(reinterpret_cast<char *>(samples), static_cast<std::streamsize>(frames * sizeof(int16_t)));
+        }
+        else
+        {
+            for (size_t done = 0; done < frames && file_;)
+            {
+                const size_t pass = std::min(frames - done, INTERLEAVED_FRAMES);
+                file_.read(reinterpret_cast<char *>(interleaved_.data()), static_cast<std::streamsize>(pass * channels_ * sizeof(int16_t)));
+                for (size_t i = 0; i < pass; ++i)
+                {
+                    samples[done + i] = interleaved_[i * channels_];
+                }
+                done += pass;
+            }
+        }
+        if (!file_)
+        {
+            throw std::runtime_error("Read error");
+        }
+        remaining_frames_ -= static_cast<int64_t>(frames);
+        return frames;
+    }
+
+    WavFileWriter::WavFileWriter(const std::filesystem::path &path, int sample_rate, int channels)
+            : file_{path, std::ios::binary | std::ios::trunc},
+              data_bytes_{0}
+    {
+        // Sizes are left at 0 until close()
+        std::array<uint8_t, HEADER_BYTES> header{};
+        std::memcpy(header.data(), "RIFF", 4);
+        std::memcpy(header.data() + 8, "WAVEfmt ", 8);
+        writeU32(header.data() + 16, 16);
+        writeU16(header.data() + 20, FORMAT_PCM);
+        writeU16(header.data() + 22, static_cast<uint16_t>(channels));
+        writeU32(header.data() + 24, static_cast<uint32_t>(sample_rate));
+        writeU32(header.data() + 28, static_cast<uint32_t>(sample_rate * channels * sizeof(int16_t)));
+        writeU16(header.data() + 32, static_cast<uint16_t>(channels * sizeof(int16_t)));
+        writeU16(header.data() + 34, 16);
+        std::memcpy(header.data() + 36, "data", 4);
+        file_.write(reinterpret_cast<const char *>(header.data()), header.size());
+        if (!file_)
+        {
+            throw std::runtime_error("Cannot create " + path.string());
+        }
+    }
+
+    WavFileWriter::~WavFileWriter()
+    {
+        try
+        {
+            close();
+        }
+        catch (const std::runtime_error &)
+        {
+        }
+    }
+
+    void WavFileWriter::write(const int16_t *samples, size_t size)
+    {
+        file_.write(reinterpret_cast<const char *>(samples), static_cast<std::streamsize>(size * sizeof(int16_t)));
+        if (!file_)
+        {
+            throw std::runtime_error("Write error");
+        }
+        data_bytes_ += static_cast<int64_t>(size * sizeof(int16_t));
+    }
+
+    void WavFileWriter::close()
+    {
+        if (!file_.is_open())
+        {
+            return;
+        }
+        if (data_bytes_ > std::numeric_limits<uint32_t>::max() - static_cast<int64_t>(HEADER_BYTES))
+        {
+            file_.close();
+            throw std::runtime_error("Output exceeds the 4 GiB limit of WAV");
+        }
+        std::array<uint8_t, 4> size{};
+        writeU32(size.data(), static_cast<uint32_t>(data_bytes_ + HEADER_BYTES - 8));
+        file_.seekp(4);
+        file_.write(reinterpret_cast<const char *>(size.data()), size.size());
+        writeU32(size.data(), static_cast<uint32_t>(data_bytes_));
+        file_.seekp(40);
+        file_.write(reinterpret_cast<const char *>(size.data()), size.size());
+        file_.close();
+        if (!file_)
+        {
+            throw std::runtime_error("Write error");
+        }
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,83 @@
+#ifndef ULTRASOUNDWATERMARK_WAVFILESTREAM_HPP
+#define ULTRASOUNDWATERMARK_WAVFILESTREAM_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Reads the samples of a PCM16 WAV file in chunks, so that memory use does not depend on the length of the file.
+     * Multichannel files are read as their first channel. A data chunk whose size is unset or larger than the file
+     * (e.g. a recording that was not closed properly) is read up to the end of the file.
+     */
+    class WavFileReader
+    {
+    public:
+        /// @throw std::runtime_error if the file cannot be opened or is not PCM16 WAV
+        explicit WavFileReader(const std::filesystem::path &path);
+
+        [[nodiscard]] int getSampleRate() const
+        {
+            return sample_rate_;
+        }
+
+        [[nodiscard]] int getChannels() const
+        {
+            return channels_;
+        }
+
+        /// Frames in the file
+        [[nodiscard]] int64_t getFrames() const
+        {
+            return frames_;
+        }
+
+        /**
+         * Read the next frames of the first channel.
+         * @return Frames read, fewer than max_frames only at the end of the file, 0 after it
+         * @throw std::runtime_error on a read error
+         */
+        size_t read(int16_t *samples, size_t max_frames);
+
+    private:
+        std::ifstream file_;
+        int sample_rate_;
+        int channels_;
+        int64_t frames_;
+        int64_t remaining_frames_;
+        std::vector<int16_t> interleaved_;
+    };
+
+    /**
+     * Writes a PCM16 WAV file in chunks. The sizes in the header are filled in by close().
+     */
+    class WavFileWriter
+    {
+    public:
+        /// @throw std::runtime_error if the file cannot be created
+        WavFileWriter(const std::filesystem::path &path, int sample_rate, int channels);
+
+        WavFileWriter(const WavFileWriter &) = delete;
+
+        WavFileWriter &operator=(const WavFileWriter &) = delete;
+
+        /// Closes the file if close() was not called. Errors are ignored then
+        ~WavFileWriter();
+
+        /// Append interleaved samples. @throw std::runtime_error on a write error
+        void write(const int16_t *samples, size_t size);
+
+        /// Complete the header and close the file. @throw std::runtime_error on a write error or if the file is too long for WAV
+        void close();
+
+    private:
+        std::ofstream file_;
+        int64_t data_bytes_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_WAVFILESTREAM_HPP
@@ -0,0 +1,497 @@
+// Benchmark suite covering every stage of the watermark pipeline, with machine-readable results for tracking
+// regressions across releases. Each benchmark times every operation individually and reports the mean, p50, p90,
+// p99 and maximum, plus the heap allocations made while it ran (tracing/AllocationCounter.hpp):
+//   format_conversion/*      FormatConversionStream in both directions and the stream/ replacements, per window
+//   reblocking/*             FlexibleSizeStreamProducer and Int16ToFloatBlockStream turning KCP payloads into windows
+//   resampling/*             ResampleStream between the pipeline's rate and the common native rates, per window
+//   model/*                  WatermarkGenerator and WatermarkDetector per window (needs --resources)
+//   kcp/loopback             KcpFrameEncoder -> KcpClientStreamConsumer -> 127.0.0.1 -> KcpServerStreamProducer ->
+//                            KcpFrameDecoder, paced in real time, from consume() on the caller side to decoded samples
+//   oboe/*                   OboeStreamConsumerPlayer and OboeLoopPlayer callback bodies, driven synthetically with
+//                            the callback sizes the callee and the caller use
+//
+// Usage: ultrasound_watermark_bench [--resources <dir>] [--filter <substring>] [--out <results.json>] [--seconds <s>]
+//   resources contains generator_param, generator_bin, detector_param and detector_bin; model/* is skipped without it
+//   filter runs only the benchmarks whose name contains the substring
+//   out defaults to standard output; a summary table always goes to standard error
+//   seconds of audio per benchmark, 5 by default
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ase/stream/FlexibleSizeStreamProducer.hpp"
+#include "ase/stream/FormatConversionStream.hpp"
+#include "BenchmarkUtilities.hpp"
+#include "WatermarkCallee.hpp"
+#include "WatermarkCaller.hpp"
+#include "dsp/SampleConversion.hpp"
+#include "kcp/KcpFrameDecoder.hpp"
+#include "kcp/KcpFrameEncoder.hpp"
+#include "oboe/OboeLoopPlayer.hpp"
+#include "oboe/OboeStreamConsumerPlayer.hpp"
+#include "stream/FloatToInt16Stream.hpp"
+#include "stream/Int16ToFloatBlockStream.hpp"
+#include "stream/ResampleStream.hpp"
+#include "tracing/AllocationCounter.hpp"
+
+using namespace ase_android;
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    constexpr int SAMPLE_RATE = WatermarkDetector::INPUT_FS;
+    constexpr int WINDOW_STEP = WatermarkDetector::WINDOW_STEP;
+    /// Samples per KCP payload arriving at the callee, as in ultrasound_watermark_conversion_bench
+    constexpr int CHUNK_FRAMES = 240;
+    constexpr int WARM_UP_ITERATIONS = 8;
+
+    struct BenchmarkResult
+    {
+        std::string name;
+        std::string unit;
+        size_t iterations;
+        double mean;
+        double p50;
+        double p90;
+        double p99;
+        double max;
+        int64_t allocations;
+    };
+
+    /// Records when each CHUNK_FRAMES chunk of the stream has been received in full
+    class ArrivalSink : public ase::AudioDataStreamBase<int16_t>
+    {
+    public:
+        explicit ArrivalSink(size_t chunks) : ase::AudioDataStreamBase<int16_t>{SAMPLE_RATE, 1}, arrivals(chunks)
+        {
+        }
+
+        void consume(const int16_t *data, size_t size) override
+        {
+            const int64_t received = received_samples.load(std::memory_order_relaxed) + static_cast<int64_t>(size);
+            const auto now = clock_type::now();
+            for (; next_chunk_ < arrivals.size() && static_cast<int64_t>(next_chunk_ + 1) * CHUNK_FRAMES <= received; ++next_chunk_)
+            {
+                arrivals[next_chunk_] = now;
+            }
+            received_samples.store(received, std::memory_order_release);
+        }
+
+        std::vector<clock_type::time_point> arrivals;
+        std::atomic<int64_t> received_samples{0};
+
+    private:
+        size_t next_chunk_ = 0;
+    };
+
+    /// Exposes the callback body of OboeStreamConsumerPlayer, and the write consume() makes once the stream runs
+    class DrivenConsumerPlayer : public OboeStreamConsumerPlayer<int16_t>
+    {
+    public:
+        using OboeStreamConsumerPlayer<int16_t>::OboeStreamConsumerPlayer;
+        using OboeStreamConsumerPlayer<int16_t>::onAudioReady;
+
+        void write(const int16_t *samples, size_t size)
+        {
+            jitter_buffer_.write(samples, size);
+        }
+    };
+
+    BenchmarkResult summarize(const std::string &name, const std::string &unit, const std::vector<double> &values, int64_t allocations)
+    {
+        double sum = 0.0;
+        for (const double value: values)
+        {
+            sum += value;
+        }
+        return BenchmarkResult{
+                name,
+                unit,
+                values.size(),
+                values.empty() ? 0.0 : sum / static_cast<double>(values.size()),
+                values.empty() ? 0.0 : percentile(values, 0.5),
+                values.empty() ? 0.0 : percentile(values, 0.9),
+                values.empty() ? 0.0 : percentile(values, 0.99),
+                values.empty() ? 0.0 : *std::max_element(values.begin(), values.end()),
+                allocations
+        };
+    }
+
+    /**
+     * Time iterations calls of op(i) after a few untimed ones, each divided by per_op (e.g. samples per call) and
+     * scaled from nanoseconds by unit_ns
+     */
+    BenchmarkResult timeEach(const std::string &name, const std::string &unit, double unit_ns, size_t iterations, double per_op,
+                             const std::function<void(size_t)> &op)
+    {
+        for (size_t i = 0; i < WARM_UP_ITERATIONS; ++i)
+        {
+            op(i);
+        }
+        std::vector<double> values(iterations);
+        const AllocationCounter allocations;
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            const auto start = clock_type::now();
+            op(i);
+            values[i] = std::chrono::duration<double, std::nano>(clock_type::now() - start).count() / unit_ns / per_op;
+        }
+        return summarize(name, unit, values, allocations.count());
+    }
+
+    class Suite
+    {
+    public:
+        explicit Suite(std::string filter) : filter_{std::move(filter)}
+        {
+        }
+
+        /// Whether name, or a benchmark of the group it names, matches the filter
+        [[nodiscard]] bool selected(const std::string &name) const
+        {
+            return filter_.empty() || name.find(filter_) != std::string::npos || filter_.find(name) != std::string::npos;
+        }
+
+        void add(const BenchmarkResult &result)
+        {
+            std::fprintf(stderr, "%-48s %10.3f %10.3f %10.3f %10.3f %12s %8lld allocs\n", result.name.c_str(), result.mean,
+                         result.p50, result.p99, result.max, result.unit.c_str(), static_cast<long long>(result.allocations));
+            results_.push_back(result);
+        }
+
+        void writeJson(std::FILE *out) const
+        {
+            char date[32];
+            const std::time_t now = std::time(nullptr);
+            std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+            std::fprintf(out, "{\n  \"context\": {\n");
+            std::fprintf(out, "    \"date\": \"%s\",\n", date);
+            std::fprintf(out, "    \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+            std::fprintf(out, "    \"conversion_instruction_set\": \"%s\",\n", dsp::conversionInstructionSet());
+            std::fprintf(out, "    \"allocations_counted\": %s\n", AllocationCounter::isEnabled() ? "true" : "false");
+            std::fprintf(out, "  },\n  \"benchmarks\": [");
+            for (size_t i = 0; i < results_.size(); ++i)
+            {
+                const BenchmarkResult &result = results_[i];
+                std::fprintf(out, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"iterations\": %zu, \"mean\": %.6g, \"p50\": %.6g, "
+                                  "\"p90\": %.6g, \"p99\": %.6g, \"max\": %.6g, \"allocations\": %lld}",
+                             i == 0 ? "" : ",", result.name.c_str(), result.unit.c_str(), result.iterations, result.mean,
+                             result.p50, result.p90, result.p99, result.max, static_cast<long long>(result.allocations));
+            }
+            std::fprintf(out, "\n  ]\n}\n");
+        }
+
+    private:
+        const std::string filter_;
+        std::vector<BenchmarkResult> results_;
+    };
+
+    /// Quiet noise, so that the models and codecs do real work
+    std::vector<int16_t> makeNoise(size_t samples)
+    {
+        std::mt19937 rng{7};
+        std::normal_distribution<float> noise{0.0f, 1000.0f};
+        std::vector<int16_t> audio(samples);
+        std::generate(audio.begin(), audio.end(), [&] { return static_cast<int16_t>(std::clamp(noise(rng), -32768.0f, 32767.0f)); });
+        return audio;
+    }
+
+    void runConversion(Suite &suite, const std::vector<int16_t> &pcm, const std::vector<float> &samples)
+    {
+        const size_t windows = pcm.size() / WINDOW_STEP;
+        if (suite.selected("format_conversion/int16_to_float"))
+        {
+            auto converter = std::make_shared<ase::FormatConversionStream<int16_t, float>>(SAMPLE_RATE, 1);
+            converter->attachConsumer(std::make_shared<ChecksumSink<float>>(SAMPLE_RATE));
+            suite.add(timeEach("format_conversion/int16_to_float", "ns/sample", 1.0, windows, WINDOW_STEP, [&](size_t i) {
+                converter->consume(pcm.data() + (i % windows) * WINDOW_STEP, WINDOW_STEP);
+            }));
+        }
+        if (suite.selected("format_conversion/float_to_int16"))
+        {
+            auto converter = std::make_shared<ase::FormatConversionStream<float, int16_t>>(SAMPLE_RATE, 1);
+            converter->attachConsumer(std::make_shared<ChecksumSink<int16_t>>(SAMPLE_RATE));
+            suite.add(timeEach("format_conversion/float_to_int16", "ns/sample", 1.0, windows, WINDOW_STEP, [&](size_t i) {
+                converter->consume(samples.data() + (i % windows) * WINDOW_STEP, WINDOW_STEP);
+            }));
+        }
+        if (suite.selected("format_conversion/float_to_int16_stream"))
+        {
+            auto converter = std::make_shared<FloatToInt16Stream>(SAMPLE_RATE, 1, WINDOW_STEP);
+            converter->attachConsumer(std::make_shared<ChecksumSink<int16_t>>(SAMPLE_RATE));
+            suite.add(timeEach("format_conversion/float_to_int16_stream", "ns/sample", 1.0, windows, WINDOW_STEP, [&](size_t i) {
+                converter->consume(samples.data() + (i % windows) * WINDOW_STEP, WINDOW_STEP);
+            }));
+        }
+
+        const size_t chunks = pcm.size() / CHUNK_FRAMES;
+        if (suite.selected("reblocking/flexible_size_stream_producer"))
+        {
+            auto sizer = std::make_shared<ase::FlexibleSizeStreamProducer<int16_t>>(SAMPLE_RATE, 1, WINDOW_STEP, 16);
+            sizer->attachConsumer(std::make_shared<ChecksumSink<int16_t>>(SAMPLE_RATE));
+            suite.add(timeEach("reblocking/flexible_size_stream_producer", "ns/sample", 1.0, chunks, CHUNK_FRAMES, [&](size_t i) {
+                sizer->consume(pcm.data() + (i % chunks) * CHUNK_FRAMES, CHUNK_FRAMES);
+            }));
+        }
+        if (suite.selected("reblocking/flexible_size_to_float"))
+        {
+            // The chain Int16ToFloatBlockStream replaces
+            auto sizer = std::make_shared<ase::FlexibleSizeStreamProducer<int16_t>>(SAMPLE_RATE, 1, WINDOW_STEP, 16);
+            auto converter = std::make_shared<ase::FormatConversionStream<int16_t, float>>(SAMPLE_RATE, 1);
+            sizer->attachConsumer(converter);
+            converter->attachConsumer(std::make_shared<ChecksumSink<float>>(SAMPLE_RATE));
+            suite.add(timeEach("reblocking/flexible_size_to_float", "ns/sample", 1.0, chunks, CHUNK_FRAMES, [&](size_t i) {
+                sizer->consume(pcm.data() + (i % chunks) * CHUNK_FRAMES, CHUNK_FRAMES);
+            }));
+        }
+        if (suite.selected("reblocking/int16_to_float_block_stream"))
+        {
+            auto fused = std::make_shared<Int16ToFloatBlockStream>(SAMPLE_RATE, 1, WINDOW_STEP);
+            fused->attachConsumer(std::make_shared<ChecksumSink<float>>(SAMPLE_RATE));
+            suite.add(timeEach("reblocking/int16_to_float_block_stream", "ns/sample", 1.0, chunks, CHUNK_FRAMES, [&](size_t i) {
+                fused->consume(pcm.data() + (i % chunks) * CHUNK_FRAMES, CHUNK_FRAMES);
+            }));
+        }
+
+        // Per input sample; the noise stands in for audio at the other rate
+        for (const int native_rate: {44100, 96000})
+        {
+            for (const bool to_native: {false, true})
+            {
+                const std::string name = "resampling/" + std::to_string(to_native ? SAMPLE_RATE : native_rate) + "_to_" +
+                                         std::to_string(to_native ? native_rate : SAMPLE_RATE);
+                if (!suite.selected(name))
+                {
+                    continue;
+                }
+                auto resampler = std::make_shared<ResampleStream<int16_t>>(to_native ? SAMPLE_RATE : native_rate,
+                                                                           to_native ? native_rate : SAMPLE_RATE, 1, WINDOW_STEP);
+                resampler->attachConsumer(std::make_shared<ChecksumSink<int16_t>>(SAMPLE_RATE));
+                suite.add(timeEach(name, "ns/sample", 1.0, windows, WINDOW_STEP, [&](size_t i) {
+                    resampler->consume(pcm.data() + (i % windows) * WINDOW_STEP, WINDOW_STEP);
+                }));
+            }
+        }
+    }
+
+    void runModels(Suite &suite, const std::filesystem::path &resource_dir, const std::vector<float> &samples)
+    {
+        const size_t windows = samples.size() / WINDOW_STEP;
+        if (suite.selected("model/generator_window"))
+        {
+            auto generator = std::make_shared<WatermarkGenerator>(resource_dir / "generator_param", resource_dir / "generator_bin");
+            generator->attachConsumer(std::make_shared<ChecksumSink<float>>(SAMPLE_RATE));
+            suite.add(timeEach("model/generator_window", "us/window", 1e3, windows, 1.0, [&](size_t i) {
+                generator->consume(samples.data() + (i % windows) * WINDOW_STEP, WINDOW_STEP);
+            }));
+        }
+        if (suite.selected("model/detector_window"))
+        {
+            auto detector = std::make_shared<WatermarkDetector>(resource_dir / "detector_param", resource_dir / "detector_bin");
+            detector->setCallback([](float, float) {});
+            suite.add(timeEach("model/detector_window", "us/window", 1e3, windows, 1.0, [&](size_t i) {
+                detector->consume(samples.data() + (i % windows) * WINDOW_STEP, WINDOW_STEP);
+            }));
+        }
+    }
+
+    void runKcpLoopback(Suite &suite, const std::vector<int16_t> &pcm)
+    {
+        if (!suite.selected("kcp/loopback"))
+        {
+            return;
+        }
+        const size_t chunks = pcm.size() / CHUNK_FRAMES;
+        auto sink = std::make_shared<ArrivalSink>(chunks);
+        auto server = std::make_shared<KcpServerStreamProducer>(SAMPLE_RATE, KcpServerStreamProducer::L3_MTU / sizeof(int16_t) + 1, 32);
+        auto decoder = std::make_shared<KcpFrameDecoder>(SAMPLE_RATE, nullptr);
+        server->attachConsumer(decoder);
+        decoder->attachConsumer(sink);
+        auto client = std::make_shared<KcpClientStreamConsumer>(SAMPLE_RATE);
+        client->connect("127.0.0.1");
+        auto encoder = std::make_shared<KcpFrameEncoder>(SAMPLE_RATE, nullptr);
+        encoder->attachConsumer(client);
+
+        // Paced like the generator output, so that KCP runs within its window as it does in a call
+        std::vector<clock_type::time_point> sends(chunks);
+        const auto start = clock_type::now();
+        for (size_t i = 0; i < chunks; ++i)
+        {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<int64_t>(i) * 1000000 * CHUNK_FRAMES / SAMPLE_RATE));
+            sends[i] = clock_type::now();
+            encoder->consume(pcm.data() + i * CHUNK_FRAMES, CHUNK_FRAMES);
+        }
+        encoder->flushPending();
+        const auto deadline = clock_type::now() + std::chrono::seconds(3);
+        while (sink->received_samples.load(std::memory_order_acquire) < static_cast<int64_t>(chunks * CHUNK_FRAMES) && clock_type::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        encoder->detachAllConsumers();
+        client.reset();
+        server->detachAllConsumers();
+        server.reset();
+
+        const auto received_chunks = static_cast<size_t>(sink->received_samples.load(std::memory_order_acquire) / CHUNK_FRAMES);
+        std::vector<double> latencies_us;
+        for (size_t i = 0; i < std::min(chunks, received_chunks); ++i)
+        {
+            latencies_us.push_back(std::chrono::duration<double, std::micro>(sink->arrivals[i] - sends[i]).count());
+        }
+        suite.add(summarize("kcp/loopback", "us/chunk", latencies_us, 0));
+        const KcpReceiveStats stats = decoder->getStats();
+        if (received_chunks < chunks || stats.lost_samples > 0)
+        {
+            std::fprintf(stderr, "kcp/loopback: %zu of %zu chunks received, %lld samples lost\n", received_chunks, chunks,
+                         static_cast<long long>(stats.lost_samples));
+        }
+    }
+
+    void runPlayers(Suite &suite, const std::vector<int16_t> &pcm)
+    {
+        if (suite.selected("oboe/consumer_player"))
+        {
+            constexpr int callback_frames = WatermarkCallee::PLAYER_CALLBACK_SIZE;
+            DrivenConsumerPlayer player{0, SAMPLE_RATE, 1, oboe::PerformanceMode::LowLatency, callback_frames,
+                                        WatermarkCallee::PLAYER_CALLBACK_BUFFER_SIZE};
+            const size_t chunks = pcm.size() / CHUNK_FRAMES;
+            const size_t callbacks = pcm.size() / callback_frames;
+            std::vector<int16_t> out(callback_frames);
+            std::vector<double> write_ns;
+            std::vector<double> callback_ns;
+            write_ns.reserve(callbacks * callback_frames / CHUNK_FRAMES + 2 * callback_frames);
+            callback_ns.reserve(callbacks);
+            // Chunks arrive as the callbacks drain them, keeping about two callbacks buffered
+            size_t written_chunks = 0;
+            const AllocationCounter allocations;
+            for (size_t i = 0; i < callbacks; ++i)
+            {
+                while (written_chunks * CHUNK_FRAMES < (i + 2) * callback_frames)
+                {
+                    const auto start = clock_type::now();
+                    player.write(pcm.data() + (written_chunks % chunks) * CHUNK_FRAMES, CHUNK_FRAMES);
+                    write_ns.push_back(std::chrono::duration<double, std::nano>(clock_type::now() - start).count());
+                    ++written_chunks;
+                }
+                const auto start = clock_type::now();
+                player.onAudioReady(nullptr, out.data(), callback_frames);
+                callback_ns.push_back(std::chrono::duration<double, std::nano>(clock_type::now() - start).count());
+            }
+            const int64_t allocated = allocations.count();
+            suite.add(summarize("oboe/consumer_player_callback", "ns/callback", callback_ns, allocated));
+            suite.add(summarize("oboe/consumer_player_consume", "ns/chunk", write_ns, allocated));
+        }
+        if (suite.selected("oboe/loop_player"))
+        {
+            // Callback size and crossfade of WatermarkCaller's signal player
+            constexpr int callback_frames = WatermarkGenerator::INPUT_FS / 2;
+            constexpr int crossfade_frames = WatermarkGenerator::INPUT_FS / 100;
+            OboeLoopPlayer<int16_t> player{0, SAMPLE_RATE, 1, oboe::PerformanceMode::None, callback_frames};
+            player.setCrossfadeFrames(crossfade_frames);
+            const size_t signal_frames = std::min<size_t>(pcm.size(), SAMPLE_RATE);
+            const std::shared_ptr<const int16_t> signal{pcm.data(), [](const int16_t *) {}};
+            player.setBuffer(signal, signal_frames);
+            std::vector<int16_t> out(callback_frames);
+            const size_t callbacks = std::max<size_t>(pcm.size() / callback_frames, 64);
+            suite.add(timeEach("oboe/loop_player_callback", "ns/callback", 1.0, callbacks, 1.0, [&](size_t) {
+                player.onAudioReady(nullptr, out.data(), callback_frames);
+            }));
+
+            // A new signal on every callback, so that each one picks it up and starts a crossfade
+            std::vector<double> switch_ns;
+            switch_ns.reserve(callbacks);
+            for (size_t i = 0; i < callbacks; ++i)
+            {
+                player.setBuffer(signal, signal_frames);
+                const auto start = clock_type::now();
+                player.onAudioReady(nullptr, out.data(), callback_frames);
+                switch_ns.push_back(std::chrono::duration<double, std::nano>(clock_type::now() - start).count());
+            }
+            suite.add(summarize("oboe/loop_player_switch_callback", "ns/callback", switch_ns, 0));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::filesystem::path resource_dir;
+    std::string filter;
+    std::string out_path;
+    double seconds = 5.0;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--resources")
+        {
+            resource_dir = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "--filter")
+        {
+            filter = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "--out")
+        {
+            out_path = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "--seconds")
+        {
+            seconds = std::stod(argv[++i]);
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--resources <dir>] [--filter <substring>] [--out <results.json>] [--seconds <s>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    const auto total = static_cast<size_t>(seconds * SAMPLE_RATE) / WINDOW_STEP * WINDOW_STEP;
+    if (total == 0)
+    {
+        std::fprintf(stderr, "At least one window of audio is needed\n");
+        return EXIT_FAILURE;
+    }
+
+    const std::vector<int16_t> pcm = makeNoise(total);
+    std::vector<float> samples(total);
+    dsp::int16ToFloat(pcm.data(), samples.data(), total);
+
+    Suite suite{filter};
+    std::fprintf(stderr, "%-48s %10s %10s %10s %10s %12s\n", "benchmark", "mean", "p50", "p99", "max", "unit");
+    runConversion(suite, pcm, samples);
+    if (!resource_dir.empty())
+    {
+        runModels(suite, resource_dir, samples);
+    }
+    else
+    {
+        std::fprintf(stderr, "model/* skipped, no --resources given\n");
+    }
+    runPlayers(suite, pcm);
+    runKcpLoopback(suite, pcm);
+
+    std::FILE *out = out_path.empty() ? stdout : std::fopen(out_path.c_str(), "w");
+    if (out == nullptr)
+    {
+        std::fprintf(stderr, "Cannot write %s\n", out_path.c_str());
+        return EXIT_FAILURE;
+    }
+    suite.writeJson(out);
+    if (out != stdout)
+    {
+        std::fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+#ifndef ULTRASOUNDWATERMARK_BENCHMARKUTILITIES_HPP
+#define ULTRASOUNDWATERMARK_BENCHMARKUTILITIES_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <ase/stream/AudioDataStreamBase.hpp>
+#include "WatermarkResultRing.hpp"
+
+/// Helpers shared by the host benchmarks
+namespace ase_ultrasound_watermark::bench
+{
+    /// Nearest-rank percentile, p in [0, 1]. NAN if there are no values
+    inline double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty())
+        {
+            return NAN;
+        }
+        std::sort(values.begin(), values.end());
+        const auto index = static_cast<size_t>(p * static_cast<double>(values.size() - 1) + 0.5);
+        return values[std::min(index, values.size() - 1)];
+    }
+
+    /// VmRSS of this process in bytes, 0 if unknown
+    inline int64_t residentBytes()
+    {
+        std::ifstream status{"/proc/self/status"};
+        std::string key;
+        while (status >> key)
+        {
+            if (key == "VmRSS:")
+            {
+                int64_t kilobytes = 0;
+                status >> kilobytes;
+                return kilobytes * 1024;
+            }
+            status.ignore(4096, '\n');
+        }
+        return 0;
+    }
+
+    /// Fastest of repetitions runs of run(), in nanoseconds per unit of work (e.g. per sample or per block)
+    template<typename F>
+    double measure(size_t units, int repetitions, F &&run)
+    {
+        double best = INFINITY;
+        for (int i = 0; i < repetitions; ++i)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            run();
+            const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            best = std::min(best, elapsed / static_cast<double>(units));
+        }
+        return best;
+    }
+
+    /// Terminal consumer that samples a checksum so that the work cannot be optimized away, without adding a pass
+    template<typename T>
+    class ChecksumSink : public ase::AudioDataStreamBase<T>
+    {
+    public:
+        explicit ChecksumSink(int sample_rate) : ase::AudioDataStreamBase<T>{sample_rate, 1}
+        {
+        }
+
+        void consume(const T *data, size_t size) override
+        {
+            if (size > 0)
+            {
+                checksum += static_cast<double>(data[0]) + static_cast<double>(data[size - 1]);
+            }
+            samples += size;
+        }
+
+        double checksum = 0.0;
+        size_t samples = 0;
+    };
+
+    /// Terminal consumer that keeps everything it receives
+    template<typename T>
+    class CollectorSink : public ase::AudioDataStreamBase<T>
+    {
+    public:
+        explicit CollectorSink(int sample_rate) : ase::AudioDataStreamBase<T>{sample_rate, 1}
+        {
+        }
+
+        void consume(const T *data, size_t size) override
+        {
+            samples.insert(samples.end(), data, data + size);
+        }
+
+        std::vector<T> samples;
+    };
+
+    /// When the recorder had captured the input up to end_position_frames
+    struct CapturePoint
+    {
+        int64_t end_position_frames;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    /// When the detector had finished the window at window_index of its input stream
+    struct DetectionPoint
+    {
+        int64_t window_index;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    /// Append the results written to ring since next_index. Call from the results callback so the ring is never lapped
+    inline void readDetections(const WatermarkResultRing &ring, uint64_t &next_index, std::vector<DetectionPoint> &detections)
+    {
+        WatermarkResultRecord record{};
+        while (ring.read(next_index, &record, 1) == 1)
+        {
+            detections.push_back({record.window_index, std::chrono::steady_clock::time_point{std::chrono::nanoseconds{record.timestamp_ns}}});
+        }
+    }
+
+    /**
+     * Capture-to-detection latency of each detected window, in milliseconds, from the capture points in position order.
+     * Window k is complete once (k + 1) * window_step samples have been captured. The detector's window indices count
+     * the windows the callee skipped, but not frames the caller dropped, so those shift later windows
+     */
+    inline std::vector<double> windowLatenciesMs(const std::vector<CapturePoint> &captures, const std::vector<DetectionPoint> &detections,
+                                                 int window_step)
+    {
+        std::vector<double> latencies_ms;
+        latencies_ms.reserve(detections.size());
+        for (const DetectionPoint &detection: detections)
+        {
+            const int64_t window_end = (detection.window_index + 1) * window_step;
+            auto it = std::lower_bound(captures.begin(), captures.end(), window_end, [](const CapturePoint &point, int64_t position) {
+                return point.end_position_frames < position;
+            });
+            if (it != captures.end())
+            {
+                latencies_ms.push_back(std::chrono::duration<double, std::milli>(detection.time - it->time).count());
+            }
+        }
+        return latencies_ms;
+    }
+} // ase_ultrasound_watermark::bench
+
+#endif //ULTRASOUNDWATERMARK_BENCHMARKUTILITIES_HPP
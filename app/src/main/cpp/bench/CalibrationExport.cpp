@@ -0,0 +1,134 @@
+// Exports calibration data for INT8 quantization of the generator and detector from real recordings.
+// Each recording is cut into WatermarkGenerator::WINDOW_STEP windows, converted to float exactly as the pipeline does,
+// and the generator windows are written as they are. The same windows are passed through the float generator and its
+// output is written as the detector windows, since that is what the detector sees in a call.
+// Windows are float32 .npy files of shape [WINDOW_STEP], listed one path per line in <engine>_windows.txt, the input
+// list format of the model toolchain's calibration step. The tables it produces are then used to write
+// generator_int8_param/_bin and detector_int8_param/_bin next to the float models, which
+// ultrasound_watermark_quant_bench compares with them. The app only loads the float models.
+//
+// Usage: ultrasound_watermark_calibration_export <resource_dir> <out_dir> <max_windows> <recording.wav>...
+//   resource_dir contains generator_param and generator_bin
+//   recordings are mono PCM16 at WatermarkGenerator::INPUT_FS, e.g. calls recorded on the target devices
+//   max_windows per engine, taken evenly across all recordings
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ase/utilities/AudioBufferOperations.hpp>
+#include "BenchmarkUtilities.hpp"
+#include "WatermarkGenerator.hpp"
+#include "dsp/SampleConversion.hpp"
+
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+
+namespace
+{
+    constexpr size_t WINDOW = WatermarkGenerator::WINDOW_STEP;
+
+    /// Write samples as a little-endian float32 NumPy array of shape [size], format version 1.0
+    void writeNpy(const std::filesystem::path &path, const float *samples, size_t size)
+    {
+        std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (" + std::to_string(size) + ",), }";
+        // Magic, version and header length take 10 bytes; the header is padded so the data starts 64-byte aligned
+        const size_t total = (10 + header.size() + 1 + 63) / 64 * 64;
+        header.append(total - 10 - header.size() - 1, ' ');
+        header.push_back('\n');
+        std::ofstream file{path, std::ios::binary};
+        const auto header_size = static_cast<uint16_t>(header.size());
+        file.write("\x93NUMPY\x01\x00", 8);
+        file.put(static_cast<char>(header_size & 0xFF));
+        file.put(static_cast<char>(header_size >> 8));
+        file.write(header.data(), static_cast<std::streamsize>(header.size()));
+        file.write(reinterpret_cast<const char *>(samples), static_cast<std::streamsize>(size * sizeof(float)));
+        if (!file)
+        {
+            throw std::runtime_error("Cannot write " + path.string());
+        }
+    }
+
+    /// Write every stride-th window of audio, returning the list of files written
+    std::vector<std::filesystem::path> writeWindows(const std::filesystem::path &dir, const std::vector<float> &audio, size_t stride)
+    {
+        std::filesystem::create_directories(dir);
+        std::vector<std::filesystem::path> files;
+        for (size_t window = 0; (window + 1) * WINDOW <= audio.size(); window += stride)
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "window_%06zu.npy", window);
+            files.push_back(std::filesystem::absolute(dir / name));
+            writeNpy(files.back(), audio.data() + window * WINDOW, WINDOW);
+        }
+        return files;
+    }
+
+    void writeList(const std::filesystem::path &path, const std::vector<std::filesystem::path> &files)
+    {
+        std::ofstream list{path};
+        for (const auto &file: files)
+        {
+            list << file.string() << '\n';
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        std::fprintf(stderr, "Usage: %s <resource_dir> <out_dir> <max_windows> <recording.wav>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path resource_dir = argv[1];
+    const std::filesystem::path out_dir = argv[2];
+    const size_t max_windows = std::max(1, std::stoi(argv[3]));
+
+    // Recordings are concatenated on window boundaries, so no window spans two of them
+    std::vector<float> input;
+    for (int i = 4; i < argc; ++i)
+    {
+        int fs = 0;
+        int channels = 0;
+        size_t length = 0;
+        auto buffer = ase::readBufferFromWavFile<int16_t>(argv[i], fs, channels, length);
+        if (!buffer || channels != 1 || fs != WatermarkGenerator::INPUT_FS)
+        {
+            std::fprintf(stderr, "Skipping %s: must be mono and sampled at %d Hz\n", argv[i], WatermarkGenerator::INPUT_FS);
+            continue;
+        }
+        const size_t offset = input.size();
+        input.resize(offset + length / WINDOW * WINDOW);
+        dsp::int16ToFloat(buffer.get(), input.data() + offset, input.size() - offset);
+    }
+    const size_t windows = input.size() / WINDOW;
+    if (windows == 0)
+    {
+        std::fprintf(stderr, "No usable recordings\n");
+        return EXIT_FAILURE;
+    }
+
+    auto generator = std::make_shared<WatermarkGenerator>(resource_dir / "generator_param", resource_dir / "generator_bin");
+    auto watermarked = std::make_shared<CollectorSink<float>>(WatermarkGenerator::OUTPUT_FS);
+    generator->attachConsumer(watermarked);
+    for (size_t offset = 0; offset < input.size(); offset += WINDOW)
+    {
+        generator->consume(input.data() + offset, WINDOW);
+    }
+
+    const size_t stride = (windows + max_windows - 1) / max_windows;
+    const auto generator_files = writeWindows(out_dir / "generator", input, stride);
+    const auto detector_files = writeWindows(out_dir / "detector", watermarked->samples, stride);
+    writeList(out_dir / "generator_windows.txt", generator_files);
+    writeList(out_dir / "detector_windows.txt", detector_files);
+    std::printf("%zu windows in, %zu generator and %zu detector windows written to %s\n", windows,
+                generator_files.size(), detector_files.size(), out_dir.c_str());
+    return EXIT_SUCCESS;
+}
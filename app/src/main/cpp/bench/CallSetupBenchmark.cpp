@@ -0,0 +1,117 @@
+// Call setup benchmark of WatermarkCaller: starts and stops a number of calls, first from cold (streams, KCP client and
+// stream graph set up by every StartCall) and then from standby, and reports how long StartCall() took and how long
+// it took until the first watermarked frame was handed to KCP.
+// The recorder plays the input in a loop in real time, so time to first packet includes waiting for a whole window.
+//
+// Usage: ultrasound_watermark_call_setup_bench <resource_dir> <input.wav> [calls]
+//   resource_dir contains generator_param, generator_bin, detector_param, detector_bin and multitone.wav
+//   calls per mode defaults to 10
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchmarkUtilities.hpp"
+#include "HostAudioDevice.hpp"
+#include "WatermarkCaller.hpp"
+#include "WatermarkCallee.hpp"
+
+using namespace ase_android;
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    constexpr int32_t RECORD_DEVICE_ID = 1;
+    constexpr int32_t CALLER_PLAY_DEVICE_ID = 2;
+    constexpr int32_t CALLEE_PLAY_DEVICE_ID = 3;
+    constexpr auto FIRST_PACKET_TIMEOUT = std::chrono::seconds(2);
+    /// Audio sent per call after the first packet, so that calls are not all setup
+    constexpr auto CALL_DURATION = std::chrono::milliseconds(200);
+
+    struct Timings
+    {
+        std::vector<double> setup_ms;
+        std::vector<double> first_packet_ms;
+        int missed;
+    };
+
+    Timings runCalls(WatermarkCaller &caller, const std::filesystem::path &signal_path, int calls)
+    {
+        Timings timings{{}, {}, 0};
+        std::string host = "127.0.0.1";
+        for (int i = 0; i < calls; ++i)
+        {
+            caller.StartCall(host, CALLER_PLAY_DEVICE_ID, RECORD_DEVICE_ID, signal_path);
+            const clock_type::time_point deadline = clock_type::now() + FIRST_PACKET_TIMEOUT;
+            CallStartupStats stats = caller.GetCallStartupStats();
+            while (stats.first_packet_ns < 0 && clock_type::now() < deadline)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                stats = caller.GetCallStartupStats();
+            }
+            timings.setup_ms.push_back(static_cast<double>(stats.setup_ns) / 1e6);
+            if (stats.first_packet_ns < 0)
+            {
+                ++timings.missed;
+            }
+            else
+            {
+                timings.first_packet_ms.push_back(static_cast<double>(stats.first_packet_ns) / 1e6);
+            }
+            std::this_thread::sleep_for(CALL_DURATION);
+            caller.StopCall();
+        }
+        return timings;
+    }
+
+    void print(const char *mode, const Timings &timings)
+    {
+        std::printf("%-8s setup_ms        p50=%.3f p90=%.3f max=%.3f\n", mode,
+                    percentile(timings.setup_ms, 0.5), percentile(timings.setup_ms, 0.9), percentile(timings.setup_ms, 1.0));
+        std::printf("%-8s first_packet_ms p50=%.3f p90=%.3f max=%.3f missed=%d\n", mode,
+                    percentile(timings.first_packet_ms, 0.5), percentile(timings.first_packet_ms, 0.9),
+                    percentile(timings.first_packet_ms, 1.0), timings.missed);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::fprintf(stderr, "Usage: %s <resource_dir> <input.wav> [calls]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path resource_dir = argv[1];
+    const std::filesystem::path input_path = argv[2];
+    const int calls = argc > 3 ? std::max(1, std::stoi(argv[3])) : 10;
+    const std::filesystem::path signal_path = resource_dir / "multitone.wav";
+
+    auto &registry = HostAudioDeviceRegistry::instance();
+    registry.add(RECORD_DEVICE_ID, std::make_shared<WavFileInputDevice>(input_path, 1.0, true));
+    registry.add(CALLER_PLAY_DEVICE_ID, std::make_shared<NullAudioDevice>());
+    registry.add(CALLEE_PLAY_DEVICE_ID, std::make_shared<NullAudioDevice>());
+
+    WatermarkCallee callee{resource_dir / "detector_param", resource_dir / "detector_bin"};
+    callee.StartServer(CALLEE_PLAY_DEVICE_ID);
+    WatermarkCaller caller{resource_dir / "generator_param", resource_dir / "generator_bin"};
+    caller.PreloadSignal(signal_path);
+
+    const Timings cold = runCalls(caller, signal_path, calls);
+    std::string host = "127.0.0.1";
+    caller.EnterStandby(host, CALLER_PLAY_DEVICE_ID, RECORD_DEVICE_ID);
+    const Timings warm = runCalls(caller, signal_path, calls);
+    caller.ExitStandby();
+    callee.Stop();
+
+    std::printf("calls    %d per mode\n", calls);
+    print("cold", cold);
+    print("standby", warm);
+    registry.clear();
+    return cold.missed + warm.missed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
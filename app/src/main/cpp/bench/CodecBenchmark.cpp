@@ -0,0 +1,269 @@
+// Benchmark of the KCP payload codecs on the audio a caller actually sends:
+//   bitrate            bytes/s on the link including frame headers, and the ratio to raw PCM16
+//   speed              encode and decode ns per block of WatermarkGenerator::WINDOW_STEP samples
+//   watermark band     SNR of the coding error at each MULTI_TONE frequency (Goertzel), worst tone reported
+//   detection          mean detector probability on the decoded audio, and its change from raw
+//
+// Exits with failure if a codec fails to decode its own output, if a lossless codec does not reproduce the input
+// exactly, if the lossy error exceeds half the quantization step, or if the lossy mode moves the mean detector
+// probability by more than MAX_LOSSY_PROBABILITY_DELTA.
+//
+// Usage: ultrasound_watermark_codec_bench <input.wav> [resource_dir] [lossy_step]
+//   input.wav is mono PCM16 at WatermarkGenerator::INPUT_FS, e.g. a microphone recording with the multitone playing
+//   resource_dir contains generator_param, generator_bin, detector_param and detector_bin. With it, the input is
+//   watermarked first and the detector runs on each codec's output; without it, the codecs run on the input as is
+//   lossy_step is the quantization step of the lossy mode, KcpCodecConfig::DEFAULT_LOSSY_STEP by default
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <ase/utilities/AudioBufferOperations.hpp>
+#include "BenchmarkUtilities.hpp"
+#include "WatermarkCaller.hpp"
+#include "WatermarkDetector.hpp"
+#include "WatermarkGenerator.hpp"
+#include "kcp/KcpAudioCodec.hpp"
+#include "kcp/KcpFrame.hpp"
+#include "stream/FloatToInt16Stream.hpp"
+#include "stream/Int16ToFloatBlockStream.hpp"
+
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+
+namespace
+{
+    constexpr int SAMPLE_RATE = WatermarkGenerator::OUTPUT_FS;
+    constexpr size_t BLOCK_FRAMES = std::min<size_t>(WatermarkGenerator::WINDOW_STEP, KcpFrameHeader::MAX_PAYLOAD_WORDS);
+    constexpr int REPETITIONS = 5;
+    /// Largest change of the mean detector probability from raw that the lossy mode is allowed
+    constexpr double MAX_LOSSY_PROBABILITY_DELTA = 0.01;
+
+    struct CodecResult
+    {
+        std::string name;
+        double bytes_per_second;
+        double ratio;
+        double encode_ns_per_block;
+        double decode_ns_per_block;
+        int max_error;
+        double worst_tone_snr_db;
+        double mean_probability;
+        bool decode_failed;
+    };
+
+    /// Power of the DFT bin at frequency over samples, by the Goertzel recurrence
+    double goertzelPower(const float *samples, size_t size, double frequency)
+    {
+        const double coefficient = 2.0 * std::cos(2.0 * M_PI * frequency / SAMPLE_RATE);
+        double s1 = 0.0;
+        double s2 = 0.0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            const double s0 = samples[i] + coefficient * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        return s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+    }
+
+    /// Worst, over the watermark tones, of tone power in the reference against coding-error power at the same frequency
+    double worstToneSnrDb(const std::vector<int16_t> &reference, const std::vector<int16_t> &decoded)
+    {
+        std::vector<float> ref(BLOCK_FRAMES);
+        std::vector<float> err(BLOCK_FRAMES);
+        double worst = INFINITY;
+        for (const int tone: WatermarkCaller::MULTI_TONE)
+        {
+            double signal_power = 0.0;
+            double error_power = 0.0;
+            for (size_t offset = 0; offset + BLOCK_FRAMES <= reference.size(); offset += BLOCK_FRAMES)
+            {
+                for (size_t i = 0; i < BLOCK_FRAMES; ++i)
+                {
+                    ref[i] = reference[offset + i];
+                    err[i] = static_cast<float>(reference[offset + i] - decoded[offset + i]);
+                }
+                signal_power += goertzelPower(ref.data(), BLOCK_FRAMES, tone);
+                error_power += goertzelPower(err.data(), BLOCK_FRAMES, tone);
+            }
+            if (error_power > 0.0)
+            {
+                worst = std::min(worst, 10.0 * std::log10(signal_power / error_power));
+            }
+        }
+        return worst;
+    }
+
+    std::vector<int16_t> watermark(const std::filesystem::path &resource_dir, const std::vector<int16_t> &input)
+    {
+        auto converter_in = std::make_shared<Int16ToFloatBlockStream>(WatermarkGenerator::INPUT_FS, 1, WatermarkGenerator::WINDOW_STEP);
+        auto generator = std::make_shared<WatermarkGenerator>(resource_dir / "generator_param", resource_dir / "generator_bin");
+        auto converter_out = std::make_shared<FloatToInt16Stream>(WatermarkGenerator::OUTPUT_FS, 1, WatermarkGenerator::WINDOW_STEP);
+        auto sink = std::make_shared<CollectorSink<int16_t>>(SAMPLE_RATE);
+        converter_in->attachConsumer(generator);
+        generator->attachConsumer(converter_out);
+        converter_out->attachConsumer(sink);
+        converter_in->consume(input.data(), input.size());
+        return std::move(sink->samples);
+    }
+
+    /// Mean instantaneous probability over all windows, from a fresh detector
+    double detect(const std::filesystem::path &resource_dir, const std::vector<int16_t> &audio)
+    {
+        auto detector = std::make_shared<WatermarkDetector>(resource_dir / "detector_param", resource_dir / "detector_bin");
+        std::vector<float> probabilities;
+        detector->setCallback([&](float instantaneous, float) { probabilities.push_back(instantaneous); });
+        auto converter = std::make_shared<Int16ToFloatBlockStream>(WatermarkDetector::INPUT_FS, 1, WatermarkDetector::WINDOW_STEP);
+        converter->attachConsumer(detector);
+        converter->consume(audio.data(), audio.size());
+        if (probabilities.empty())
+        {
+            return NAN;
+        }
+        return std::accumulate(probabilities.begin(), probabilities.end(), 0.0) / static_cast<double>(probabilities.size());
+    }
+
+    CodecResult run(const std::string &name, const KcpCodecConfig &config, const std::vector<int16_t> &audio,
+                    const std::filesystem::path &resource_dir)
+    {
+        const size_t blocks = audio.size() / BLOCK_FRAMES;
+        const size_t total = blocks * BLOCK_FRAMES;
+        auto codec = KcpAudioCodec::create(config);
+        // Encoded blocks, each as [payload words, codec id] like KcpFrameEncoder, which sends raw when coding does not pay
+        std::vector<int16_t> encoded(total);
+        std::vector<size_t> encoded_words(blocks);
+        std::vector<bool> coded(blocks);
+        const double encode_ns = measure(blocks, REPETITIONS, [&] {
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                const int16_t *samples = audio.data() + b * BLOCK_FRAMES;
+                int16_t *words = encoded.data() + b * BLOCK_FRAMES;
+                const size_t size = codec ? codec->encode(samples, BLOCK_FRAMES, words, BLOCK_FRAMES - 1) : 0;
+                coded[b] = size > 0;
+                encoded_words[b] = coded[b] ? size : BLOCK_FRAMES;
+                if (!coded[b])
+                {
+                    std::copy(samples, samples + BLOCK_FRAMES, words);
+                }
+            }
+        });
+        std::vector<int16_t> decoded(total);
+        auto decoder = KcpAudioCodec::create(KcpCodecConfig{config.id, 1});
+        bool decode_failed = false;
+        const double decode_ns = measure(blocks, REPETITIONS, [&] {
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                const int16_t *words = encoded.data() + b * BLOCK_FRAMES;
+                int16_t *samples = decoded.data() + b * BLOCK_FRAMES;
+                if (coded[b])
+                {
+                    decode_failed |= !decoder->decode(words, encoded_words[b], samples, BLOCK_FRAMES);
+                }
+                else
+                {
+                    std::copy(words, words + BLOCK_FRAMES, samples);
+                }
+            }
+        });
+        const size_t link_words = std::accumulate(encoded_words.begin(), encoded_words.end(), size_t{0}) + blocks * KcpFrameHeader::HEADER_WORDS;
+        const double seconds = static_cast<double>(total) / SAMPLE_RATE;
+        const std::vector<int16_t> reference(audio.begin(), audio.begin() + static_cast<std::ptrdiff_t>(total));
+        int max_error = 0;
+        for (size_t i = 0; i < total; ++i)
+        {
+            max_error = std::max(max_error, std::abs(reference[i] - decoded[i]));
+        }
+        return CodecResult{
+                name,
+                static_cast<double>(link_words * sizeof(int16_t)) / seconds,
+                static_cast<double>(link_words) / static_cast<double>(total + blocks * KcpFrameHeader::HEADER_WORDS),
+                encode_ns,
+                decode_ns,
+                max_error,
+                worstToneSnrDb(reference, decoded),
+                resource_dir.empty() ? NAN : detect(resource_dir, decoded),
+                decode_failed
+        };
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <input.wav> [resource_dir] [lossy_step]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path input_path = argv[1];
+    const std::filesystem::path resource_dir = argc > 2 ? argv[2] : "";
+    const int lossy_step = argc > 3 ? std::stoi(argv[3]) : KcpCodecConfig::DEFAULT_LOSSY_STEP;
+
+    int fs = 0;
+    int channels = 0;
+    size_t length = 0;
+    auto buffer = ase::readBufferFromWavFile<int16_t>(input_path, fs, channels, length);
+    if (!buffer || length == 0 || channels != 1 || fs != WatermarkGenerator::INPUT_FS)
+    {
+        std::fprintf(stderr, "Input must be mono and sampled at %d Hz\n", WatermarkGenerator::INPUT_FS);
+        return EXIT_FAILURE;
+    }
+    std::vector<int16_t> audio(buffer.get(), buffer.get() + length);
+    if (!resource_dir.empty())
+    {
+        audio = watermark(resource_dir, audio);
+    }
+    if (audio.size() < BLOCK_FRAMES)
+    {
+        std::fprintf(stderr, "Input is shorter than one block of %zu frames\n", BLOCK_FRAMES);
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%.1f s of %s audio, blocks of %zu frames\n", static_cast<double>(audio.size()) / SAMPLE_RATE,
+                resource_dir.empty() ? "input" : "watermarked", BLOCK_FRAMES);
+    std::printf("%-16s %12s %7s %14s %14s %9s %17s %16s %9s\n", "codec", "bytes_per_s", "ratio", "encode_ns_blk",
+                "decode_ns_blk", "max_error", "worst_tone_snr_db", "mean_probability", "delta");
+    const std::vector<std::pair<std::string, KcpCodecConfig>> codecs{
+            {"raw",                                       KcpCodecConfig::raw()},
+            {"lossless",                                  KcpCodecConfig::lossless()},
+            {"lossy_step" + std::to_string(lossy_step), KcpCodecConfig::lossy(lossy_step)},
+    };
+    double raw_probability = NAN;
+    bool passed = true;
+    for (const auto &[name, config]: codecs)
+    {
+        const CodecResult result = run(name, config, audio, resource_dir);
+        if (config.id == KcpCodecId::Raw)
+        {
+            raw_probability = result.mean_probability;
+        }
+        std::printf("%-16s %12.0f %7.3f %14.0f %14.0f %9d %17.1f %16.4f %+9.4f\n", result.name.c_str(),
+                    result.bytes_per_second, result.ratio, result.encode_ns_per_block, result.decode_ns_per_block,
+                    result.max_error, result.worst_tone_snr_db, result.mean_probability, result.mean_probability - raw_probability);
+        if (result.decode_failed)
+        {
+            std::fprintf(stderr, "%s: decoding failed\n", name.c_str());
+            passed = false;
+        }
+        const int max_error = config.id == KcpCodecId::Raw ? 0 : config.quantization_step / 2;
+        if (result.max_error > max_error)
+        {
+            std::fprintf(stderr, "%s: error %d exceeds %d\n", name.c_str(), result.max_error, max_error);
+            passed = false;
+        }
+        // NaN without a resource_dir, which skips the check
+        if (config.quantization_step > 1 && std::abs(result.mean_probability - raw_probability) > MAX_LOSSY_PROBABILITY_DELTA)
+        {
+            std::fprintf(stderr, "%s: mean probability moved %+.4f from raw, more than %.4f\n", name.c_str(),
+                         result.mean_probability - raw_probability, MAX_LOSSY_PROBABILITY_DELTA);
+            passed = false;
+        }
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
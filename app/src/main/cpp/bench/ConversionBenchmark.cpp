@@ -0,0 +1,172 @@
+// Microbenchmark of the PCM16 <-> float stages around the models:
+//   detector/generator input:  FlexibleSizeStreamProducer<int16_t> -> FormatConversionStream<int16_t, float>
+//                              vs. the fused Int16ToFloatBlockStream
+//   generator output:          FormatConversionStream<float, int16_t> vs. FloatToInt16Stream
+//   kernels alone:             scalar vs. the compiled SIMD path
+// Before timing, the fused stages are run once next to the DSP core's chain and every output sample is compared, so
+// that the kernels' full scale (1 / 32768, see dsp/SampleConversion.hpp) and rounding are checked against the core's.
+// Exits with failure on any mismatch, and if the PCM16 round trip through the SIMD kernels is not exact.
+//
+// Usage: ultrasound_watermark_conversion_bench [seconds_of_audio] [chunk_frames]
+//   seconds_of_audio defaults to 60, chunk_frames (size of each incoming block, e.g. one KCP payload) to 240
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ase/stream/FlexibleSizeStreamProducer.hpp"
+#include "ase/stream/FormatConversionStream.hpp"
+#include "BenchmarkUtilities.hpp"
+#include "WatermarkDetector.hpp"
+#include "dsp/SampleConversion.hpp"
+#include "stream/FloatToInt16Stream.hpp"
+#include "stream/Int16ToFloatBlockStream.hpp"
+
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+
+namespace
+{
+    constexpr int SAMPLE_RATE = WatermarkDetector::INPUT_FS;
+    constexpr int WINDOW_STEP = WatermarkDetector::WINDOW_STEP;
+    constexpr int REPETITIONS = 5;
+
+    /// Whether the outputs are identical. Prints the first difference if not
+    template<typename T>
+    bool sameOutput(const char *name, const std::vector<T> &expected, const std::vector<T> &actual)
+    {
+        if (expected.size() != actual.size())
+        {
+            std::fprintf(stderr, "%s: %zu samples from the core's chain, %zu from the fused stage\n", name, expected.size(), actual.size());
+            return false;
+        }
+        const auto [expected_it, actual_it] = std::mismatch(expected.begin(), expected.end(), actual.begin());
+        if (expected_it != expected.end())
+        {
+            std::fprintf(stderr, "%s: sample %td is %.9g from the core's chain, %.9g from the fused stage\n", name,
+                         expected_it - expected.begin(), static_cast<double>(*expected_it), static_cast<double>(*actual_it));
+            return false;
+        }
+        return true;
+    }
+
+    void report(const char *name, const char *baseline, double baseline_ns, const char *candidate, double candidate_ns)
+    {
+        std::printf("%-22s %-6s %7.3f ns/sample   %-6s %7.3f ns/sample   speedup %.2fx\n",
+                    name, baseline, baseline_ns, candidate, candidate_ns, baseline_ns / candidate_ns);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const double seconds = argc > 1 ? std::stod(argv[1]) : 60.0;
+    const size_t chunk_frames = argc > 2 ? std::stoul(argv[2]) : 240;
+    const auto total = static_cast<size_t>(seconds * SAMPLE_RATE) / WINDOW_STEP * WINDOW_STEP;
+    if (total == 0 || chunk_frames == 0)
+    {
+        std::fprintf(stderr, "Usage: %s [seconds_of_audio] [chunk_frames]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> pcm{-32768, 32767};
+    std::vector<int16_t> pcm_in(total);
+    std::generate(pcm_in.begin(), pcm_in.end(), [&] { return static_cast<int16_t>(pcm(rng)); });
+    std::vector<float> float_in(total);
+    dsp::int16ToFloatScalar(pcm_in.data(), float_in.data(), total);
+
+    auto feed = [&](ase::AudioDataStreamBase<int16_t> &stream) {
+        for (size_t offset = 0; offset < total; offset += chunk_frames)
+        {
+            stream.consume(pcm_in.data() + offset, std::min(chunk_frames, total - offset));
+        }
+    };
+    auto feed_windows = [&](ase::AudioDataStreamBase<float> &stream) {
+        for (size_t offset = 0; offset < total; offset += WINDOW_STEP)
+        {
+            stream.consume(float_in.data() + offset, WINDOW_STEP);
+        }
+    };
+
+    std::printf("instruction_set %s, %zu samples, input chunks of %zu frames, windows of %d frames\n",
+                dsp::conversionInstructionSet(), total, chunk_frames, WINDOW_STEP);
+
+    // Every sample of the fused stages against the core's chain
+    bool matches = true;
+    {
+        auto sizer = std::make_shared<ase::FlexibleSizeStreamProducer<int16_t>>(SAMPLE_RATE, 1, WINDOW_STEP, 16);
+        auto converter = std::make_shared<ase::FormatConversionStream<int16_t, float>>(SAMPLE_RATE, 1);
+        auto chain_sink = std::make_shared<CollectorSink<float>>(SAMPLE_RATE);
+        sizer->attachConsumer(converter);
+        converter->attachConsumer(chain_sink);
+        auto fused = std::make_shared<Int16ToFloatBlockStream>(SAMPLE_RATE, 1, WINDOW_STEP);
+        auto fused_sink = std::make_shared<CollectorSink<float>>(SAMPLE_RATE);
+        fused->attachConsumer(fused_sink);
+        feed(*sizer);
+        feed(*fused);
+        matches &= sameOutput("int16->float", chain_sink->samples, fused_sink->samples);
+
+        auto out_converter = std::make_shared<ase::FormatConversionStream<float, int16_t>>(SAMPLE_RATE, 1);
+        auto out_chain_sink = std::make_shared<CollectorSink<int16_t>>(SAMPLE_RATE);
+        out_converter->attachConsumer(out_chain_sink);
+        auto out_fused = std::make_shared<FloatToInt16Stream>(SAMPLE_RATE, 1, WINDOW_STEP);
+        auto out_fused_sink = std::make_shared<CollectorSink<int16_t>>(SAMPLE_RATE);
+        out_fused->attachConsumer(out_fused_sink);
+        // Generator output is not on the PCM16 grid, so that rounding is compared too
+        std::uniform_real_distribution<float> model_output{-1.0f, 1.0f};
+        std::vector<float> generated(total);
+        std::generate(generated.begin(), generated.end(), [&] { return model_output(rng); });
+        for (size_t offset = 0; offset < total; offset += WINDOW_STEP)
+        {
+            out_converter->consume(generated.data() + offset, WINDOW_STEP);
+            out_fused->consume(generated.data() + offset, WINDOW_STEP);
+        }
+        matches &= sameOutput("float->int16", out_chain_sink->samples, out_fused_sink->samples);
+    }
+
+    // Input side: reblock to windows and convert to float
+    auto sizer = std::make_shared<ase::FlexibleSizeStreamProducer<int16_t>>(SAMPLE_RATE, 1, WINDOW_STEP, 16);
+    auto converter = std::make_shared<ase::FormatConversionStream<int16_t, float>>(SAMPLE_RATE, 1);
+    auto chain_sink = std::make_shared<ChecksumSink<float>>(SAMPLE_RATE);
+    sizer->attachConsumer(converter);
+    converter->attachConsumer(chain_sink);
+    auto fused = std::make_shared<Int16ToFloatBlockStream>(SAMPLE_RATE, 1, WINDOW_STEP);
+    auto fused_sink = std::make_shared<ChecksumSink<float>>(SAMPLE_RATE);
+    fused->attachConsumer(fused_sink);
+    const double chain_in_ns = measure(total, REPETITIONS, [&] { feed(*sizer); });
+    const double fused_in_ns = measure(total, REPETITIONS, [&] { feed(*fused); });
+    report("int16->float windows", "chain", chain_in_ns, "fused", fused_in_ns);
+
+    // Output side: convert generator windows back to PCM16
+    auto out_converter = std::make_shared<ase::FormatConversionStream<float, int16_t>>(SAMPLE_RATE, 1);
+    auto out_chain_sink = std::make_shared<ChecksumSink<int16_t>>(SAMPLE_RATE);
+    out_converter->attachConsumer(out_chain_sink);
+    auto out_fused = std::make_shared<FloatToInt16Stream>(SAMPLE_RATE, 1, WINDOW_STEP);
+    auto out_fused_sink = std::make_shared<ChecksumSink<int16_t>>(SAMPLE_RATE);
+    out_fused->attachConsumer(out_fused_sink);
+    const double chain_out_ns = measure(total, REPETITIONS, [&] { feed_windows(*out_converter); });
+    const double fused_out_ns = measure(total, REPETITIONS, [&] { feed_windows(*out_fused); });
+    report("float->int16 windows", "chain", chain_out_ns, "fused", fused_out_ns);
+
+    // Kernels alone
+    std::vector<float> float_out(total);
+    std::vector<int16_t> pcm_out(total);
+    const double scalar_in_ns = measure(total, REPETITIONS, [&] { dsp::int16ToFloatScalar(pcm_in.data(), float_out.data(), total); });
+    const double simd_in_ns = measure(total, REPETITIONS, [&] { dsp::int16ToFloat(pcm_in.data(), float_out.data(), total); });
+    report("int16->float kernel", "scalar", scalar_in_ns, "simd", simd_in_ns);
+    const double scalar_out_ns = measure(total, REPETITIONS, [&] { dsp::floatToInt16Scalar(float_in.data(), pcm_out.data(), total); });
+    const double simd_out_ns = measure(total, REPETITIONS, [&] { dsp::floatToInt16(float_in.data(), pcm_out.data(), total); });
+    report("float->int16 kernel", "scalar", scalar_out_ns, "simd", simd_out_ns);
+
+    // The round trip through the SIMD kernels must be exact
+    if (!std::equal(pcm_in.begin(), pcm_in.end(), pcm_out.begin()))
+    {
+        std::fprintf(stderr, "PCM16 round trip is not lossless\n");
+        return EXIT_FAILURE;
+    }
+    return matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,223 @@
+// Benchmark of the caller's two ways of playing the pilot signal, driving the player callbacks synthetically:
+//   looped        OboeLoopPlayer looping a recording of the signal, as StartCall() with a signal file
+//   synthesized   OboeTonePlayer synthesizing WatermarkCaller::DefaultPilotTones(), as StartCall() with pilot tones
+// For each it reports the resident memory added by creating the player and giving it the signal, and the wall time
+// per callback, p50/p99, at the caller's callback size and at a low-latency one, plus the callbacks that pick up a
+// new signal (a crossfade for the loop player, a tone change for the tone player).
+//
+// Usage: ultrasound_watermark_pilot_bench [--signal <multitone.wav>] [--variant <looped|synthesized>]
+//   signal is the recording looped by the looped variant, mono PCM16 at WatermarkGenerator::INPUT_FS, normally
+//   res/raw/multitone.wav. Without it, the default pilot tones are rendered in memory for as long as that recording
+//   (12 s, 1.1 MB) instead
+//   variant runs only that one. Memory freed by one variant may be reused by the next, so run each in its own process
+//   for exact resident memory figures
+//
+// The looped variant's resident memory is mostly the signal buffer, whose size is printed with it; the rest is the
+// player and page granularity.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <numbers>
+#include <string>
+#include <vector>
+
+#include "BenchmarkUtilities.hpp"
+#include "WatermarkCaller.hpp"
+#include "batch/WavFileStream.hpp"
+#include "oboe/OboeLoopPlayer.hpp"
+#include "oboe/OboeTonePlayer.hpp"
+
+using namespace ase_android;
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    constexpr int SAMPLE_RATE = WatermarkGenerator::INPUT_FS;
+    /// WatermarkCaller's signal player callback and crossfade
+    constexpr int CALLER_CALLBACK_FRAMES = SAMPLE_RATE / 2;
+    constexpr int CROSSFADE_FRAMES = SAMPLE_RATE / 100;
+    /// A typical low-latency burst, for players that would share a callback with other audio
+    constexpr int LOW_LATENCY_CALLBACK_FRAMES = 192;
+    /// Length of res/raw/multitone.wav
+    constexpr int DEFAULT_LOOP_SECONDS = 12;
+    /// Audio played per measurement
+    constexpr int MEASURED_SECONDS = 120;
+
+    struct VariantResult
+    {
+        double resident_mb;
+        /// Of resident_mb, the signal kept in memory
+        double signal_mb;
+        double caller_p50_us;
+        double caller_p99_us;
+        double low_latency_p50_ns;
+        double low_latency_p99_ns;
+        double switch_p50_us;
+        double switch_p99_us;
+    };
+
+    /// Nanoseconds per callback of callback_frames, for MEASURED_SECONDS of audio. before_each runs untimed
+    std::vector<double> timeCallbacks(OboePlayerBase<int16_t> &player, int callback_frames,
+                                      const std::function<void(size_t)> &before_each = {})
+    {
+        std::vector<int16_t> out(callback_frames);
+        const size_t callbacks = static_cast<size_t>(MEASURED_SECONDS) * SAMPLE_RATE / callback_frames;
+        std::vector<double> ns;
+        ns.reserve(callbacks);
+        for (size_t i = 0; i < callbacks; ++i)
+        {
+            if (before_each)
+            {
+                before_each(i);
+            }
+            const auto start = clock_type::now();
+            player.onAudioReady(nullptr, out.data(), callback_frames);
+            ns.push_back(std::chrono::duration<double, std::nano>(clock_type::now() - start).count());
+        }
+        return ns;
+    }
+
+    /// The default pilot tones rendered with std::sin, standing in for the recording
+    void renderTones(int16_t *samples, size_t frames)
+    {
+        const std::vector<dsp::Tone> tones = WatermarkCaller::DefaultPilotTones();
+        for (size_t i = 0; i < frames; ++i)
+        {
+            double value = 0.0;
+            for (const dsp::Tone &tone: tones)
+            {
+                value += tone.amplitude * std::sin(2.0 * std::numbers::pi * tone.frequency_hz * static_cast<double>(i) / SAMPLE_RATE);
+            }
+            samples[i] = static_cast<int16_t>(std::lround(std::clamp(value * 32768.0, -32768.0, 32767.0)));
+        }
+    }
+
+    VariantResult runLooped(const std::filesystem::path &signal_path)
+    {
+        const int64_t resident_before = residentBytes();
+        auto player = std::make_unique<OboeLoopPlayer<int16_t>>(0, SAMPLE_RATE, 1, oboe::PerformanceMode::None, CALLER_CALLBACK_FRAMES);
+        player->setCrossfadeFrames(CROSSFADE_FRAMES);
+        size_t frames = 0;
+        std::shared_ptr<int16_t> signal;
+        if (signal_path.empty())
+        {
+            frames = static_cast<size_t>(DEFAULT_LOOP_SECONDS) * SAMPLE_RATE;
+            signal = std::shared_ptr<int16_t>(new int16_t[frames], std::default_delete<int16_t[]>());
+            renderTones(signal.get(), frames);
+        }
+        else
+        {
+            WavFileReader reader{signal_path};
+            frames = static_cast<size_t>(reader.getFrames());
+            signal = std::shared_ptr<int16_t>(new int16_t[frames], std::default_delete<int16_t[]>());
+            reader.read(signal.get(), frames);
+        }
+        player->setBuffer(std::shared_ptr<const int16_t>(signal), frames);
+        std::vector<int16_t> out(CALLER_CALLBACK_FRAMES);
+        player->onAudioReady(nullptr, out.data(), CALLER_CALLBACK_FRAMES);
+        const int64_t resident_after = residentBytes();
+
+        const std::vector<double> caller_ns = timeCallbacks(*player, CALLER_CALLBACK_FRAMES);
+        const std::vector<double> low_latency_ns = timeCallbacks(*player, LOW_LATENCY_CALLBACK_FRAMES);
+        // The same buffer published again, so that every callback starts a crossfade
+        const std::vector<double> switch_ns = timeCallbacks(*player, CALLER_CALLBACK_FRAMES, [&](size_t) {
+            player->setBuffer(std::shared_ptr<const int16_t>(signal), frames);
+        });
+        return VariantResult{static_cast<double>(resident_after - resident_before) / (1024.0 * 1024.0),
+                             static_cast<double>(frames * sizeof(int16_t)) / (1024.0 * 1024.0),
+                             percentile(caller_ns, 0.5) / 1e3, percentile(caller_ns, 0.99) / 1e3,
+                             percentile(low_latency_ns, 0.5), percentile(low_latency_ns, 0.99),
+                             percentile(switch_ns, 0.5) / 1e3, percentile(switch_ns, 0.99) / 1e3};
+    }
+
+    VariantResult runSynthesized()
+    {
+        const int64_t resident_before = residentBytes();
+        auto player = std::make_unique<OboeTonePlayer<int16_t>>(0, SAMPLE_RATE, 1, oboe::PerformanceMode::None,
+                                                                CALLER_CALLBACK_FRAMES, CROSSFADE_FRAMES);
+        const std::vector<dsp::Tone> tones = WatermarkCaller::DefaultPilotTones();
+        player->setTones(tones);
+        std::vector<int16_t> out(CALLER_CALLBACK_FRAMES);
+        player->onAudioReady(nullptr, out.data(), CALLER_CALLBACK_FRAMES);
+        const int64_t resident_after = residentBytes();
+
+        const std::vector<double> caller_ns = timeCallbacks(*player, CALLER_CALLBACK_FRAMES);
+        const std::vector<double> low_latency_ns = timeCallbacks(*player, LOW_LATENCY_CALLBACK_FRAMES);
+        // Alternate between the full set and one without its first tone, so that every callback fades a tone
+        const std::vector<dsp::Tone> fewer_tones(tones.begin() + 1, tones.end());
+        const std::vector<double> switch_ns = timeCallbacks(*player, CALLER_CALLBACK_FRAMES, [&](size_t i) {
+            player->setTones(i % 2 == 0 ? fewer_tones : tones);
+        });
+        return VariantResult{static_cast<double>(resident_after - resident_before) / (1024.0 * 1024.0), 0.0,
+                             percentile(caller_ns, 0.5) / 1e3, percentile(caller_ns, 0.99) / 1e3,
+                             percentile(low_latency_ns, 0.5), percentile(low_latency_ns, 0.99),
+                             percentile(switch_ns, 0.5) / 1e3, percentile(switch_ns, 0.99) / 1e3};
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::filesystem::path signal_path;
+    std::string only_variant;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--signal")
+        {
+            signal_path = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "--variant")
+        {
+            only_variant = argv[++i];
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--signal <multitone.wav>] [--variant <looped|synthesized>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!signal_path.empty())
+    {
+        try
+        {
+            const WavFileReader reader{signal_path};
+            if (reader.getSampleRate() != SAMPLE_RATE || reader.getChannels() != 1 || reader.getFrames() == 0)
+            {
+                std::fprintf(stderr, "Signal must be mono, sampled at %d Hz and not empty\n", SAMPLE_RATE);
+                return EXIT_FAILURE;
+            }
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::printf("%s kernels, callbacks of %d and %d frames\n", dsp::conversionInstructionSet(), CALLER_CALLBACK_FRAMES,
+                LOW_LATENCY_CALLBACK_FRAMES);
+    std::printf("%-12s %12s %10s %13s %13s %13s %13s %13s %13s\n", "variant", "resident_mb", "signal_mb", "caller_p50",
+                "caller_p99", "low_lat_p50", "low_lat_p99", "switch_p50", "switch_p99");
+    for (const std::string variant: {"synthesized", "looped"})
+    {
+        if (!only_variant.empty() && only_variant != variant)
+        {
+            continue;
+        }
+        const VariantResult result = variant == "looped" ? runLooped(signal_path) : runSynthesized();
+        std::printf("%-12s %12.2f %10.2f %10.1f us %10.1f us %10.0f ns %10.0f ns %10.1f us %10.1f us\n", variant.c_str(),
+                    result.resident_mb, result.signal_mb, result.caller_p50_us, result.caller_p99_us, result.low_latency_p50_ns,
+                    result.low_latency_p99_ns, result.switch_p50_us, result.switch_p99_us);
+    }
+    std::printf("real time budget per callback: %.0f us and %.0f us\n", 1e6 * CALLER_CALLBACK_FRAMES / SAMPLE_RATE,
+                1e6 * LOW_LATENCY_CALLBACK_FRAMES / SAMPLE_RATE);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+// End-to-end host benchmark of the caller/callee pipeline:
+// WAV recorder -> WatermarkGenerator -> KCP over 127.0.0.1 -> WatermarkDetector.
+// The recorder is driven as fast as possible (or at the given speed factor) by the host audio backend.
+//
+// Usage: ultrasound_watermark_pipeline_bench <resource_dir> <input.wav> [speed]
+//   resource_dir contains generator_param, generator_bin, detector_param, detector_bin and multitone.wav
+//   speed is relative to real time, 0 (default) runs as fast as possible
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchmarkUtilities.hpp"
+#include "HostAudioDevice.hpp"
+#include "WatermarkCaller.hpp"
+#include "WatermarkCallee.hpp"
+
+using namespace ase_android;
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    constexpr int32_t RECORD_DEVICE_ID = 1;
+    constexpr int32_t CALLER_PLAY_DEVICE_ID = 2;
+    constexpr int32_t CALLEE_PLAY_DEVICE_ID = 3;
+    constexpr auto IDLE_TIMEOUT = std::chrono::seconds(3);
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::fprintf(stderr, "Usage: %s <resource_dir> <input.wav> [speed]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path resource_dir = argv[1];
+    const std::filesystem::path input_path = argv[2];
+    const double speed = argc > 3 ? std::stod(argv[3]) : 0.0;
+
+    std::mutex log_mutex;
+    std::vector<CapturePoint> captures;
+    std::vector<DetectionPoint> detections;
+    uint64_t next_detection = 0;
+    clock_type::time_point last_activity = clock_type::now();
+
+    auto &registry = HostAudioDeviceRegistry::instance();
+    auto recorder_device = std::make_shared<WavFileInputDevice>(input_path, speed, false);
+    if (recorder_device->getFileSampleRate() != WatermarkGenerator::INPUT_FS)
+    {
+        std::fprintf(stderr, "Input must be sampled at %d Hz\n", WatermarkGenerator::INPUT_FS);
+        return EXIT_FAILURE;
+    }
+    recorder_device->setTransferObserver([&](int64_t position_frames, int32_t num_frames) {
+        std::lock_guard lock{log_mutex};
+        captures.push_back({position_frames + num_frames, clock_type::now()});
+    });
+    registry.add(RECORD_DEVICE_ID, recorder_device);
+    registry.add(CALLER_PLAY_DEVICE_ID, std::make_shared<NullAudioDevice>());
+    registry.add(CALLEE_PLAY_DEVICE_ID, std::make_shared<NullAudioDevice>());
+
+    // Free-running capture outpaces inference by design, so queue without loss instead of dropping
+    WatermarkCallee callee{resource_dir / "detector_param", resource_dir / "detector_bin",
+                           speed > 0 ? OverflowPolicy::LatestWins : OverflowPolicy::Block};
+    WatermarkCaller caller{resource_dir / "generator_param", resource_dir / "generator_bin",
+                           speed > 0 ? OverflowPolicy::DropOldest : OverflowPolicy::Block};
+    callee.SetOnWatermarkResultsCallback([&](float, float) {
+        std::lock_guard lock{log_mutex};
+        readDetections(callee.GetResultRing(), next_detection, detections);
+        last_activity = clock_type::now();
+    });
+
+    callee.StartServer(CALLEE_PLAY_DEVICE_ID);
+    std::string host = "127.0.0.1";
+    caller.StartCall(host, CALLER_PLAY_DEVICE_ID, RECORD_DEVICE_ID, resource_dir / "multitone.wav");
+
+    // Run until the input is exhausted and the detector has gone quiet
+    while (true)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::lock_guard lock{log_mutex};
+        if (!captures.empty())
+        {
+            last_activity = std::max(last_activity, captures.back().time);
+        }
+        if (recorder_device->isExhausted() && clock_type::now() - last_activity > IDLE_TIMEOUT)
+        {
+            break;
+        }
+    }
+    const KcpSendStats send_stats = caller.GetKcpSendStats();
+    const KcpReceiveStats receive_stats = callee.GetKcpReceiveStats();
+    caller.StopCall();
+    callee.Stop();
+
+    std::lock_guard lock{log_mutex};
+    if (captures.empty() || detections.empty())
+    {
+        std::fprintf(stderr, "No detection results received\n");
+        return EXIT_FAILURE;
+    }
+
+    const std::vector<double> latencies_ms = windowLatenciesMs(captures, detections, WatermarkDetector::WINDOW_STEP);
+
+    const int64_t total_frames = captures.back().end_position_frames;
+    const double elapsed_s = std::chrono::duration<double>(detections.back().time - captures.front().time).count();
+    const double samples_per_second = static_cast<double>(total_frames) / elapsed_s;
+    std::printf("input_frames        %lld\n", static_cast<long long>(total_frames));
+    std::printf("windows             %zu\n", detections.size());
+    std::printf("elapsed_s           %.3f\n", elapsed_s);
+    std::printf("samples_per_second  %.1f\n", samples_per_second);
+    std::printf("realtime_factor     %.2f\n", samples_per_second / WatermarkGenerator::INPUT_FS);
+    std::printf("window_latency_ms   p50=%.2f p90=%.2f p99=%.2f max=%.2f\n",
+                percentile(latencies_ms, 0.5), percentile(latencies_ms, 0.9), percentile(latencies_ms, 0.99),
+                latencies_ms.empty() ? 0.0 : *std::max_element(latencies_ms.begin(), latencies_ms.end()));
+    const AsyncStageStats queue_stats = caller.GetGeneratorQueueStats();
+    const AsyncStageStats detector_queue_stats = callee.GetDetectorQueueStats();
+    std::printf("generator_queue     max_depth=%d dropped=%lld overflows=%lld\n", queue_stats.max_depth_frames,
+                static_cast<long long>(queue_stats.dropped_frames), static_cast<long long>(queue_stats.overflows));
+    std::printf("detector_queue      max_depth=%d dropped=%lld overflows=%lld\n", detector_queue_stats.max_depth_frames,
+                static_cast<long long>(detector_queue_stats.dropped_frames), static_cast<long long>(detector_queue_stats.overflows));
+    // After the warm-up in the constructors, windows should not allocate at all
+    std::printf("worker_allocations  generator=%lld in %lld windows, detector=%lld in %lld windows%s\n",
+                static_cast<long long>(queue_stats.allocations), static_cast<long long>(queue_stats.allocating_blocks),
+                static_cast<long long>(detector_queue_stats.allocations), static_cast<long long>(detector_queue_stats.allocating_blocks),
+                AllocationCounter::isEnabled() ? "" : " (not counted in this build)");
+    std::printf("kcp_send            frames=%lld avg_frame_bytes=%.0f samples_per_frame=%.1f\n", static_cast<long long>(send_stats.frames),
+                static_cast<double>(send_stats.words * sizeof(int16_t)) / static_cast<double>(std::max<int64_t>(send_stats.frames, 1)),
+                static_cast<double>(send_stats.samples) / static_cast<double>(std::max<int64_t>(send_stats.frames, 1)));
+    std::printf("kcp_receive         frames=%lld gaps=%lld lost_frames=%lld lost_samples=%lld late=%lld discarded_words=%lld\n",
+                static_cast<long long>(receive_stats.frames), static_cast<long long>(receive_stats.gaps),
+                static_cast<long long>(receive_stats.lost_frames), static_cast<long long>(receive_stats.lost_samples),
+                static_cast<long long>(receive_stats.late_frames), static_cast<long long>(receive_stats.discarded_words));
+    for (const auto &[stage, latency]: caller.GetLatencyReport())
+    {
+        std::printf("caller.%-13s p50=%.2f p90=%.2f p99=%.2f max=%.2f (ms, n=%lld)\n", stage.c_str(),
+                    latency.p50_us / 1e3, latency.p90_us / 1e3, latency.p99_us / 1e3, latency.max_us / 1e3,
+                    static_cast<long long>(latency.count));
+    }
+    for (const auto &[stage, latency]: callee.GetLatencyReport())
+    {
+        std::printf("callee.%-13s p50=%.2f p90=%.2f p99=%.2f max=%.2f (ms, n=%lld)\n", stage.c_str(),
+                    latency.p50_us / 1e3, latency.p90_us / 1e3, latency.p99_us / 1e3, latency.max_us / 1e3,
+                    static_cast<long long>(latency.count));
+    }
+    registry.clear();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,203 @@
+// Benchmark of the INT8 models against the float ones, for the generator and the detector of each variant:
+//   load               construction time and resident memory added by loading both engines and warming them up
+//   speed              wall time per WatermarkGenerator::WINDOW_STEP window, p50 and p99
+//   detection          mean detector probability on the variant's own watermarked input, and on the clean input
+//
+// This is the accuracy gate for INT8 models, which the app does not load on its own: it exits with failure unless both
+// variants ran and the INT8 variant's mean probabilities on watermarked and on clean input are within
+// MAX_INT8_PROBABILITY_DELTA of the float variant's.
+//
+// Usage: ultrasound_watermark_quant_bench <resource_dir> <input.wav>
+//   resource_dir contains generator_param, generator_bin, detector_param and detector_bin, and for the INT8 variant
+//   generator_int8_param, generator_int8_bin, detector_int8_param and detector_int8_bin (see the calibration export)
+//   input.wav is mono PCM16 at WatermarkGenerator::INPUT_FS
+//   The INT8 variant runs after the float one in the same process, so its resident memory may be understated by
+//   memory the float variant freed
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <ase/utilities/AudioBufferOperations.hpp>
+#include "BenchmarkUtilities.hpp"
+#include "WatermarkDetector.hpp"
+#include "WatermarkGenerator.hpp"
+#include "dsp/SampleConversion.hpp"
+
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    constexpr size_t WINDOW = WatermarkGenerator::WINDOW_STEP;
+    /// Largest change of a mean detector probability from the float variant that INT8 models are allowed
+    constexpr double MAX_INT8_PROBABILITY_DELTA = 0.02;
+
+    struct Variant
+    {
+        std::string name;
+        /// Prefix of the model files, e.g. "generator" + suffix + "_param"
+        std::string suffix;
+    };
+
+    struct VariantResult
+    {
+        double load_ms;
+        double resident_mb;
+        double generator_p50_us;
+        double generator_p99_us;
+        double detector_p50_us;
+        double detector_p99_us;
+        double watermarked_probability;
+        double clean_probability;
+    };
+
+    double mean(const std::vector<float> &values)
+    {
+        if (values.empty())
+        {
+            return NAN;
+        }
+        return std::accumulate(values.begin(), values.end(), 0.0) / static_cast<double>(values.size());
+    }
+
+    /// Feed whole windows of audio to consumer one at a time, returning the wall time of each in microseconds
+    std::vector<double> timeWindows(ase::AudioDataStreamBase<float> &consumer, const std::vector<float> &audio)
+    {
+        std::vector<double> times_us;
+        times_us.reserve(audio.size() / WINDOW);
+        for (size_t offset = 0; offset + WINDOW <= audio.size(); offset += WINDOW)
+        {
+            const auto start = clock_type::now();
+            consumer.consume(audio.data() + offset, WINDOW);
+            times_us.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - start).count());
+        }
+        return times_us;
+    }
+
+    VariantResult run(const std::filesystem::path &resource_dir, const Variant &variant, const std::vector<float> &input)
+    {
+        const std::string generator_name = "generator" + variant.suffix;
+        const std::string detector_name = "detector" + variant.suffix;
+        const std::vector<float> silence(WINDOW, 0.0f);
+
+        const int64_t resident_before = residentBytes();
+        const auto load_start = clock_type::now();
+        auto generator = std::make_shared<WatermarkGenerator>(resource_dir / (generator_name + "_param"), resource_dir / (generator_name + "_bin"));
+        auto detector = std::make_shared<WatermarkDetector>(resource_dir / (detector_name + "_param"), resource_dir / (detector_name + "_bin"));
+        const double load_ms = std::chrono::duration<double, std::milli>(clock_type::now() - load_start).count();
+        // Warm up as WatermarkCaller and WatermarkCallee do, so that the figures include first-use allocations
+        std::vector<float> probabilities;
+        detector->setCallback([&](float instantaneous, float) { probabilities.push_back(instantaneous); });
+        generator->consume(silence.data(), silence.size());
+        detector->consume(silence.data(), silence.size());
+        const int64_t resident_after = residentBytes();
+
+        auto watermarked = std::make_shared<CollectorSink<float>>(WatermarkGenerator::OUTPUT_FS);
+        generator->attachConsumer(watermarked);
+        const std::vector<double> generator_us = timeWindows(*generator, input);
+        probabilities.clear();
+        const std::vector<double> detector_us = timeWindows(*detector, watermarked->samples);
+        const double watermarked_probability = mean(probabilities);
+        probabilities.clear();
+        timeWindows(*detector, input);
+        const double clean_probability = mean(probabilities);
+
+        return VariantResult{
+                load_ms,
+                static_cast<double>(resident_after - resident_before) / (1024.0 * 1024.0),
+                percentile(generator_us, 0.5),
+                percentile(generator_us, 0.99),
+                percentile(detector_us, 0.5),
+                percentile(detector_us, 0.99),
+                watermarked_probability,
+                clean_probability
+        };
+    }
+
+    bool hasModels(const std::filesystem::path &resource_dir, const Variant &variant)
+    {
+        for (const char *model: {"generator", "detector"})
+        {
+            for (const char *part: {"_param", "_bin"})
+            {
+                if (!std::filesystem::exists(resource_dir / (model + variant.suffix + part)))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::fprintf(stderr, "Usage: %s <resource_dir> <input.wav>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path resource_dir = argv[1];
+    const std::filesystem::path input_path = argv[2];
+
+    int fs = 0;
+    int channels = 0;
+    size_t length = 0;
+    auto buffer = ase::readBufferFromWavFile<int16_t>(input_path, fs, channels, length);
+    if (!buffer || channels != 1 || fs != WatermarkGenerator::INPUT_FS || length < WINDOW)
+    {
+        std::fprintf(stderr, "Input must be mono, sampled at %d Hz and at least one window long\n", WatermarkGenerator::INPUT_FS);
+        return EXIT_FAILURE;
+    }
+    std::vector<float> input(length / WINDOW * WINDOW);
+    dsp::int16ToFloat(buffer.get(), input.data(), input.size());
+
+    std::printf("%.1f s of input, %zu windows of %zu frames\n", static_cast<double>(input.size()) / WatermarkGenerator::INPUT_FS,
+                input.size() / WINDOW, WINDOW);
+    std::printf("%-8s %9s %12s %15s %15s %14s %14s %13s %11s %9s\n", "variant", "load_ms", "resident_mb", "generator_p50",
+                "generator_p99", "detector_p50", "detector_p99", "watermarked_p", "clean_p", "delta_p");
+    // The float variant first: it is the baseline the INT8 one is compared with
+    const std::vector<Variant> variants{{"float", ""}, {"int8", "_int8"}};
+    for (const Variant &variant: variants)
+    {
+        if (!hasModels(resource_dir, variant))
+        {
+            std::fprintf(stderr, "%s models not found in %s\n", variant.name.c_str(), resource_dir.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    double float_probability = NAN;
+    double float_clean_probability = NAN;
+    bool passed = true;
+    for (const Variant &variant: variants)
+    {
+        const VariantResult result = run(resource_dir, variant, input);
+        if (variant.suffix.empty())
+        {
+            float_probability = result.watermarked_probability;
+            float_clean_probability = result.clean_probability;
+        }
+        std::printf("%-8s %9.1f %12.2f %12.0f us %12.0f us %11.0f us %11.0f us %13.4f %11.4f %+9.4f\n", variant.name.c_str(),
+                    result.load_ms, result.resident_mb, result.generator_p50_us, result.generator_p99_us,
+                    result.detector_p50_us, result.detector_p99_us, result.watermarked_probability, result.clean_probability,
+                    result.watermarked_probability - float_probability);
+        // Written so that a NaN mean, from a detector that reported no windows, fails too
+        if (!variant.suffix.empty() && !(std::abs(result.watermarked_probability - float_probability) <= MAX_INT8_PROBABILITY_DELTA &&
+                                         std::abs(result.clean_probability - float_clean_probability) <= MAX_INT8_PROBABILITY_DELTA))
+        {
+            std::fprintf(stderr, "%s: mean probability differs from float by more than %.2f\n", variant.name.c_str(), MAX_INT8_PROBABILITY_DELTA);
+            passed = false;
+        }
+    }
+    std::printf("real time budget per window: %.0f us\n", 1e6 * static_cast<double>(WINDOW) / WatermarkGenerator::INPUT_FS);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,306 @@
+// Benchmark and quality check of dsp::PolyphaseResampler, which converts between a device's native rate and the
+// pipeline's rate when streams are opened natively (see OboeStreamAdapter::setNativeSampleRate() and ResampleStream):
+//   cost      CPU cycles per output sample, counted with perf_event_open, over callbacks of a typical burst, with the
+//             nanoseconds per sample and the share of one core the conversion takes in real time. Where the kernel
+//             does not grant the cycle counter (perf_event_paranoid), cycles are reported as n/a
+//   quality   gain and SINAD of tones across the 16-17.5 kHz pilot band, and for downsampling the rejection of the
+//             tones that would alias onto it
+// Exits with 1 if a pilot tone's gain is off by more than MAX_GAIN_ERROR_DB, or its SINAD or the alias rejection
+// is below MIN_SINAD_DB.
+//
+// Usage: ultrasound_watermark_resampler_bench [--seconds <s>] [--rates <input:output>[,<input:output>...]]
+//   seconds of audio converted per cost measurement, 10 by default
+//   rates defaults to 44100:48000,48000:44100,96000:48000,48000:96000
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numbers>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dsp/PolyphaseResampler.hpp"
+#include "dsp/SampleConversion.hpp"
+
+using namespace ase_ultrasound_watermark;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    /// Callback size the cost is measured at: a typical low-latency burst
+    constexpr size_t BURST_FRAMES = 192;
+    constexpr int REPEATS = 5;
+    constexpr double PILOT_LOW_HZ = 16000.0;
+    constexpr double PILOT_HIGH_HZ = 17500.0;
+    constexpr double PILOT_STEP_HZ = 250.0;
+    constexpr double TONE_AMPLITUDE = 0.5;
+    constexpr double MAX_GAIN_ERROR_DB = 0.1;
+    constexpr double MIN_SINAD_DB = 80.0;
+
+    struct RatePair
+    {
+        int input;
+        int output;
+    };
+
+    struct Cost
+    {
+        double cycles_per_sample; // NAN without the counter
+        double ns_per_sample;
+    };
+
+    struct ToneQuality
+    {
+        double gain_db;
+        double sinad_db;
+    };
+
+    /// Counts the CPU cycles this thread spends in user space
+    class CycleCounter
+    {
+    public:
+        CycleCounter()
+        {
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+
+        ~CycleCounter()
+        {
+            if (fd_ >= 0)
+            {
+                close(fd_);
+            }
+        }
+
+        [[nodiscard]] bool available() const
+        {
+            return fd_ >= 0;
+        }
+
+        void start()
+        {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        uint64_t stop()
+        {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t cycles = 0;
+            return read(fd_, &cycles, sizeof(cycles)) == sizeof(cycles) ? cycles : 0;
+        }
+
+    private:
+        int fd_;
+    };
+
+    std::vector<float> sine(double frequency_hz, int rate, size_t frames)
+    {
+        std::vector<float> samples(frames);
+        for (size_t i = 0; i < frames; ++i)
+        {
+            samples[i] = static_cast<float>(TONE_AMPLITUDE * std::sin(2.0 * std::numbers::pi * frequency_hz * static_cast<double>(i) / rate));
+        }
+        return samples;
+    }
+
+    /// Convert all of input in bursts, returning what the resampler makes of it
+    std::vector<float> convert(dsp::PolyphaseResampler &resampler, const std::vector<float> &input)
+    {
+        std::vector<float> output(resampler.maxOutputFrames(input.size()) + 1);
+        size_t produced = 0;
+        for (size_t done = 0; done < input.size(); done += BURST_FRAMES)
+        {
+            const size_t frames = std::min(BURST_FRAMES, input.size() - done);
+            produced += resampler.process(input.data() + done, frames, output.data() + produced, output.size() - produced);
+        }
+        output.resize(produced);
+        return output;
+    }
+
+    /// Least-squares fit of a sine at frequency_hz to the steady part of samples: its amplitude, and what is left
+    ToneQuality fitTone(const std::vector<float> &samples, double frequency_hz, int rate)
+    {
+        // Skip the first and last tenth of a second: the filter's start-up and the input's end
+        const size_t begin = static_cast<size_t>(rate / 10);
+        const size_t end = samples.size() - static_cast<size_t>(rate / 10);
+        double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            const double phase = 2.0 * std::numbers::pi * frequency_hz * static_cast<double>(i) / rate;
+            const double s = std::sin(phase);
+            const double c = std::cos(phase);
+            ss += s * s;
+            sc += s * c;
+            cc += c * c;
+            ys += samples[i] * s;
+            yc += samples[i] * c;
+        }
+        const double det = ss * cc - sc * sc;
+        const double a = (ys * cc - yc * sc) / det;
+        const double b = (yc * ss - ys * sc) / det;
+        double signal = 0.0, residual = 0.0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            const double phase = 2.0 * std::numbers::pi * frequency_hz * static_cast<double>(i) / rate;
+            const double fitted = a * std::sin(phase) + b * std::cos(phase);
+            signal += fitted * fitted;
+            residual += (samples[i] - fitted) * (samples[i] - fitted);
+        }
+        return ToneQuality{20.0 * std::log10(std::hypot(a, b) / TONE_AMPLITUDE), 10.0 * std::log10(signal / std::max(residual, 1e-30))};
+    }
+
+    Cost measureCost(const RatePair &rates, double seconds)
+    {
+        dsp::PolyphaseResampler resampler{rates.input, rates.output, 1, BURST_FRAMES};
+        const std::vector<float> input = sine(1000.0, rates.input, static_cast<size_t>(seconds * rates.input));
+        std::vector<float> output(resampler.maxOutputFrames(BURST_FRAMES));
+        CycleCounter counter;
+        Cost best{NAN, INFINITY};
+        for (int repeat = 0; repeat < REPEATS; ++repeat)
+        {
+            resampler.reset();
+            size_t produced = 0;
+            if (counter.available())
+            {
+                counter.start();
+            }
+            const auto start = clock_type::now();
+            for (size_t done = 0; done + BURST_FRAMES <= input.size(); done += BURST_FRAMES)
+            {
+                produced += resampler.process(input.data() + done, BURST_FRAMES, output.data(), output.size());
+            }
+            const double ns = std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+            // Measurements only ever come out high on a busy machine, so the lowest is the most representative
+            best.ns_per_sample = std::min(best.ns_per_sample, ns / static_cast<double>(produced));
+            if (counter.available())
+            {
+                const double cycles = static_cast<double>(counter.stop()) / static_cast<double>(produced);
+                best.cycles_per_sample = std::isnan(best.cycles_per_sample) ? cycles : std::min(best.cycles_per_sample, cycles);
+            }
+        }
+        return best;
+    }
+
+    std::vector<RatePair> parseRates(const std::string &list)
+    {
+        std::vector<RatePair> pairs;
+        std::stringstream stream{list};
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            const size_t colon = item.find(':');
+            if (colon == std::string::npos)
+            {
+                throw std::runtime_error("Rate pair " + item + " is not <input:output>");
+            }
+            pairs.push_back(RatePair{std::stoi(item.substr(0, colon)), std::stoi(item.substr(colon + 1))});
+        }
+        return pairs;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 10.0;
+    std::vector<RatePair> pairs{{44100, 48000}, {48000, 44100}, {96000, 48000}, {48000, 96000}};
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            if (i + 1 < argc && arg == "--seconds")
+            {
+                seconds = std::stod(argv[++i]);
+            }
+            else if (i + 1 < argc && arg == "--rates")
+            {
+                pairs = parseRates(argv[++i]);
+            }
+            else
+            {
+                std::fprintf(stderr, "Usage: %s [--seconds <s>] [--rates <input:output>[,<input:output>...]]\n", argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%s kernels, callbacks of %zu frames, passband %.0f Hz\n", dsp::conversionInstructionSet(), BURST_FRAMES,
+                dsp::PolyphaseResampler::DEFAULT_PASSBAND_HZ);
+    std::printf("%-13s %5s %14s %10s %10s | %9s %9s %10s %9s\n", "rates", "taps", "cycles/sample", "ns/sample", "core_load",
+                "min_gain", "max_gain", "min_sinad", "alias");
+    bool passed = true;
+    for (const RatePair &rates: pairs)
+    {
+        try
+        {
+            const dsp::PolyphaseResampler probe{rates.input, rates.output, 1, BURST_FRAMES};
+            const Cost cost = measureCost(rates, seconds);
+
+            double min_gain = INFINITY, max_gain = -INFINITY, min_sinad = INFINITY, max_alias = -INFINITY;
+            for (double frequency = PILOT_LOW_HZ; frequency <= PILOT_HIGH_HZ; frequency += PILOT_STEP_HZ)
+            {
+                dsp::PolyphaseResampler resampler{rates.input, rates.output, 1, BURST_FRAMES};
+                const ToneQuality tone = fitTone(convert(resampler, sine(frequency, rates.input, rates.input)), frequency, rates.output);
+                min_gain = std::min(min_gain, tone.gain_db);
+                max_gain = std::max(max_gain, tone.gain_db);
+                min_sinad = std::min(min_sinad, tone.sinad_db);
+                // The input tone that would land on frequency after downsampling
+                const double alias = rates.output - frequency;
+                if (rates.input > rates.output && alias < rates.input / 2.0)
+                {
+                    dsp::PolyphaseResampler alias_resampler{rates.input, rates.output, 1, BURST_FRAMES};
+                    const ToneQuality leak = fitTone(convert(alias_resampler, sine(alias, rates.input, rates.input)), frequency, rates.output);
+                    max_alias = std::max(max_alias, leak.gain_db);
+                }
+            }
+
+            char rate_text[32];
+            std::snprintf(rate_text, sizeof(rate_text), "%d->%d", rates.input, rates.output);
+            char alias_text[16] = "n/a";
+            if (std::isfinite(max_alias))
+            {
+                std::snprintf(alias_text, sizeof(alias_text), "%.1f dB", max_alias);
+            }
+            char cycles_text[16] = "n/a";
+            if (!std::isnan(cost.cycles_per_sample))
+            {
+                std::snprintf(cycles_text, sizeof(cycles_text), "%.1f", cost.cycles_per_sample);
+            }
+            std::printf("%-13s %5d %14s %10.2f %9.3f%% | %6.3f dB %6.3f dB %7.1f dB %9s\n", rate_text, probe.getTapsPerPhase(),
+                        cycles_text, cost.ns_per_sample, cost.ns_per_sample * rates.output / 1e7, min_gain, max_gain, min_sinad,
+                        alias_text);
+            passed = passed && std::max(std::abs(min_gain), std::abs(max_gain)) <= MAX_GAIN_ERROR_DB && min_sinad >= MIN_SINAD_DB &&
+                     !(max_alias > -MIN_SINAD_DB);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::printf("%d->%d: %s\n", rates.input, rates.output, e.what());
+            passed = false;
+        }
+    }
+    std::printf("pilot band %.0f-%.0f Hz: %s (gain within %.1f dB, SINAD and alias rejection at least %.0f dB)\n", PILOT_LOW_HZ,
+                PILOT_HIGH_HZ, passed ? "pass" : "FAIL", MAX_GAIN_ERROR_DB, MIN_SINAD_DB);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,135 @@
+// Capacity benchmark of WatermarkSessionServer: N synthetic callers stream framed audio in real time into N sessions
+// that share a pool of detector workers. N is doubled until the pool can no longer keep up.
+// A run keeps up if no session drops audio and no session's backlog exceeds MAX_REALTIME_BACKLOG_MS.
+// The model files are copied into memory once, and every session's detector parses its own weights from that copy.
+//
+// Usage: ultrasound_watermark_session_bench <resource_dir> [workers] [max_sessions] [seconds]
+//   resource_dir contains detector_param and detector_bin
+//   workers defaults to the number of hardware threads, max_sessions to 256, seconds per run to 10
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "WatermarkSessionServer.hpp"
+#include "kcp/KcpFrameEncoder.hpp"
+
+using namespace ase_ultrasound_watermark;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    constexpr int SAMPLE_RATE = WatermarkDetector::INPUT_FS;
+    constexpr int CHUNK_FRAMES = SAMPLE_RATE / 100;
+    constexpr double MAX_REALTIME_BACKLOG_MS = 500.0;
+
+    struct RunResult
+    {
+        bool realtime;
+        double cores_used;
+        double max_backlog_ms;
+        int64_t dropped_frames;
+        int64_t detected_windows;
+    };
+
+    RunResult run(const ModelSource &model, int workers, int sessions, double seconds)
+    {
+        WatermarkSessionServer server{model, workers};
+        std::atomic<int64_t> results{0};
+        server.SetOnWatermarkResultsCallback([&](uint32_t, float, float) {
+            results.fetch_add(1, std::memory_order_relaxed);
+        });
+
+        // Each caller frames its audio like WatermarkCaller does
+        std::vector<std::shared_ptr<KcpFrameEncoder>> callers;
+        for (int i = 0; i < sessions; ++i)
+        {
+            auto encoder = std::make_shared<KcpFrameEncoder>(SAMPLE_RATE, nullptr);
+            server.OpenSession(static_cast<uint32_t>(i), encoder);
+            callers.push_back(encoder);
+        }
+
+        // Quiet noise, so that the detector does real work on every window
+        std::mt19937 rng{7};
+        std::normal_distribution<float> noise{0.0f, 1000.0f};
+        std::vector<int16_t> audio(SAMPLE_RATE);
+        std::generate(audio.begin(), audio.end(), [&] { return static_cast<int16_t>(std::clamp(noise(rng), -32768.0f, 32767.0f)); });
+
+        const auto chunks = static_cast<int64_t>(seconds * SAMPLE_RATE / CHUNK_FRAMES);
+        const auto start = clock_type::now();
+        const int64_t busy_start = server.GetBusyNanoseconds();
+        double max_backlog_ms = 0.0;
+        for (int64_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(chunk * 1000000LL * CHUNK_FRAMES / SAMPLE_RATE));
+            const size_t offset = static_cast<size_t>(chunk * CHUNK_FRAMES) % (audio.size() - CHUNK_FRAMES);
+            for (auto &caller: callers)
+            {
+                caller->consume(audio.data() + offset, CHUNK_FRAMES);
+            }
+            if (chunk % 10 == 0)
+            {
+                for (const auto &stats: server.GetSessionStats())
+                {
+                    max_backlog_ms = std::max(max_backlog_ms, 1000.0 * stats.backlog_frames / SAMPLE_RATE);
+                }
+            }
+        }
+        const double wall_ns = std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+        const double cores_used = static_cast<double>(server.GetBusyNanoseconds() - busy_start) / wall_ns;
+
+        int64_t dropped = 0;
+        for (const auto &stats: server.GetSessionStats())
+        {
+            dropped += stats.dropped_frames;
+        }
+        return RunResult{dropped == 0 && max_backlog_ms <= MAX_REALTIME_BACKLOG_MS, cores_used, max_backlog_ms, dropped,
+                         results.load(std::memory_order_relaxed)};
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <resource_dir> [workers] [max_sessions] [seconds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path resource_dir = argv[1];
+    const int workers = argc > 2 ? std::stoi(argv[2]) : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const int max_sessions = argc > 3 ? std::stoi(argv[3]) : 256;
+    const double seconds = argc > 4 ? std::stod(argv[4]) : 10.0;
+    const ModelSource model = ModelSource::fromBuffers(ModelBuffer::mapFile(resource_dir / "detector_param"),
+                                                       ModelBuffer::mapFile(resource_dir / "detector_bin"));
+
+    std::printf("workers %d, %.1f s per run, real time if nothing is dropped and backlog <= %.0f ms\n",
+                workers, seconds, MAX_REALTIME_BACKLOG_MS);
+    std::printf("%8s %9s %10s %17s %14s %8s %8s\n",
+                "sessions", "realtime", "cores_used", "sessions_per_core", "max_backlog_ms", "dropped", "windows");
+    int best_sessions = 0;
+    double best_sessions_per_core = 0.0;
+    for (int sessions = 1; sessions <= max_sessions; sessions *= 2)
+    {
+        const RunResult result = run(model, workers, sessions, seconds);
+        const double sessions_per_core = result.cores_used > 0.0 ? sessions / result.cores_used : 0.0;
+        std::printf("%8d %9s %10.2f %17.2f %14.1f %8lld %8lld\n", sessions, result.realtime ? "yes" : "no",
+                    result.cores_used, sessions_per_core, result.max_backlog_ms,
+                    static_cast<long long>(result.dropped_frames), static_cast<long long>(result.detected_windows));
+        if (!result.realtime)
+        {
+            break;
+        }
+        best_sessions = sessions;
+        best_sessions_per_core = sessions_per_core;
+    }
+    std::printf("max_realtime_sessions %d\n", best_sessions);
+    std::printf("sessions_per_core     %.2f\n", best_sessions_per_core);
+    return EXIT_SUCCESS;
+}
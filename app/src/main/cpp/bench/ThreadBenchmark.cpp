@@ -0,0 +1,191 @@
+// Sweep of the pipeline's thread policies: the caller/callee pipeline of ultrasound_watermark_pipeline_bench is run once
+// per combination of CPU mask (any, performance cores, efficiency cores) and nice value (inherited, URGENT_DISPLAY),
+// applied to the inference workers and the KCP I/O threads alike. For each it reports the generator and detector
+// stage latencies and the capture-to-detection latency of every window, p50/p90/p99.
+// Combinations the system does not permit (e.g. raising priority without CAP_SYS_NICE) are skipped.
+// The recorder runs in real time by default, since the contention being measured does not exist when it free-runs.
+//
+// Usage: ultrasound_watermark_thread_bench <resource_dir> <input.wav> [speed]
+//   resource_dir contains generator_param, generator_bin, detector_param, detector_bin and multitone.wav
+//   input.wav is mono PCM16 at WatermarkGenerator::INPUT_FS
+//   speed is relative to real time, 1 by default
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchmarkUtilities.hpp"
+#include "HostAudioDevice.hpp"
+#include "ThreadPolicy.hpp"
+#include "WatermarkCaller.hpp"
+#include "WatermarkCallee.hpp"
+
+using namespace ase_android;
+using namespace ase_ultrasound_watermark;
+using namespace ase_ultrasound_watermark::bench;
+using clock_type = std::chrono::steady_clock;
+
+namespace
+{
+    constexpr int32_t RECORD_DEVICE_ID = 1;
+    constexpr int32_t CALLER_PLAY_DEVICE_ID = 2;
+    constexpr int32_t CALLEE_PLAY_DEVICE_ID = 3;
+    constexpr auto IDLE_TIMEOUT = std::chrono::seconds(3);
+    /// Android's THREAD_PRIORITY_URGENT_DISPLAY
+    constexpr int RAISED_NICE = -8;
+
+    struct Setting
+    {
+        std::string cores;
+        ThreadPolicy policy;
+    };
+
+    LatencyHistogram::Summary findStage(const std::vector<LatencyTracer::StageLatency> &report, const std::string &stage)
+    {
+        for (const auto &entry: report)
+        {
+            if (entry.stage == stage)
+            {
+                return entry.latency;
+            }
+        }
+        return {};
+    }
+
+    bool isPermitted(const ThreadPolicy &policy)
+    {
+        // runWithThreadPolicy() carries on without a policy it cannot apply, so try it on a thread of its own
+        bool permitted = true;
+        std::thread probe{[&] {
+            try
+            {
+                policy.applyToCurrentThread();
+            }
+            catch (const std::runtime_error &)
+            {
+                permitted = false;
+            }
+        }};
+        probe.join();
+        return permitted;
+    }
+
+    /// Run the whole input through a caller and a callee with threads, printing one row
+    void run(const std::filesystem::path &resource_dir, const std::filesystem::path &input_path, double speed,
+             const ModelSource &generator_model, const ModelSource &detector_model, const Setting &setting)
+    {
+        std::mutex log_mutex;
+        std::vector<CapturePoint> captures;
+        std::vector<DetectionPoint> detections;
+        uint64_t next_detection = 0;
+        clock_type::time_point last_activity = clock_type::now();
+
+        auto &registry = HostAudioDeviceRegistry::instance();
+        registry.clear();
+        auto recorder_device = std::make_shared<WavFileInputDevice>(input_path, speed, false);
+        recorder_device->setTransferObserver([&](int64_t position_frames, int32_t num_frames) {
+            std::lock_guard lock{log_mutex};
+            captures.push_back({position_frames + num_frames, clock_type::now()});
+        });
+        registry.add(RECORD_DEVICE_ID, recorder_device);
+        registry.add(CALLER_PLAY_DEVICE_ID, std::make_shared<NullAudioDevice>());
+        registry.add(CALLEE_PLAY_DEVICE_ID, std::make_shared<NullAudioDevice>());
+
+        const PipelineThreadConfig threads{setting.policy, setting.policy};
+        WatermarkCallee callee{detector_model, OverflowPolicy::LatestWins, threads};
+        WatermarkCaller caller{generator_model, OverflowPolicy::DropOldest, threads};
+        callee.SetOnWatermarkResultsCallback([&](float, float) {
+            std::lock_guard lock{log_mutex};
+            readDetections(callee.GetResultRing(), next_detection, detections);
+            last_activity = clock_type::now();
+        });
+        callee.StartServer(CALLEE_PLAY_DEVICE_ID);
+        std::string host = "127.0.0.1";
+        caller.StartCall(host, CALLER_PLAY_DEVICE_ID, RECORD_DEVICE_ID, resource_dir / "multitone.wav");
+
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            std::lock_guard lock{log_mutex};
+            if (!captures.empty())
+            {
+                last_activity = std::max(last_activity, captures.back().time);
+            }
+            if (recorder_device->isExhausted() && clock_type::now() - last_activity > IDLE_TIMEOUT)
+            {
+                break;
+            }
+        }
+        const auto generator = findStage(caller.GetLatencyReport(), "generator");
+        const auto detector = findStage(callee.GetLatencyReport(), "detector");
+        const AsyncStageStats generator_queue = caller.GetGeneratorQueueStats();
+        const AsyncStageStats detector_queue = callee.GetDetectorQueueStats();
+        caller.StopCall();
+        callee.Stop();
+
+            std::lock_guard lock{log_mutex};
+        const std::vector<double> latencies_ms = windowLatenciesMs(captures, detections, WatermarkDetector::WINDOW_STEP);
+
+        const std::string nice = setting.policy.nice == ThreadPolicy::KEEP_NICE ? "keep" : std::to_string(setting.policy.nice);
+        std::printf("%-12s %5s %#10llx %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8lld\n", setting.cores.c_str(),
+                    nice.c_str(), static_cast<unsigned long long>(setting.policy.cpu_mask),
+                    generator.p50_us / 1e3, generator.p90_us / 1e3, generator.p99_us / 1e3,
+                    detector.p50_us / 1e3, detector.p90_us / 1e3, detector.p99_us / 1e3,
+                    percentile(latencies_ms, 0.5), percentile(latencies_ms, 0.9), percentile(latencies_ms, 0.99),
+                    static_cast<long long>(generator_queue.dropped_frames + detector_queue.dropped_frames));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::fprintf(stderr, "Usage: %s <resource_dir> <input.wav> [speed]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path resource_dir = argv[1];
+    const std::filesystem::path input_path = argv[2];
+    const double speed = argc > 3 ? std::stod(argv[3]) : 1.0;
+
+    if (WavFileInputDevice{input_path, speed, false}.getFileSampleRate() != WatermarkGenerator::INPUT_FS)
+    {
+        std::fprintf(stderr, "Input must be sampled at %d Hz\n", WatermarkGenerator::INPUT_FS);
+        return EXIT_FAILURE;
+    }
+    const ModelSource generator_model = ModelSource::fromFiles(resource_dir / "generator_param", resource_dir / "generator_bin");
+    const ModelSource detector_model = ModelSource::fromFiles(resource_dir / "detector_param", resource_dir / "detector_bin");
+
+    const CpuTopology topology = CpuTopology::detect();
+    std::printf("cpus %#llx, performance %#llx, efficiency %#llx\n", static_cast<unsigned long long>(topology.all_mask),
+                static_cast<unsigned long long>(topology.performance_mask), static_cast<unsigned long long>(topology.efficiency_mask));
+    std::printf("%-12s %5s %10s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "cores", "nice", "mask", "gen_p50", "gen_p90",
+                "gen_p99", "det_p50", "det_p90", "det_p99", "win_p50", "win_p90", "win_p99", "dropped");
+    const std::vector<std::pair<std::string, uint64_t>> masks{
+            {"any",         0},
+            {"performance", topology.performance_mask},
+            {"efficiency",  topology.efficiency_mask}
+    };
+    for (const auto &[cores, mask]: masks)
+    {
+        for (int nice: {ThreadPolicy::KEEP_NICE, RAISED_NICE})
+        {
+            const Setting setting{cores, ThreadPolicy{mask, nice}};
+            if (!isPermitted(setting.policy))
+            {
+                std::printf("%-12s %5d %#10llx not permitted\n", cores.c_str(), nice, static_cast<unsigned long long>(mask));
+                continue;
+            }
+            run(resource_dir, input_path, speed, generator_model, detector_model, setting);
+        }
+    }
+    std::printf("latencies in ms; real time budget per window: %.2f ms\n",
+                1e3 * static_cast<double>(WatermarkGenerator::WINDOW_STEP) / WatermarkGenerator::INPUT_FS);
+    HostAudioDeviceRegistry::instance().clear();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,361 @@
+#ifndef ULTRASOUNDWATERMARK_OSCILLATORBANK_HPP
+#define ULTRASOUNDWATERMARK_OSCILLATORBANK_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "SampleConversion.hpp"
+
+namespace ase_ultrasound_watermark::dsp
+{
+    struct Tone
+    {
+        float frequency_hz;
+        /// Peak amplitude relative to full scale. The amplitudes of a tone set should add up to at most 1 to not clip
+        float amplitude;
+    };
+
+    /**
+     * Sum of sine oscillators, for synthesizing a multitone signal in an audio callback instead of looping a
+     * recording of it.
+     *
+     * Each tone has an exact 32-bit phase accumulator, so that its frequency does not drift however long it plays.
+     * Samples are produced in blocks of BLOCK_FRAMES: at the start of a block, the sines and cosines of the next
+     * LANES phases are looked up in a wavetable, and the block is then computed LANES samples at a time by rotating
+     * all lanes by LANES phase steps with a few multiply-adds (NEON or SSE vectors, picked at compile time like the
+     * sample conversion kernels, or scalar code). Re-seeding every block keeps the rounding of the rotation from accumulating.
+     *
+     * Tone sets can be changed at any time: tones whose frequency is unchanged keep their phase and ramp to their
+     * new amplitude, new tones fade in from silence and removed ones fade out, so that changes do not click.
+     * No method allocates or locks. Not thread-safe: setTones() and render() must be called from the same thread.
+     */
+    class OscillatorBank
+    {
+    public:
+        /// Largest tone set. Twice as many oscillators exist, so that removed tones can fade out
+        constexpr static size_t MAX_TONES = 16;
+        /// Frames between re-seeding the oscillators from their phase accumulators, a multiple of LANES
+        constexpr static int BLOCK_FRAMES = 240;
+        /// Vectors of 4 consecutive frames computed per step. They are independent, so that the rotation of one
+        /// overlaps with the others instead of each step waiting for the previous one
+        constexpr static int VECTORS = 4;
+        constexpr static int LANES = 4 * VECTORS;
+
+        /**
+         * @param ramp_frames Length of the amplitude ramp of changed, new and removed tones, rounded up to a
+         * multiple of BLOCK_FRAMES. 0 applies changes at the next block
+         */
+        OscillatorBank(int sample_rate, int ramp_frames)
+                : sample_rate_{sample_rate},
+                  ramp_blocks_{(std::max(ramp_frames, 0) + BLOCK_FRAMES - 1) / BLOCK_FRAMES},
+                  block_{},
+                  block_position_{BLOCK_FRAMES},
+                  oscillators_{}
+        {
+            sineTable(); // Built here rather than in the first audio callback
+        }
+
+        /**
+         * Check that a tone set can be played at sample_rate
+         * @throw std::runtime_error if there are more than MAX_TONES tones, or a frequency is not between 0 and
+         * Nyquist, or an amplitude is negative
+         */
+        static void validateTones(const std::vector<Tone> &tones, int sample_rate)
+        {
+            if (tones.size() > MAX_TONES)
+            {
+                throw std::runtime_error("At most " + std::to_string(MAX_TONES) + " tones, got " + std::to_string(tones.size()));
+            }
+            for (const Tone &tone: tones)
+            {
+                if (!(tone.frequency_hz > 0.0f && tone.frequency_hz < static_cast<float>(sample_rate) / 2.0f))
+                {
+                    throw std::runtime_error("Tone frequency " + std::to_string(tone.frequency_hz) + " Hz is not between 0 and " +
+                                             std::to_string(sample_rate / 2) + " Hz");
+                }
+                if (!(tone.amplitude >= 0.0f))
+                {
+                    throw std::runtime_error("Tone amplitude must not be negative");
+                }
+            }
+        }
+
+        /// Play tones (at most MAX_TONES, see validateTones()) from the next block. An empty set fades out to silence
+        void setTones(const Tone *tones, size_t count)
+        {
+            for (Oscillator &oscillator: oscillators_)
+            {
+                oscillator.matched = false;
+            }
+            for (size_t t = 0; t < std::min(count, MAX_TONES); ++t)
+            {
+                const uint32_t increment = phaseIncrement(tones[t].frequency_hz);
+                Oscillator *target = nullptr;
+                for (Oscillator &oscillator: oscillators_)
+                {
+                    if (oscillator.active && !oscillator.matched && oscillator.increment == increment)
+                    {
+                        target = &oscillator;
+                        break;
+                    }
+                }
+                if (target == nullptr)
+                {
+                    target = freeOscillator();
+                    *target = Oscillator{};
+                    target->increment = increment;
+                    target->active = true;
+                }
+                target->matched = true;
+                rampTo(*target, tones[t].amplitude);
+            }
+            for (Oscillator &oscillator: oscillators_)
+            {
+                if (oscillator.active && !oscillator.matched)
+                {
+                    rampTo(oscillator, 0.0f);
+                }
+            }
+        }
+
+        /// Write the next frames of the signal
+        void render(float *out, size_t frames)
+        {
+            while (frames > 0)
+            {
+                if (block_position_ == BLOCK_FRAMES)
+                {
+                    renderBlock();
+                    block_position_ = 0;
+                }
+                const size_t take = std::min(frames, static_cast<size_t>(BLOCK_FRAMES - block_position_));
+                std::copy_n(block_.data() + block_position_, take, out);
+                block_position_ += static_cast<int>(take);
+                out += take;
+                frames -= take;
+            }
+        }
+
+        /// Silence at once and forget all tones and phases
+        void reset()
+        {
+            oscillators_ = {};
+            block_position_ = BLOCK_FRAMES;
+        }
+
+    private:
+        struct Oscillator
+        {
+            uint32_t phase;
+            uint32_t increment;
+            float gain;
+            float target_gain;
+            int ramp_blocks_left;
+            bool active;
+            /// Scratch of setTones()
+            bool matched;
+        };
+
+        constexpr static int TABLE_BITS = 12;
+        constexpr static int TABLE_SIZE = 1 << TABLE_BITS;
+        constexpr static int FRACTION_BITS = 32 - TABLE_BITS;
+        constexpr static uint32_t QUARTER_TURN = 1u << 30;
+
+        const int sample_rate_;
+        const int ramp_blocks_;
+        std::array<float, BLOCK_FRAMES> block_;
+        int block_position_;
+        std::array<Oscillator, 2 * MAX_TONES> oscillators_;
+
+        /// One period of sine plus a guard point for interpolation
+        static const std::array<float, TABLE_SIZE + 1> &sineTable()
+        {
+            static const std::array<float, TABLE_SIZE + 1> table = [] {
+                std::array<float, TABLE_SIZE + 1> values{};
+                for (int i = 0; i <= TABLE_SIZE; ++i)
+                {
+                    values[i] = static_cast<float>(std::sin(2.0 * std::numbers::pi * i / TABLE_SIZE));
+                }
+                return values;
+            }();
+            return table;
+        }
+
+        /// Linearly interpolated wavetable lookup. The error is below 3e-7, negligible next to PCM16 quantization
+        static float sine(uint32_t phase)
+        {
+            const auto &table = sineTable();
+            const uint32_t index = phase >> FRACTION_BITS;
+            const float fraction = static_cast<float>(phase & ((1u << FRACTION_BITS) - 1)) * (1.0f / (1u << FRACTION_BITS));
+            return table[index] + (table[index + 1] - table[index]) * fraction;
+        }
+
+        static float cosine(uint32_t phase)
+        {
+            return sine(phase + QUARTER_TURN);
+        }
+
+        [[nodiscard]] uint32_t phaseIncrement(float frequency_hz) const
+        {
+            return static_cast<uint32_t>(std::llround(static_cast<double>(frequency_hz) / sample_rate_ * 4294967296.0));
+        }
+
+        Oscillator *freeOscillator()
+        {
+            Oscillator *quietest = nullptr;
+            for (Oscillator &oscillator: oscillators_)
+            {
+                if (!oscillator.active)
+                {
+                    return &oscillator;
+                }
+                if (!oscillator.matched && (quietest == nullptr || oscillator.gain < quietest->gain))
+                {
+                    quietest = &oscillator;
+                }
+            }
+            // Only when tone sets change faster than they fade out: cut the quietest tone that is fading out.
+            // At most MAX_TONES are matched, so there always is one
+            return quietest;
+        }
+
+        void rampTo(Oscillator &oscillator, float gain) const
+        {
+            oscillator.target_gain = gain;
+            oscillator.ramp_blocks_left = ramp_blocks_;
+            if (ramp_blocks_ == 0)
+            {
+                oscillator.gain = gain;
+            }
+        }
+
+        void renderBlock()
+        {
+            block_.fill(0.0f);
+            for (Oscillator &oscillator: oscillators_)
+            {
+                if (!oscillator.active)
+                {
+                    continue;
+                }
+                const float gain_end = oscillator.ramp_blocks_left > 0
+                                       ? oscillator.gain + (oscillator.target_gain - oscillator.gain) / static_cast<float>(oscillator.ramp_blocks_left)
+                                       : oscillator.gain;
+                addOscillator(oscillator.phase, oscillator.increment, oscillator.gain,
+                              (gain_end - oscillator.gain) / static_cast<float>(BLOCK_FRAMES));
+                oscillator.phase += oscillator.increment * static_cast<uint32_t>(BLOCK_FRAMES);
+                oscillator.gain = gain_end;
+                if (oscillator.ramp_blocks_left > 0 && --oscillator.ramp_blocks_left == 0)
+                {
+                    oscillator.gain = oscillator.target_gain;
+                }
+                if (oscillator.ramp_blocks_left == 0 && oscillator.target_gain == 0.0f)
+                {
+                    oscillator.active = false;
+                }
+            }
+        }
+
+        /// Add a block of one oscillator, with its gain ramping linearly by gain_step per frame
+        void addOscillator(uint32_t phase, uint32_t increment, float gain, float gain_step)
+        {
+            // Lane k holds sin and cos of the phase of frame i + k, and is rotated by LANES frames per step.
+            // The first 4 lanes are looked up, the others are rotated from the 4 before them
+            alignas(16) float sin_lanes[LANES];
+            alignas(16) float cos_lanes[LANES];
+            alignas(16) float gain_lanes[LANES];
+            for (int k = 0; k < 4; ++k)
+            {
+                const uint32_t lane_phase = phase + increment * static_cast<uint32_t>(k);
+                sin_lanes[k] = sine(lane_phase);
+                cos_lanes[k] = cosine(lane_phase);
+            }
+            const float vector_sin = sine(increment * 4u);
+            const float vector_cos = cosine(increment * 4u);
+            for (int k = 4; k < LANES; ++k)
+            {
+                sin_lanes[k] = sin_lanes[k - 4] * vector_cos + cos_lanes[k - 4] * vector_sin;
+                cos_lanes[k] = cos_lanes[k - 4] * vector_cos - sin_lanes[k - 4] * vector_sin;
+            }
+            for (int k = 0; k < LANES; ++k)
+            {
+                gain_lanes[k] = gain + gain_step * static_cast<float>(k);
+            }
+            const uint32_t rotation = increment * static_cast<uint32_t>(LANES);
+            const float rotation_sin = sine(rotation);
+            const float rotation_cos = cosine(rotation);
+            const float lanes_gain_step = gain_step * static_cast<float>(LANES);
+            float *out = block_.data();
+#if defined(ULTRASOUND_WATERMARK_NEON)
+            float32x4_t s[VECTORS], c[VECTORS], g[VECTORS];
+            for (int v = 0; v < VECTORS; ++v)
+            {
+                s[v] = vld1q_f32(sin_lanes + 4 * v);
+                c[v] = vld1q_f32(cos_lanes + 4 * v);
+                g[v] = vld1q_f32(gain_lanes + 4 * v);
+            }
+            const float32x4_t rs = vdupq_n_f32(rotation_sin);
+            const float32x4_t rc = vdupq_n_f32(rotation_cos);
+            const float32x4_t dg = vdupq_n_f32(lanes_gain_step);
+            for (int i = 0; i < BLOCK_FRAMES; i += LANES)
+            {
+                // Unrolled so that the vectors stay in registers (GCC and Clang both take this spelling)
+#pragma GCC unroll 4
+                for (int v = 0; v < VECTORS; ++v)
+                {
+                    vst1q_f32(out + i + 4 * v, vmlaq_f32(vld1q_f32(out + i + 4 * v), s[v], g[v]));
+                    const float32x4_t next_s = vmlaq_f32(vmulq_f32(s[v], rc), c[v], rs);
+                    c[v] = vmlsq_f32(vmulq_f32(c[v], rc), s[v], rs);
+                    s[v] = next_s;
+                    g[v] = vaddq_f32(g[v], dg);
+                }
+            }
+#elif defined(ULTRASOUND_WATERMARK_AVX2) || defined(ULTRASOUND_WATERMARK_SSE2)
+            __m128 s[VECTORS], c[VECTORS], g[VECTORS];
+            for (int v = 0; v < VECTORS; ++v)
+            {
+                s[v] = _mm_load_ps(sin_lanes + 4 * v);
+                c[v] = _mm_load_ps(cos_lanes + 4 * v);
+                g[v] = _mm_load_ps(gain_lanes + 4 * v);
+            }
+            const __m128 rs = _mm_set1_ps(rotation_sin);
+            const __m128 rc = _mm_set1_ps(rotation_cos);
+            const __m128 dg = _mm_set1_ps(lanes_gain_step);
+            for (int i = 0; i < BLOCK_FRAMES; i += LANES)
+            {
+                // Unrolled so that the vectors stay in registers (GCC and Clang both take this spelling)
+#pragma GCC unroll 4
+                for (int v = 0; v < VECTORS; ++v)
+                {
+                    _mm_storeu_ps(out + i + 4 * v, _mm_add_ps(_mm_loadu_ps(out + i + 4 * v), _mm_mul_ps(s[v], g[v])));
+                    const __m128 next_s = _mm_add_ps(_mm_mul_ps(s[v], rc), _mm_mul_ps(c[v], rs));
+                    c[v] = _mm_sub_ps(_mm_mul_ps(c[v], rc), _mm_mul_ps(s[v], rs));
+                    s[v] = next_s;
+                    g[v] = _mm_add_ps(g[v], dg);
+                }
+            }
+#else
+            for (int i = 0; i < BLOCK_FRAMES; i += LANES)
+            {
+                for (int k = 0; k < LANES; ++k)
+                {
+                    out[i + k] += sin_lanes[k] * gain_lanes[k];
+                    const float next_s = sin_lanes[k] * rotation_cos + cos_lanes[k] * rotation_sin;
+                    cos_lanes[k] = cos_lanes[k] * rotation_cos - sin_lanes[k] * rotation_sin;
+                    sin_lanes[k] = next_s;
+                    gain_lanes[k] += lanes_gain_step;
+                }
+            }
+#endif
+        }
+    };
+
+} // ase_ultrasound_watermark::dsp
+
+#endif //ULTRASOUNDWATERMARK_OSCILLATORBANK_HPP
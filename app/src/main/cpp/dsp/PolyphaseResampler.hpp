@@ -0,0 +1,308 @@
+#ifndef ULTRASOUNDWATERMARK_POLYPHASERESAMPLER_HPP
+#define ULTRASOUNDWATERMARK_POLYPHASERESAMPLER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "SampleConversion.hpp"
+
+namespace ase_ultrasound_watermark::dsp
+{
+    /**
+     * Streaming rational sample rate converter, e.g. between a device running at 44.1 kHz and the 48 kHz pipeline.
+     *
+     * The rates are reduced to L/M (160/147 for 44.1 -> 48 kHz) and a Kaiser-windowed sinc low-pass is split into its
+     * L polyphase branches, so that each output sample is a single dot product of TAPS_MULTIPLE-aligned length with
+     * the input history, vectorized with NEON or SSE (picked at compile time like the sample conversion kernels).
+     * The transition band runs from passband_hz up to the lower rate minus passband_hz: frequencies above the passband
+     * may alias, but only onto frequencies above the passband, which halves the filter length for the same attenuation.
+     * The default passband keeps the 16-17.5 kHz pilot band flat with margin.
+     *
+     * Output is aligned with the input: output frame n is the input at time n * input_rate / output_rate. The filter's
+     * look-ahead (latencyInputFrames()) is therefore needed before the first output frame.
+     *
+     * Input and output are interleaved. Neither process() nor inputFramesFor() allocate, lock or throw.
+     */
+    class PolyphaseResampler
+    {
+    public:
+        constexpr static float DEFAULT_PASSBAND_HZ = 19000.0f;
+        constexpr static float DEFAULT_ATTENUATION_DB = 90.0f;
+        /// Taps per branch are padded to a multiple of this, the width of the unrolled dot product
+        constexpr static int TAPS_MULTIPLE = 8;
+
+        /**
+         * @param max_input_frames Largest input to a single process() call
+         * @param passband_hz Highest frequency kept without attenuation
+         * @param attenuation_db Attenuation of everything that would alias into the passband
+         * @throw std::runtime_error if a rate is not positive or the passband is not below half the lower rate
+         */
+        PolyphaseResampler(int input_rate, int output_rate, int channels, size_t max_input_frames,
+                           float passband_hz = DEFAULT_PASSBAND_HZ, float attenuation_db = DEFAULT_ATTENUATION_DB)
+                : input_rate_{input_rate},
+                  output_rate_{output_rate},
+                  channels_{channels},
+                  max_input_frames_{max_input_frames}
+        {
+            if (input_rate <= 0 || output_rate <= 0 || channels <= 0)
+            {
+                throw std::runtime_error("Invalid resampler rates " + std::to_string(input_rate) + " -> " + std::to_string(output_rate));
+            }
+            const int lower_rate = std::min(input_rate, output_rate);
+            if (!(passband_hz > 0.0f && passband_hz < static_cast<float>(lower_rate) / 2.0f))
+            {
+                throw std::runtime_error("Resampler passband of " + std::to_string(std::lround(passband_hz)) + " Hz is not below " +
+                                         std::to_string(lower_rate / 2) + " Hz");
+            }
+            const int divisor = std::gcd(input_rate, output_rate);
+            up_ = output_rate / divisor;
+            down_ = input_rate / divisor;
+            step_frames_ = down_ / up_;
+            step_phase_ = down_ % up_;
+            design(passband_hz, static_cast<float>(lower_rate) - passband_hz, attenuation_db);
+            capacity_ = 2 * static_cast<size_t>(taps_) + max_input_frames_;
+            history_.assign(capacity_ * channels_, 0.0f);
+            reset();
+        }
+
+        [[nodiscard]] int getInputRate() const
+        {
+            return input_rate_;
+        }
+
+        [[nodiscard]] int getOutputRate() const
+        {
+            return output_rate_;
+        }
+
+        [[nodiscard]] int getTapsPerPhase() const
+        {
+            return taps_;
+        }
+
+        [[nodiscard]] size_t getMaxInputFrames() const
+        {
+            return max_input_frames_;
+        }
+
+        /// Input frames the first output frame waits for beyond its own
+        [[nodiscard]] int latencyInputFrames() const
+        {
+            return taps_ / 2;
+        }
+
+        /// Most output frames process() returns for input_frames, if every call takes all the output its input completes
+        [[nodiscard]] size_t maxOutputFrames(size_t input_frames) const
+        {
+            return MaxOutputFrames(input_rate_, output_rate_, input_frames);
+        }
+
+        static size_t MaxOutputFrames(int input_rate, int output_rate, size_t input_frames)
+        {
+            return (input_frames * static_cast<size_t>(output_rate) + static_cast<size_t>(input_rate) - 1) / static_cast<size_t>(input_rate);
+        }
+
+        /// Input frames process() needs before it can return output_frames, given what it holds already
+        [[nodiscard]] size_t inputFramesFor(size_t output_frames) const
+        {
+            if (output_frames == 0)
+            {
+                return 0;
+            }
+            const size_t last = position_ + (phase_ + (output_frames - 1) * down_) / up_;
+            return last < length_ ? 0 : last + 1 - length_;
+        }
+
+        /**
+         * Append input and write the output frames that it completes, up to max_output_frames; those beyond are
+         * returned by the next call.
+         * @param input_frames At most getMaxInputFrames()
+         * @return Output frames written
+         */
+        size_t process(const float *in, size_t input_frames, float *out, size_t max_output_frames)
+        {
+            input_frames = std::min(input_frames, max_input_frames_);
+            for (int c = 0; c < channels_; ++c)
+            {
+                float *history = channelHistory(c) + length_;
+                for (size_t i = 0; i < input_frames; ++i)
+                {
+                    history[i] = in[i * channels_ + c];
+                }
+            }
+            length_ += input_frames;
+
+            size_t produced = 0;
+            while (produced < max_output_frames && position_ < length_)
+            {
+                const float *coefficients = coefficients_.data() + phase_ * static_cast<size_t>(taps_);
+                const size_t window = position_ + 1 - static_cast<size_t>(taps_);
+                for (int c = 0; c < channels_; ++c)
+                {
+                    out[produced * channels_ + c] = dot(channelHistory(c) + window, coefficients, taps_);
+                }
+                ++produced;
+                position_ += step_frames_;
+                phase_ += step_phase_;
+                if (phase_ >= up_)
+                {
+                    phase_ -= up_;
+                    ++position_;
+                }
+            }
+
+            // Keep the history the next output needs
+            const size_t keep_from = std::min(position_ + 1 - static_cast<size_t>(taps_), length_);
+            if (keep_from > 0)
+            {
+                for (int c = 0; c < channels_; ++c)
+                {
+                    float *history = channelHistory(c);
+                    std::copy(history + keep_from, history + length_, history);
+                }
+                length_ -= keep_from;
+                position_ -= keep_from;
+            }
+            return produced;
+        }
+
+        /// Forget all input, as if newly constructed
+        void reset()
+        {
+            std::fill(history_.begin(), history_.end(), 0.0f);
+            // taps_ - 1 frames of silence precede the input. Starting half the filter later aligns the output with it
+            length_ = static_cast<size_t>(taps_) - 1;
+            position_ = length_ + static_cast<size_t>(taps_ / 2);
+            phase_ = 0;
+        }
+
+    private:
+        const int input_rate_;
+        const int output_rate_;
+        const int channels_;
+        const size_t max_input_frames_;
+        size_t up_;
+        size_t down_;
+        /// down_ / up_ input frames per output frame, as whole frames and branches
+        size_t step_frames_;
+        size_t step_phase_;
+        int taps_;
+        /// Branch p holds its taps in input order, so that its dot product runs forward over the history
+        std::vector<float> coefficients_;
+        size_t capacity_;
+        /// Per channel, capacity_ frames of input from the oldest the next output needs
+        std::vector<float> history_;
+        /// Frames held per channel
+        size_t length_;
+        /// Newest input frame of the next output, and its branch
+        size_t position_;
+        size_t phase_;
+
+        float *channelHistory(int channel)
+        {
+            return history_.data() + static_cast<size_t>(channel) * capacity_;
+        }
+
+        static double besselI0(double x)
+        {
+            double sum = 1.0;
+            double term = 1.0;
+            for (int k = 1; k < 50 && term > 1e-12 * sum; ++k)
+            {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        }
+
+        void design(float passband_hz, float stopband_hz, float attenuation_db)
+        {
+            // Kaiser's formulas, with the transition width relative to the up-sampled rate
+            const double upsampled_rate = static_cast<double>(input_rate_) * static_cast<double>(up_);
+            const double transition = 2.0 * std::numbers::pi * (stopband_hz - passband_hz) / upsampled_rate;
+            const double beta = attenuation_db > 50.0f ? 0.1102 * (attenuation_db - 8.7)
+                                                       : 0.5842 * std::pow(std::max(attenuation_db - 21.0f, 0.0f), 0.4) +
+                                                         0.07886 * (attenuation_db - 21.0);
+            const auto length = static_cast<size_t>(std::ceil((attenuation_db - 8.0) / (2.285 * transition)));
+            taps_ = static_cast<int>((length + up_ - 1) / up_);
+            taps_ = (taps_ + TAPS_MULTIPLE - 1) / TAPS_MULTIPLE * TAPS_MULTIPLE;
+
+            const size_t total = up_ * static_cast<size_t>(taps_);
+            const double cutoff = (passband_hz + stopband_hz) / upsampled_rate; // In cycles per sample, times two
+            // Centered on a tap rather than between two, so that branch 0 at taps_ / 2 past an input frame is that frame
+            const double center = static_cast<double>(total / 2);
+            const double window_norm = besselI0(beta);
+            std::vector<double> prototype(total);
+            for (size_t j = 0; j < total; ++j)
+            {
+                const double t = static_cast<double>(j) - center;
+                const double sinc = t == 0.0 ? 1.0 : std::sin(std::numbers::pi * cutoff * t) / (std::numbers::pi * cutoff * t);
+                const double r = t / (center + 1.0);
+                prototype[j] = cutoff * sinc * besselI0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / window_norm;
+            }
+            coefficients_.assign(total, 0.0f);
+            for (size_t p = 0; p < up_; ++p)
+            {
+                // Branch p sees input frame position - k through prototype tap p + k * up_. Normalized to unit DC
+                // gain, so that no branch is louder than another
+                double sum = 0.0;
+                for (int k = 0; k < taps_; ++k)
+                {
+                    sum += prototype[p + static_cast<size_t>(k) * up_];
+                }
+                for (int k = 0; k < taps_; ++k)
+                {
+                    coefficients_[p * taps_ + (taps_ - 1 - k)] = static_cast<float>(prototype[p + static_cast<size_t>(k) * up_] / sum);
+                }
+            }
+        }
+
+        /// Dot product of two arrays of length, a multiple of TAPS_MULTIPLE
+        static float dot(const float *a, const float *b, int length)
+        {
+#if defined(ULTRASOUND_WATERMARK_NEON)
+            float32x4_t acc0 = vdupq_n_f32(0.0f);
+            float32x4_t acc1 = vdupq_n_f32(0.0f);
+            for (int i = 0; i < length; i += 8)
+            {
+                acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+                acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+            }
+            const float32x4_t sum = vaddq_f32(acc0, acc1);
+            const float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+            return vget_lane_f32(vpadd_f32(half, half), 0);
+#elif defined(ULTRASOUND_WATERMARK_AVX2) || defined(ULTRASOUND_WATERMARK_SSE2)
+            __m128 acc0 = _mm_setzero_ps();
+            __m128 acc1 = _mm_setzero_ps();
+            for (int i = 0; i < length; i += 8)
+            {
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+                acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+            }
+            __m128 sum = _mm_add_ps(acc0, acc1);
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            return _mm_cvtss_f32(sum);
+#else
+            float acc[8] = {};
+            for (int i = 0; i < length; i += 8)
+            {
+                for (int k = 0; k < 8; ++k)
+                {
+                    acc[k] += a[i + k] * b[i + k];
+                }
+            }
+            return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+#endif
+        }
+    };
+
+} // ase_ultrasound_watermark::dsp
+
+#endif //ULTRASOUNDWATERMARK_POLYPHASERESAMPLER_HPP
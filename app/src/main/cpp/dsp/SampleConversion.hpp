@@ -0,0 +1,141 @@
+#ifndef ULTRASOUNDWATERMARK_SAMPLECONVERSION_HPP
+#define ULTRASOUNDWATERMARK_SAMPLECONVERSION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ULTRASOUND_WATERMARK_NEON 1
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define ULTRASOUND_WATERMARK_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ULTRASOUND_WATERMARK_SSE2 1
+#endif
+
+/**
+ * PCM16 <-> float conversion kernels. Full scale is 32768 in both directions, i.e. -32768 maps to -1.0f and
+ * +1.0f saturates to 32767 (SIMD paths saturate correctly for inputs within +-65536.0f, far beyond any real signal).
+ * This must match ase::FormatConversionStream, which the kernels replace; ultrasound_watermark_conversion_bench
+ * compares their output sample by sample and fails on any difference.
+ * The instruction set is picked at compile time: NEON on Android arm builds,
+ * AVX2 or SSE2 on x86 depending on the target flags, scalar otherwise.
+ */
+namespace ase_ultrasound_watermark::dsp
+{
+    constexpr float PCM16_TO_FLOAT = 1.0f / 32768.0f;
+    constexpr float FLOAT_TO_PCM16 = 32768.0f;
+
+    /// Name of the instruction set the kernels were compiled for
+    constexpr const char *conversionInstructionSet()
+    {
+#if defined(ULTRASOUND_WATERMARK_NEON)
+        return "neon";
+#elif defined(ULTRASOUND_WATERMARK_AVX2)
+        return "avx2";
+#elif defined(ULTRASOUND_WATERMARK_SSE2)
+        return "sse2";
+#else
+        return "scalar";
+#endif
+    }
+
+    inline void int16ToFloatScalar(const int16_t *in, float *out, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            out[i] = static_cast<float>(in[i]) * PCM16_TO_FLOAT;
+        }
+    }
+
+    inline void floatToInt16Scalar(const float *in, int16_t *out, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            const float scaled = std::nearbyint(in[i] * FLOAT_TO_PCM16);
+            out[i] = static_cast<int16_t>(std::clamp(scaled, -32768.0f, 32767.0f));
+        }
+    }
+
+    inline void int16ToFloat(const int16_t *in, float *out, size_t size)
+    {
+        size_t i = 0;
+#if defined(ULTRASOUND_WATERMARK_NEON)
+        const float32x4_t scale = vdupq_n_f32(PCM16_TO_FLOAT);
+        for (; i + 8 <= size; i += 8)
+        {
+            const int16x8_t x = vld1q_s16(in + i);
+            vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+            vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+        }
+#elif defined(ULTRASOUND_WATERMARK_AVX2)
+        const __m256 scale = _mm256_set1_ps(PCM16_TO_FLOAT);
+        for (; i + 16 <= size; i += 16)
+        {
+            const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 8));
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(lo)), scale));
+            _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(hi)), scale));
+        }
+#elif defined(ULTRASOUND_WATERMARK_SSE2)
+        const __m128 scale = _mm_set1_ps(PCM16_TO_FLOAT);
+        for (; i + 8 <= size; i += 8)
+        {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+            // Sign-extend by placing each sample in the upper half of a 32-bit lane and shifting it back down
+            const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+            const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+        }
+#endif
+        int16ToFloatScalar(in + i, out + i, size - i);
+    }
+
+    inline void floatToInt16(const float *in, int16_t *out, size_t size)
+    {
+        size_t i = 0;
+#if defined(ULTRASOUND_WATERMARK_NEON)
+        const float32x4_t scale = vdupq_n_f32(FLOAT_TO_PCM16);
+        for (; i + 8 <= size; i += 8)
+        {
+#if defined(__aarch64__)
+            const int32x4_t lo = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + i), scale));
+            const int32x4_t hi = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + i + 4), scale));
+#else
+            // ARMv7 has no round-to-nearest conversion, truncation is off by at most one LSB
+            const int32x4_t lo = vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i), scale));
+            const int32x4_t hi = vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i + 4), scale));
+#endif
+            // Saturating narrow to int16
+            vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+        }
+#elif defined(ULTRASOUND_WATERMARK_AVX2)
+        const __m256 scale = _mm256_set1_ps(FLOAT_TO_PCM16);
+        for (; i + 16 <= size; i += 16)
+        {
+            const __m256i lo = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale));
+            const __m256i hi = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale));
+            // packs works within 128-bit lanes, restore sample order afterwards
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), packed);
+        }
+#elif defined(ULTRASOUND_WATERMARK_SSE2)
+        const __m128 scale = _mm_set1_ps(FLOAT_TO_PCM16);
+        for (; i + 8 <= size; i += 8)
+        {
+            const __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), scale));
+            const __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(lo, hi));
+        }
+#endif
+        floatToInt16Scalar(in + i, out + i, size - i);
+    }
+
+} // ase_ultrasound_watermark::dsp
+
+#endif //ULTRASOUNDWATERMARK_SAMPLECONVERSION_HPP
@@ -0,0 +1,456 @@
+#ifndef ULTRASOUNDWATERMARK_HOSTAUDIODEVICE_HPP
+#define ULTRASOUNDWATERMARK_HOSTAUDIODEVICE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <ase/utilities/AudioBufferOperations.hpp>
+
+namespace ase_android
+{
+    /**
+     * An audio endpoint used by the host (Linux) oboe backend in place of a real device.
+     * Samples are exchanged as interleaved floats in [-1, 1]. The host AudioStream converts them from/to the stream format.
+     */
+    class HostAudioDevice
+    {
+    public:
+        /// Called after each transfer with the device position before the transfer and the number of frames transferred
+        using TransferObserver = std::function<void(int64_t position_frames, int32_t num_frames)>;
+
+        /**
+         * @param sample_rate Sample rate of the device, or 0 if the device accepts any rate
+         * @param speed Playback speed relative to real time. 1.0 paces callbacks in real time, 0 runs as fast as possible
+         */
+        explicit HostAudioDevice(int32_t sample_rate, double speed)
+                : sample_rate_{sample_rate},
+                  speed_{speed},
+                  position_frames_{0}
+        {
+        }
+
+        virtual ~HostAudioDevice() = default;
+
+        [[nodiscard]] virtual bool supportsInput() const = 0;
+
+        [[nodiscard]] virtual bool supportsOutput() const = 0;
+
+        /**
+         * Fill the buffer with captured audio.
+         * @return Number of frames captured. 0 indicates end of stream and stops the stream.
+         */
+        int32_t capture(float *data, int32_t num_frames, int32_t channels)
+        {
+            const int32_t captured = onCapture(data, num_frames, channels);
+            notifyTransfer(captured);
+            return captured;
+        }
+
+        void render(const float *data, int32_t num_frames, int32_t channels)
+        {
+            onRender(data, num_frames, channels);
+            notifyTransfer(num_frames);
+        }
+
+        [[nodiscard]] int32_t getSampleRate() const
+        {
+            return sample_rate_;
+        }
+
+        [[nodiscard]] double getSpeed() const
+        {
+            return speed_;
+        }
+
+        [[nodiscard]] int64_t getPositionFrames() const
+        {
+            return position_frames_.load(std::memory_order_acquire);
+        }
+
+        /// Observer is called on the stream thread. Set it before starting the stream.
+        void setTransferObserver(TransferObserver observer)
+        {
+            observer_ = std::move(observer);
+        }
+
+        template<typename SAMPLE_T>
+        static void pcmToFloat(const SAMPLE_T *in, float *out, size_t samples)
+        {
+            constexpr float scale = 1.0f / static_cast<float>(std::numeric_limits<SAMPLE_T>::max());
+            for (size_t i = 0; i < samples; ++i)
+            {
+                out[i] = static_cast<float>(in[i]) * scale;
+            }
+        }
+
+        template<typename SAMPLE_T>
+        static void floatToPcm(const float *in, SAMPLE_T *out, size_t samples)
+        {
+            constexpr auto scale = static_cast<double>(std::numeric_limits<SAMPLE_T>::max());
+            for (size_t i = 0; i < samples; ++i)
+            {
+                const double clamped = std::clamp(static_cast<double>(in[i]), -1.0, 1.0);
+                out[i] = static_cast<SAMPLE_T>(std::lround(clamped * scale));
+            }
+        }
+
+    protected:
+        virtual int32_t onCapture(float *data, int32_t num_frames, int32_t channels) = 0;
+
+        virtual void onRender(const float *data, int32_t num_frames, int32_t channels) = 0;
+
+    private:
+        const int32_t sample_rate_;
+        const double speed_;
+        std::atomic<int64_t> position_frames_;
+        TransferObserver observer_;
+
+        void notifyTransfer(int32_t num_frames)
+        {
+            const int64_t position = position_frames_.fetch_add(num_frames, std::memory_order_acq_rel);
+            if (observer_ && num_frames > 0)
+            {
+                observer_(position, num_frames);
+            }
+        }
+    };
+
+    /// Captures silence and discards everything rendered to it
+    class NullAudioDevice : public HostAudioDevice
+    {
+    public:
+        explicit NullAudioDevice(int32_t sample_rate = 0, double speed = 1.0) : HostAudioDevice{sample_rate, speed}
+        {
+        }
+
+        [[nodiscard]] bool supportsInput() const override
+        {
+            return true;
+        }
+
+        [[nodiscard]] bool supportsOutput() const override
+        {
+            return true;
+        }
+
+    protected:
+        int32_t onCapture(float *data, int32_t num_frames, int32_t channels) override
+        {
+            std::fill(data, data + static_cast<size_t>(num_frames) * channels, 0.0f);
+            return num_frames;
+        }
+
+        void onRender(const float *data, int32_t num_frames, int32_t channels) override
+        {
+        }
+    };
+
+    /// Captures the content of a WAV file, optionally looping it. Channels are duplicated or dropped to match the stream.
+    class WavFileInputDevice : public HostAudioDevice
+    {
+    public:
+        WavFileInputDevice(const std::filesystem::path &path, double speed, bool loop)
+                : HostAudioDevice{0, speed},
+                  loop_{loop},
+                  read_position_frames_{0}
+        {
+            int fs = 0;
+            size_t length = 0;
+            auto pcm = ase::readBufferFromWavFile<int16_t>(path, fs, file_channels_, length);
+            if (!pcm || fs <= 0 || file_channels_ <= 0)
+            {
+                throw std::runtime_error("Cannot read WAV file " + path.string());
+            }
+            file_sample_rate_ = fs;
+            length_frames_ = length;
+            samples_.resize(length_frames_ * file_channels_);
+            pcmToFloat(pcm.get(), samples_.data(), samples_.size());
+        }
+
+        [[nodiscard]] bool supportsInput() const override
+        {
+            return true;
+        }
+
+        [[nodiscard]] bool supportsOutput() const override
+        {
+            return false;
+        }
+
+        [[nodiscard]] int32_t getFileSampleRate() const
+        {
+            return file_sample_rate_;
+        }
+
+        [[nodiscard]] size_t getLengthFrames() const
+        {
+            return length_frames_;
+        }
+
+        [[nodiscard]] bool isExhausted() const
+        {
+            return !loop_ && read_position_frames_.load(std::memory_order_acquire) >= length_frames_;
+        }
+
+    protected:
+        int32_t onCapture(float *data, int32_t num_frames, int32_t channels) override
+        {
+            size_t position = read_position_frames_.load(std::memory_order_relaxed);
+            int32_t captured = 0;
+            while (captured < num_frames && length_frames_ > 0)
+            {
+                if (position >= length_frames_)
+                {
+                    if (!loop_)
+                    {
+                        break;
+                    }
+                    position = 0;
+                }
+                const float *frame = samples_.data() + position * file_channels_;
+                for (int32_t c = 0; c < channels; ++c)
+                {
+                    data[static_cast<size_t>(captured) * channels + c] = frame[std::min(c, file_channels_ - 1)];
+                }
+                ++position;
+                ++captured;
+            }
+            read_position_frames_.store(position, std::memory_order_release);
+            return captured;
+        }
+
+        void onRender(const float *data, int32_t num_frames, int32_t channels) override
+        {
+        }
+
+    private:
+        const bool loop_;
+        int file_channels_ = 0;
+        int32_t file_sample_rate_ = 0;
+        size_t length_frames_ = 0;
+        std::vector<float> samples_;
+        std::atomic<size_t> read_position_frames_;
+    };
+
+    /// Writes everything rendered to it into a 16-bit PCM WAV file. The header is finalized on destruction.
+    class WavFileOutputDevice : public HostAudioDevice
+    {
+    public:
+        WavFileOutputDevice(const std::filesystem::path &path, int32_t sample_rate, int32_t channels, double speed)
+                : HostAudioDevice{sample_rate, speed},
+                  file_{path, std::ios::binary | std::ios::trunc},
+                  channels_{channels},
+                  data_bytes_{0}
+        {
+            if (!file_)
+            {
+                throw std::runtime_error("Cannot open WAV file " + path.string());
+            }
+            writeHeader();
+        }
+
+        ~WavFileOutputDevice() override
+        {
+            std::lock_guard lock{mutex_};
+            file_.seekp(0);
+            writeHeader();
+        }
+
+        [[nodiscard]] bool supportsInput() const override
+        {
+            return false;
+        }
+
+        [[nodiscard]] bool supportsOutput() const override
+        {
+            return true;
+        }
+
+    protected:
+        int32_t onCapture(float *data, int32_t num_frames, int32_t channels) override
+        {
+            return 0;
+        }
+
+        void onRender(const float *data, int32_t num_frames, int32_t channels) override
+        {
+            std::lock_guard lock{mutex_};
+            pcm_.resize(static_cast<size_t>(num_frames) * channels_);
+            for (int32_t i = 0; i < num_frames; ++i)
+            {
+                for (int32_t c = 0; c < channels_; ++c)
+                {
+                    floatToPcm(data + static_cast<size_t>(i) * channels + std::min(c, channels - 1),
+                               pcm_.data() + static_cast<size_t>(i) * channels_ + c, 1);
+                }
+            }
+            file_.write(reinterpret_cast<const char *>(pcm_.data()), static_cast<std::streamsize>(pcm_.size() * sizeof(int16_t)));
+            data_bytes_ += static_cast<uint32_t>(pcm_.size() * sizeof(int16_t));
+        }
+
+    private:
+        std::mutex mutex_;
+        std::ofstream file_;
+        const int32_t channels_;
+        uint32_t data_bytes_;
+        std::vector<int16_t> pcm_;
+
+        template<typename T>
+        void put(T value)
+        {
+            file_.write(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        void writeHeader()
+        {
+            const auto block_align = static_cast<uint16_t>(channels_ * sizeof(int16_t));
+            file_.write("RIFF", 4);
+            put<uint32_t>(36 + data_bytes_);
+            file_.write("WAVEfmt ", 8);
+            put<uint32_t>(16);
+            put<uint16_t>(1); // PCM
+            put<uint16_t>(static_cast<uint16_t>(channels_));
+            put<uint32_t>(static_cast<uint32_t>(getSampleRate()));
+            put<uint32_t>(static_cast<uint32_t>(getSampleRate()) * block_align);
+            put<uint16_t>(block_align);
+            put<uint16_t>(16);
+            file_.write("data", 4);
+            put<uint32_t>(data_bytes_);
+        }
+    };
+
+    /**
+     * In-memory loopback. Audio rendered by an output stream is captured by an input stream opened on the same device.
+     * Capturing from an empty loopback yields silence and counts an underrun.
+     */
+    class LoopbackAudioDevice : public HostAudioDevice
+    {
+    public:
+        explicit LoopbackAudioDevice(int32_t sample_rate = 0, double speed = 1.0, size_t capacity_samples = 1 << 20)
+                : HostAudioDevice{sample_rate, speed},
+                  capacity_samples_{capacity_samples},
+                  underruns_{0}
+        {
+        }
+
+        [[nodiscard]] bool supportsInput() const override
+        {
+            return true;
+        }
+
+        [[nodiscard]] bool supportsOutput() const override
+        {
+            return true;
+        }
+
+        [[nodiscard]] int64_t getUnderrunCount() const
+        {
+            return underruns_.load(std::memory_order_relaxed);
+        }
+
+    protected:
+        int32_t onCapture(float *data, int32_t num_frames, int32_t channels) override
+        {
+            std::lock_guard lock{mutex_};
+            const size_t wanted = static_cast<size_t>(num_frames) * channels;
+            const size_t available = std::min(wanted, samples_.size());
+            std::copy(samples_.begin(), samples_.begin() + static_cast<std::ptrdiff_t>(available), data);
+            samples_.erase(samples_.begin(), samples_.begin() + static_cast<std::ptrdiff_t>(available));
+            if (available < wanted)
+            {
+                std::fill(data + available, data + wanted, 0.0f);
+                underruns_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return num_frames;
+        }
+
+        void onRender(const float *data, int32_t num_frames, int32_t channels) override
+        {
+            std::lock_guard lock{mutex_};
+            samples_.insert(samples_.end(), data, data + static_cast<size_t>(num_frames) * channels);
+            if (samples_.size() > capacity_samples_)
+            {
+                samples_.erase(samples_.begin(), samples_.begin() + static_cast<std::ptrdiff_t>(samples_.size() - capacity_samples_));
+            }
+        }
+
+    private:
+        std::mutex mutex_;
+        std::deque<float> samples_;
+        const size_t capacity_samples_;
+        std::atomic<int64_t> underruns_;
+    };
+
+    /**
+     * Maps device ids used by the oboe adapters to host devices.
+     * Unregistered default ids (0 or -1) resolve to a real-time NullAudioDevice.
+     */
+    class HostAudioDeviceRegistry
+    {
+    public:
+        static HostAudioDeviceRegistry &instance()
+        {
+            static HostAudioDeviceRegistry registry;
+            return registry;
+        }
+
+        void add(int32_t device_id, std::shared_ptr<HostAudioDevice> device)
+        {
+            std::lock_guard lock{mutex_};
+            devices_[device_id] = std::move(device);
+        }
+
+        void remove(int32_t device_id)
+        {
+            std::lock_guard lock{mutex_};
+            devices_.erase(device_id);
+        }
+
+        void clear()
+        {
+            std::lock_guard lock{mutex_};
+            devices_.clear();
+        }
+
+        std::shared_ptr<HostAudioDevice> find(int32_t device_id, bool input)
+        {
+            std::lock_guard lock{mutex_};
+            auto it = devices_.find(device_id);
+            if (it == devices_.end())
+            {
+                if (device_id == 0 || device_id == -1)
+                {
+                    return std::make_shared<NullAudioDevice>();
+                }
+                return nullptr;
+            }
+            if ((input && !it->second->supportsInput()) || (!input && !it->second->supportsOutput()))
+            {
+                return nullptr;
+            }
+            return it->second;
+        }
+
+    private:
+        HostAudioDeviceRegistry() = default;
+
+        std::mutex mutex_;
+        std::map<int32_t, std::shared_ptr<HostAudioDevice>> devices_;
+    };
+
+} // ase_android
+
+#endif //ULTRASOUNDWATERMARK_HOSTAUDIODEVICE_HPP
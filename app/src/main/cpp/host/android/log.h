@@ -0,0 +1,34 @@
+#ifndef ULTRASOUNDWATERMARK_HOST_ANDROID_LOG_H
+#define ULTRASOUNDWATERMARK_HOST_ANDROID_LOG_H
+
+// Host (Linux) stand-in for <android/log.h>. Log lines are written to stderr.
+
+#include <cstdarg>
+#include <cstdio>
+
+typedef enum android_LogPriority
+{
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+inline int __android_log_print(int prio, const char *tag, const char *fmt, ...)
+{
+    static constexpr char PRIORITY_LETTERS[] = "??VDIWEFS";
+    std::fprintf(stderr, "%c/%s: ", PRIORITY_LETTERS[prio >= 0 && prio <= ANDROID_LOG_SILENT ? prio : 0], tag);
+    va_list args;
+    va_start(args, fmt);
+    const int written = std::vfprintf(stderr, fmt, args);
+    va_end(args);
+    std::fputc('\n', stderr);
+    return written;
+}
+
+#endif //ULTRASOUNDWATERMARK_HOST_ANDROID_LOG_H
@@ -0,0 +1,659 @@
+#ifndef ULTRASOUNDWATERMARK_HOST_OBOE_H
+#define ULTRASOUNDWATERMARK_HOST_OBOE_H
+
+// Host (Linux) stand-in for the subset of the oboe API used by ase_android::OboeStreamAdapter and its subclasses.
+// Streams are not backed by audio hardware. Instead, every device id is resolved through
+// ase_android::HostAudioDeviceRegistry to a WAV file, an in-memory loopback or a null device,
+// and a thread per stream drives the data callback either in real time or as fast as possible.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "HostAudioDevice.hpp"
+
+namespace oboe
+{
+    constexpr int32_t kUnspecified = 0;
+
+    /// Stream properties used when a builder leaves them unspecified, set by apps from AudioManager
+    class DefaultStreamValues
+    {
+    public:
+        inline static int32_t SampleRate = 48000;
+        inline static int32_t FramesPerBurst = 192;
+        inline static int32_t ChannelCount = 2;
+    };
+
+    enum class Result : int32_t
+    {
+        OK = 0,
+        ErrorBase = -900,
+        ErrorDisconnected = -899,
+        ErrorIllegalArgument = -898,
+        ErrorInternal = -896,
+        ErrorInvalidState = -895,
+        ErrorUnimplemented = -890,
+        ErrorUnavailable = -889,
+        ErrorInvalidFormat = -883,
+        ErrorInvalidRate = -880,
+        ErrorClosed = -869,
+    };
+
+    enum class StreamState : int32_t
+    {
+        Uninitialized = 0,
+        Unknown = 1,
+        Open = 2,
+        Starting = 3,
+        Started = 4,
+        Pausing = 5,
+        Paused = 6,
+        Flushing = 7,
+        Flushed = 8,
+        Stopping = 9,
+        Stopped = 10,
+        Closing = 11,
+        Closed = 12,
+        Disconnected = 13,
+    };
+
+    enum class Direction : int32_t
+    {
+        Output = 0,
+        Input = 1,
+    };
+
+    enum class AudioFormat : int32_t
+    {
+        Invalid = -1,
+        Unspecified = 0,
+        I16 = 1,
+        Float = 2,
+        I24 = 3,
+        I32 = 4,
+    };
+
+    enum class DataCallbackResult : int32_t
+    {
+        Continue = 0,
+        Stop = 1,
+    };
+
+    enum class SharingMode : int32_t
+    {
+        Exclusive = 0,
+        Shared = 1,
+    };
+
+    enum class PerformanceMode : int32_t
+    {
+        None = 10,
+        PowerSaving = 11,
+        LowLatency = 12,
+    };
+
+    enum class AudioApi : int32_t
+    {
+        Unspecified = kUnspecified,
+        OpenSLES,
+        AAudio,
+    };
+
+    enum class SampleRateConversionQuality : int32_t
+    {
+        None,
+        Fastest,
+        Low,
+        Medium,
+        High,
+        Best,
+    };
+
+    enum class ContentType : int32_t
+    {
+        Speech = 1,
+        Music = 2,
+        Movie = 3,
+        Sonification = 4,
+    };
+
+    enum class Usage : int32_t
+    {
+        Media = 1,
+        VoiceCommunication = 2,
+        VoiceCommunicationSignalling = 3,
+        Alarm = 4,
+        Notification = 5,
+        NotificationRingtone = 6,
+        Game = 14,
+        Assistant = 16,
+    };
+
+    enum class InputPreset : int32_t
+    {
+        Generic = 1,
+        Camcorder = 5,
+        VoiceRecognition = 6,
+        VoiceCommunication = 7,
+        Unprocessed = 9,
+        VoicePerformance = 10,
+    };
+
+    class AudioStream;
+
+    class AudioStreamDataCallback
+    {
+    public:
+        virtual ~AudioStreamDataCallback() = default;
+
+        virtual DataCallbackResult onAudioReady(AudioStream *audioStream, void *audioData, int32_t numFrames) = 0;
+    };
+
+    class AudioStreamErrorCallback
+    {
+    public:
+        virtual ~AudioStreamErrorCallback() = default;
+
+        virtual bool onError(AudioStream *audioStream, Result error)
+        {
+            return false;
+        }
+
+        virtual void onErrorBeforeClose(AudioStream *audioStream, Result error)
+        {
+        }
+
+        virtual void onErrorAfterClose(AudioStream *audioStream, Result error)
+        {
+        }
+    };
+
+    template<typename T>
+    class ResultWithValue
+    {
+    public:
+        explicit ResultWithValue(T value) : value_{value}, error_{Result::OK}
+        {
+        }
+
+        explicit ResultWithValue(Result error) : value_{}, error_{error}
+        {
+        }
+
+        explicit operator bool() const
+        {
+            return error_ == Result::OK;
+        }
+
+        [[nodiscard]] T value() const
+        {
+            return value_;
+        }
+
+        [[nodiscard]] Result error() const
+        {
+            return error_;
+        }
+
+    private:
+        T value_;
+        Result error_;
+    };
+
+    struct AudioStreamBase
+    {
+        int32_t device_id = kUnspecified;
+        Direction direction = Direction::Output;
+        SharingMode sharing_mode = SharingMode::Shared;
+        PerformanceMode performance_mode = PerformanceMode::None;
+        AudioApi audio_api = AudioApi::Unspecified;
+        AudioFormat format = AudioFormat::Unspecified;
+        int32_t channel_count = kUnspecified;
+        int32_t sample_rate = kUnspecified;
+        int32_t frames_per_data_callback = kUnspecified;
+        AudioStreamDataCallback *data_callback = nullptr;
+        AudioStreamErrorCallback *error_callback = nullptr;
+    };
+
+    class AudioStream
+    {
+    public:
+        /// Frames handed to the data callback when the builder did not request a size
+        static constexpr int32_t DEFAULT_FRAMES_PER_BURST = 192;
+
+        AudioStream(const AudioStreamBase &properties, std::shared_ptr<ase_android::HostAudioDevice> device)
+                : properties_{properties},
+                  device_{std::move(device)},
+                  state_{StreamState::Open},
+                  xrun_count_{0}
+        {
+            if (properties_.frames_per_data_callback <= 0)
+            {
+                properties_.frames_per_data_callback = DEFAULT_FRAMES_PER_BURST;
+            }
+        }
+
+        AudioStream(const AudioStream &) = delete;
+
+        AudioStream &operator=(const AudioStream &) = delete;
+
+        ~AudioStream()
+        {
+            close();
+        }
+
+        Result requestStart()
+        {
+            std::lock_guard lock{control_mutex_};
+            if (state_ == StreamState::Closed)
+            {
+                return Result::ErrorClosed;
+            }
+            if (state_ == StreamState::Started)
+            {
+                return Result::OK;
+            }
+            joinWorker();
+            state_ = StreamState::Started;
+            worker_ = std::thread{&AudioStream::run, this};
+            return Result::OK;
+        }
+
+        Result requestStop()
+        {
+            StreamState expected = StreamState::Started;
+            state_.compare_exchange_strong(expected, StreamState::Stopping);
+            return Result::OK;
+        }
+
+        Result stop()
+        {
+            std::lock_guard lock{control_mutex_};
+            requestStop();
+            joinWorker();
+            if (state_ != StreamState::Closed)
+            {
+                state_ = StreamState::Stopped;
+            }
+            return Result::OK;
+        }
+
+        Result close()
+        {
+            stop();
+            state_ = StreamState::Closed;
+            return Result::OK;
+        }
+
+        [[nodiscard]] StreamState getState() const
+        {
+            return state_;
+        }
+
+        [[nodiscard]] int32_t getSampleRate() const
+        {
+            return properties_.sample_rate;
+        }
+
+        [[nodiscard]] int32_t getChannelCount() const
+        {
+            return properties_.channel_count;
+        }
+
+        [[nodiscard]] int32_t getDeviceId() const
+        {
+            return properties_.device_id;
+        }
+
+        [[nodiscard]] Direction getDirection() const
+        {
+            return properties_.direction;
+        }
+
+        [[nodiscard]] AudioFormat getFormat() const
+        {
+            return properties_.format;
+        }
+
+        [[nodiscard]] SharingMode getSharingMode() const
+        {
+            return properties_.sharing_mode;
+        }
+
+        [[nodiscard]] PerformanceMode getPerformanceMode() const
+        {
+            return properties_.performance_mode;
+        }
+
+        [[nodiscard]] AudioApi getAudioApi() const
+        {
+            return properties_.audio_api;
+        }
+
+        [[nodiscard]] int32_t getFramesPerBurst() const
+        {
+            return properties_.frames_per_data_callback;
+        }
+
+        [[nodiscard]] int32_t getFramesPerDataCallback() const
+        {
+            return properties_.frames_per_data_callback;
+        }
+
+        /// Callbacks run back to back from the device thread, like a double-buffered device
+        [[nodiscard]] int32_t getBufferSizeInFrames() const
+        {
+            return 2 * properties_.frames_per_data_callback;
+        }
+
+        [[nodiscard]] ResultWithValue<int32_t> getXRunCount() const
+        {
+            return ResultWithValue<int32_t>{xrun_count_.load(std::memory_order_relaxed)};
+        }
+
+        [[nodiscard]] bool isXRunCountSupported() const
+        {
+            return true;
+        }
+
+    private:
+        AudioStreamBase properties_;
+        std::shared_ptr<ase_android::HostAudioDevice> device_;
+        std::atomic<StreamState> state_;
+        std::atomic<int32_t> xrun_count_;
+        std::mutex control_mutex_;
+        std::thread worker_;
+
+        void joinWorker()
+        {
+            if (worker_.joinable() && worker_.get_id() != std::this_thread::get_id())
+            {
+                worker_.join();
+            }
+        }
+
+        static size_t bytesPerSample(AudioFormat format)
+        {
+            switch (format)
+            {
+                case AudioFormat::I16:
+                    return sizeof(int16_t);
+                case AudioFormat::I24:
+                    return 3;
+                case AudioFormat::I32:
+                    return sizeof(int32_t);
+                case AudioFormat::Float:
+                    return sizeof(float);
+                default:
+                    return 0;
+            }
+        }
+
+        void run()
+        {
+            using clock = std::chrono::steady_clock;
+            const int32_t frames = properties_.frames_per_data_callback;
+            const size_t samples = static_cast<size_t>(frames) * properties_.channel_count;
+            std::vector<uint8_t> audio_data(samples * bytesPerSample(properties_.format));
+            std::vector<float> device_data(samples);
+            const double speed = device_->getSpeed();
+            const auto start_time = clock::now();
+            int64_t frames_processed = 0;
+
+            while (state_ == StreamState::Started)
+            {
+                DataCallbackResult result;
+                if (properties_.direction == Direction::Input)
+                {
+                    const int32_t captured = device_->capture(device_data.data(), frames, properties_.channel_count);
+                    if (captured <= 0)
+                    {
+                        break;
+                    }
+                    fromFloat(device_data.data(), audio_data.data(), static_cast<size_t>(captured) * properties_.channel_count);
+                    result = properties_.data_callback->onAudioReady(this, audio_data.data(), captured);
+                    frames_processed += captured;
+                } else
+                {
+                    result = properties_.data_callback->onAudioReady(this, audio_data.data(), frames);
+                    toFloat(audio_data.data(), device_data.data(), samples);
+                    device_->render(device_data.data(), frames, properties_.channel_count);
+                    frames_processed += frames;
+                }
+                if (result == DataCallbackResult::Stop)
+                {
+                    break;
+                }
+                if (speed > 0)
+                {
+                    const auto due = start_time + std::chrono::duration_cast<clock::duration>(
+                            std::chrono::duration<double>(static_cast<double>(frames_processed) / properties_.sample_rate / speed));
+                    if (clock::now() > due + std::chrono::duration<double>(static_cast<double>(frames) / properties_.sample_rate))
+                    {
+                        xrun_count_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    std::this_thread::sleep_until(due);
+                }
+            }
+            StreamState expected = StreamState::Started;
+            if (!state_.compare_exchange_strong(expected, StreamState::Stopped))
+            {
+                expected = StreamState::Stopping;
+                state_.compare_exchange_strong(expected, StreamState::Stopped);
+            }
+        }
+
+        void fromFloat(const float *in, uint8_t *out, size_t samples) const
+        {
+            switch (properties_.format)
+            {
+                case AudioFormat::I16:
+                    ase_android::HostAudioDevice::floatToPcm(in, reinterpret_cast<int16_t *>(out), samples);
+                    break;
+                case AudioFormat::I32:
+                    ase_android::HostAudioDevice::floatToPcm(in, reinterpret_cast<int32_t *>(out), samples);
+                    break;
+                case AudioFormat::Float:
+                    std::copy(in, in + samples, reinterpret_cast<float *>(out));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void toFloat(const uint8_t *in, float *out, size_t samples) const
+        {
+            switch (properties_.format)
+            {
+                case AudioFormat::I16:
+                    ase_android::HostAudioDevice::pcmToFloat(reinterpret_cast<const int16_t *>(in), out, samples);
+                    break;
+                case AudioFormat::I32:
+                    ase_android::HostAudioDevice::pcmToFloat(reinterpret_cast<const int32_t *>(in), out, samples);
+                    break;
+                case AudioFormat::Float:
+                    std::copy(reinterpret_cast<const float *>(in), reinterpret_cast<const float *>(in) + samples, out);
+                    break;
+                default:
+                    std::fill(out, out + samples, 0.0f);
+                    break;
+            }
+        }
+    };
+
+    class AudioStreamBuilder
+    {
+    public:
+        AudioStreamBuilder *setDeviceId(int32_t device_id)
+        {
+            properties_.device_id = device_id;
+            return this;
+        }
+
+        AudioStreamBuilder *setDirection(Direction direction)
+        {
+            properties_.direction = direction;
+            return this;
+        }
+
+        [[nodiscard]] Direction getDirection() const
+        {
+            return properties_.direction;
+        }
+
+        AudioStreamBuilder *setSharingMode(SharingMode mode)
+        {
+            properties_.sharing_mode = mode;
+            return this;
+        }
+
+        AudioStreamBuilder *setPerformanceMode(PerformanceMode mode)
+        {
+            properties_.performance_mode = mode;
+            return this;
+        }
+
+        AudioStreamBuilder *setAudioApi(AudioApi api)
+        {
+            properties_.audio_api = api;
+            return this;
+        }
+
+        AudioStreamBuilder *setFormat(AudioFormat format)
+        {
+            properties_.format = format;
+            return this;
+        }
+
+        AudioStreamBuilder *setChannelCount(int32_t channel_count)
+        {
+            properties_.channel_count = channel_count;
+            return this;
+        }
+
+        AudioStreamBuilder *setSampleRate(int32_t sample_rate)
+        {
+            properties_.sample_rate = sample_rate;
+            return this;
+        }
+
+        AudioStreamBuilder *setFramesPerDataCallback(int32_t frames)
+        {
+            properties_.frames_per_data_callback = frames;
+            return this;
+        }
+
+        AudioStreamBuilder *setDataCallback(AudioStreamDataCallback *callback)
+        {
+            properties_.data_callback = callback;
+            return this;
+        }
+
+        AudioStreamBuilder *setErrorCallback(AudioStreamErrorCallback *callback)
+        {
+            properties_.error_callback = callback;
+            return this;
+        }
+
+        // The following properties have no meaning for host devices and are accepted for API compatibility only
+        AudioStreamBuilder *setContentType(ContentType)
+        {
+            return this;
+        }
+
+        AudioStreamBuilder *setUsage(Usage)
+        {
+            return this;
+        }
+
+        AudioStreamBuilder *setInputPreset(InputPreset)
+        {
+            return this;
+        }
+
+        AudioStreamBuilder *setSampleRateConversionQuality(SampleRateConversionQuality)
+        {
+            return this;
+        }
+
+        AudioStreamBuilder *setChannelConversionAllowed(bool)
+        {
+            return this;
+        }
+
+        AudioStreamBuilder *setFormatConversionAllowed(bool)
+        {
+            return this;
+        }
+
+        Result openStream(std::shared_ptr<AudioStream> &stream)
+        {
+            if (properties_.data_callback == nullptr)
+            {
+                return Result::ErrorIllegalArgument;
+            }
+            if (properties_.format != AudioFormat::I16 && properties_.format != AudioFormat::I32 && properties_.format != AudioFormat::Float)
+            {
+                return Result::ErrorInvalidFormat;
+            }
+            if (properties_.sample_rate < 0 || properties_.channel_count <= 0)
+            {
+                return Result::ErrorIllegalArgument;
+            }
+            auto device = ase_android::HostAudioDeviceRegistry::instance().find(
+                    properties_.device_id, properties_.direction == Direction::Input);
+            if (!device)
+            {
+                return Result::ErrorUnavailable;
+            }
+            // Like AAudio, an unspecified rate opens the device at its own
+            AudioStreamBase properties = properties_;
+            if (properties.sample_rate == kUnspecified)
+            {
+                properties.sample_rate = device->getSampleRate() != 0 ? device->getSampleRate() : DefaultStreamValues::SampleRate;
+            }
+            if (device->getSampleRate() != 0 && device->getSampleRate() != properties.sample_rate)
+            {
+                return Result::ErrorInvalidRate;
+            }
+            stream = std::make_shared<AudioStream>(properties, std::move(device));
+            return Result::OK;
+        }
+
+    private:
+        AudioStreamBase properties_;
+    };
+
+    inline const char *convertToText(Result result)
+    {
+        switch (result)
+        {
+            case Result::OK:
+                return "OK";
+            case Result::ErrorDisconnected:
+                return "ErrorDisconnected";
+            case Result::ErrorIllegalArgument:
+                return "ErrorIllegalArgument";
+            case Result::ErrorInvalidState:
+                return "ErrorInvalidState";
+            case Result::ErrorUnavailable:
+                return "ErrorUnavailable";
+            case Result::ErrorInvalidFormat:
+                return "ErrorInvalidFormat";
+            case Result::ErrorInvalidRate:
+                return "ErrorInvalidRate";
+            case Result::ErrorClosed:
+                return "ErrorClosed";
+            default:
+                return "Error";
+        }
+    }
+} // oboe
+
+#endif //ULTRASOUNDWATERMARK_HOST_OBOE_H
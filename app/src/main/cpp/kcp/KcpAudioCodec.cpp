@@ -0,0 +1,18 @@
+#include "KcpAudioCodec.hpp"
+#include "PredictiveAudioCodec.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    std::unique_ptr<KcpAudioCodec> KcpAudioCodec::create(const KcpCodecConfig &config)
+    {
+        switch (config.id)
+        {
+            case KcpCodecId::Predictive:
+                return std::make_unique<PredictiveAudioCodec>(config.quantization_step);
+            case KcpCodecId::Raw:
+            default:
+                return nullptr;
+        }
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,78 @@
+#ifndef ULTRASOUNDWATERMARK_KCPAUDIOCODEC_HPP
+#define ULTRASOUNDWATERMARK_KCPAUDIOCODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace ase_ultrasound_watermark
+{
+    /// Identifies the payload encoding of a frame, carried in the low bits of the KcpFrameHeader flags
+    enum class KcpCodecId : uint8_t
+    {
+        /// PCM16 samples as is
+        Raw = 0,
+        /// PredictiveAudioCodec
+        Predictive = 1,
+    };
+
+    struct KcpCodecConfig
+    {
+        /// Error bound of lossy(): +-8 LSB, about -77 dBFS of white noise, far below the watermark tones
+        constexpr static int DEFAULT_LOSSY_STEP = 16;
+
+        KcpCodecId id = KcpCodecId::Raw;
+        /// Predictive only. 1 is lossless; a larger step quantizes the prediction residual, bounding the error of every sample to step / 2
+        int quantization_step = 1;
+
+        static KcpCodecConfig raw()
+        {
+            return {KcpCodecId::Raw, 1};
+        }
+
+        static KcpCodecConfig lossless()
+        {
+            return {KcpCodecId::Predictive, 1};
+        }
+
+        static KcpCodecConfig lossy(int quantization_step = DEFAULT_LOSSY_STEP)
+        {
+            return {KcpCodecId::Predictive, quantization_step};
+        }
+    };
+
+    /**
+     * Compresses the payload of one KCP frame.
+     *
+     * Every frame is coded on its own, with no state carried over from earlier frames, so that a receiver joining
+     * mid-stream or resynchronizing after a bad frame can decode the next one. Encoded bytes are packed into the
+     * int16_t words the link carries, in little-endian order like the rest of the frame.
+     *
+     * To add a codec, give it a KcpCodecId and construct it in create(); KcpFrameDecoder then decodes it automatically.
+     */
+    class KcpAudioCodec
+    {
+    public:
+        virtual ~KcpAudioCodec() = default;
+
+        /// nullptr for KcpCodecId::Raw, which KcpFrameEncoder/KcpFrameDecoder handle without a codec
+        static std::unique_ptr<KcpAudioCodec> create(const KcpCodecConfig &config);
+
+        [[nodiscard]] virtual KcpCodecId id() const = 0;
+
+        /**
+         * @param words Output, room for max_words words
+         * @return Words written, or 0 if the encoding does not fit in max_words. The caller then sends the samples raw
+         */
+        virtual size_t encode(const int16_t *samples, size_t size, int16_t *words, size_t max_words) = 0;
+
+        /**
+         * @param size Number of samples the frame was encoded from
+         * @return false if the words are not a valid encoding of size samples
+         */
+        virtual bool decode(const int16_t *words, size_t num_words, int16_t *samples, size_t size) = 0;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_KCPAUDIOCODEC_HPP
@@ -0,0 +1,107 @@
+#ifndef ULTRASOUNDWATERMARK_KCPFRAME_HPP
+#define ULTRASOUNDWATERMARK_KCPFRAME_HPP
+
+#include <cstdint>
+#include <cstring>
+#include "KcpAudioCodec.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Header prepended to every block of samples sent through the KCP link.
+     *
+     * KcpClientStreamConsumer and KcpServerStreamProducer carry int16_t words, so frames are laid out as int16_t words
+     * as well and the header occupies HEADER_WORDS words. Both ends are little-endian (Android/Linux on ARM and x86).
+     *
+     *   word 0     magic (MAGIC)
+     *   word 1     low byte: header length in words, high byte: flags (low 4 bits: KcpCodecId of the payload)
+     *   word 2     number of payload words following the header
+     *   word 3     number of samples the payload decodes to. 0 in raw frames of older callers, meaning payload_words
+     *   words 4-7  monotonic capture time of the newest sample in the payload, nanoseconds
+     *   words 8-9  frame sequence number, +1 per frame
+     *   words 10-13 position of the first payload sample in the caller's stream
+     *
+     * Receivers skip header words beyond those they understand, so the header can grow without breaking older callees.
+     * Frames of older callers end after word 7 (MIN_HEADER_WORDS) and carry no sequence number.
+     */
+    struct KcpFrameHeader
+    {
+        static constexpr int16_t MAGIC = 0x5557; // "WU"
+        static constexpr uint8_t MIN_HEADER_WORDS = 8;
+        static constexpr uint8_t HEADER_WORDS = 14;
+        static constexpr size_t MAX_PAYLOAD_WORDS = 8192;
+        static constexpr uint8_t CODEC_MASK = 0x0F;
+
+        uint8_t header_words;
+        uint8_t flags;
+        uint16_t payload_words;
+        uint16_t sample_count;
+        int64_t capture_time_ns;
+        /// Only valid if hasSequence()
+        uint32_t sequence;
+        int64_t sample_offset;
+
+        [[nodiscard]] bool hasSequence() const
+        {
+            return header_words >= HEADER_WORDS;
+        }
+
+        [[nodiscard]] KcpCodecId codec() const
+        {
+            return static_cast<KcpCodecId>(flags & CODEC_MASK);
+        }
+
+        void setCodec(KcpCodecId codec)
+        {
+            flags = static_cast<uint8_t>((flags & ~CODEC_MASK) | static_cast<uint8_t>(codec));
+        }
+
+        void serialize(int16_t *words) const
+        {
+            words[0] = MAGIC;
+            words[1] = static_cast<int16_t>(header_words | (flags << 8));
+            words[2] = static_cast<int16_t>(payload_words);
+            words[3] = static_cast<int16_t>(sample_count);
+            std::memcpy(words + 4, &capture_time_ns, sizeof(capture_time_ns));
+            std::memcpy(words + 8, &sequence, sizeof(sequence));
+            std::memcpy(words + 10, &sample_offset, sizeof(sample_offset));
+        }
+
+        /**
+         * Parse the first MIN_HEADER_WORDS words of a header. Returns false if words do not start a valid frame.
+         * Once all header_words words are available, call deserializeSequence() for the rest.
+         */
+        bool deserialize(const int16_t *words)
+        {
+            if (words[0] != MAGIC)
+            {
+                return false;
+            }
+            header_words = static_cast<uint8_t>(words[1] & 0xFF);
+            flags = static_cast<uint8_t>((static_cast<uint16_t>(words[1]) >> 8) & 0xFF);
+            payload_words = static_cast<uint16_t>(words[2]);
+            sample_count = static_cast<uint16_t>(words[3]);
+            if (sample_count == 0 && codec() == KcpCodecId::Raw)
+            {
+                sample_count = payload_words;
+            }
+            std::memcpy(&capture_time_ns, words + 4, sizeof(capture_time_ns));
+            sequence = 0;
+            sample_offset = 0;
+            return header_words >= MIN_HEADER_WORDS && payload_words <= MAX_PAYLOAD_WORDS && sample_count <= MAX_PAYLOAD_WORDS;
+        }
+
+        /// Parse the sequence fields from header_words words, if the sender wrote them
+        void deserializeSequence(const int16_t *words)
+        {
+            if (hasSequence())
+            {
+                std::memcpy(&sequence, words + 8, sizeof(sequence));
+                std::memcpy(&sample_offset, words + 10, sizeof(sample_offset));
+            }
+        }
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_KCPFRAME_HPP
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include "KcpFrameDecoder.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    KcpFrameDecoder::KcpFrameDecoder(int sample_rate, LatencyTracer *tracer)
+            : ase::AudioDataStreamProducer<int16_t, true>{sample_rate, 1, KcpFrameHeader::MAX_PAYLOAD_WORDS, 2},
+              tracer_{tracer},
+              receive_histogram_{tracer ? &tracer->stage("kcp_receive") : nullptr},
+              decoded_(KcpFrameHeader::MAX_PAYLOAD_WORDS),
+              pending_offset_{0},
+              position_frames_{0},
+              max_concealed_samples_{sample_rate},
+              sequence_started_{false},
+              expected_sequence_{0},
+              expected_sample_offset_{0},
+              frames_{0},
+              lost_frames_{0},
+              lost_samples_{0},
+              gaps_{0},
+              late_frames_{0},
+              discarded_words_{0},
+              undecodable_frames_{0}
+    {
+        pending_.reserve(2 * (KcpFrameHeader::HEADER_WORDS + KcpFrameHeader::MAX_PAYLOAD_WORDS));
+    }
+
+    void KcpFrameDecoder::consume(const int16_t *words, size_t size)
+    {
+        pending_.insert(pending_.end(), words, words + size);
+        while (pending_.size() - pending_offset_ >= KcpFrameHeader::MIN_HEADER_WORDS)
+        {
+            const int16_t *frame = pending_.data() + pending_offset_;
+            KcpFrameHeader header{};
+            if (!header.deserialize(frame))
+            {
+                // Not at a frame boundary (e.g. joined mid-stream). Resynchronize on the next magic word
+                ++pending_offset_;
+                discarded_words_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            const size_t frame_words = header.header_words + static_cast<size_t>(header.payload_words);
+            if (pending_.size() - pending_offset_ < frame_words)
+            {
+                break; // Wait for the rest of the frame
+            }
+            header.deserializeSequence(frame);
+            onFrame(header, frame + header.header_words);
+            pending_offset_ += frame_words;
+        }
+        // Compact once the consumed prefix dominates, keeping consume() amortized linear
+        if (pending_offset_ > 0 && pending_offset_ * 2 >= pending_.size())
+        {
+            pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(pending_offset_));
+            pending_offset_ = 0;
+        }
+    }
+
+    void KcpFrameDecoder::restartSequence()
+    {
+        pending_.clear();
+        pending_offset_ = 0;
+        sequence_started_ = false;
+    }
+
+    KcpReceiveStats KcpFrameDecoder::getStats() const
+    {
+        return KcpReceiveStats{
+                frames_.load(std::memory_order_relaxed),
+                lost_frames_.load(std::memory_order_relaxed),
+                lost_samples_.load(std::memory_order_relaxed),
+                gaps_.load(std::memory_order_relaxed),
+                late_frames_.load(std::memory_order_relaxed),
+                discarded_words_.load(std::memory_order_relaxed),
+                undecodable_frames_.load(std::memory_order_relaxed)
+        };
+    }
+
+    bool KcpFrameDecoder::checkSequence(const KcpFrameHeader &header)
+    {
+        if (!header.hasSequence())
+        {
+            return true;
+        }
+        if (sequence_started_)
+        {
+            // Wrap-around safe distance from the frame we expected
+            const auto missing = static_cast<int32_t>(header.sequence - expected_sequence_);
+            if (missing < 0)
+            {
+                late_frames_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (missing > 0)
+            {
+                const int64_t samples = header.sample_offset - expected_sample_offset_;
+                gaps_.fetch_add(1, std::memory_order_relaxed);
+                lost_frames_.fetch_add(missing, std::memory_order_relaxed);
+                lost_samples_.fetch_add(std::max<int64_t>(samples, 0), std::memory_order_relaxed);
+                if (samples > 0 && samples <= max_concealed_samples_)
+                {
+                    conceal(samples);
+                }
+            }
+        }
+        sequence_started_ = true;
+        expected_sequence_ = header.sequence + 1;
+        expected_sample_offset_ = header.sample_offset + header.sample_count;
+        return true;
+    }
+
+    void KcpFrameDecoder::conceal(int64_t count)
+    {
+        std::fill(decoded_.begin(), decoded_.end(), int16_t{0});
+        while (count > 0)
+        {
+            const auto chunk = static_cast<size_t>(std::min<int64_t>(count, static_cast<int64_t>(decoded_.size())));
+            position_frames_ += static_cast<int64_t>(chunk);
+            produce(decoded_.data(), chunk);
+            count -= static_cast<int64_t>(chunk);
+        }
+    }
+
+    void KcpFrameDecoder::onFrame(const KcpFrameHeader &header, const int16_t *payload)
+    {
+        frames_.fetch_add(1, std::memory_order_relaxed);
+        if (!checkSequence(header) || header.sample_count == 0)
+        {
+            return;
+        }
+        const int16_t *samples = decodePayload(header, payload);
+        if (samples == nullptr)
+        {
+            // Keep the sample positions of later frames, and the timeline, aligned with the caller
+            undecodable_frames_.fetch_add(1, std::memory_order_relaxed);
+            std::fill_n(decoded_.begin(), header.sample_count, int16_t{0});
+            samples = decoded_.data();
+        }
+        position_frames_ += header.sample_count;
+        if (tracer_ && header.capture_time_ns != 0)
+        {
+            tracer_->timeline().append(position_frames_, header.capture_time_ns);
+            tracer_->record(*receive_histogram_, position_frames_);
+        }
+        produce(samples, header.sample_count);
+    }
+
+    const int16_t *KcpFrameDecoder::decodePayload(const KcpFrameHeader &header, const int16_t *payload)
+    {
+        const KcpCodecId id = header.codec();
+        if (id == KcpCodecId::Raw)
+        {
+            return header.payload_words == header.sample_count ? payload : nullptr;
+        }
+        auto &codec = codecs_[static_cast<size_t>(id)];
+        if (!codec)
+        {
+            codec = KcpAudioCodec::create(KcpCodecConfig{id, 1});
+            if (!codec)
+            {
+                return nullptr;
+            }
+        }
+        return codec->decode(payload, header.payload_words, decoded_.data(), header.sample_count) ? decoded_.data() : nullptr;
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,111 @@
+#ifndef ULTRASOUNDWATERMARK_KCPFRAMEDECODER_HPP
+#define ULTRASOUNDWATERMARK_KCPFRAMEDECODER_HPP
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <ase/stream/AudioDataStreamProducer.hpp>
+#include "KcpAudioCodec.hpp"
+#include "KcpFrame.hpp"
+#include "tracing/LatencyTracer.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    struct KcpReceiveStats
+    {
+        /// Frames received, including undecodable ones
+        int64_t frames;
+        /// Frames missing from the sequence, e.g. skipped while resynchronizing
+        int64_t lost_frames;
+        /// Samples of the missing frames, by the sample offsets around the gap
+        int64_t lost_samples;
+        /// Runs of consecutive missing frames
+        int64_t gaps;
+        /// Frames that arrived after a later one (duplicates or out of order), which are dropped
+        int64_t late_frames;
+        /// Words skipped while searching for a frame header
+        int64_t discarded_words;
+        /// Frames with an unknown codec or a corrupt payload
+        int64_t undecodable_frames;
+    };
+
+    /**
+     * Reassembles KcpFrameEncoder frames from the words produced by KcpServerStreamProducer, which may split or merge
+     * frames arbitrarily, and produces the payload samples, decoding them with the KcpAudioCodec named in each header.
+     *
+     * The capture time carried in each header is appended to the tracer's timeline, so that callee-side stages are
+     * measured from capture on the caller. This is only meaningful when both ends share a monotonic clock (loopback,
+     * host benchmark); across devices the values are offset by the clock difference, but their spread is still valid.
+     *
+     * Frames carry a sequence number and the offset of their first sample, so a missing frame is detected at the next
+     * one, together with the exact number of samples lost. Up to one second of lost samples is replaced by silence so
+     * that later audio keeps its position (detector windows, timeline), while frames arriving late are dropped.
+     */
+    class KcpFrameDecoder : public ase::AudioDataStreamProducer<int16_t, true>
+    {
+    public:
+        /**
+         * @param tracer Receives capture times and the "kcp_receive" stage. May be nullptr
+         */
+        KcpFrameDecoder(int sample_rate, LatencyTracer *tracer);
+
+        void consume(const int16_t *words, size_t size) override;
+
+        /**
+         * Forget the partial frame and the sequence received so far, so that the next frame is taken as the start of a
+         * new stream, e.g. from a caller that reconnected. The stream position and the counters carry on.
+         * Call while consume() is not running
+         */
+        void restartSequence();
+
+        /// Words skipped while searching for a frame header
+        [[nodiscard]] int64_t getDiscardedWords() const
+        {
+            return discarded_words_.load(std::memory_order_relaxed);
+        }
+
+        /// Frames with an unknown codec or a corrupt payload. Each was replaced by silence of the same length
+        [[nodiscard]] int64_t getUndecodableFrames() const
+        {
+            return undecodable_frames_.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] KcpReceiveStats getStats() const;
+
+    private:
+        LatencyTracer *const tracer_;
+        LatencyHistogram *const receive_histogram_;
+        /// Created on first use, indexed by KcpCodecId
+        std::array<std::unique_ptr<KcpAudioCodec>, KcpFrameHeader::CODEC_MASK + 1> codecs_;
+        std::vector<int16_t> decoded_;
+        std::vector<int16_t> pending_;
+        size_t pending_offset_;
+        int64_t position_frames_;
+        const int64_t max_concealed_samples_;
+        bool sequence_started_;
+        uint32_t expected_sequence_;
+        int64_t expected_sample_offset_;
+        std::atomic<int64_t> frames_;
+        std::atomic<int64_t> lost_frames_;
+        std::atomic<int64_t> lost_samples_;
+        std::atomic<int64_t> gaps_;
+        std::atomic<int64_t> late_frames_;
+        std::atomic<int64_t> discarded_words_;
+        std::atomic<int64_t> undecodable_frames_;
+
+        /// Returns false if the frame arrived late and must be dropped
+        bool checkSequence(const KcpFrameHeader &header);
+
+        /// Produce count samples of silence in place of lost audio
+        void conceal(int64_t count);
+
+        void onFrame(const KcpFrameHeader &header, const int16_t *payload);
+
+        /// Returns the decoded samples, or nullptr if the payload cannot be decoded
+        const int16_t *decodePayload(const KcpFrameHeader &header, const int16_t *payload);
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_KCPFRAMEDECODER_HPP
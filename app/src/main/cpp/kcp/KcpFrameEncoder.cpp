@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <stdexcept>
+#include "KcpFrameEncoder.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        /// Payload words per frame allowed by the framing config
+        size_t payloadBudgetWords(const KcpFramingConfig &framing)
+        {
+            const size_t frame_words = framing.max_frame_bytes / sizeof(int16_t);
+            if (frame_words <= KcpFrameHeader::HEADER_WORDS)
+            {
+                throw std::runtime_error("KCP frames of " + std::to_string(framing.max_frame_bytes) + " bytes leave no room for samples");
+            }
+            return std::min(frame_words - KcpFrameHeader::HEADER_WORDS, KcpFrameHeader::MAX_PAYLOAD_WORDS);
+        }
+    }
+
+    KcpFrameEncoder::KcpFrameEncoder(int sample_rate, LatencyTracer *tracer, const KcpCodecConfig &codec, const KcpFramingConfig &framing)
+            : ase::AudioDataStreamProducer<int16_t, true>{sample_rate, 1, KcpFrameHeader::HEADER_WORDS + KcpFrameHeader::MAX_PAYLOAD_WORDS, 2},
+              tracer_{tracer},
+              send_histogram_{tracer ? &tracer->stage("kcp_send") : nullptr},
+              codec_{KcpAudioCodec::create(codec)},
+              payload_budget_words_{payloadBudgetWords(framing)},
+              flush_deadline_{framing.flush_deadline},
+              frame_(KcpFrameHeader::HEADER_WORDS + KcpFrameHeader::MAX_PAYLOAD_WORDS),
+              words_per_sample_{1.0},
+              sequence_{0},
+              position_frames_{0},
+              stopping_{false},
+              encoded_samples_{0},
+              sent_words_{0},
+              sent_frames_{0}
+    {
+        pending_.reserve(KcpFrameHeader::MAX_PAYLOAD_WORDS);
+        if (flush_deadline_.count() > 0)
+        {
+            flush_thread_ = std::thread{[this] { flushLoop(); }};
+        }
+    }
+
+    KcpFrameEncoder::~KcpFrameEncoder()
+    {
+        {
+            std::lock_guard lock{mutex_};
+            stopping_ = true;
+        }
+        pending_changed_.notify_all();
+        if (flush_thread_.joinable())
+        {
+            flush_thread_.join();
+        }
+    }
+
+    void KcpFrameEncoder::consume(const int16_t *samples, size_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+        std::unique_lock lock{mutex_};
+        const bool was_empty = pending_.empty();
+        if (was_empty)
+        {
+            pending_since_ = std::chrono::steady_clock::now();
+        }
+        pending_.insert(pending_.end(), samples, samples + size);
+        sendFrames(flush_deadline_.count() == 0);
+        if (was_empty && !pending_.empty())
+        {
+            lock.unlock();
+            pending_changed_.notify_one();
+        }
+    }
+
+    void KcpFrameEncoder::flushPending()
+    {
+        std::lock_guard lock{mutex_};
+        sendFrames(true);
+    }
+
+    void KcpFrameEncoder::skipFrames(int64_t frames)
+    {
+        std::lock_guard lock{mutex_};
+        position_frames_ += frames;
+    }
+
+    void KcpFrameEncoder::sendFrames(bool flush)
+    {
+        size_t offset = 0;
+        while (offset < pending_.size())
+        {
+            const size_t sent = sendFrame(pending_.data() + offset, pending_.size() - offset, flush);
+            if (sent == 0)
+            {
+                break;
+            }
+            offset += sent;
+        }
+        if (offset > 0)
+        {
+            pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(offset));
+            // What is left arrived with the last block
+            pending_since_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    size_t KcpFrameEncoder::sendFrame(const int16_t *samples, size_t available, bool flush)
+    {
+        // Samples expected to fit in one frame, from how well the last frame compressed
+        const size_t capacity = codec_
+                                ? std::min(KcpFrameHeader::MAX_PAYLOAD_WORDS, static_cast<size_t>(static_cast<double>(payload_budget_words_) / words_per_sample_))
+                                : payload_budget_words_;
+        if (available < capacity && !flush)
+        {
+            return 0;
+        }
+        size_t count = std::min(available, capacity);
+        int16_t *payload = frame_.data() + KcpFrameHeader::HEADER_WORDS;
+        KcpFrameHeader header{};
+        header.header_words = KcpFrameHeader::HEADER_WORDS;
+        header.setCodec(KcpCodecId::Raw);
+        // Only worth it if the frame shrinks. Otherwise send raw, which the receiver copies without decoding
+        while (codec_)
+        {
+            const size_t words = codec_->encode(samples, count, payload, std::min(payload_budget_words_, count - 1));
+            if (words > 0)
+            {
+                header.setCodec(codec_->id());
+                header.payload_words = static_cast<uint16_t>(words);
+                words_per_sample_ = static_cast<double>(words) / static_cast<double>(count);
+                break;
+            }
+            if (count <= payload_budget_words_)
+            {
+                words_per_sample_ = 1.0;
+                break;
+            }
+            // Compressed worse than the last frame and overflowed the budget, retry with fewer samples
+            count = std::max(payload_budget_words_, count * 3 / 4);
+        }
+        if (header.codec() == KcpCodecId::Raw)
+        {
+            count = std::min(count, payload_budget_words_);
+            header.payload_words = static_cast<uint16_t>(count);
+            std::copy(samples, samples + count, payload);
+        }
+        header.sample_count = static_cast<uint16_t>(count);
+        header.sequence = sequence_++;
+        header.sample_offset = position_frames_;
+        position_frames_ += static_cast<int64_t>(count);
+        header.capture_time_ns = tracer_ ? tracer_->timeline().find(position_frames_).value_or(0) : 0;
+        header.serialize(frame_.data());
+        const size_t frame_words = KcpFrameHeader::HEADER_WORDS + header.payload_words;
+        produce(frame_.data(), frame_words);
+        encoded_samples_.fetch_add(static_cast<int64_t>(count), std::memory_order_relaxed);
+        sent_words_.fetch_add(static_cast<int64_t>(frame_words), std::memory_order_relaxed);
+        sent_frames_.fetch_add(1, std::memory_order_relaxed);
+        if (send_histogram_)
+        {
+            tracer_->record(*send_histogram_, position_frames_);
+        }
+        return count;
+    }
+
+    void KcpFrameEncoder::flushLoop()
+    {
+        std::unique_lock lock{mutex_};
+        while (!stopping_)
+        {
+            if (pending_.empty())
+            {
+                pending_changed_.wait(lock);
+                continue;
+            }
+            const auto deadline = pending_since_ + flush_deadline_;
+            if (std::chrono::steady_clock::now() < deadline)
+            {
+                pending_changed_.wait_until(lock, deadline);
+                continue;
+            }
+            sendFrames(true);
+        }
+    }
+
+} // ase_ultrasound_watermark
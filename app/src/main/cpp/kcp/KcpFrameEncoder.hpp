@@ -0,0 +1,119 @@
+#ifndef ULTRASOUNDWATERMARK_KCPFRAMEENCODER_HPP
+#define ULTRASOUNDWATERMARK_KCPFRAMEENCODER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <ase/stream/AudioDataStreamProducer.hpp>
+#include "KcpAudioCodec.hpp"
+#include "KcpFrame.hpp"
+#include "tracing/LatencyTracer.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    struct KcpFramingConfig
+    {
+        /// IPv4 and UDP headers plus the KCP segment header, which share a datagram with the frame
+        constexpr static size_t TRANSPORT_OVERHEAD_BYTES = 20 + 8 + 24;
+
+        /// Largest frame, header included. The default does not coalesce: every consume() becomes frames at once
+        size_t max_frame_bytes = (KcpFrameHeader::HEADER_WORDS + KcpFrameHeader::MAX_PAYLOAD_WORDS) * sizeof(int16_t);
+        /// How long samples may wait for more to fill a frame. 0 sends the remainder of every consume() at once
+        std::chrono::microseconds flush_deadline{0};
+
+        /// Frames that each fill one datagram of a link with the given L3 MTU (e.g. KcpServerStreamProducer::L3_MTU)
+        static KcpFramingConfig forMtu(size_t l3_mtu_bytes, std::chrono::microseconds flush_deadline)
+        {
+            return {l3_mtu_bytes - TRANSPORT_OVERHEAD_BYTES, flush_deadline};
+        }
+    };
+
+    struct KcpSendStats
+    {
+        /// Frames handed to the transport
+        int64_t frames;
+        /// Words handed to the transport, headers included
+        int64_t words;
+        /// Samples carried by those frames
+        int64_t samples;
+    };
+
+    /**
+     * Packs samples into KcpFrameHeader-prefixed frames before they are handed to KcpClientStreamConsumer.
+     * The header carries the capture time of the newest sample, looked up in the tracer's timeline, and a sequence
+     * number and sample offset that let KcpFrameDecoder detect lost frames.
+     *
+     * The payload is compressed with the configured KcpAudioCodec. Frames the codec cannot shrink are sent raw, so a
+     * frame is never larger than without the codec.
+     *
+     * Incoming blocks are coalesced into frames of up to max_frame_bytes, however the upstream stage sizes its blocks,
+     * so that each frame fills one datagram. Samples that do not fill a frame wait for the next block, or at most
+     * flush_deadline, after which a helper thread sends them in a shorter frame.
+     */
+    class KcpFrameEncoder : public ase::AudioDataStreamProducer<int16_t, true>
+    {
+    public:
+        /**
+         * @param tracer Source of capture timestamps. Also receives the "kcp_send" stage. May be nullptr
+         * @param codec Payload encoding. KcpFrameDecoder reads it from each frame, so the receiver needs no configuration
+         */
+        KcpFrameEncoder(int sample_rate, LatencyTracer *tracer, const KcpCodecConfig &codec = KcpCodecConfig::raw(),
+                        const KcpFramingConfig &framing = {});
+
+        ~KcpFrameEncoder() override;
+
+        void consume(const int16_t *samples, size_t size) override;
+
+        /// Send the samples waiting for a frame to fill now, e.g. before disconnecting
+        void flushPending();
+
+        /// Advance the stream position past frames dropped upstream, so that capture times stay aligned
+        void skipFrames(int64_t frames);
+
+        [[nodiscard]] KcpSendStats getStats() const
+        {
+            return KcpSendStats{
+                    sent_frames_.load(std::memory_order_relaxed),
+                    sent_words_.load(std::memory_order_relaxed),
+                    encoded_samples_.load(std::memory_order_relaxed)
+            };
+        }
+
+    private:
+        LatencyTracer *const tracer_;
+        LatencyHistogram *const send_histogram_;
+        const std::unique_ptr<KcpAudioCodec> codec_;
+        const size_t payload_budget_words_;
+        const std::chrono::microseconds flush_deadline_;
+        /// Guards everything below, consume() and the flush thread both send
+        std::mutex mutex_;
+        std::condition_variable pending_changed_;
+        std::vector<int16_t> frame_;
+        std::vector<int16_t> pending_;
+        std::chrono::steady_clock::time_point pending_since_;
+        /// Payload words per sample of the last coded frame, to guess how many samples the next one holds
+        double words_per_sample_;
+        uint32_t sequence_;
+        int64_t position_frames_;
+        bool stopping_;
+        std::atomic<int64_t> encoded_samples_;
+        std::atomic<int64_t> sent_words_;
+        std::atomic<int64_t> sent_frames_;
+        std::thread flush_thread_;
+
+        /// Send whole frames from the front of pending_. With flush, the remainder as well
+        void sendFrames(bool flush);
+
+        /// Send one frame from the front of samples. Returns the samples sent, 0 if they do not fill a frame yet
+        size_t sendFrame(const int16_t *samples, size_t available, bool flush);
+
+        void flushLoop();
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_KCPFRAMEENCODER_HPP
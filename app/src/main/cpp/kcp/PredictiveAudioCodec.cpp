@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include "PredictiveAudioCodec.hpp"
+#include "KcpFrame.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        constexpr uint32_t RICE_PARAMETER_BITS = 5;
+        constexpr uint32_t MAX_RICE_PARAMETER = 16;
+        constexpr uint32_t ESCAPE_QUOTIENT = 24;
+        /// Predictions are clamped to int16, so a residual is within +-65535 and its zigzag code below 2^17
+        constexpr uint32_t ESCAPE_BITS = 17;
+        constexpr size_t HEADER_BYTES = 2;
+        constexpr int MAX_ORDER = 2;
+
+        /// LSB-first bit packer with a bounded output
+        class BitWriter
+        {
+        public:
+            BitWriter(uint8_t *out, size_t capacity) : out_{out}, capacity_{capacity}
+            {
+            }
+
+            /// bits <= 32
+            void write(uint32_t value, uint32_t bits)
+            {
+                accumulator_ |= static_cast<uint64_t>(value) << count_;
+                count_ += bits;
+                while (count_ >= 8)
+                {
+                    if (size_ < capacity_)
+                    {
+                        out_[size_] = static_cast<uint8_t>(accumulator_);
+                    }
+                    ++size_;
+                    accumulator_ >>= 8;
+                    count_ -= 8;
+                }
+            }
+
+            /// Pads the last byte with zeros. Returns the bytes written, or 0 on overflow
+            size_t finish()
+            {
+                if (count_ > 0)
+                {
+                    write(0, 8 - count_);
+                }
+                return size_ <= capacity_ ? size_ : 0;
+            }
+
+        private:
+            uint8_t *const out_;
+            const size_t capacity_;
+            size_t size_ = 0;
+            uint64_t accumulator_ = 0;
+            uint32_t count_ = 0;
+        };
+
+        /// LSB-first bit reader. Reads past the end return zeros and are reported by overrun()
+        class BitReader
+        {
+        public:
+            BitReader(const uint8_t *in, size_t size) : in_{in}, size_{size}
+            {
+            }
+
+            /// bits <= 32
+            uint32_t read(uint32_t bits)
+            {
+                refill();
+                const auto value = static_cast<uint32_t>(accumulator_ & ((uint64_t{1} << bits) - 1));
+                skip(bits);
+                return value;
+            }
+
+            /// Number of consecutive one bits at the read position, up to limit (<= 56)
+            uint32_t peekOnes(uint32_t limit)
+            {
+                refill();
+                return std::min<uint32_t>(static_cast<uint32_t>(std::countr_one(accumulator_)), limit);
+            }
+
+            void skip(uint32_t bits)
+            {
+                accumulator_ >>= bits;
+                count_ -= bits;
+                consumed_bits_ += bits;
+            }
+
+            [[nodiscard]] bool overrun() const
+            {
+                return consumed_bits_ > size_ * 8;
+            }
+
+        private:
+            const uint8_t *const in_;
+            const size_t size_;
+            size_t position_ = 0;
+            size_t consumed_bits_ = 0;
+            uint64_t accumulator_ = 0;
+            uint32_t count_ = 0;
+
+            void refill()
+            {
+                while (count_ <= 56)
+                {
+                    const uint64_t byte = position_ < size_ ? in_[position_] : 0;
+                    accumulator_ |= byte << count_;
+                    ++position_;
+                    count_ += 8;
+                }
+            }
+        };
+
+        inline int32_t clampSample(int32_t value)
+        {
+            return std::clamp<int32_t>(value, INT16_MIN, INT16_MAX);
+        }
+
+        inline int32_t predict(int order, int32_t previous, int32_t before_previous)
+        {
+            switch (order)
+            {
+                case 0:
+                    return 0;
+                case 1:
+                    return previous;
+                default:
+                    return clampSample(2 * previous - before_previous);
+            }
+        }
+
+        inline uint32_t zigzag(int32_t value)
+        {
+            return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+        }
+
+        inline int32_t unzigzag(uint32_t value)
+        {
+            return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+        }
+
+        /// The fixed predictor with the smallest absolute residual over the input
+        int chooseOrder(const int16_t *samples, size_t size)
+        {
+            int64_t sums[MAX_ORDER + 1] = {0, 0, 0};
+            int32_t previous = 0;
+            int32_t before_previous = 0;
+            for (size_t i = 0; i < size; ++i)
+            {
+                const int32_t x = samples[i];
+                sums[0] += std::abs(x);
+                sums[1] += std::abs(x - previous);
+                sums[2] += std::abs(x - clampSample(2 * previous - before_previous));
+                before_previous = previous;
+                previous = x;
+            }
+            return static_cast<int>(std::min_element(sums, sums + MAX_ORDER + 1) - sums);
+        }
+
+        /// Rice parameter close to log2 of the mean, which is within a fraction of a bit of the optimum for Laplacian residuals
+        uint32_t riceParameter(const uint32_t *residuals, size_t size)
+        {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < size; ++i)
+            {
+                sum += residuals[i];
+            }
+            uint32_t k = 0;
+            while (k < MAX_RICE_PARAMETER && (static_cast<uint64_t>(size) << (k + 1)) < sum)
+            {
+                ++k;
+            }
+            return k;
+        }
+    }
+
+    PredictiveAudioCodec::PredictiveAudioCodec(int quantization_step)
+            : quantization_step_{quantization_step}
+    {
+        if (quantization_step < 1 || quantization_step > MAX_QUANTIZATION_STEP)
+        {
+            throw std::runtime_error("Quantization step must be within 1 and " + std::to_string(MAX_QUANTIZATION_STEP));
+        }
+        // No frame carries more samples, so encode() never allocates
+        residuals_.reserve(KcpFrameHeader::MAX_PAYLOAD_WORDS);
+    }
+
+    size_t PredictiveAudioCodec::encode(const int16_t *samples, size_t size, int16_t *words, size_t max_words)
+    {
+        if (size == 0)
+        {
+            return 0;
+        }
+        const int order = chooseOrder(samples, size);
+        // Predict from the decoder's reconstruction, not the input, so that quantization errors do not accumulate
+        residuals_.resize(size);
+        const int32_t step = quantization_step_;
+        const int32_t half_step = step / 2;
+        int32_t previous = 0;
+        int32_t before_previous = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            const int32_t prediction = predict(order, previous, before_previous);
+            const int32_t residual = samples[i] - prediction;
+            int32_t quantized = residual;
+            int32_t reconstructed = samples[i];
+            if (step > 1)
+            {
+                quantized = residual >= 0 ? (residual + half_step) / step : -((half_step - residual) / step);
+                reconstructed = clampSample(prediction + quantized * step);
+            }
+            residuals_[i] = zigzag(quantized);
+            before_previous = previous;
+            previous = reconstructed;
+        }
+
+        BitWriter writer{reinterpret_cast<uint8_t *>(words), max_words * sizeof(int16_t)};
+        writer.write(static_cast<uint32_t>(order), 8);
+        writer.write(static_cast<uint32_t>(step), 8);
+        for (size_t begin = 0; begin < size; begin += PARTITION_SAMPLES)
+        {
+            const size_t count = std::min(PARTITION_SAMPLES, size - begin);
+            const uint32_t *partition = residuals_.data() + begin;
+            const uint32_t k = riceParameter(partition, count);
+            writer.write(k, RICE_PARAMETER_BITS);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const uint32_t value = partition[i];
+                const uint32_t quotient = value >> k;
+                if (quotient < ESCAPE_QUOTIENT)
+                {
+                    // quotient ones, a terminating zero, then the k low bits
+                    writer.write((1u << quotient) - 1, quotient + 1);
+                    writer.write(value & ((1u << k) - 1), k);
+                }
+                else
+                {
+                    writer.write((1u << ESCAPE_QUOTIENT) - 1, ESCAPE_QUOTIENT);
+                    writer.write(value, ESCAPE_BITS);
+                }
+            }
+        }
+        const size_t bytes = writer.finish();
+        if (bytes == 0)
+        {
+            return 0;
+        }
+        const size_t num_words = (bytes + 1) / sizeof(int16_t);
+        if (num_words > max_words)
+        {
+            return 0;
+        }
+        if (bytes % 2 != 0)
+        {
+            reinterpret_cast<uint8_t *>(words)[bytes] = 0;
+        }
+        return num_words;
+    }
+
+    bool PredictiveAudioCodec::decode(const int16_t *words, size_t num_words, int16_t *samples, size_t size)
+    {
+        const size_t bytes = num_words * sizeof(int16_t);
+        if (bytes < HEADER_BYTES)
+        {
+            return false;
+        }
+        BitReader reader{reinterpret_cast<const uint8_t *>(words), bytes};
+        const auto order = static_cast<int>(reader.read(8));
+        const auto step = static_cast<int32_t>(reader.read(8));
+        if (order > MAX_ORDER || step < 1)
+        {
+            return false;
+        }
+        int32_t previous = 0;
+        int32_t before_previous = 0;
+        for (size_t begin = 0; begin < size; begin += PARTITION_SAMPLES)
+        {
+            const size_t count = std::min(PARTITION_SAMPLES, size - begin);
+            const uint32_t k = reader.read(RICE_PARAMETER_BITS);
+            if (k > MAX_RICE_PARAMETER)
+            {
+                return false;
+            }
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint32_t value;
+                const uint32_t quotient = reader.peekOnes(ESCAPE_QUOTIENT);
+                if (quotient < ESCAPE_QUOTIENT)
+                {
+                    reader.skip(quotient + 1);
+                    value = (quotient << k) | reader.read(k);
+                }
+                else
+                {
+                    reader.skip(ESCAPE_QUOTIENT);
+                    value = reader.read(ESCAPE_BITS);
+                }
+                const int32_t sample = clampSample(predict(order, previous, before_previous) + unzigzag(value) * step);
+                samples[begin + i] = static_cast<int16_t>(sample);
+                before_previous = previous;
+                previous = sample;
+            }
+            if (reader.overrun())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,50 @@
+#ifndef ULTRASOUNDWATERMARK_PREDICTIVEAUDIOCODEC_HPP
+#define ULTRASOUNDWATERMARK_PREDICTIVEAUDIOCODEC_HPP
+
+#include <vector>
+#include "KcpAudioCodec.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Low-complexity predictive PCM16 codec, in the spirit of FLAC's fixed predictors.
+     *
+     * Each frame picks the fixed polynomial predictor (order 0, 1 or 2) with the smallest residual, and Rice-codes the
+     * zigzag-mapped residuals in partitions of PARTITION_SAMPLES, each with its own Rice parameter. There is no
+     * transform and no psychoacoustic model: a few integer operations per sample either way.
+     *
+     * With a quantization step above 1 the codec becomes near-lossless: the residual is quantized inside the prediction
+     * loop (as in ADPCM or JPEG-LS), so every decoded sample is within step / 2 of the input and the error does not
+     * accumulate. The error is white, spread evenly over 0 to fs / 2, so unlike a perceptual codec it never removes
+     * the inaudible 16-17.5 kHz band the watermark lives in. Each step doubling saves one bit per sample.
+     *
+     * Frame layout: byte 0 predictor order, byte 1 quantization step, then per partition a 5-bit Rice parameter and
+     * the Rice codes. A quotient of ESCAPE_QUOTIENT or more is sent as ESCAPE_QUOTIENT ones and the raw 17-bit value.
+     */
+    class PredictiveAudioCodec : public KcpAudioCodec
+    {
+    public:
+        constexpr static size_t PARTITION_SAMPLES = 256;
+        constexpr static int MAX_QUANTIZATION_STEP = 255;
+
+        /// @param quantization_step 1 for lossless, up to MAX_QUANTIZATION_STEP
+        explicit PredictiveAudioCodec(int quantization_step);
+
+        [[nodiscard]] KcpCodecId id() const override
+        {
+            return KcpCodecId::Predictive;
+        }
+
+        size_t encode(const int16_t *samples, size_t size, int16_t *words, size_t max_words) override;
+
+        /// Decodes any quantization step, the one the frame was encoded with is in its header
+        bool decode(const int16_t *words, size_t num_words, int16_t *samples, size_t size) override;
+
+    private:
+        const int quantization_step_;
+        std::vector<uint32_t> residuals_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_PREDICTIVEAUDIOCODEC_HPP
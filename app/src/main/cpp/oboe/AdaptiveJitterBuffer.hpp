@@ -0,0 +1,233 @@
+#ifndef ULTRASOUNDWATERMARK_ADAPTIVEJITTERBUFFER_HPP
+#define ULTRASOUNDWATERMARK_ADAPTIVEJITTERBUFFER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ase/Common.hpp>
+#include "SpscRingBuffer.hpp"
+
+namespace ase_android
+{
+    struct JitterBufferStats
+    {
+        /// Callbacks that could not be filled completely and played silence instead
+        int64_t underruns;
+        /// Frames rejected by write() because the buffer was full
+        int64_t overrun_frames;
+        /// Frames discarded by the reader to cut latency back to the target
+        int64_t dropped_frames;
+        /// Callbacks that were time-compressed or time-stretched to converge on the target
+        int64_t compressed_callbacks;
+        int64_t stretched_callbacks;
+        /// Current fill level and the adaptive target, in frames
+        int32_t depth_frames;
+        int32_t target_frames;
+        /// Smoothed arrival jitter, in microseconds
+        int32_t jitter_us;
+    };
+
+    /**
+     * Adaptive jitter buffer between a network receive thread (writer) and a realtime audio callback (reader).
+     *
+     * Samples are exchanged through a wait-free SpscRingBuffer. The writer estimates arrival jitter in the spirit of
+     * RFC 3550 (difference between wall-clock and media-clock inter-arrival time) with a fast-attack/slow-decay filter
+     * and derives a target fill level from it. The reader converges on that target: small deviations are absorbed by
+     * reading slightly more or fewer frames than requested and linearly resampling them to the callback size, large
+     * excess is dropped at once, and after an underrun it plays silence until the target is reached again.
+     */
+    template<typename SAMPLE_T>
+    class AdaptiveJitterBuffer
+    {
+    public:
+        /// Target depth is this many jitter estimates above the minimum target
+        static constexpr float JITTER_MULTIPLIER = 3.0f;
+        /// Maximum stretch per callback, as a fraction of the callback size (0.5%)
+        static constexpr int32_t STRETCH_DIVISOR = 200;
+
+        /**
+         * @param sample_rate Sample rate of the stream, used to convert arrival times to frames
+         * @param channels Samples per frame
+         * @param callback_frames Frames requested by each read(). Also the minimum target depth
+         * @param capacity_samples Capacity of the underlying ring in samples. Bounds the maximum latency
+         */
+        AdaptiveJitterBuffer(int32_t sample_rate, int32_t channels, int32_t callback_frames, size_t capacity_samples)
+                : sample_rate_{sample_rate},
+                  channels_{channels},
+                  min_target_frames_{callback_frames},
+                  max_target_frames_{static_cast<int32_t>(capacity_samples / channels / 2)},
+                  ring_{capacity_samples},
+                  scratch_frames_{callback_frames * 2},
+                  scratch_{static_cast<size_t>(callback_frames) * 2 * channels},
+                  buffering_{true},
+                  has_last_arrival_{false},
+                  last_transit_s_{0},
+                  media_time_s_{0},
+                  jitter_s_{0},
+                  target_frames_{callback_frames},
+                  jitter_us_{0},
+                  underruns_{0},
+                  overrun_frames_{0},
+                  dropped_frames_{0},
+                  compressed_callbacks_{0},
+                  stretched_callbacks_{0}
+        {
+        }
+
+        /// Writer side. Append interleaved samples and update the jitter estimate
+        void write(const SAMPLE_T *samples, size_t size)
+        {
+            updateJitter(size / channels_);
+            const size_t written = ring_.write(samples, size);
+            if (unlikely(written < size))
+            {
+                overrun_frames_.fetch_add(static_cast<int64_t>((size - written) / channels_), std::memory_order_relaxed);
+            }
+        }
+
+        /// Reader side. Fill exactly num_frames frames of output, silence included
+        void read(SAMPLE_T *out, int32_t num_frames)
+        {
+            const size_t required_samples = static_cast<size_t>(num_frames) * channels_;
+            auto depth = static_cast<int32_t>(ring_.readableSize() / channels_);
+            const int32_t target = target_frames_.load(std::memory_order_relaxed);
+
+            if (buffering_)
+            {
+                if (depth < target)
+                {
+                    std::fill(out, out + required_samples, SAMPLE_T{0});
+                    return;
+                }
+                buffering_ = false;
+            }
+
+            if (depth > 2 * target + num_frames)
+            {
+                const size_t excess = static_cast<size_t>(depth - target) * channels_;
+                dropped_frames_.fetch_add(static_cast<int64_t>(ring_.discard(excess) / channels_), std::memory_order_relaxed);
+                depth = target;
+            }
+
+            const int32_t adjust = std::max(1, num_frames / STRETCH_DIVISOR);
+            if (depth > target + num_frames / 2 && num_frames + adjust <= scratch_frames_ && depth >= num_frames + adjust)
+            {
+                // Slightly compress time: play num_frames + adjust input frames in num_frames
+                ring_.read(scratch_.get(), static_cast<size_t>(num_frames + adjust) * channels_);
+                resample(scratch_.get(), num_frames + adjust, out, num_frames);
+                compressed_callbacks_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (depth < target - num_frames / 2 && depth >= num_frames && num_frames - adjust > 1 &&
+                num_frames - adjust <= scratch_frames_)
+            {
+                // Slightly stretch time: play num_frames - adjust input frames in num_frames
+                ring_.read(scratch_.get(), static_cast<size_t>(num_frames - adjust) * channels_);
+                resample(scratch_.get(), num_frames - adjust, out, num_frames);
+                stretched_callbacks_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            const size_t read = ring_.read(out, required_samples);
+            if (read < required_samples)
+            {
+                std::fill(out + read, out + required_samples, SAMPLE_T{0});
+                underruns_.fetch_add(1, std::memory_order_relaxed);
+                buffering_ = true;
+            }
+        }
+
+        /**
+         * Reader side. Number of written frames that have been played, dropped or rejected so far, i.e. the stream
+         * position of the next frame to be played.
+         */
+        [[nodiscard]] int64_t readPositionFrames() const
+        {
+            return static_cast<int64_t>(ring_.totalConsumed() / channels_) + overrun_frames_.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] JitterBufferStats getStats() const
+        {
+            return JitterBufferStats{
+                    underruns_.load(std::memory_order_relaxed),
+                    overrun_frames_.load(std::memory_order_relaxed),
+                    dropped_frames_.load(std::memory_order_relaxed),
+                    compressed_callbacks_.load(std::memory_order_relaxed),
+                    stretched_callbacks_.load(std::memory_order_relaxed),
+                    static_cast<int32_t>(ring_.readableSize() / channels_),
+                    target_frames_.load(std::memory_order_relaxed),
+                    jitter_us_.load(std::memory_order_relaxed)
+            };
+        }
+
+    private:
+        const int32_t sample_rate_;
+        const int32_t channels_;
+        const int32_t min_target_frames_;
+        const int32_t max_target_frames_;
+        SpscRingBuffer<SAMPLE_T> ring_;
+        const int32_t scratch_frames_;
+        ase::aligned_unique_ptr<SAMPLE_T[]> scratch_;
+        // Reader state
+        bool buffering_;
+        // Writer state
+        bool has_last_arrival_;
+        double last_transit_s_;
+        double media_time_s_;
+        double jitter_s_;
+        std::chrono::steady_clock::time_point first_arrival_;
+        // Shared
+        std::atomic<int32_t> target_frames_;
+        std::atomic<int32_t> jitter_us_;
+        std::atomic<int64_t> underruns_;
+        std::atomic<int64_t> overrun_frames_;
+        std::atomic<int64_t> dropped_frames_;
+        std::atomic<int64_t> compressed_callbacks_;
+        std::atomic<int64_t> stretched_callbacks_;
+
+        void updateJitter(size_t frames)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            if (!has_last_arrival_)
+            {
+                first_arrival_ = now;
+                has_last_arrival_ = true;
+            }
+            // Transit is arrival time minus media time, both relative to the first block
+            const double arrival_s = std::chrono::duration<double>(now - first_arrival_).count();
+            const double transit_s = arrival_s - media_time_s_;
+            const double deviation = std::abs(transit_s - last_transit_s_);
+            // Fast attack so that a burst raises the target at once, slow decay so that it does not oscillate
+            jitter_s_ += (deviation - jitter_s_) / (deviation > jitter_s_ ? 4.0 : 64.0);
+            last_transit_s_ = transit_s;
+            media_time_s_ += static_cast<double>(frames) / sample_rate_;
+
+            const auto target = static_cast<int32_t>(min_target_frames_ + JITTER_MULTIPLIER * jitter_s_ * sample_rate_);
+            target_frames_.store(std::clamp(target, min_target_frames_, max_target_frames_), std::memory_order_relaxed);
+            jitter_us_.store(static_cast<int32_t>(jitter_s_ * 1e6), std::memory_order_relaxed);
+        }
+
+        void resample(const SAMPLE_T *in, int32_t in_frames, SAMPLE_T *out, int32_t out_frames) const
+        {
+            // Linear interpolation which maps the first and last input frames onto the first and last output frames
+            const double step = static_cast<double>(in_frames - 1) / static_cast<double>(out_frames - 1);
+            for (int32_t i = 0; i < out_frames; ++i)
+            {
+                const double position = i * step;
+                const auto index = std::min(static_cast<int32_t>(position), in_frames - 2);
+                const double fraction = position - index;
+                for (int32_t c = 0; c < channels_; ++c)
+                {
+                    const double a = in[static_cast<size_t>(index) * channels_ + c];
+                    const double b = in[static_cast<size_t>(index + 1) * channels_ + c];
+                    out[static_cast<size_t>(i) * channels_ + c] = static_cast<SAMPLE_T>(a + (b - a) * fraction);
+                }
+            }
+        }
+    };
+
+} // ase_android
+
+#endif //ULTRASOUNDWATERMARK_ADAPTIVEJITTERBUFFER_HPP
@@ -8,16 +8,29 @@
 #include <exception>
 #include <utility>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
 
 #include <oboe/Oboe.h>
 #include <android/log.h>
-#include <ase/utilities/SpinLock.hpp>
 #include <ase/Common.hpp>
 #include "OboePlayerBase.hpp"
 
 namespace ase_android
 {
 
+    /**
+     * Plays a buffer in a loop. The buffer can be replaced at any time without blocking the realtime callback.
+     *
+     * setBuffer()/clearBuffer() publish an immutable LoopBuffer descriptor through an atomic pointer, and the
+     * callback only does an atomic load of it. Replaced descriptors are retired and reclaimed on the calling
+     * (non-realtime) thread once the callback provably no longer references them: the callback bumps an epoch
+     * counter around its body and announces the descriptors it holds across callbacks in two hazard pointers.
+     * Optionally, switching buffers crossfades from the old loop position into the new buffer.
+     */
     template<typename SAMPLE_T>
     class OboeLoopPlayer : public OboePlayerBase<SAMPLE_T>
     {
@@ -25,22 +38,26 @@ namespace ase_android
     public:
         explicit OboeLoopPlayer(int32_t device, int32_t sample_rate, int32_t channels, oboe::PerformanceMode mode, int32_t callback_samples)
                 : OboePlayerBase<SAMPLE_T>(device, sample_rate, channels, mode, callback_samples),
-                  _zeros{ase::simd_new_array_raw<SAMPLE_T>(base::frames_per_callback_ * base::_num_channels), std::default_delete<SAMPLE_T[]>()}
+                  _zeros{makeZeros(base::frames_per_callback_, base::_num_channels)},
+                  _published{nullptr},
+                  _callback_epoch{0},
+                  _hazard_active{nullptr},
+                  _hazard_fading{nullptr},
+                  _crossfade_frames{0},
+                  _active{nullptr},
+                  _fading{nullptr},
+                  _position_in_frames{0},
+                  _fading_position_in_frames{0},
+                  _fade_progress_in_frames{0},
+                  _fade_length_in_frames{0}
         {
-            std::fill(_zeros.get(), _zeros.get() + base::frames_per_callback_ * base::_num_channels, 0);
-            _buffer.data = _zeros;
-            _buffer.size_in_frames = base::frames_per_callback_;
-            _buffer.read_position_in_frames = 0;
+            _published.store(_zeros.get());
         }
 
 
         void start() override
         {
-            _buffer.mutex.lock();
-            _buffer.data = _zeros;
-            _buffer.size_in_frames = base::frames_per_callback_;
-            _buffer.read_position_in_frames = 0;
-            _buffer.mutex.unlock();
+            publish(nullptr);
             base::start();
         }
 
@@ -52,13 +69,29 @@ namespace ase_android
          */
         void setBuffer(ase::aligned_unique_ptr<SAMPLE_T[]> &&ptr, size_t buffer_size_frames)
         {
-            std::lock_guard lock{_buffer.mutex};
             // __cpp_lib_shared_ptr_arrays has not been migrated in to NDK's clang.
             // Therefore, the moving constructor from unique_ptr to shared_ptr is not implemented. We have to use this workaround.
             SAMPLE_T *raw_ptr = ptr.release();
-            _buffer.data = std::shared_ptr<SAMPLE_T>(raw_ptr, ptr.get_deleter());
-            _buffer.size_in_frames = buffer_size_frames;
-            _buffer.read_position_in_frames = 0;
+            setBuffer(std::shared_ptr<const SAMPLE_T>(raw_ptr, ptr.get_deleter()), buffer_size_frames);
+        }
+
+        /**
+         * Set the content to be played from a shared, immutable buffer. The buffer is kept alive until the player
+         * no longer references it. Useful to play the same content from several players or from a cache.
+         * @param data Audio content. May alias a larger owner (e.g. a memory mapping)
+         * @param buffer_size_frames The size of the supplied buffer, in terms of frames.
+         */
+        void setBuffer(std::shared_ptr<const SAMPLE_T> data, size_t buffer_size_frames)
+        {
+            if (!data || buffer_size_frames == 0)
+            {
+                clearBuffer();
+                return;
+            }
+            auto buffer = std::make_unique<LoopBuffer>();
+            buffer->data = std::move(data);
+            buffer->size_in_frames = static_cast<int32_t>(buffer_size_frames);
+            publish(std::move(buffer));
         }
 
         /**
@@ -69,10 +102,16 @@ namespace ase_android
          */
         void clearBuffer()
         {
-            std::lock_guard lock{_buffer.mutex};
-            _buffer.size_in_frames = base::frames_per_callback_;
-            _buffer.data = _zeros;
-            _buffer.read_position_in_frames = 0;
+            publish(nullptr);
+        }
+
+        /**
+         * Crossfade length used when the content changes while playing, including the change from silence
+         * to the first buffer. 0 (default) switches immediately at the next callback.
+         */
+        void setCrossfadeFrames(int32_t frames)
+        {
+            _crossfade_frames.store(std::max(0, frames), std::memory_order_relaxed);
         }
 
         /**
@@ -82,40 +121,67 @@ namespace ase_android
         void stop() override
         {
             base::stop();
-            std::lock_guard lock{_buffer.mutex};
-            _buffer.size_in_frames = base::frames_per_callback_;
-            _buffer.data = _zeros;
-            _buffer.read_position_in_frames = 0;
+            std::lock_guard lock{_retire_mutex};
+            // No callback can run now, so its private state can be reset from here
+            _active = nullptr;
+            _fading = nullptr;
+            _position_in_frames = 0;
+            _hazard_active.store(nullptr);
+            _hazard_fading.store(nullptr);
+            publishLocked(nullptr);
         }
 
         oboe::DataCallbackResult
         onAudioReady(oboe::AudioStream *audioStream, void *audioData, int32_t numFrames) override
         {
-            std::lock_guard lock{_buffer.mutex};
-            if (unlikely(!_buffer.data)) // For safe destruction
+            _callback_epoch.fetch_add(1); // Odd: inside callback
+            const LoopBuffer *published = _published.load();
+            if (unlikely(published == nullptr)) // For safe destruction
             {
+                _callback_epoch.fetch_add(1);
                 return oboe::DataCallbackResult::Stop;
             }
-            for (int32_t frames_left = numFrames; frames_left > 0;)
+            if (published != _active)
             {
-                int32_t buffer_left = _buffer.size_in_frames - _buffer.read_position_in_frames;
-                const SAMPLE_T *const start = _buffer.data.get() + _buffer.read_position_in_frames * base::_num_channels;
-                if (likely(buffer_left > numFrames))
+                const int32_t crossfade = _crossfade_frames.load(std::memory_order_relaxed);
+                if (crossfade > 0 && _active != nullptr)
                 {
-                    const SAMPLE_T *const end = start + numFrames * base::_num_channels;
-                    std::copy(start, end, reinterpret_cast<SAMPLE_T *>(audioData));
-                    frames_left -= numFrames;
-                    base::setFramesWritten(base::getFramesWritten() + numFrames);
-                    _buffer.read_position_in_frames += numFrames;
+                    _fading = _active;
+                    _fading_position_in_frames = _position_in_frames;
+                    _fade_progress_in_frames = 0;
+                    _fade_length_in_frames = crossfade;
                 } else
                 {
-                    const SAMPLE_T *const end = start + buffer_left * base::_num_channels;
-                    std::copy(start, end, reinterpret_cast<SAMPLE_T *>(audioData));
-                    frames_left -= buffer_left;
-                    base::setFramesWritten(base::getFramesWritten() + buffer_left);
-                    _buffer.read_position_in_frames = 0;
+                    _fading = nullptr;
                 }
+                _active = published;
+                _position_in_frames = 0;
+                // Order matters: announce the fading buffer before dropping it from the active hazard
+                _hazard_fading.store(_fading);
+                _hazard_active.store(_active);
             }
+
+            auto *out = reinterpret_cast<SAMPLE_T *>(audioData);
+            for (int32_t frames_left = numFrames; frames_left > 0;)
+            {
+                const int32_t buffer_left = _active->size_in_frames - _position_in_frames;
+                const int32_t to_copy = std::min(frames_left, buffer_left);
+                const SAMPLE_T *const start = _active->data.get() + static_cast<size_t>(_position_in_frames) * base::_num_channels;
+                std::copy(start, start + static_cast<size_t>(to_copy) * base::_num_channels, out);
+                out += static_cast<size_t>(to_copy) * base::_num_channels;
+                frames_left -= to_copy;
+                _position_in_frames += to_copy;
+                if (_position_in_frames >= _active->size_in_frames)
+                {
+                    _position_in_frames = 0;
+                }
+            }
+            if (_fading != nullptr)
+            {
+                mixFadingBuffer(reinterpret_cast<SAMPLE_T *>(audioData), numFrames);
+            }
+            base::setFramesWritten(base::getFramesWritten() + numFrames);
+            _callback_epoch.fetch_add(1); // Even: outside callback
             return oboe::DataCallbackResult::Continue;
         }
 
@@ -123,17 +189,129 @@ namespace ase_android
         virtual ~OboeLoopPlayer() override
         {
             stop();
+            std::lock_guard lock{_retire_mutex};
+            _published.store(nullptr);
+            _retired.clear();
+            _current.reset();
         }
 
     protected:
-        struct
-        {
-            std::shared_ptr<SAMPLE_T> data;
-            int size_in_frames;
-            int read_position_in_frames;
-            ase::SpinLock mutex;
-        } _buffer;
-        std::shared_ptr<SAMPLE_T> _zeros;
+        struct LoopBuffer
+        {
+            std::shared_ptr<const SAMPLE_T> data;
+            int32_t size_in_frames;
+        };
+
+        // Owned by the control threads (guarded by _retire_mutex)
+        std::mutex _retire_mutex;
+        const std::unique_ptr<LoopBuffer> _zeros;
+        std::unique_ptr<LoopBuffer> _current;
+        std::vector<std::unique_ptr<LoopBuffer>> _retired;
+        // Shared between control threads and the callback
+        std::atomic<const LoopBuffer *> _published;
+        std::atomic<uint64_t> _callback_epoch;
+        std::atomic<const LoopBuffer *> _hazard_active;
+        std::atomic<const LoopBuffer *> _hazard_fading;
+        std::atomic<int32_t> _crossfade_frames;
+        // Owned by the callback
+        const LoopBuffer *_active;
+        const LoopBuffer *_fading;
+        int32_t _position_in_frames;
+        int32_t _fading_position_in_frames;
+        int32_t _fade_progress_in_frames;
+        int32_t _fade_length_in_frames;
+
+        static std::unique_ptr<LoopBuffer> makeZeros(int32_t frames, int32_t channels)
+        {
+            const int32_t samples = frames * channels;
+            auto zeros = std::make_unique<LoopBuffer>();
+            SAMPLE_T *raw_ptr = ase::simd_new_array_raw<SAMPLE_T>(samples);
+            std::fill(raw_ptr, raw_ptr + samples, SAMPLE_T{0});
+            zeros->data = std::shared_ptr<const SAMPLE_T>(raw_ptr, std::default_delete<SAMPLE_T[]>());
+            zeros->size_in_frames = frames;
+            return zeros;
+        }
+
+        /// Publish buffer (nullptr publishes silence), retire the previous one and reclaim what is safe to free
+        void publish(std::unique_ptr<LoopBuffer> buffer)
+        {
+            std::lock_guard lock{_retire_mutex};
+            publishLocked(std::move(buffer));
+        }
+
+        void publishLocked(std::unique_ptr<LoopBuffer> buffer)
+        {
+            const LoopBuffer *next = buffer ? buffer.get() : _zeros.get();
+            _published.store(next);
+            if (_current)
+            {
+                _retired.push_back(std::move(_current));
+            }
+            _current = std::move(buffer);
+            reclaimLocked();
+        }
+
+        /// Free retired descriptors that the callback can no longer reach. Never called on the realtime thread.
+        void reclaimLocked()
+        {
+            if (_retired.empty())
+            {
+                return;
+            }
+            // A callback in progress may have loaded a descriptor without announcing it yet. Wait for it to finish.
+            const uint64_t epoch = _callback_epoch.load();
+            if (epoch & 1u)
+            {
+                while (_callback_epoch.load() == epoch)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(500));
+                }
+            }
+            const LoopBuffer *active = _hazard_active.load();
+            const LoopBuffer *fading = _hazard_fading.load();
+            std::erase_if(_retired, [active, fading](const std::unique_ptr<LoopBuffer> &retired) {
+                return retired.get() != active && retired.get() != fading;
+            });
+        }
+
+        void mixFadingBuffer(SAMPLE_T *out, int32_t num_frames)
+        {
+            const int32_t channels = base::_num_channels;
+            int32_t i = 0;
+            for (; i < num_frames && _fade_progress_in_frames < _fade_length_in_frames; ++i, ++_fade_progress_in_frames)
+            {
+                const float gain_in = static_cast<float>(_fade_progress_in_frames) / static_cast<float>(_fade_length_in_frames);
+                const SAMPLE_T *old_frame = _fading->data.get() + static_cast<size_t>(_fading_position_in_frames) * channels;
+                for (int32_t c = 0; c < channels; ++c)
+                {
+                    const size_t index = static_cast<size_t>(i) * channels + c;
+                    const float mixed = gain_in * static_cast<float>(out[index]) + (1.0f - gain_in) * static_cast<float>(old_frame[c]);
+                    out[index] = toSample(mixed);
+                }
+                if (++_fading_position_in_frames >= _fading->size_in_frames)
+                {
+                    _fading_position_in_frames = 0;
+                }
+            }
+            if (_fade_progress_in_frames >= _fade_length_in_frames)
+            {
+                _fading = nullptr;
+                _hazard_fading.store(nullptr);
+            }
+        }
+
+        static SAMPLE_T toSample(float value)
+        {
+            if constexpr (std::is_integral_v<SAMPLE_T>)
+            {
+                constexpr auto min = static_cast<float>(std::numeric_limits<SAMPLE_T>::min());
+                constexpr auto max = static_cast<float>(std::numeric_limits<SAMPLE_T>::max());
+                return static_cast<SAMPLE_T>(std::lround(std::clamp(value, min, max)));
+            } else
+            {
+                return static_cast<SAMPLE_T>(value);
+            }
+        }
     };
 }
 #endif //LOWLATENCYAUDIOPLAYERRECORDER_OBOEPLAYER_H
@@ -34,51 +34,26 @@ namespace ase_android
         void start() override
         {
             std::lock_guard<std::recursive_mutex> lock{base::_oboe_stream_lock};
-            const char *error_message = nullptr;
             oboe::AudioStreamBuilder builder;
             if (base::_device_id != base::DEFAULT_DEVICE_ID)
             {
                 builder.setDeviceId(base::_device_id);
             }
 
-            auto result = builder
-                    .setDirection(oboe::Direction::Output)
+            builder.setDirection(oboe::Direction::Output)
                     ->setContentType(oboe::ContentType::Music)
                     ->setUsage(oboe::Usage::Media)
-                    ->setSharingMode(oboe::SharingMode::Shared)
                     ->setAudioApi(base::_audio_api)
-                            // LowLatency or PowerSaving on some phones cause glitch due to limited CPU resource
-                    ->setPerformanceMode(base::_performance_mode)
                     ->setChannelCount(base::_num_channels)
-                    ->setSampleRate(base::_sample_rate)
                     ->setSampleRateConversionQuality(oboe::SampleRateConversionQuality::None)
-                    ->setFormat(base::getOboeAudioFormat())
-                    ->setDataCallback(this)
-                    ->setFramesPerDataCallback(frames_per_callback_)
-                    ->openStream(base::_oboe_stream);
-
+                    ->setFormat(base::getOboeAudioFormat());
+            // At the native rate, pulling _sample_rate audio from onAudioReady(), and with the sharing and performance
+            // mode that suit this device (see OboeStreamAdapter::startStream())
+            const auto result = base::startStream(builder, frames_per_callback_);
             if (result != oboe::Result::OK)
             {
-                error_message = "Cannot create oboe output stream, error=";
-            }
-
-            result = base::_oboe_stream->requestStart();
-
-            if (result != oboe::Result::OK)
-            {
-                error_message = "Cannot start oboe output stream, error=";
-            }
-
-            if (error_message != nullptr)
-            {
-                if (base::_oboe_stream)
-                {
-                    base::_oboe_stream->stop();
-                    base::_oboe_stream->close();
-                    base::_oboe_stream.reset();
-                }
                 throw std::runtime_error(
-                        std::string(error_message) +
+                        std::string("Cannot start oboe output stream, error=") +
                         std::to_string(static_cast<int>(result)));
             }
             base::setFramesWritten(0);
@@ -30,51 +30,26 @@ namespace ase_android
         void start() override
         {
             std::lock_guard<std::recursive_mutex> lock{oboeBase::_oboe_stream_lock};
-            const char *error_message = nullptr;
-            oboe::Result result{};
             oboe::AudioStreamBuilder builder;
             if (oboeBase::_device_id != oboeBase::DEFAULT_DEVICE_ID)
             {
                 builder.setDeviceId(oboeBase::_device_id);
             }
-            result = builder
-                    .setInputPreset(oboe::InputPreset::Unprocessed)
+            builder.setInputPreset(oboe::InputPreset::Unprocessed)
                     ->setDirection(oboe::Direction::Input)
                     ->setAudioApi(oboeBase::_audio_api) // AAudio has problem on HarmonyOS
-                    ->setSharingMode(oboe::SharingMode::Shared)
-                    ->setPerformanceMode(oboeBase::_performance_mode)
                     ->setChannelCount(streamBase::_num_channels)
                     ->setChannelConversionAllowed(false)
-                    ->setSampleRate(oboeBase::_sample_rate)
                     ->setSampleRateConversionQuality(oboe::SampleRateConversionQuality::None)
                     ->setFormat(oboeBase::getOboeAudioFormat())
-                    ->setFormatConversionAllowed(true)
-                    ->setDataCallback(this)
-                    ->setFramesPerDataCallback(streamBase::_block_size_frames)
-                    ->openStream(oboeBase::_oboe_stream);
+                    ->setFormatConversionAllowed(true);
+            // At the native rate, converted to _sample_rate before produce(), and with the sharing and performance
+            // mode that suit this device (see OboeStreamAdapter::startStream())
+            const auto result = oboeBase::startStream(builder, streamBase::_block_size_frames);
             if (result != oboe::Result::OK)
             {
-                error_message = "Cannot create oboe input stream, error=";
-            }
-
-            result = oboeBase::_oboe_stream->requestStart();
-
-            if (result != oboe::Result::OK)
-            {
-                error_message = "Cannot start oboe input stream, error=";
-            }
-
-
-            if (error_message != nullptr)
-            {
-                if (oboeBase::_oboe_stream)
-                {
-                    oboeBase::_oboe_stream->stop();
-                    oboeBase::_oboe_stream->close();
-                    oboeBase::_oboe_stream.reset();
-                }
                 throw std::runtime_error(
-                        std::string(error_message) +
+                        std::string("Cannot start oboe input stream, error=") +
                         std::to_string(static_cast<int>(result)));
             }
             oboeBase::_frames_written = 0;
@@ -1,25 +1,65 @@
 #ifndef LOWLATENCYAUDIOPLAYERRECORDER_OBOESTREAMADAPTER_H
 #define LOWLATENCYAUDIOPLAYERRECORDER_OBOESTREAMADAPTER_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <string>
 #include <thread>
 #include <type_traits>
+#include <vector>
 #include <oboe/Oboe.h>
 #include <mutex>
 #include "ase/Common.hpp"
+#include "dsp/PolyphaseResampler.hpp"
+#include "dsp/SampleConversion.hpp"
+#include "tracing/LatencyHistogram.hpp"
+#include "StreamProfile.hpp"
 
 
 namespace ase_android
 {
+    /// Profile and callback timing of a stream since its start(), see OboeStreamAdapter::getStreamStats()
+    struct OboeStreamStats
+    {
+        oboe::Direction direction;
+        int32_t device_id;
+        /// As granted, which need not be what was asked for: without MMAP an exclusive request opens a shared stream
+        oboe::PerformanceMode performance_mode;
+        oboe::SharingMode sharing_mode;
+        int32_t sample_rate;
+        /// Underruns of an output stream or overruns of an input stream, -1 if the audio API does not count them
+        int32_t xruns;
+        int64_t callbacks;
+        /// Callbacks that came more than a callback period after they were due
+        int64_t late_callbacks;
+        /// Late callbacks among them that came after the stream's buffer must have run dry (or full, for input)
+        int64_t stalled_callbacks;
+        /// How far the time between callbacks strays from the audio they carry, in microseconds
+        ase_ultrasound_watermark::LatencyHistogram::Summary callback_jitter;
+        /// Profiles given up for glitching, and the streams reopened on the next one
+        int32_t fallbacks;
+    };
 
     template<typename SAMPLE_T, typename = typename std::enable_if<std::is_arithmetic<SAMPLE_T>::value, SAMPLE_T>::type>
     class OboeStreamAdapter : public oboe::AudioStreamDataCallback, public oboe::AudioStreamErrorCallback
     {
     public:
         static constexpr int DEFAULT_DEVICE_ID = -1;
+        /**
+         * Lowest native rate that is converted in the callback. A device below it cannot carry the pilot band
+         * anyway, so its streams are opened at the sample rate given at construction and converted by the platform.
+         */
+        static constexpr int32_t MIN_CONVERTED_SAMPLE_RATE = 44100;
 
         OboeStreamAdapter() = delete;
 
+        /// @param mode Performance mode of the stream when adaptive profiles are disabled, see setAdaptiveProfile()
         OboeStreamAdapter(int32_t device, int32_t sample_rate, int32_t channels, oboe::PerformanceMode mode) :
                 _oboe_stream_lock{},
                 _device_id{device},
@@ -27,21 +67,39 @@ namespace ase_android
                 _num_channels{channels},
                 _performance_mode{mode},
                 _frames_written{0},
-                _audio_api{oboe::AudioApi::Unspecified}
+                _audio_api{oboe::AudioApi::Unspecified},
+                _native_sample_rate{true},
+                _adaptive_profile{true},
+                _rate_converter{*this},
+                _frames_per_callback{oboe::kUnspecified},
+                _profile_level{0},
+                _stream_profile{STREAM_PROFILES.back()},
+                _stream_sample_rate{sample_rate},
+                _xrun_count_supported{false},
+                _closed_xruns{0},
+                _fallbacks{0},
+                _callbacks{0},
+                _late_callbacks{0},
+                _stalled_callbacks{0},
+                _last_callback_ns{0},
+                _last_callback_period_ns{0},
+                _stall_threshold_ns{0},
+                _monitor_stop{false}
+        {
+        }
+
+        ~OboeStreamAdapter() override
         {
+            stopMonitor();
         }
 
         virtual void start() = 0;
 
         virtual void stop()
         {
+            stopMonitor();
             std::lock_guard<std::recursive_mutex> lock{_oboe_stream_lock};
-            if (_oboe_stream)
-            {
-                _oboe_stream->stop();
-                _oboe_stream->close();
-                _oboe_stream.reset();
-            }
+            closeStream();
         }
 
         void setFramesWritten(int64_t frames)
@@ -54,7 +112,14 @@ namespace ase_android
             return _frames_written;
         }
 
+        /// Rate of the samples exchanged with onAudioReady(), the one given at construction
         [[nodiscard]] int32_t getSampleRate() const
+        {
+            return _sample_rate;
+        }
+
+        /// Rate the stream runs at. Differs from getSampleRate() when the callback converts between the two
+        [[nodiscard]] int32_t getStreamSampleRate() const
         {
             if (_oboe_stream)
             {
@@ -105,6 +170,48 @@ namespace ase_android
             _audio_api = api;
         }
 
+        /**
+         * Open streams at the device's native rate and convert to and from getSampleRate() in the callback with
+         * dsp::PolyphaseResampler. Asking for a rate the device does not run at either fails or takes the platform's
+         * resampling path, which rules out MMAP and fast-track streams. OpenSL ES takes the native rate from
+         * oboe::DefaultStreamValues, which the app sets from AudioManager. Enabled by default; takes effect at the
+         * next start().
+         */
+        void setNativeSampleRate(bool native)
+        {
+            _native_sample_rate = native;
+        }
+
+        /**
+         * Pick the stream's profile per device instead of using SharingMode::Shared and the performance mode given at
+         * construction. The stream tries STREAM_PROFILES from the one StreamProfileStore holds for it, and while it
+         * runs, xruns (stalled callbacks where the audio API does not count xruns) are watched: a profile that
+         * glitches is recorded as failed in the store and the stream is reopened on the next one. No single profile suits
+         * every phone; low latency paths glitch on some for lack of CPU. Enabled by default; takes effect at the
+         * next start().
+         */
+        void setAdaptiveProfile(bool adaptive)
+        {
+            _adaptive_profile = adaptive;
+        }
+
+        [[nodiscard]] OboeStreamStats getStreamStats()
+        {
+            std::lock_guard<std::recursive_mutex> lock{_oboe_stream_lock};
+            const int32_t xruns = countXRuns();
+            return OboeStreamStats{_stream_builder.getDirection(),
+                                   getDeviceId(),
+                                   _stream_profile.performance_mode,
+                                   _stream_profile.sharing_mode,
+                                   _stream_sample_rate,
+                                   _xrun_count_supported ? _closed_xruns + xruns : -1,
+                                   _callbacks.load(std::memory_order_relaxed),
+                                   _late_callbacks.load(std::memory_order_relaxed),
+                                   _stalled_callbacks.load(std::memory_order_relaxed),
+                                   _callback_jitter.summarize(),
+                                   _fallbacks};
+        }
+
     protected:
         std::recursive_mutex _oboe_stream_lock;
         std::shared_ptr<oboe::AudioStream> _oboe_stream;
@@ -115,6 +222,71 @@ namespace ase_android
         int64_t _frames_written;
         std::function<void(oboe::AudioStream *stream)> _on_error_callback;
         oboe::AudioApi _audio_api;
+        bool _native_sample_rate;
+        bool _adaptive_profile;
+
+        /**
+         * Open and start _oboe_stream from a builder set up with everything but the rate, the data callback, the
+         * callback size and the profile, which are filled in here. Adaptive streams (see setAdaptiveProfile()) try
+         * the profiles from the stored one down until one starts, skipping those that fail to open for this start
+         * only, and are then watched by a monitor thread until stop(). The stored profile is looked up again for the
+         * device the stream was routed to, as an unspecified device is not known before the stream opens. Others are
+         * shared, with the performance mode given at construction.
+         * @param frames_per_callback At getSampleRate(), or oboe::kUnspecified
+         */
+        oboe::Result startStream(const oboe::AudioStreamBuilder &builder, int32_t frames_per_callback)
+        {
+            std::lock_guard<std::recursive_mutex> lock{_oboe_stream_lock};
+            stopMonitor();
+            closeStream();
+            _stream_builder = builder;
+            _frames_per_callback = frames_per_callback;
+            _closed_xruns = 0;
+            _fallbacks = 0;
+            _callbacks.store(0, std::memory_order_relaxed);
+            _late_callbacks.store(0, std::memory_order_relaxed);
+            _stalled_callbacks.store(0, std::memory_order_relaxed);
+            _callback_jitter.reset();
+            if (!_adaptive_profile)
+            {
+                std::shared_ptr<oboe::AudioStream> stream;
+                const auto result = openProfile(StreamProfile{_performance_mode, oboe::SharingMode::Shared}, stream);
+                return result == oboe::Result::OK ? startOpened(std::move(stream)) : result;
+            }
+            auto result = oboe::Result::ErrorInternal;
+            auto &store = StreamProfileStore::instance();
+            for (_profile_level = store.level(StreamProfileStore::key(builder.getDirection(), _device_id, _audio_api));
+                 _profile_level < STREAM_PROFILES.size(); ++_profile_level)
+            {
+                std::shared_ptr<oboe::AudioStream> stream;
+                result = openProfile(STREAM_PROFILES[_profile_level], stream);
+                if (result != oboe::Result::OK)
+                {
+                    continue;
+                }
+                const auto key = StreamProfileStore::key(stream->getDirection(), stream->getDeviceId(), stream->getAudioApi());
+                const size_t routed_level = store.level(key);
+                if (routed_level > _profile_level)
+                {
+                    // Routed to a device this profile glitched on before
+                    stream->close();
+                    _profile_level = routed_level - 1;
+                    continue;
+                }
+                _profile_key = key;
+                result = startOpened(std::move(stream));
+                if (result == oboe::Result::OK)
+                {
+                    if (nextProfileLevel() < STREAM_PROFILES.size())
+                    {
+                        _monitor_stop = false;
+                        _monitor = std::thread{&OboeStreamAdapter::monitorProfile, this};
+                    }
+                    break;
+                }
+            }
+            return result;
+        }
 
         void onErrorAfterClose(oboe::AudioStream *stream, oboe::Result error) override
         {
@@ -147,6 +319,441 @@ namespace ase_android
             }
             return oboe::AudioFormat::Invalid;
         }
+
+    private:
+        /**
+         * Data callback of the stream, timing it for getStreamStats() and passing it on to onAudioReady() unchanged if the stream runs at getSampleRate(),
+         * and through a dsp::PolyphaseResampler otherwise. Output streams pull what the resampler needs from
+         * onAudioReady(); input streams push what it makes. Either way onAudioReady() gets at most the frames per
+         * callback it asked for, and nothing is allocated in the callback.
+         */
+        class RateConverter : public oboe::AudioStreamDataCallback
+        {
+        public:
+            explicit RateConverter(OboeStreamAdapter &owner) : _owner{owner}, _output{false}, _chunk_frames{0}, _max_frames{0}
+            {
+            }
+
+            void prepare(const oboe::AudioStream &stream, int32_t frames_per_callback)
+            {
+                _resampler.reset();
+                const int32_t stream_rate = stream.getSampleRate();
+                const int32_t rate = _owner._sample_rate;
+                if (stream_rate == rate)
+                {
+                    return;
+                }
+                const int32_t channels = stream.getChannelCount();
+                if (frames_per_callback <= 0)
+                {
+                    frames_per_callback = std::max(scaleFrames(stream.getFramesPerBurst(), rate, stream_rate), MIN_CALLBACK_FRAMES);
+                }
+                _output = stream.getDirection() == oboe::Direction::Output;
+                // Stream frames per chunk such that the chunk never makes or needs more than frames_per_callback
+                _chunk_frames = std::max(static_cast<size_t>(static_cast<int64_t>(frames_per_callback) * stream_rate / rate), size_t{1});
+                _max_frames = static_cast<size_t>(frames_per_callback);
+                _resampler = _output ? std::make_unique<Resampler>(rate, stream_rate, channels, _max_frames)
+                                     : std::make_unique<Resampler>(stream_rate, rate, channels, _chunk_frames);
+                _stream_block.assign(_chunk_frames * channels, 0.0f);
+                _block.assign(_max_frames * channels, 0.0f);
+                _samples.assign(_max_frames * channels, SAMPLE_T{});
+            }
+
+            oboe::DataCallbackResult onAudioReady(oboe::AudioStream *audioStream, void *audioData, int32_t numFrames) override
+            {
+                _owner.recordCallback(numFrames);
+                if (!_resampler)
+                {
+                    return _owner.onAudioReady(audioStream, audioData, numFrames);
+                }
+                auto *data = reinterpret_cast<SAMPLE_T *>(audioData);
+                const auto channels = static_cast<size_t>(_owner._num_channels);
+                const auto frames = static_cast<size_t>(numFrames);
+                auto result = oboe::DataCallbackResult::Continue;
+                for (size_t done = 0; done < frames;)
+                {
+                    const size_t chunk = std::min(frames - done, _chunk_frames);
+                    if (_output)
+                    {
+                        const size_t needed = std::min(_resampler->inputFramesFor(chunk), _max_frames);
+                        if (needed > 0)
+                        {
+                            result = _owner.onAudioReady(audioStream, _samples.data(), static_cast<int32_t>(needed));
+                            toFloat(_samples.data(), _block.data(), needed * channels);
+                        }
+                        const size_t made = _resampler->process(_block.data(), needed, _stream_block.data(), chunk);
+                        fromFloat(_stream_block.data(), data + done * channels, made * channels);
+                        done += made;
+                    }
+                    else
+                    {
+                        toFloat(data + done * channels, _stream_block.data(), chunk * channels);
+                        const size_t made = _resampler->process(_stream_block.data(), chunk, _block.data(), _max_frames);
+                        if (made > 0)
+                        {
+                            fromFloat(_block.data(), _samples.data(), made * channels);
+                            result = _owner.onAudioReady(audioStream, _samples.data(), static_cast<int32_t>(made));
+                        }
+                        done += chunk;
+                    }
+                    if (result != oboe::DataCallbackResult::Continue)
+                    {
+                        if (_output)
+                        {
+                            std::fill(data + done * channels, data + frames * channels, SAMPLE_T{});
+                        }
+                        break;
+                    }
+                }
+                return result;
+            }
+
+        private:
+            using Resampler = ase_ultrasound_watermark::dsp::PolyphaseResampler;
+            static constexpr int32_t MIN_CALLBACK_FRAMES = 64;
+
+            OboeStreamAdapter &_owner;
+            std::unique_ptr<Resampler> _resampler;
+            bool _output;
+            /// Stream frames converted at a time, and the most frames exchanged with onAudioReady() at a time
+            size_t _chunk_frames;
+            size_t _max_frames;
+            std::vector<float> _stream_block;
+            std::vector<float> _block;
+            std::vector<SAMPLE_T> _samples;
+
+            static void toFloat(const SAMPLE_T *in, float *out, size_t samples)
+            {
+                if constexpr (std::is_same_v<SAMPLE_T, int16_t>)
+                {
+                    ase_ultrasound_watermark::dsp::int16ToFloat(in, out, samples);
+                } else if constexpr (std::is_floating_point_v<SAMPLE_T>)
+                {
+                    std::copy_n(in, samples, out);
+                } else
+                {
+                    constexpr float scale = 1.0f / static_cast<float>(std::numeric_limits<SAMPLE_T>::max());
+                    std::transform(in, in + samples, out, [](SAMPLE_T sample) { return static_cast<float>(sample) * scale; });
+                }
+            }
+
+            static void fromFloat(const float *in, SAMPLE_T *out, size_t samples)
+            {
+                if constexpr (std::is_same_v<SAMPLE_T, int16_t>)
+                {
+                    ase_ultrasound_watermark::dsp::floatToInt16(in, out, samples);
+                } else if constexpr (std::is_floating_point_v<SAMPLE_T>)
+                {
+                    std::copy_n(in, samples, out);
+                } else
+                {
+                    constexpr auto max = static_cast<double>(std::numeric_limits<SAMPLE_T>::max());
+                    std::transform(in, in + samples, out, [](float sample) {
+                        return static_cast<SAMPLE_T>(std::clamp(static_cast<double>(sample) * max, -max - 1.0, max));
+                    });
+                }
+            }
+        };
+
+        RateConverter _rate_converter;
+
+        /// Time between polls of the stream, and the span glitches are counted over
+        static constexpr auto MONITOR_INTERVAL = std::chrono::seconds(1);
+        static constexpr auto MONITOR_WINDOW = std::chrono::seconds(10);
+        /// Glitches within MONITOR_WINDOW that give up the profile. A stray xrun, e.g. when another app starts, is not
+        /// worth the gap of reopening the stream
+        static constexpr int64_t FALLBACK_GLITCHES = 3;
+        /// Callback periods a callback may come late by before it counts as stalled, however large the buffer. Some
+        /// paths deliver callbacks in bursts, so a gap of a few periods is their normal rhythm rather than a glitch
+        static constexpr int64_t MIN_STALL_PERIODS = 4;
+
+        oboe::AudioStreamBuilder _stream_builder;
+        int32_t _frames_per_callback;
+        std::string _profile_key;
+        size_t _profile_level;
+        /// Profile and rate the stream was opened with
+        StreamProfile _stream_profile;
+        int32_t _stream_sample_rate;
+        bool _xrun_count_supported;
+        /// Xruns of the streams closed since start(), by fallbacks
+        int32_t _closed_xruns;
+        int32_t _fallbacks;
+        /// Callback timing, written by the callback thread
+        std::atomic<int64_t> _callbacks;
+        std::atomic<int64_t> _late_callbacks;
+        std::atomic<int64_t> _stalled_callbacks;
+        int64_t _last_callback_ns;
+        int64_t _last_callback_period_ns;
+        /// How long the stream's buffer lasts, set when it starts
+        int64_t _stall_threshold_ns;
+        ase_ultrasound_watermark::LatencyHistogram _callback_jitter;
+        std::thread _monitor;
+        std::mutex _monitor_mutex;
+        std::condition_variable _monitor_cv;
+        bool _monitor_stop;
+
+        /**
+         * Open stream at the native rate if enabled, with the callback going through the rate converter. The stream
+         * is not started, and startOpened() prepares the converter for it, so another stream may still be running.
+         */
+        oboe::Result openStream(oboe::AudioStreamBuilder &builder, int32_t frames_per_callback, std::shared_ptr<oboe::AudioStream> &stream)
+        {
+            oboe::Result result;
+            if (_native_sample_rate)
+            {
+                // An unspecified rate is the device's own with AAudio, and DefaultStreamValues::SampleRate with
+                // OpenSL ES; the latter is the best guess of the former for sizing the callback
+                const int32_t native_rate = oboe::DefaultStreamValues::SampleRate;
+                oboe::AudioStreamBuilder native_builder = builder;
+                result = native_builder
+                        .setSampleRate(oboe::kUnspecified)
+                        ->setFramesPerDataCallback(native_rate > 0 ? scaleFrames(frames_per_callback, native_rate, _sample_rate)
+                                                                   : frames_per_callback)
+                        ->setDataCallback(&_rate_converter)
+                        ->openStream(stream);
+                if (result == oboe::Result::OK && stream->getSampleRate() != _sample_rate &&
+                    stream->getSampleRate() < MIN_CONVERTED_SAMPLE_RATE)
+                {
+                    stream->close();
+                    stream.reset();
+                }
+                if (result == oboe::Result::OK && stream)
+                {
+                    return result;
+                }
+            }
+            // Without conversion quality the platform may still open another rate than asked for
+            return builder
+                    .setSampleRate(_sample_rate)
+                    ->setFramesPerDataCallback(frames_per_callback)
+                    ->setDataCallback(&_rate_converter)
+                    ->openStream(stream);
+        }
+
+        /// Open a stream with profile without starting it. Called with the stream lock held
+        oboe::Result openProfile(const StreamProfile &profile, std::shared_ptr<oboe::AudioStream> &stream)
+        {
+            oboe::AudioStreamBuilder builder = _stream_builder;
+            builder.setSharingMode(profile.sharing_mode)
+                    ->setPerformanceMode(profile.performance_mode);
+            return openStream(builder, _frames_per_callback, stream);
+        }
+
+        /// Make stream, opened by openProfile(), the running one. Called with the stream lock held and no stream open
+        oboe::Result startOpened(std::shared_ptr<oboe::AudioStream> stream)
+        {
+            _oboe_stream = std::move(stream);
+            _rate_converter.prepare(*_oboe_stream, _frames_per_callback);
+            _stream_profile = StreamProfile{_oboe_stream->getPerformanceMode(), _oboe_stream->getSharingMode()};
+            _stream_sample_rate = _oboe_stream->getSampleRate();
+            _xrun_count_supported = _oboe_stream->isXRunCountSupported();
+            _stall_threshold_ns = static_cast<int64_t>(_oboe_stream->getBufferSizeInFrames()) * 1000000000 / _stream_sample_rate;
+            _last_callback_ns = 0;
+            const auto result = _oboe_stream->requestStart();
+            if (result != oboe::Result::OK)
+            {
+                closeStream();
+            }
+            return result;
+        }
+
+        /// Called with the stream lock held
+        void closeStream()
+        {
+            if (_oboe_stream)
+            {
+                _oboe_stream->stop();
+                _closed_xruns += countXRuns();
+                _oboe_stream->close();
+                _oboe_stream.reset();
+            }
+        }
+
+        void stopMonitor()
+        {
+            {
+                std::lock_guard<std::mutex> lock{_monitor_mutex};
+                _monitor_stop = true;
+            }
+            _monitor_cv.notify_all();
+            if (_monitor.joinable())
+            {
+                _monitor.join();
+            }
+        }
+
+        /// Xruns of the open stream
+        [[nodiscard]] int32_t countXRuns() const
+        {
+            if (!_oboe_stream || !_xrun_count_supported)
+            {
+                return 0;
+            }
+            const auto xruns = _oboe_stream->getXRunCount();
+            return xruns ? xruns.value() : 0;
+        }
+
+        /// Xruns since start(), or stalled callbacks where the audio API does not count xruns
+        [[nodiscard]] int64_t countGlitches() const
+        {
+            if (_xrun_count_supported)
+            {
+                return _closed_xruns + countXRuns();
+            }
+            return _stalled_callbacks.load(std::memory_order_relaxed);
+        }
+
+        /// The profile below the current one that differs from what the stream was granted, or past the last one
+        [[nodiscard]] size_t nextProfileLevel() const
+        {
+            size_t level = _profile_level + 1;
+            while (level < STREAM_PROFILES.size() &&
+                   STREAM_PROFILES[level].performance_mode == _stream_profile.performance_mode &&
+                   STREAM_PROFILES[level].sharing_mode == _stream_profile.sharing_mode)
+            {
+                ++level;
+            }
+            return level;
+        }
+
+        /**
+         * Body of the monitor thread. Never blocks on the stream lock, so that stop() can join it while holding the
+         * lock; a poll that finds the lock taken is skipped. The first poll sets the baseline, so that xruns of the
+         * stream settling in after start do not count. A stream lost in a fallback is retried at every poll.
+         */
+        void monitorProfile()
+        {
+            using clock = std::chrono::steady_clock;
+            std::unique_lock<std::mutex> lock{_monitor_mutex};
+            bool has_baseline = false;
+            int64_t baseline = 0;
+            clock::time_point window_start;
+            while (!_monitor_cv.wait_for(lock, MONITOR_INTERVAL, [this] { return _monitor_stop; }))
+            {
+                std::unique_lock<std::recursive_mutex> stream_lock{_oboe_stream_lock, std::try_to_lock};
+                if (!stream_lock.owns_lock())
+                {
+                    continue;
+                }
+                if (!_oboe_stream)
+                {
+                    restartProfile();
+                    has_baseline = false;
+                    continue;
+                }
+                const int64_t glitches = countGlitches();
+                const auto now = clock::now();
+                if (has_baseline && glitches - baseline >= FALLBACK_GLITCHES)
+                {
+                    const bool fell_back = fallBack();
+                    if (_oboe_stream && (!fell_back || nextProfileLevel() >= STREAM_PROFILES.size()))
+                    {
+                        // Nothing further down to try
+                        return;
+                    }
+                    has_baseline = false;
+                    continue;
+                }
+                if (!has_baseline || now - window_start >= MONITOR_WINDOW)
+                {
+                    baseline = glitches;
+                    window_start = now;
+                    has_baseline = true;
+                }
+            }
+        }
+
+        /**
+         * Move the stream to the next profile that starts, and record the running one as failed. The replacement is
+         * opened while the glitching stream still runs, which is only closed once there is one; some devices open a
+         * single stream per direction at a time, so failing that, it is closed first after all. If no profile below
+         * starts, the glitching profile is reopened, and the profile is not recorded as failed.
+         * Returns false if the stream keeps its profile. Called with the stream lock held.
+         */
+        bool fallBack()
+        {
+            const size_t failed_level = _profile_level;
+            const size_t first_level = nextProfileLevel();
+            for (const bool close_first: {false, true})
+            {
+                if (close_first)
+                {
+                    closeStream();
+                }
+                for (size_t level = first_level; level < STREAM_PROFILES.size(); ++level)
+                {
+                    std::shared_ptr<oboe::AudioStream> replacement;
+                    if (openProfile(STREAM_PROFILES[level], replacement) != oboe::Result::OK)
+                    {
+                        continue;
+                    }
+                    closeStream();
+                    if (startOpened(std::move(replacement)) == oboe::Result::OK)
+                    {
+                        _profile_level = level;
+                        StreamProfileStore::instance().demote(_profile_key, level);
+                        ++_fallbacks;
+                        return true;
+                    }
+                }
+            }
+            _profile_level = failed_level;
+            if (!_oboe_stream)
+            {
+                restartProfile();
+            }
+            return false;
+        }
+
+        /**
+         * Reopen the stream on its current profile after it was lost in a fallback. Reports an error through the
+         * error callback if it does not start, and is retried by the monitor. Called with the stream lock held.
+         */
+        void restartProfile()
+        {
+            std::shared_ptr<oboe::AudioStream> stream;
+            auto result = openProfile(STREAM_PROFILES[_profile_level], stream);
+            if (result == oboe::Result::OK)
+            {
+                result = startOpened(std::move(stream));
+            }
+            if (result != oboe::Result::OK && _on_error_callback)
+            {
+                std::thread(_on_error_callback, nullptr).detach();
+            }
+        }
+
+        /// Called at the start of each data callback, on the callback thread
+        void recordCallback(int32_t num_frames)
+        {
+            const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            if (_last_callback_ns != 0)
+            {
+                const int64_t interval_ns = now_ns - _last_callback_ns;
+                _callback_jitter.record(std::abs(interval_ns - _last_callback_period_ns));
+                if (interval_ns > 2 * _last_callback_period_ns)
+                {
+                    _late_callbacks.fetch_add(1, std::memory_order_relaxed);
+                }
+                if (interval_ns > std::max(MIN_STALL_PERIODS * _last_callback_period_ns, _stall_threshold_ns))
+                {
+                    _stalled_callbacks.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            _last_callback_ns = now_ns;
+            _last_callback_period_ns = static_cast<int64_t>(num_frames) * 1000000000 / _stream_sample_rate;
+            _callbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        static int32_t scaleFrames(int32_t frames, int32_t to_rate, int32_t from_rate)
+        {
+            if (frames <= 0)
+            {
+                return frames;
+            }
+            return static_cast<int32_t>((static_cast<int64_t>(frames) * to_rate + from_rate / 2) / from_rate);
+        }
     };
 }
 #endif //LOWLATENCYAUDIOPLAYERRECORDER_OBOESTREAMADAPTER_H
@@ -0,0 +1,150 @@
+#ifndef ULTRASOUNDWATERMARK_OBOETONEPLAYER_HPP
+#define ULTRASOUNDWATERMARK_OBOETONEPLAYER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include <oboe/Oboe.h>
+#include <ase/utilities/SpinLock.hpp>
+#include "OboePlayerBase.hpp"
+#include "dsp/OscillatorBank.hpp"
+#include "dsp/SampleConversion.hpp"
+
+namespace ase_android
+{
+    /**
+     * Plays a set of sine tones synthesized in the callback, the counterpart of OboeLoopPlayer for signals that are
+     * a sum of tones: no file to load and no buffer of the signal, only a block of the oscillator bank.
+     *
+     * setTones() copies the tone set into a pending slot under a spin lock that the callback only ever try-locks,
+     * so the callback never waits; if it misses the lock it picks the tones up at the next callback. Tone changes
+     * ramp over the crossfade length given at construction (see dsp::OscillatorBank). Every channel plays the
+     * same signal.
+     */
+    template<typename SAMPLE_T>
+    class OboeTonePlayer : public OboePlayerBase<SAMPLE_T>
+    {
+        using base = OboePlayerBase<SAMPLE_T>;
+        using Tone = ase_ultrasound_watermark::dsp::Tone;
+        using OscillatorBank = ase_ultrasound_watermark::dsp::OscillatorBank;
+    public:
+        /// @param crossfade_frames Ramp of tones that are added, removed or change amplitude
+        OboeTonePlayer(int32_t device, int32_t sample_rate, int32_t channels, oboe::PerformanceMode mode, int32_t callback_samples,
+                       int32_t crossfade_frames = 0)
+                : OboePlayerBase<SAMPLE_T>(device, sample_rate, channels, mode, callback_samples),
+                  _pending_count{0},
+                  _pending_version{0},
+                  _applied_version{0},
+                  _bank{sample_rate, crossfade_frames}
+        {
+        }
+
+        /// Start the stream playing silence, as OboeLoopPlayer does. Call setTones() to play
+        void start() override
+        {
+            clearTones();
+            base::start();
+        }
+
+        /**
+         * Play tones, replacing the current ones
+         * @throw std::runtime_error if the tone set is not valid (see dsp::OscillatorBank::validateTones())
+         */
+        void setTones(const std::vector<Tone> &tones)
+        {
+            OscillatorBank::validateTones(tones, base::_sample_rate);
+            std::lock_guard lock{_pending_lock};
+            std::copy(tones.begin(), tones.end(), _pending.begin());
+            _pending_count = tones.size();
+            _pending_version.fetch_add(1, std::memory_order_release);
+        }
+
+        /// Fade out to silence. The stream keeps running; call stop() to shut it down
+        void clearTones()
+        {
+            setTones({});
+        }
+
+        /// Stop the stream started by start(). The tones are removed
+        void stop() override
+        {
+            base::stop();
+            // No callback can run now, so its private state can be reset from here
+            std::lock_guard lock{_pending_lock};
+            _pending_count = 0;
+            _applied_version = _pending_version.load();
+            _bank.reset();
+        }
+
+        oboe::DataCallbackResult
+        onAudioReady(oboe::AudioStream *audioStream, void *audioData, int32_t numFrames) override
+        {
+            const uint64_t version = _pending_version.load(std::memory_order_acquire);
+            if (version != _applied_version && _pending_lock.try_lock())
+            {
+                _bank.setTones(_pending.data(), _pending_count);
+                _applied_version = _pending_version.load(std::memory_order_relaxed);
+                _pending_lock.unlock();
+            }
+
+            auto *out = reinterpret_cast<SAMPLE_T *>(audioData);
+            const int32_t channels = base::_num_channels;
+            for (int32_t done = 0; done < numFrames;)
+            {
+                const int32_t frames = std::min(numFrames - done, static_cast<int32_t>(_block.size()));
+                _bank.render(_block.data(), frames);
+                SAMPLE_T *const frame_out = out + static_cast<size_t>(done) * channels;
+                if (channels == 1)
+                {
+                    toSamples(_block.data(), frame_out, frames);
+                }
+                else
+                {
+                    toSamples(_block.data(), _interleave.data(), frames);
+                    for (int32_t i = 0; i < frames; ++i)
+                    {
+                        std::fill_n(frame_out + static_cast<size_t>(i) * channels, channels, _interleave[i]);
+                    }
+                }
+                done += frames;
+            }
+            base::setFramesWritten(base::getFramesWritten() + numFrames);
+            return oboe::DataCallbackResult::Continue;
+        }
+
+        virtual ~OboeTonePlayer() override
+        {
+            stop();
+        }
+
+    protected:
+        // Shared between control threads and the callback
+        ase::SpinLock _pending_lock;
+        std::array<Tone, OscillatorBank::MAX_TONES> _pending;
+        size_t _pending_count;
+        std::atomic<uint64_t> _pending_version;
+        // Owned by the callback
+        uint64_t _applied_version;
+        OscillatorBank _bank;
+        std::array<float, OscillatorBank::BLOCK_FRAMES> _block;
+        std::array<SAMPLE_T, OscillatorBank::BLOCK_FRAMES> _interleave;
+
+        static void toSamples(const float *in, SAMPLE_T *out, int32_t frames)
+        {
+            if constexpr (std::is_same_v<SAMPLE_T, int16_t>)
+            {
+                ase_ultrasound_watermark::dsp::floatToInt16(in, out, static_cast<size_t>(frames));
+            } else
+            {
+                std::copy_n(in, frames, out);
+            }
+        }
+    };
+
+} // ase_android
+
+#endif //ULTRASOUNDWATERMARK_OBOETONEPLAYER_HPP
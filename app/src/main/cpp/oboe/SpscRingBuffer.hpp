@@ -0,0 +1,153 @@
+#ifndef ULTRASOUNDWATERMARK_SPSCRINGBUFFER_HPP
+#define ULTRASOUNDWATERMARK_SPSCRINGBUFFER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <ase/Common.hpp>
+
+namespace ase_android
+{
+    /**
+     * Wait-free single-producer/single-consumer ring of trivially copyable elements.
+     *
+     * Exactly one thread may call the producer methods (write(), writeZeros(), writableSize()) and exactly one
+     * thread may call the consumer methods (read(), peek(), discard(), readableSize()).
+     * Neither side ever blocks or retries; a full/empty ring results in a short write/read.
+     * Capacity is rounded up to a power of two so that indices can be masked instead of taken modulo.
+     */
+    template<typename T>
+    class SpscRingBuffer
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "SpscRingBuffer only supports trivially copyable elements");
+
+    public:
+        explicit SpscRingBuffer(size_t min_capacity)
+                : capacity_{roundUpToPowerOfTwo(std::max<size_t>(min_capacity, 2))},
+                  mask_{capacity_ - 1},
+                  buffer_{capacity_},
+                  write_index_{0},
+                  read_index_{0}
+        {
+        }
+
+        SpscRingBuffer(const SpscRingBuffer &) = delete;
+
+        SpscRingBuffer &operator=(const SpscRingBuffer &) = delete;
+
+        [[nodiscard]] size_t capacity() const
+        {
+            return capacity_;
+        }
+
+        /// Producer side. Number of elements that can be written without overwriting unread data
+        [[nodiscard]] size_t writableSize() const
+        {
+            const size_t write = write_index_.load(std::memory_order_relaxed);
+            const size_t read = read_index_.load(std::memory_order_acquire);
+            return capacity_ - (write - read);
+        }
+
+        /// Consumer side. Number of elements available to read
+        [[nodiscard]] size_t readableSize() const
+        {
+            const size_t read = read_index_.load(std::memory_order_relaxed);
+            const size_t write = write_index_.load(std::memory_order_acquire);
+            return write - read;
+        }
+
+        /// Total number of elements consumed (read or discarded) since construction
+        [[nodiscard]] size_t totalConsumed() const
+        {
+            return read_index_.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Producer side. Append up to size elements.
+         * @return Number of elements actually written. Less than size if the ring is full.
+         */
+        size_t write(const T *data, size_t size)
+        {
+            const size_t write = write_index_.load(std::memory_order_relaxed);
+            const size_t read = read_index_.load(std::memory_order_acquire);
+            const size_t to_write = std::min(size, capacity_ - (write - read));
+            const size_t offset = write & mask_;
+            const size_t first = std::min(to_write, capacity_ - offset);
+            std::memcpy(buffer_.get() + offset, data, first * sizeof(T));
+            std::memcpy(buffer_.get(), data + first, (to_write - first) * sizeof(T));
+            write_index_.store(write + to_write, std::memory_order_release);
+            return to_write;
+        }
+
+        /// Producer side. Append up to size zero-valued elements
+        size_t writeZeros(size_t size)
+        {
+            const size_t write = write_index_.load(std::memory_order_relaxed);
+            const size_t read = read_index_.load(std::memory_order_acquire);
+            const size_t to_write = std::min(size, capacity_ - (write - read));
+            const size_t offset = write & mask_;
+            const size_t first = std::min(to_write, capacity_ - offset);
+            std::memset(buffer_.get() + offset, 0, first * sizeof(T));
+            std::memset(buffer_.get(), 0, (to_write - first) * sizeof(T));
+            write_index_.store(write + to_write, std::memory_order_release);
+            return to_write;
+        }
+
+        /// Consumer side. Copy up to size elements without consuming them
+        size_t peek(T *data, size_t size) const
+        {
+            const size_t read = read_index_.load(std::memory_order_relaxed);
+            const size_t write = write_index_.load(std::memory_order_acquire);
+            const size_t to_read = std::min(size, write - read);
+            const size_t offset = read & mask_;
+            const size_t first = std::min(to_read, capacity_ - offset);
+            std::memcpy(data, buffer_.get() + offset, first * sizeof(T));
+            std::memcpy(data + first, buffer_.get(), (to_read - first) * sizeof(T));
+            return to_read;
+        }
+
+        /// Consumer side. Copy and consume up to size elements
+        size_t read(T *data, size_t size)
+        {
+            const size_t to_read = peek(data, size);
+            read_index_.store(read_index_.load(std::memory_order_relaxed) + to_read, std::memory_order_release);
+            return to_read;
+        }
+
+        /// Consumer side. Drop up to size of the oldest elements
+        size_t discard(size_t size)
+        {
+            const size_t read = read_index_.load(std::memory_order_relaxed);
+            const size_t write = write_index_.load(std::memory_order_acquire);
+            const size_t to_discard = std::min(size, write - read);
+            read_index_.store(read + to_discard, std::memory_order_release);
+            return to_discard;
+        }
+
+    private:
+        // Keep producer and consumer indices on separate cache lines to avoid false sharing
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        const size_t capacity_;
+        const size_t mask_;
+        ase::aligned_unique_ptr<T[]> buffer_;
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> write_index_;
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> read_index_;
+
+        static constexpr size_t roundUpToPowerOfTwo(size_t value)
+        {
+            size_t result = 1;
+            while (result < value)
+            {
+                result <<= 1;
+            }
+            return result;
+        }
+    };
+
+} // ase_android
+
+#endif //ULTRASOUNDWATERMARK_SPSCRINGBUFFER_HPP
@@ -0,0 +1,191 @@
+#ifndef ULTRASOUNDWATERMARK_STREAMPROFILE_HPP
+#define ULTRASOUNDWATERMARK_STREAMPROFILE_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <oboe/Oboe.h>
+
+namespace ase_android
+{
+    /// Performance and sharing mode a stream is opened with
+    struct StreamProfile
+    {
+        oboe::PerformanceMode performance_mode;
+        oboe::SharingMode sharing_mode;
+    };
+
+    /**
+     * Profiles adaptive streams try, best first. An exclusive low-latency stream is an MMAP stream where the device
+     * supports it, with the shortest path to the hardware; a shared one still gets a fast mixer track; the last is
+     * the platform's default path with large buffers, which copes with a CPU that cannot keep up with small bursts.
+     */
+    inline constexpr std::array<StreamProfile, 3> STREAM_PROFILES{{
+            {oboe::PerformanceMode::LowLatency, oboe::SharingMode::Exclusive},
+            {oboe::PerformanceMode::LowLatency, oboe::SharingMode::Shared},
+            {oboe::PerformanceMode::None, oboe::SharingMode::Shared},
+    }};
+
+    /**
+     * Process-wide record of the profile each stream starts from, as an index into STREAM_PROFILES. A stream is
+     * identified by the direction, device and audio API it was actually opened with, see key(). Profiles that glitched
+     * are demoted past, and once open() names a file the record is kept there, so later sessions start on the best
+     * profile that held up. A glitch may have had a passing cause, such as a CPU-heavy app, so a demoted stream tries
+     * the profile above again every PROMOTION_INTERVAL, and is demoted again if it still glitches there.
+     * A record made under another build fingerprint is dropped, as an OS update may fix or break a path. Thread safe.
+     */
+    class StreamProfileStore
+    {
+    public:
+        static constexpr auto PROMOTION_INTERVAL = std::chrono::hours(24 * 7);
+
+        static StreamProfileStore &instance()
+        {
+            static StreamProfileStore store;
+            return store;
+        }
+
+        static std::string key(oboe::Direction direction, int32_t device_id, oboe::AudioApi audio_api)
+        {
+            return std::string(direction == oboe::Direction::Input ? "input" : "output") + ':' +
+                   std::to_string(device_id) + ':' + std::to_string(static_cast<int>(audio_api));
+        }
+
+        /// Load the record kept at path and save it there from now on. A missing or unreadable file starts empty
+        void open(const std::filesystem::path &path, const std::string &fingerprint)
+        {
+            std::lock_guard lock{mutex_};
+            path_ = path;
+            fingerprint_ = fingerprint;
+            levels_.clear();
+            std::ifstream file{path_};
+            std::string recorded_fingerprint;
+            if (!std::getline(file, recorded_fingerprint) || recorded_fingerprint != fingerprint_)
+            {
+                return;
+            }
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::istringstream fields{line};
+                std::string stream_key;
+                Record record{0, 0};
+                if (fields >> stream_key >> record.level >> record.since_s && record.level > 0 && record.level < STREAM_PROFILES.size())
+                {
+                    levels_[stream_key] = record;
+                }
+            }
+        }
+
+        /**
+         * Index into STREAM_PROFILES the stream starts from, 0 unless it was demoted. Moves the stream one profile up
+         * for every PROMOTION_INTERVAL since it was last demoted or promoted.
+         */
+        [[nodiscard]] size_t level(const std::string &stream_key)
+        {
+            std::lock_guard lock{mutex_};
+            const auto it = levels_.find(stream_key);
+            if (it == levels_.end())
+            {
+                return 0;
+            }
+            Record &record = it->second;
+            const int64_t now_s = nowSeconds();
+            const auto intervals = static_cast<size_t>(std::max<int64_t>((now_s - record.since_s) / PROMOTION_INTERVAL_S, 0));
+            if (intervals == 0)
+            {
+                return record.level;
+            }
+            record.level -= std::min(intervals, record.level);
+            record.since_s = now_s;
+            const size_t level = record.level;
+            if (level == 0)
+            {
+                levels_.erase(it);
+            }
+            saveLocked();
+            return level;
+        }
+
+        /// Start the stream from level on, unless it already starts further down
+        void demote(const std::string &stream_key, size_t level)
+        {
+            std::lock_guard lock{mutex_};
+            level = std::min(level, STREAM_PROFILES.size() - 1);
+            Record &stored = levels_.try_emplace(stream_key, Record{0, 0}).first->second;
+            if (stored.level >= level)
+            {
+                return;
+            }
+            stored = Record{level, nowSeconds()};
+            saveLocked();
+        }
+
+        /// Forget every demotion, so that each stream tries the best profile again
+        void clear()
+        {
+            std::lock_guard lock{mutex_};
+            levels_.clear();
+            saveLocked();
+        }
+
+    private:
+        struct Record
+        {
+            size_t level;
+            /// Wall-clock time of the last demotion or promotion, as the record outlives reboots
+            int64_t since_s;
+        };
+
+        static constexpr int64_t PROMOTION_INTERVAL_S = std::chrono::duration_cast<std::chrono::seconds>(PROMOTION_INTERVAL).count();
+
+        mutable std::mutex mutex_;
+        std::filesystem::path path_;
+        std::string fingerprint_;
+        std::map<std::string, Record> levels_;
+
+        StreamProfileStore() = default;
+
+        static int64_t nowSeconds()
+        {
+            return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        /// Write a temporary file and rename it over the record, so that a crash never leaves half of one
+        void saveLocked() const
+        {
+            if (path_.empty())
+            {
+                return;
+            }
+            std::filesystem::path temporary = path_;
+            temporary += ".tmp";
+            {
+                std::ofstream file{temporary, std::ios::trunc};
+                file << fingerprint_ << '\n';
+                for (const auto &[stream_key, record]: levels_)
+                {
+                    file << stream_key << ' ' << record.level << ' ' << record.since_s << '\n';
+                }
+                if (!file)
+                {
+                    return;
+                }
+            }
+            std::error_code error;
+            std::filesystem::rename(temporary, path_, error);
+        }
+    };
+
+} // ase_android
+
+#endif //ULTRASOUNDWATERMARK_STREAMPROFILE_HPP
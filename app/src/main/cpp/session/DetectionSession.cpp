@@ -0,0 +1,117 @@
+#include <algorithm>
+#include "DetectionSession.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    DetectionSession::Input::Input(std::weak_ptr<DetectionSession> session)
+            : ase::AudioDataStreamBase<int16_t>{WatermarkDetector::INPUT_FS, 1},
+              session_{std::move(session)}
+    {
+    }
+
+    void DetectionSession::Input::consume(const int16_t *samples, size_t size)
+    {
+        if (const auto session = session_.lock())
+        {
+            session->enqueue(samples, size);
+        }
+    }
+
+    std::shared_ptr<DetectionSession> DetectionSession::create(uint32_t session_id, std::shared_ptr<WatermarkDetector> detector,
+                                                               DetectorWorkerPool &pool, int queue_windows, int max_batch,
+                                                               ResultsCallback callback)
+    {
+        std::shared_ptr<DetectionSession> session{new DetectionSession(session_id, std::move(detector), pool, queue_windows, max_batch,
+                                                                       std::move(callback))};
+        // The decoder is handed to the transport, which may outlive the session
+        session->decoder_->attachConsumer(std::make_shared<Input>(session));
+        return session;
+    }
+
+    DetectionSession::DetectionSession(uint32_t session_id, std::shared_ptr<WatermarkDetector> detector, DetectorWorkerPool &pool,
+                                       int queue_windows, int max_batch, ResultsCallback callback)
+            : session_id_{session_id},
+              window_samples_{WatermarkDetector::WINDOW_STEP},
+              max_batch_samples_{window_samples_ * std::max(max_batch, 1)},
+              pool_{pool},
+              detector_{std::move(detector)},
+              converter_{std::make_shared<Int16ToFloatBlockStream>(WatermarkDetector::INPUT_FS, 1, WatermarkDetector::WINDOW_STEP)},
+              decoder_{std::make_shared<KcpFrameDecoder>(WatermarkDetector::INPUT_FS, nullptr)},
+              queue_{window_samples_ * std::max(queue_windows, max_batch)},
+              scratch_{max_batch_samples_},
+              callback_{std::move(callback)},
+              scheduled_{false},
+              closed_{false},
+              received_frames_{0},
+              detected_windows_{0},
+              dropped_frames_{0}
+    {
+        detector_->setCallback([this](float instantaneous, float average) {
+            detected_windows_.fetch_add(1, std::memory_order_relaxed);
+            if (callback_ && !closed_.load(std::memory_order_relaxed))
+            {
+                callback_(session_id_, instantaneous, average);
+            }
+        });
+        converter_->attachConsumer(detector_);
+    }
+
+    void DetectionSession::close()
+    {
+        closed_.store(true, std::memory_order_release);
+    }
+
+    SessionStats DetectionSession::getStats() const
+    {
+        const int64_t received = received_frames_.load(std::memory_order_relaxed);
+        const int64_t dropped = dropped_frames_.load(std::memory_order_relaxed);
+        const int64_t detected = detected_windows_.load(std::memory_order_relaxed);
+        return SessionStats{
+                session_id_,
+                received,
+                detected,
+                dropped,
+                static_cast<int32_t>(std::max<int64_t>(received - dropped - detected * WatermarkDetector::WINDOW_STEP, 0))
+        };
+    }
+
+    void DetectionSession::enqueue(const int16_t *samples, size_t size)
+    {
+        if (closed_.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        received_frames_.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+        if (size > queue_.writableSize())
+        {
+            // The pool is saturated. Keep what is queued so that the detector sees contiguous audio up to here
+            dropped_frames_.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+            return;
+        }
+        queue_.write(samples, size);
+        scheduleIfReady();
+    }
+
+    void DetectionSession::scheduleIfReady()
+    {
+        if (queue_.readableSize() >= window_samples_ && !closed_.load(std::memory_order_acquire) && !scheduled_.exchange(true))
+        {
+            pool_.submit([self = shared_from_this()] { self->drain(); });
+        }
+    }
+
+    void DetectionSession::drain()
+    {
+        if (!closed_.load(std::memory_order_acquire))
+        {
+            const size_t available = queue_.readableSize() / window_samples_ * window_samples_;
+            const size_t batch = std::min(available, max_batch_samples_);
+            queue_.read(scratch_.get(), batch);
+            converter_->consume(scratch_.get(), batch);
+        }
+        scheduled_.store(false);
+        // Windows that arrived while running (or beyond the batch) would otherwise wait for the next enqueue()
+        scheduleIfReady();
+    }
+
+} // ase_ultrasound_watermark
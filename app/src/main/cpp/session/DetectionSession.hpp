@@ -0,0 +1,116 @@
+#ifndef ULTRASOUNDWATERMARK_DETECTIONSESSION_HPP
+#define ULTRASOUNDWATERMARK_DETECTIONSESSION_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include "WatermarkDetector.hpp"
+#include "kcp/KcpFrameDecoder.hpp"
+#include "oboe/SpscRingBuffer.hpp"
+#include "stream/Int16ToFloatBlockStream.hpp"
+#include "DetectorWorkerPool.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    struct SessionStats
+    {
+        uint32_t session_id;
+        /// Frames received from the caller
+        int64_t received_frames;
+        /// Windows the detector has produced results for
+        int64_t detected_windows;
+        /// Frames dropped because the session's queue was full
+        int64_t dropped_frames;
+        /// Frames received but not yet detected
+        int32_t backlog_frames;
+    };
+
+    /**
+     * One caller's detection state on a WatermarkSessionServer: its own WatermarkDetector (the running average is per
+     * caller) fed from a bounded queue that is drained on a shared DetectorWorkerPool.
+     *
+     * The ingress stream is called from the transport thread. Whenever a whole window is queued and the session is not
+     * already scheduled, it submits one drain task to the pool; the task processes up to max_batch windows and
+     * resubmits itself if more are pending. This keeps at most one task per session in flight, so the detector is
+     * never entered concurrently and windows are detected in order, while idle sessions cost no worker time.
+     */
+    class DetectionSession : public std::enable_shared_from_this<DetectionSession>
+    {
+    public:
+        using ResultsCallback = std::function<void(uint32_t session_id, float instantaneous, float average)>;
+
+        /**
+         * @param queue_windows Windows buffered per session. Incoming audio that does not fit is dropped
+         * @param max_batch Windows handed to the detector per drain task
+         */
+        static std::shared_ptr<DetectionSession> create(uint32_t session_id, std::shared_ptr<WatermarkDetector> detector,
+                                                        DetectorWorkerPool &pool, int queue_windows, int max_batch,
+                                                        ResultsCallback callback);
+
+        DetectionSession(const DetectionSession &) = delete;
+
+        DetectionSession &operator=(const DetectionSession &) = delete;
+
+        /**
+         * KcpFrameEncoder-framed PCM16 from the caller. Attach it to the session's transport. It holds no reference to
+         * the session, so the transport may keep it longer: input arriving after the session is gone is discarded
+         */
+        [[nodiscard]] std::shared_ptr<ase::AudioDataStreamBase<int16_t>> getIngress() const
+        {
+            return decoder_;
+        }
+
+        /// Stop scheduling detection. Further input and windows still queued are discarded, and no more results are delivered
+        void close();
+
+        [[nodiscard]] uint32_t getSessionId() const
+        {
+            return session_id_;
+        }
+
+        [[nodiscard]] SessionStats getStats() const;
+
+    private:
+        class Input : public ase::AudioDataStreamBase<int16_t>
+        {
+        public:
+            explicit Input(std::weak_ptr<DetectionSession> session);
+
+            void consume(const int16_t *samples, size_t size) override;
+
+        private:
+            const std::weak_ptr<DetectionSession> session_;
+        };
+
+        const uint32_t session_id_;
+        const size_t window_samples_;
+        const size_t max_batch_samples_;
+        DetectorWorkerPool &pool_;
+        std::shared_ptr<WatermarkDetector> detector_;
+        std::shared_ptr<Int16ToFloatBlockStream> converter_;
+        std::shared_ptr<KcpFrameDecoder> decoder_;
+        ase_android::SpscRingBuffer<int16_t> queue_;
+        ase::aligned_unique_ptr<int16_t[]> scratch_;
+        const ResultsCallback callback_;
+        std::atomic<bool> scheduled_;
+        std::atomic<bool> closed_;
+        std::atomic<int64_t> received_frames_;
+        std::atomic<int64_t> detected_windows_;
+        std::atomic<int64_t> dropped_frames_;
+
+        DetectionSession(uint32_t session_id, std::shared_ptr<WatermarkDetector> detector, DetectorWorkerPool &pool,
+                         int queue_windows, int max_batch, ResultsCallback callback);
+
+        /// Transport thread
+        void enqueue(const int16_t *samples, size_t size);
+
+        void scheduleIfReady();
+
+        /// Pool worker
+        void drain();
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_DETECTIONSESSION_HPP
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <stdexcept>
+#include "DetectorWorkerPool.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    DetectorWorkerPool::DetectorWorkerPool(int num_workers)
+            : stopping_{false},
+              busy_ns_{0}
+    {
+        if (num_workers <= 0)
+        {
+            throw std::runtime_error("DetectorWorkerPool needs at least one worker");
+        }
+        workers_.reserve(num_workers);
+        for (int i = 0; i < num_workers; ++i)
+        {
+            workers_.emplace_back(&DetectorWorkerPool::run, this);
+        }
+    }
+
+    DetectorWorkerPool::~DetectorWorkerPool()
+    {
+        {
+            std::lock_guard lock{mutex_};
+            stopping_ = true;
+            tasks_.clear();
+        }
+        wake_.notify_all();
+        for (auto &worker: workers_)
+        {
+            worker.join();
+        }
+    }
+
+    void DetectorWorkerPool::submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard lock{mutex_};
+            if (stopping_)
+            {
+                return;
+            }
+            tasks_.push_back(std::move(task));
+        }
+        wake_.notify_one();
+    }
+
+    void DetectorWorkerPool::run()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock lock{mutex_};
+                wake_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (stopping_)
+                {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            const auto start = std::chrono::steady_clock::now();
+            task();
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            busy_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+        }
+    }
+
+} // ase_ultrasound_watermark
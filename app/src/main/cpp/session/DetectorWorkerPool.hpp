@@ -0,0 +1,58 @@
+#ifndef ULTRASOUNDWATERMARK_DETECTORWORKERPOOL_HPP
+#define ULTRASOUNDWATERMARK_DETECTORWORKERPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Fixed set of threads running detection tasks for many sessions.
+     * Tasks are executed in submission order by whichever worker is free. A session keeps at most one task queued or
+     * running at a time (see DetectionSession), so its windows are still processed in order.
+     */
+    class DetectorWorkerPool
+    {
+    public:
+        explicit DetectorWorkerPool(int num_workers);
+
+        DetectorWorkerPool(const DetectorWorkerPool &) = delete;
+
+        DetectorWorkerPool &operator=(const DetectorWorkerPool &) = delete;
+
+        /// Joins the workers. Tasks that have not started yet are discarded
+        ~DetectorWorkerPool();
+
+        void submit(std::function<void()> task);
+
+        [[nodiscard]] int getWorkerCount() const
+        {
+            return static_cast<int>(workers_.size());
+        }
+
+        /// Total time all workers have spent running tasks
+        [[nodiscard]] int64_t getBusyNanoseconds() const
+        {
+            return busy_ns_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::deque<std::function<void()>> tasks_;
+        bool stopping_;
+        std::atomic<int64_t> busy_ns_;
+        std::vector<std::thread> workers_;
+
+        void run();
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_DETECTORWORKERPOOL_HPP
@@ -0,0 +1,322 @@
+#ifndef ULTRASOUNDWATERMARK_ASYNCSTREAMSTAGE_HPP
+#define ULTRASOUNDWATERMARK_ASYNCSTREAMSTAGE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <ase/Common.hpp>
+#include <ase/stream/AudioDataStreamProducer.hpp>
+#include "ThreadPolicy.hpp"
+#include "oboe/SpscRingBuffer.hpp"
+#include "tracing/AllocationCounter.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /// What an AsyncStreamStage does with a block that does not fit into its queue
+    enum class OverflowPolicy
+    {
+        /// Reject the incoming block and keep the queued ones
+        DropNewest,
+        /// Discard just enough of the oldest queued blocks to make room, so the queue holds the most recent audio
+        DropOldest,
+        /// When the queue is full, skip every queued block except the most recent one. Suits consumers that only
+        /// care about the latest window and would rather skip stale ones than fall further behind
+        LatestWins,
+        /// Wait for the worker to make room. Lossless, but never use it from a realtime callback
+        Block
+    };
+
+    struct AsyncStageStats
+    {
+        /// Frames queued but not yet handed to the consumers
+        int32_t depth_frames;
+        /// Highest depth seen since the last start()
+        int32_t max_depth_frames;
+        /// Frames lost to overflow, whichever end they were dropped from
+        int64_t dropped_frames;
+        /// Number of consume() calls that hit the queue limit
+        int64_t overflows;
+        /// Frames handed to the consumers by the worker
+        int64_t processed_frames;
+        /// Heap allocations made by the consumers while the worker handed them blocks. Always 0 without
+        /// AllocationCounter support in the build
+        int64_t allocations;
+        /// Blocks during which the consumers allocated. Stays 0 once every consumer has warmed up
+        int64_t allocating_blocks;
+    };
+
+    /**
+     * Decouples a producer from its consumers with a wait-free handoff queue and a worker thread.
+     *
+     * consume() only copies samples into an SpscRingBuffer and wakes the worker, so it is safe to call from a realtime
+     * audio callback (except with OverflowPolicy::Block). The worker reads the queue in blocks of block_size_frames and
+     * produces them to the attached consumers, so everything downstream runs on the worker thread instead.
+     *
+     * consume() must be called from a single thread at a time. Attach consumers before start().
+     */
+    template<typename SAMPLE_T>
+    class AsyncStreamStage : public ase::AudioDataStreamProducer<SAMPLE_T, true>
+    {
+        using base = ase::AudioDataStreamProducer<SAMPLE_T, true>;
+    public:
+        /**
+         * @param block_size_frames Frames per block handed to the consumers
+         * @param queue_blocks Queue limit in blocks. Bounds the latency the stage can add
+         */
+        AsyncStreamStage(int sample_rate, int channels, int block_size_frames, int queue_blocks, OverflowPolicy policy)
+                : ase::AudioDataStreamProducer<SAMPLE_T, true>{sample_rate, channels, block_size_frames, queue_blocks},
+                  policy_{policy},
+                  block_samples_{static_cast<size_t>(block_size_frames) * channels},
+                  queue_limit_samples_{block_samples_ * queue_blocks},
+                  // The dropping policies keep a second queue's worth of headroom, so that new samples can be written
+                  // while the worker has not yet discarded the old ones
+                  ring_{policy == OverflowPolicy::DropOldest || policy == OverflowPolicy::LatestWins ? 2 * queue_limit_samples_ : queue_limit_samples_},
+                  scratch_{block_samples_},
+                  running_{false},
+                  wake_sequence_{0},
+                  written_samples_{0},
+                  discard_until_samples_{0},
+                  max_depth_samples_{0},
+                  dropped_samples_{0},
+                  overflows_{0},
+                  processed_samples_{0},
+                  allocations_{0},
+                  allocating_blocks_{0}
+        {
+        }
+
+        AsyncStreamStage(const AsyncStreamStage &) = delete;
+
+        AsyncStreamStage &operator=(const AsyncStreamStage &) = delete;
+
+        ~AsyncStreamStage() override
+        {
+            stop();
+        }
+
+        /// Run the worker with policy from the next start() on. A policy the system does not permit is logged and skipped
+        void setWorkerPolicy(const ThreadPolicy &policy)
+        {
+            std::lock_guard lock{control_mutex_};
+            worker_policy_ = policy;
+        }
+
+        /**
+         * Start the worker thread. Samples consumed before start() are queued and processed once it runs.
+         * @throw std::system_error if the thread cannot be created
+         */
+        void start()
+        {
+            std::lock_guard lock{control_mutex_};
+            if (worker_.joinable())
+            {
+                return;
+            }
+            max_depth_samples_.store(0, std::memory_order_relaxed);
+            running_.store(true, std::memory_order_release);
+            try
+            {
+                // The worker inherits the policy from the thread that creates it
+                runWithThreadPolicy(worker_policy_, [this] { worker_ = std::thread(&AsyncStreamStage::run, this); });
+            }
+            catch (...)
+            {
+                running_.store(false, std::memory_order_release);
+                throw;
+            }
+        }
+
+        /// Stop the worker after it has processed everything queued so far, then flush the consumers
+        void stop()
+        {
+            std::lock_guard lock{control_mutex_};
+            if (!worker_.joinable())
+            {
+                return;
+            }
+            running_.store(false, std::memory_order_release);
+            wake();
+            worker_.join();
+            base::flush();
+        }
+
+        /// Producer side. Queue samples for the worker
+        void consume(const SAMPLE_T *data, size_t samples) override
+        {
+            if (queuedSamples() + samples > queue_limit_samples_ && !makeRoom(samples))
+            {
+                return;
+            }
+            const size_t written = ring_.write(data, samples);
+            written_samples_.store(written_samples_.load(std::memory_order_relaxed) + written, std::memory_order_release);
+            updateMaxDepth(queuedSamples());
+            wake();
+        }
+
+        /// Frames dropped so far. Downstream stream positions lag upstream ones by this much
+        [[nodiscard]] int64_t getDroppedFrames() const
+        {
+            return static_cast<int64_t>(dropped_samples_.load(std::memory_order_relaxed) / base::_num_channels);
+        }
+
+        [[nodiscard]] AsyncStageStats getStats() const
+        {
+            const auto channels = static_cast<size_t>(base::_num_channels);
+            const size_t written = written_samples_.load(std::memory_order_acquire);
+            const size_t consumed = std::max(ring_.totalConsumed(), discard_until_samples_.load(std::memory_order_relaxed));
+            return AsyncStageStats{
+                    static_cast<int32_t>((written - std::min(written, consumed)) / channels),
+                    static_cast<int32_t>(max_depth_samples_.load(std::memory_order_relaxed) / channels),
+                    getDroppedFrames(),
+                    overflows_.load(std::memory_order_relaxed),
+                    static_cast<int64_t>(processed_samples_.load(std::memory_order_relaxed) / channels),
+                    allocations_.load(std::memory_order_relaxed),
+                    allocating_blocks_.load(std::memory_order_relaxed)
+            };
+        }
+
+    private:
+        const OverflowPolicy policy_;
+        const size_t block_samples_;
+        const size_t queue_limit_samples_;
+        ase_android::SpscRingBuffer<SAMPLE_T> ring_;
+        ase::aligned_unique_ptr<SAMPLE_T[]> scratch_;
+        std::mutex control_mutex_;
+        ThreadPolicy worker_policy_;
+        std::thread worker_;
+        std::atomic<bool> running_;
+        std::atomic<uint32_t> wake_sequence_;
+        // Written by the producer only
+        std::atomic<size_t> written_samples_;
+        // Raised by the producer, honoured by the worker: every sample before this position is to be discarded
+        std::atomic<size_t> discard_until_samples_;
+        std::atomic<size_t> max_depth_samples_;
+        std::atomic<size_t> dropped_samples_;
+        std::atomic<int64_t> overflows_;
+        std::atomic<size_t> processed_samples_;
+        std::atomic<int64_t> allocations_;
+        std::atomic<int64_t> allocating_blocks_;
+
+        /// Producer side. Called when samples do not fit. Returns false if they are to be dropped
+        bool makeRoom(size_t samples)
+        {
+            overflows_.fetch_add(1, std::memory_order_relaxed);
+            switch (policy_)
+            {
+                case OverflowPolicy::Block:
+                    if (samples > ring_.capacity())
+                    {
+                        break;
+                    }
+                    // A block larger than the limit is let in once the queue is empty
+                    while (queuedSamples() + samples > std::max(queue_limit_samples_, samples))
+                    {
+                        wake();
+                        std::this_thread::yield();
+                    }
+                    return true;
+                case OverflowPolicy::DropOldest:
+                case OverflowPolicy::LatestWins:
+                {
+                    // Ask the worker to discard the oldest blocks, keeping the new samples and whole blocks before them.
+                    // The headroom takes the new samples until it does; if even that is full, the worker is stuck
+                    // and the new samples are dropped as well
+                    const size_t keep = policy_ == OverflowPolicy::LatestWins ? block_samples_ : queue_limit_samples_;
+                    const size_t written = written_samples_.load(std::memory_order_relaxed);
+                    if (written + samples > keep)
+                    {
+                        const size_t keep_from = (written + samples - keep + block_samples_ - 1) / block_samples_ * block_samples_;
+                        discard_until_samples_.store(std::min(keep_from, written / block_samples_ * block_samples_), std::memory_order_release);
+                    }
+                    wake();
+                    if (samples <= ring_.writableSize())
+                    {
+                        return true;
+                    }
+                    break;
+                }
+                case OverflowPolicy::DropNewest:
+                    break;
+            }
+            dropped_samples_.fetch_add(samples, std::memory_order_relaxed);
+            return false;
+        }
+
+        /// Producer side. Samples in the ring, including those the worker has yet to discard
+        [[nodiscard]] size_t queuedSamples() const
+        {
+            return written_samples_.load(std::memory_order_relaxed) - ring_.totalConsumed();
+        }
+
+        void updateMaxDepth(size_t depth)
+        {
+            if (depth > max_depth_samples_.load(std::memory_order_relaxed))
+            {
+                max_depth_samples_.store(depth, std::memory_order_relaxed);
+            }
+        }
+
+        void wake()
+        {
+            wake_sequence_.fetch_add(1, std::memory_order_release);
+            wake_sequence_.notify_one();
+        }
+
+        void run()
+        {
+            const AllocationCounter allocations;
+            while (true)
+            {
+                // Load the sequence before checking the queue so that a wake() in between is not lost
+                const uint32_t sequence = wake_sequence_.load(std::memory_order_acquire);
+                const bool running = running_.load(std::memory_order_acquire);
+                discardOverflow();
+                size_t available = ring_.readableSize();
+                while (available >= block_samples_)
+                {
+                    processBlock(block_samples_, allocations);
+                    discardOverflow();
+                    available = ring_.readableSize();
+                }
+                if (!running)
+                {
+                    if (available > 0)
+                    {
+                        processBlock(available, allocations);
+                    }
+                    return;
+                }
+                wake_sequence_.wait(sequence, std::memory_order_acquire);
+            }
+        }
+
+        void processBlock(size_t samples, const AllocationCounter &allocations)
+        {
+            ring_.read(scratch_.get(), samples);
+            const int64_t allocations_before = allocations.count();
+            base::produce(scratch_.get(), samples / base::_num_channels);
+            const int64_t allocated = allocations.count() - allocations_before;
+            if (unlikely(allocated > 0))
+            {
+                allocations_.fetch_add(allocated, std::memory_order_relaxed);
+                allocating_blocks_.fetch_add(1, std::memory_order_relaxed);
+            }
+            processed_samples_.fetch_add(samples, std::memory_order_relaxed);
+        }
+
+        void discardOverflow()
+        {
+            const size_t discard_until = discard_until_samples_.load(std::memory_order_acquire);
+            const size_t consumed = ring_.totalConsumed();
+            if (unlikely(discard_until > consumed))
+            {
+                dropped_samples_.fetch_add(ring_.discard(discard_until - consumed), std::memory_order_relaxed);
+            }
+        }
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_ASYNCSTREAMSTAGE_HPP
@@ -0,0 +1,51 @@
+#ifndef ULTRASOUNDWATERMARK_FLOATTOINT16STREAM_HPP
+#define ULTRASOUNDWATERMARK_FLOATTOINT16STREAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <ase/Common.hpp>
+#include <ase/stream/AudioDataStreamProducer.hpp>
+#include "dsp/SampleConversion.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Replacement for FormatConversionStream<float, int16_t> using the SIMD kernels in dsp/SampleConversion.hpp.
+     * Blocks are converted and produced as they arrive, in chunks of at most max_block_frames, without reblocking.
+     */
+    class FloatToInt16Stream
+            : public ase::AudioDataStreamBase<float>,
+              public ase::AudioDataStreamProducer<int16_t, true>
+    {
+        using producer = ase::AudioDataStreamProducer<int16_t, true>;
+    public:
+        FloatToInt16Stream(int sample_rate, int channels, int max_block_frames)
+                : ase::AudioDataStreamBase<float>{sample_rate, channels},
+                  ase::AudioDataStreamProducer<int16_t, true>{sample_rate, channels, max_block_frames, 1},
+                  channels_{static_cast<size_t>(channels)},
+                  max_block_samples_{static_cast<size_t>(max_block_frames) * channels},
+                  block_{max_block_samples_}
+        {
+        }
+
+        void consume(const float *data, size_t samples) override
+        {
+            while (samples > 0)
+            {
+                const size_t take = std::min(samples, max_block_samples_);
+                dsp::floatToInt16(data, block_.get(), take);
+                producer::produce(block_.get(), take / channels_);
+                data += take;
+                samples -= take;
+            }
+        }
+
+    private:
+        const size_t channels_;
+        const size_t max_block_samples_;
+        ase::aligned_unique_ptr<int16_t[]> block_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_FLOATTOINT16STREAM_HPP
@@ -0,0 +1,70 @@
+#ifndef ULTRASOUNDWATERMARK_INT16TOFLOATBLOCKSTREAM_HPP
+#define ULTRASOUNDWATERMARK_INT16TOFLOATBLOCKSTREAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <ase/Common.hpp>
+#include <ase/stream/AudioDataStreamProducer.hpp>
+#include "dsp/SampleConversion.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Fused replacement for FlexibleSizeStreamProducer<int16_t> followed by FormatConversionStream<int16_t, float>.
+     *
+     * Incoming PCM16 is converted with dsp::int16ToFloat straight into an aligned float block of block_size_frames,
+     * and each block is produced as soon as it fills up. Samples are touched once instead of being staged in an int16
+     * block first and converted into a second buffer afterwards. A trailing partial block is held until the next
+     * consume(), or dropped by reset().
+     */
+    class Int16ToFloatBlockStream
+            : public ase::AudioDataStreamBase<int16_t>,
+              public ase::AudioDataStreamProducer<float, true>
+    {
+        using producer = ase::AudioDataStreamProducer<float, true>;
+    public:
+        Int16ToFloatBlockStream(int sample_rate, int channels, int block_size_frames)
+                : ase::AudioDataStreamBase<int16_t>{sample_rate, channels},
+                  ase::AudioDataStreamProducer<float, true>{sample_rate, channels, block_size_frames, 1},
+                  block_frames_{block_size_frames},
+                  block_samples_{static_cast<size_t>(block_size_frames) * channels},
+                  block_{block_samples_},
+                  filled_samples_{0}
+        {
+        }
+
+        void consume(const int16_t *data, size_t samples) override
+        {
+            while (samples > 0)
+            {
+                const size_t take = std::min(samples, block_samples_ - filled_samples_);
+                dsp::int16ToFloat(data, block_.get() + filled_samples_, take);
+                filled_samples_ += take;
+                data += take;
+                samples -= take;
+                if (filled_samples_ == block_samples_)
+                {
+                    producer::produce(block_.get(), block_frames_);
+                    filled_samples_ = 0;
+                }
+            }
+        }
+
+        /// Drop a partially filled block, e.g. between two calls. Returns the frames dropped
+        int64_t reset()
+        {
+            const auto dropped_frames = static_cast<int64_t>(filled_samples_ / producer::_num_channels);
+            filled_samples_ = 0;
+            return dropped_frames;
+        }
+
+    private:
+        const int block_frames_;
+        const size_t block_samples_;
+        ase::aligned_unique_ptr<float[]> block_;
+        size_t filled_samples_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_INT16TOFLOATBLOCKSTREAM_HPP
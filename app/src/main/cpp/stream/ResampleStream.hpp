@@ -0,0 +1,141 @@
+#ifndef ULTRASOUNDWATERMARK_RESAMPLESTREAM_HPP
+#define ULTRASOUNDWATERMARK_RESAMPLESTREAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <ase/Common.hpp>
+#include <ase/stream/AudioDataStreamProducer.hpp>
+#include "dsp/PolyphaseResampler.hpp"
+#include "dsp/SampleConversion.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Stream stage converting from input_rate to the rate it produces at, with dsp::PolyphaseResampler.
+     *
+     * Consumes and produces SAMPLE_T, int16_t or float; PCM16 is converted to float and back with the SIMD kernels
+     * around the resampler. Input is processed in chunks of at most max_block_frames, and each chunk's output is
+     * produced as it is computed, without reblocking. The output is aligned with the input, so the resampler's
+     * look-ahead stays behind until drain() pushes it out.
+     */
+    template<typename SAMPLE_T>
+    class ResampleStream : public ase::AudioDataStreamProducer<SAMPLE_T, true>
+    {
+        static_assert(std::is_same_v<SAMPLE_T, int16_t> || std::is_same_v<SAMPLE_T, float>);
+        using producer = ase::AudioDataStreamProducer<SAMPLE_T, true>;
+    public:
+        /// @throw std::runtime_error if the rates are not supported (see dsp::PolyphaseResampler)
+        ResampleStream(int input_rate, int output_rate, int channels, int max_block_frames,
+                       float passband_hz = dsp::PolyphaseResampler::DEFAULT_PASSBAND_HZ)
+                : ase::AudioDataStreamProducer<SAMPLE_T, true>{output_rate, channels, static_cast<int>(
+                        dsp::PolyphaseResampler::MaxOutputFrames(input_rate, output_rate, static_cast<size_t>(max_block_frames))), 1},
+                  resampler_{input_rate, output_rate, channels, static_cast<size_t>(max_block_frames), passband_hz},
+                  channels_{static_cast<size_t>(channels)},
+                  max_block_frames_{static_cast<size_t>(max_block_frames)},
+                  max_output_frames_{resampler_.maxOutputFrames(max_block_frames_)},
+                  input_{max_block_frames_ * channels_},
+                  output_{max_output_frames_ * channels_},
+                  samples_{max_output_frames_ * channels_},
+                  consumed_frames_{0},
+                  produced_frames_{0}
+        {
+        }
+
+        [[nodiscard]] int getInputRate() const
+        {
+            return resampler_.getInputRate();
+        }
+
+        /// Frames produced since construction or reset()
+        [[nodiscard]] int64_t getFramesProduced() const
+        {
+            return produced_frames_;
+        }
+
+        /// Frames produced for input_frames of input, once drained
+        [[nodiscard]] int64_t outputFramesFor(int64_t input_frames) const
+        {
+            const int64_t output_rate = producer::getSampleRate();
+            const int64_t input_rate = resampler_.getInputRate();
+            return (input_frames * output_rate + input_rate - 1) / input_rate;
+        }
+
+        void consume(const SAMPLE_T *data, size_t samples) override
+        {
+            while (samples > 0)
+            {
+                const size_t frames = std::min(samples / channels_, max_block_frames_);
+                if (frames == 0)
+                {
+                    break;
+                }
+                if constexpr (std::is_same_v<SAMPLE_T, float>)
+                {
+                    process(data, frames, max_output_frames_);
+                }
+                else
+                {
+                    dsp::int16ToFloat(data, input_.get(), frames * channels_);
+                    process(input_.get(), frames, max_output_frames_);
+                }
+                consumed_frames_ += static_cast<int64_t>(frames);
+                data += frames * channels_;
+                samples -= frames * channels_;
+            }
+        }
+
+        /// Produce the output still owed for the input so far, as if it were followed by silence
+        void drain()
+        {
+            std::fill_n(input_.get(), max_block_frames_ * channels_, 0.0f);
+            for (int64_t owed = outputFramesFor(consumed_frames_) - produced_frames_; owed > 0;
+                 owed = outputFramesFor(consumed_frames_) - produced_frames_)
+            {
+                const size_t frames = std::min(resampler_.inputFramesFor(static_cast<size_t>(owed)), max_block_frames_);
+                process(input_.get(), frames, static_cast<size_t>(std::min<int64_t>(owed, static_cast<int64_t>(max_output_frames_))));
+            }
+        }
+
+        /// Forget the input so far, e.g. between two files
+        void reset()
+        {
+            resampler_.reset();
+            consumed_frames_ = 0;
+            produced_frames_ = 0;
+        }
+
+    private:
+        dsp::PolyphaseResampler resampler_;
+        const size_t channels_;
+        const size_t max_block_frames_;
+        const size_t max_output_frames_;
+        ase::aligned_unique_ptr<float[]> input_;
+        ase::aligned_unique_ptr<float[]> output_;
+        ase::aligned_unique_ptr<SAMPLE_T[]> samples_;
+        int64_t consumed_frames_;
+        int64_t produced_frames_;
+
+        void process(const float *in, size_t frames, size_t max_output_frames)
+        {
+            const size_t produced = resampler_.process(in, frames, output_.get(), max_output_frames);
+            if (produced == 0)
+            {
+                return;
+            }
+            if constexpr (std::is_same_v<SAMPLE_T, float>)
+            {
+                producer::produce(output_.get(), produced);
+            }
+            else
+            {
+                dsp::floatToInt16(output_.get(), samples_.get(), produced * channels_);
+                producer::produce(samples_.get(), produced);
+            }
+            produced_frames_ += static_cast<int64_t>(produced);
+        }
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_RESAMPLESTREAM_HPP
@@ -0,0 +1,82 @@
+#ifndef ULTRASOUNDWATERMARK_STREAMGATE_HPP
+#define ULTRASOUNDWATERMARK_STREAMGATE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <ase/stream/AudioDataStreamProducer.hpp>
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Passes blocks through to its consumers while open and discards them while closed, so that a running stream
+     * graph can be switched on and off without detaching or re-creating anything.
+     *
+     * Blocks are let through or discarded whole. close() waits for a block already being passed through to
+     * finish, so once it returns the consumers are not called until the next open().
+     *
+     * consume() must be called from a single thread at a time, open() and close() from any other.
+     */
+    template<typename SAMPLE_T>
+    class StreamGate : public ase::AudioDataStreamProducer<SAMPLE_T, true>
+    {
+        using base = ase::AudioDataStreamProducer<SAMPLE_T, true>;
+    public:
+        StreamGate(int sample_rate, int channels, int block_size_frames)
+                : ase::AudioDataStreamProducer<SAMPLE_T, true>{sample_rate, channels, block_size_frames, 1},
+                  open_{false},
+                  in_flight_{false},
+                  discarded_frames_{0}
+        {
+        }
+
+        void consume(const SAMPLE_T *data, size_t samples) override
+        {
+            in_flight_.store(true);
+            if (open_.load())
+            {
+                base::produce(data, samples / base::_num_channels);
+            }
+            else
+            {
+                discarded_frames_.fetch_add(static_cast<int64_t>(samples / base::_num_channels), std::memory_order_relaxed);
+            }
+            in_flight_.store(false);
+        }
+
+        void open()
+        {
+            open_.store(true);
+        }
+
+        /// Returns once the consumers are no longer called
+        void close()
+        {
+            open_.store(false);
+            while (in_flight_.load())
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        [[nodiscard]] bool isOpen() const
+        {
+            return open_.load(std::memory_order_relaxed);
+        }
+
+        /// Frames discarded while closed
+        [[nodiscard]] int64_t getDiscardedFrames() const
+        {
+            return discarded_frames_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Sequentially consistent, so that close() either sees the block in flight or consume() sees the gate closed
+        std::atomic<bool> open_;
+        std::atomic<bool> in_flight_;
+        std::atomic<int64_t> discarded_frames_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_STREAMGATE_HPP
@@ -0,0 +1,137 @@
+// Round trip of PredictiveAudioCodec: lossless frames decode to the input exactly, lossy ones to within half the
+// quantization step, and truncated frames are rejected. Covers each predictor order, partition boundaries, the
+// escape code for residuals too large for the partition's Rice parameter, and samples at the int16_t limits.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "kcp/KcpAudioCodec.hpp"
+#include "kcp/PredictiveAudioCodec.hpp"
+
+using namespace ase_ultrasound_watermark;
+
+namespace
+{
+    constexpr int16_t MIN_SAMPLE = std::numeric_limits<int16_t>::min();
+    constexpr int16_t MAX_SAMPLE = std::numeric_limits<int16_t>::max();
+
+    int failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    std::vector<std::pair<std::string, std::vector<int16_t>>> signals()
+    {
+        std::vector<std::pair<std::string, std::vector<int16_t>>> result;
+        std::mt19937 random{460};
+        std::uniform_int_distribution<int> any_sample{MIN_SAMPLE, MAX_SAMPLE};
+        std::normal_distribution<double> noise{0.0, 30.0};
+
+        result.emplace_back("single sample", std::vector<int16_t>{1234});
+        result.emplace_back("silence", std::vector<int16_t>(1000, 0));
+        // Order 2 predicts a ramp exactly
+        std::vector<int16_t> ramp(700);
+        for (size_t i = 0; i < ramp.size(); ++i)
+        {
+            ramp[i] = static_cast<int16_t>(-20000 + 50 * static_cast<int>(i));
+        }
+        result.emplace_back("ramp", ramp);
+        // The watermark band, with a little noise, across several partitions and a partial last one
+        std::vector<int16_t> tones(3 * PredictiveAudioCodec::PARTITION_SAMPLES + 17);
+        for (size_t i = 0; i < tones.size(); ++i)
+        {
+            const double t = static_cast<double>(i) / 48000.0;
+            tones[i] = static_cast<int16_t>(std::lround(4000.0 * std::sin(2.0 * M_PI * 16000.0 * t) +
+                                                        3000.0 * std::sin(2.0 * M_PI * 17250.0 * t) + noise(random)));
+        }
+        result.emplace_back("tones", tones);
+        // Mostly quiet with full-scale spikes, which take the escape code
+        std::vector<int16_t> spikes(600);
+        for (size_t i = 0; i < spikes.size(); ++i)
+        {
+            spikes[i] = i % 97 == 0 ? (i % 2 == 0 ? MAX_SAMPLE : MIN_SAMPLE) : static_cast<int16_t>(std::lround(noise(random)));
+        }
+        result.emplace_back("spikes", spikes);
+        std::vector<int16_t> full_scale(512);
+        for (size_t i = 0; i < full_scale.size(); ++i)
+        {
+            full_scale[i] = i % 2 == 0 ? MAX_SAMPLE : MIN_SAMPLE;
+        }
+        result.emplace_back("full scale square", full_scale);
+        std::vector<int16_t> white(1024);
+        for (auto &sample: white)
+        {
+            sample = static_cast<int16_t>(any_sample(random));
+        }
+        result.emplace_back("white noise", white);
+        return result;
+    }
+
+    void testRoundTrip(int quantization_step)
+    {
+        auto encoder = KcpAudioCodec::create(quantization_step == 1 ? KcpCodecConfig::lossless() : KcpCodecConfig::lossy(quantization_step));
+        // The receiver's decoder is created without knowing the step, which the frame carries
+        auto decoder = KcpAudioCodec::create(KcpCodecConfig{KcpCodecId::Predictive, 1});
+        const int max_error = quantization_step / 2;
+        for (const auto &[name, samples]: signals())
+        {
+            const std::string label = name + ", step " + std::to_string(quantization_step);
+            // Room for the worst case, every sample escaped
+            std::vector<int16_t> words(2 * samples.size() + 16);
+            const size_t num_words = encoder->encode(samples.data(), samples.size(), words.data(), words.size());
+            check(num_words > 0, label + ": encodes");
+            if (num_words == 0)
+            {
+                continue;
+            }
+            std::vector<int16_t> decoded(samples.size());
+            check(decoder->decode(words.data(), num_words, decoded.data(), decoded.size()), label + ": decodes");
+            int error = 0;
+            for (size_t i = 0; i < samples.size(); ++i)
+            {
+                error = std::max(error, std::abs(static_cast<int>(samples[i]) - decoded[i]));
+            }
+            check(error <= max_error, label + ": error " + std::to_string(error) + " within " + std::to_string(max_error));
+
+            // Too little room is reported, not overrun
+            if (num_words > 1)
+            {
+                std::vector<int16_t> small(num_words - 1);
+                check(encoder->encode(samples.data(), samples.size(), small.data(), small.size()) == 0, label + ": rejects a short buffer");
+            }
+            // A frame cut short is rejected rather than decoded from whatever follows it
+            if (num_words > 2 && samples.size() > 1)
+            {
+                check(!decoder->decode(words.data(), num_words / 2, decoded.data(), decoded.size()), label + ": rejects a truncated frame");
+            }
+        }
+    }
+}
+
+int main()
+{
+    check(KcpAudioCodec::create(KcpCodecConfig::raw()) == nullptr, "raw has no codec");
+    for (const int step: {1, 2, 3, KcpCodecConfig::DEFAULT_LOSSY_STEP, PredictiveAudioCodec::MAX_QUANTIZATION_STEP})
+    {
+        testRoundTrip(step);
+    }
+    if (failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    std::printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
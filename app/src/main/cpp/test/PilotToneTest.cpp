@@ -0,0 +1,140 @@
+// Checks WatermarkCaller::DefaultPilotTones() against the recording it replaces, res/raw/multitone.wav: every
+// MULTI_TONE frequency is in the recording at PILOT_TONE_AMPLITUDE, the tones account for the whole recording, and
+// dsp::OscillatorBank synthesizes them at the same amplitudes.
+//
+// Usage: ultrasound_watermark_pilot_tone_test <multitone.wav>
+//   Exits with SKIPPED_EXIT_CODE if the file is not a WAV file, e.g. a Git LFS pointer in a checkout without LFS
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "WatermarkCaller.hpp"
+#include "batch/WavFileStream.hpp"
+#include "dsp/OscillatorBank.hpp"
+
+using namespace ase_ultrasound_watermark;
+
+namespace
+{
+    constexpr int SKIPPED_EXIT_CODE = 77;
+    constexpr int SAMPLE_RATE = WatermarkGenerator::INPUT_FS;
+    /// Largest difference between a tone's amplitude in the recording and in the default tone set
+    constexpr double MAX_AMPLITUDE_ERROR_DB = 1.0;
+    /// Smallest share of the recording's power that the default tones must account for
+    constexpr double MIN_TONE_POWER_SHARE = 0.95;
+
+    int failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    /// Peak amplitude of the sine at frequency in samples, by the Goertzel recurrence. Exact for whole cycles
+    double toneAmplitude(const std::vector<float> &samples, double frequency)
+    {
+        const double coefficient = 2.0 * std::cos(2.0 * M_PI * frequency / SAMPLE_RATE);
+        double s1 = 0.0;
+        double s2 = 0.0;
+        for (const float sample: samples)
+        {
+            const double s0 = sample + coefficient * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        const double power = s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+        return 2.0 * std::sqrt(std::max(power, 0.0)) / static_cast<double>(samples.size());
+    }
+
+    double meanSquare(const std::vector<float> &samples)
+    {
+        double sum = 0.0;
+        for (const float sample: samples)
+        {
+            sum += static_cast<double>(sample) * sample;
+        }
+        return sum / static_cast<double>(samples.size());
+    }
+
+    double decibels(double amplitude, double reference)
+    {
+        return 20.0 * std::log10(amplitude / reference);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        std::fprintf(stderr, "Usage: %s <multitone.wav>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::vector<float> recording;
+    try
+    {
+        WavFileReader reader{argv[1]};
+        if (reader.getSampleRate() != SAMPLE_RATE || reader.getChannels() != 1)
+        {
+            std::fprintf(stderr, "FAILED: recording is not mono at %d Hz\n", SAMPLE_RATE);
+            return EXIT_FAILURE;
+        }
+        // Whole seconds, so that every tone, a multiple of 1 Hz, completes whole cycles
+        const size_t frames = static_cast<size_t>(reader.getFrames()) / SAMPLE_RATE * SAMPLE_RATE;
+        std::vector<int16_t> samples(frames);
+        if (frames == 0 || reader.read(samples.data(), frames) != frames)
+        {
+            std::fprintf(stderr, "FAILED: recording is shorter than a second\n");
+            return EXIT_FAILURE;
+        }
+        recording.reserve(frames);
+        for (const int16_t sample: samples)
+        {
+            recording.push_back(static_cast<float>(sample) / 32768.0f);
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::printf("skipped: %s\n", e.what());
+        return SKIPPED_EXIT_CODE;
+    }
+
+    const std::vector<dsp::Tone> tones = WatermarkCaller::DefaultPilotTones();
+    dsp::OscillatorBank bank{SAMPLE_RATE, 0};
+    bank.setTones(tones.data(), tones.size());
+    std::vector<float> synthesized(recording.size());
+    bank.render(synthesized.data(), synthesized.size());
+
+    std::printf("%10s %10s %10s %12s\n", "tone_hz", "recorded", "default", "synthesized");
+    double tone_power = 0.0;
+    for (const dsp::Tone &tone: tones)
+    {
+        const double recorded = toneAmplitude(recording, tone.frequency_hz);
+        const double rendered = toneAmplitude(synthesized, tone.frequency_hz);
+        std::printf("%10.0f %10.4f %10.4f %12.4f\n", tone.frequency_hz, recorded, tone.amplitude, rendered);
+        tone_power += recorded * recorded / 2.0;
+        check(std::abs(decibels(recorded, tone.amplitude)) <= MAX_AMPLITUDE_ERROR_DB,
+              std::to_string(static_cast<int>(tone.frequency_hz)) + " Hz recorded at " + std::to_string(recorded) + ", not PILOT_TONE_AMPLITUDE");
+        check(std::abs(decibels(rendered, recorded)) <= MAX_AMPLITUDE_ERROR_DB,
+              std::to_string(static_cast<int>(tone.frequency_hz)) + " Hz synthesized at " + std::to_string(rendered) + ", recorded at " + std::to_string(recorded));
+    }
+    const double share = tone_power / meanSquare(recording);
+    std::printf("default tones carry %.1f%% of the recording's power\n", 100.0 * share);
+    check(share >= MIN_TONE_POWER_SHARE, "the recording has components outside MULTI_TONE");
+
+    if (failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    std::printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
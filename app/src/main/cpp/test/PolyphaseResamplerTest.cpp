@@ -0,0 +1,255 @@
+// Response of dsp::PolyphaseResampler between the pipeline's rate and the common native rates: gain flat to within
+// MAX_GAIN_ERROR_DB up to the pilot band, output aligned with the input as documented (output frame n is the input
+// at n * input_rate / output_rate), tones that would alias onto the pilot band rejected by MIN_ALIAS_REJECTION_DB,
+// channels kept apart, the same output whatever the input is split into, and inputFramesFor() agreeing with
+// process().
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dsp/PolyphaseResampler.hpp"
+
+using namespace ase_ultrasound_watermark;
+
+namespace
+{
+    constexpr double TONE_AMPLITUDE = 0.5;
+    constexpr double PILOT_HIGH_HZ = 17500.0;
+    constexpr double MAX_GAIN_ERROR_DB = 0.1;
+    /// Timing error allowed between the output and the input it is aligned with, in output frames
+    constexpr double MAX_ALIGNMENT_ERROR_FRAMES = 0.01;
+    constexpr double MIN_ALIAS_REJECTION_DB = 80.0;
+    constexpr size_t BURST_FRAMES = 192;
+
+    struct RatePair
+    {
+        int input;
+        int output;
+    };
+
+    constexpr RatePair RATE_PAIRS[] = {{44100, 48000}, {48000, 44100}, {96000, 48000}, {48000, 96000}};
+
+    int failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    std::string label(const RatePair &rates)
+    {
+        return std::to_string(rates.input) + " -> " + std::to_string(rates.output);
+    }
+
+    std::vector<float> sine(double frequency_hz, int rate, size_t frames)
+    {
+        std::vector<float> samples(frames);
+        for (size_t i = 0; i < frames; ++i)
+        {
+            samples[i] = static_cast<float>(TONE_AMPLITUDE * std::sin(2.0 * std::numbers::pi * frequency_hz * static_cast<double>(i) / rate));
+        }
+        return samples;
+    }
+
+    /// Convert all of the interleaved input in pieces of at most burst_frames
+    std::vector<float> convert(dsp::PolyphaseResampler &resampler, const std::vector<float> &input, int channels, size_t burst_frames)
+    {
+        const size_t input_frames = input.size() / static_cast<size_t>(channels);
+        std::vector<float> output((resampler.maxOutputFrames(input_frames) + 1) * channels);
+        size_t produced = 0;
+        for (size_t done = 0; done < input_frames; done += burst_frames)
+        {
+            const size_t frames = std::min(burst_frames, input_frames - done);
+            produced += resampler.process(input.data() + done * channels, frames, output.data() + produced * channels,
+                                          output.size() / channels - produced);
+        }
+        output.resize(produced * channels);
+        return output;
+    }
+
+    struct Fit
+    {
+        /// Relative to TONE_AMPLITUDE
+        double gain_db;
+        /// Of the fitted sine against one starting at output frame 0
+        double phase_rad;
+    };
+
+    /// Least-squares fit of a sine at frequency_hz to channel of the steady part of samples
+    Fit fitTone(const std::vector<float> &samples, int channels, int channel, double frequency_hz, int rate)
+    {
+        // Skip the first and last tenth of a second: the filter's start-up and the input's end
+        const size_t frames = samples.size() / static_cast<size_t>(channels);
+        const size_t begin = static_cast<size_t>(rate / 10);
+        const size_t end = frames - static_cast<size_t>(rate / 10);
+        double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            const double phase = 2.0 * std::numbers::pi * frequency_hz * static_cast<double>(i) / rate;
+            const double s = std::sin(phase);
+            const double c = std::cos(phase);
+            const double y = samples[i * channels + channel];
+            ss += s * s;
+            sc += s * c;
+            cc += c * c;
+            ys += y * s;
+            yc += y * c;
+        }
+        const double det = ss * cc - sc * sc;
+        const double a = (ys * cc - yc * sc) / det;
+        const double b = (yc * ss - ys * sc) / det;
+        return Fit{20.0 * std::log10(std::max(std::hypot(a, b), 1e-30) / TONE_AMPLITUDE), std::atan2(b, a)};
+    }
+
+    void testPassband(const RatePair &rates)
+    {
+        dsp::PolyphaseResampler resampler{rates.input, rates.output, 1, BURST_FRAMES};
+        double worst_gain_db = 0.0;
+        double worst_alignment_frames = 0.0;
+        for (double frequency_hz = 500.0; frequency_hz <= PILOT_HIGH_HZ; frequency_hz += 500.0)
+        {
+            resampler.reset();
+            const Fit fit = fitTone(convert(resampler, sine(frequency_hz, rates.input, rates.input), 1, BURST_FRAMES), 1, 0,
+                                    frequency_hz, rates.output);
+            const double alignment_frames = fit.phase_rad / (2.0 * std::numbers::pi * frequency_hz) * rates.output;
+            if (std::abs(fit.gain_db) > std::abs(worst_gain_db))
+            {
+                worst_gain_db = fit.gain_db;
+            }
+            if (std::abs(alignment_frames) > std::abs(worst_alignment_frames))
+            {
+                worst_alignment_frames = alignment_frames;
+            }
+        }
+        check(std::abs(worst_gain_db) <= MAX_GAIN_ERROR_DB,
+              label(rates) + ": passband gain off by " + std::to_string(worst_gain_db) + " dB");
+        check(std::abs(worst_alignment_frames) <= MAX_ALIGNMENT_ERROR_FRAMES,
+              label(rates) + ": output off the input by " + std::to_string(worst_alignment_frames) + " frames");
+    }
+
+    /// Downsampling from twice the rate: the tones that fold onto the pilot band must not come through
+    void testAliasRejection()
+    {
+        const RatePair rates{96000, 48000};
+        dsp::PolyphaseResampler resampler{rates.input, rates.output, 1, BURST_FRAMES};
+        double worst_db = -INFINITY;
+        for (double alias_hz = 16000.0; alias_hz <= PILOT_HIGH_HZ; alias_hz += 250.0)
+        {
+            resampler.reset();
+            const std::vector<float> output = convert(resampler, sine(rates.output - alias_hz, rates.input, rates.input), 1, BURST_FRAMES);
+            worst_db = std::max(worst_db, fitTone(output, 1, 0, alias_hz, rates.output).gain_db);
+        }
+        check(worst_db <= -MIN_ALIAS_REJECTION_DB, label(rates) + ": aliases onto the pilot band at " + std::to_string(worst_db) + " dB");
+    }
+
+    /// A different tone in each channel, each coming out at its own frequency only
+    void testChannels(const RatePair &rates)
+    {
+        const double frequencies[] = {1000.0, 17000.0};
+        const std::vector<float> left = sine(frequencies[0], rates.input, rates.input);
+        const std::vector<float> right = sine(frequencies[1], rates.input, rates.input);
+        std::vector<float> input(2 * left.size());
+        for (size_t i = 0; i < left.size(); ++i)
+        {
+            input[2 * i] = left[i];
+            input[2 * i + 1] = right[i];
+        }
+        dsp::PolyphaseResampler resampler{rates.input, rates.output, 2, BURST_FRAMES};
+        const std::vector<float> output = convert(resampler, input, 2, BURST_FRAMES);
+        for (int channel = 0; channel < 2; ++channel)
+        {
+            const std::string name = label(rates) + ", channel " + std::to_string(channel);
+            check(std::abs(fitTone(output, 2, channel, frequencies[channel], rates.output).gain_db) <= MAX_GAIN_ERROR_DB, name + ": own tone");
+            check(fitTone(output, 2, channel, frequencies[1 - channel], rates.output).gain_db <= -MIN_ALIAS_REJECTION_DB,
+                  name + ": no crosstalk");
+        }
+    }
+
+    /// Splitting the input differently, down to single frames, leaves the output as it was
+    void testSplitting(const RatePair &rates)
+    {
+        std::vector<float> input = sine(3000.0, rates.input, rates.input / 5);
+        for (size_t i = 0; i < input.size(); ++i)
+        {
+            input[i] += static_cast<float>(0.1 * std::sin(0.37 * static_cast<double>(i * i % 1009)));
+        }
+        dsp::PolyphaseResampler reference{rates.input, rates.output, 1, BURST_FRAMES};
+        const std::vector<float> expected = convert(reference, input, 1, BURST_FRAMES);
+        for (const size_t burst: {size_t{1}, size_t{7}, BURST_FRAMES - 1})
+        {
+            dsp::PolyphaseResampler resampler{rates.input, rates.output, 1, BURST_FRAMES};
+            check(convert(resampler, input, 1, burst) == expected, label(rates) + ": same output in pieces of " + std::to_string(burst));
+        }
+    }
+
+    void testInputFramesFor(const RatePair &rates)
+    {
+        const std::vector<float> input(BURST_FRAMES, 0.25f);
+        std::vector<float> output(BURST_FRAMES * 4);
+        bool agrees = true;
+        // From a fresh resampler, exactly enough and one frame short of it
+        for (const size_t wanted: {size_t{1}, size_t{5}, size_t{64}})
+        {
+            dsp::PolyphaseResampler enough{rates.input, rates.output, 1, BURST_FRAMES};
+            const size_t needed = enough.inputFramesFor(wanted);
+            agrees &= needed > 0 && needed <= BURST_FRAMES && enough.process(input.data(), needed, output.data(), wanted) == wanted;
+            dsp::PolyphaseResampler short_of_it{rates.input, rates.output, 1, BURST_FRAMES};
+            agrees &= short_of_it.process(input.data(), needed - 1, output.data(), wanted) < wanted;
+        }
+        // And from whatever one resampler still holds after each request
+        dsp::PolyphaseResampler resampler{rates.input, rates.output, 1, BURST_FRAMES};
+        for (const size_t wanted: {size_t{1}, size_t{5}, size_t{64}, size_t{90}, size_t{1}, size_t{60}})
+        {
+            const size_t needed = resampler.inputFramesFor(wanted);
+            agrees &= needed <= BURST_FRAMES && resampler.process(input.data(), needed, output.data(), wanted) == wanted;
+        }
+        check(agrees, label(rates) + ": inputFramesFor() gives exactly the input process() needs");
+    }
+
+    void testInvalidArguments()
+    {
+        const auto throws = [](int input_rate, int output_rate, int channels, float passband_hz) {
+            try
+            {
+                dsp::PolyphaseResampler{input_rate, output_rate, channels, BURST_FRAMES, passband_hz};
+            }
+            catch (const std::runtime_error &)
+            {
+                return true;
+            }
+            return false;
+        };
+        check(throws(0, 48000, 1, 1000.0f) && throws(48000, -1, 1, 1000.0f) && throws(48000, 44100, 0, 1000.0f), "rejects invalid rates");
+        check(throws(48000, 16000, 1, dsp::PolyphaseResampler::DEFAULT_PASSBAND_HZ), "rejects a passband above the lower Nyquist rate");
+    }
+}
+
+int main()
+{
+    for (const RatePair &rates: RATE_PAIRS)
+    {
+        testPassband(rates);
+        testChannels(rates);
+        testSplitting(rates);
+        testInputFramesFor(rates);
+    }
+    testAliasRejection();
+    testInvalidArguments();
+    if (failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    std::printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+// Checks that a call allocates nothing on the inference workers once WatermarkCaller and WatermarkCallee have warmed
+// up their models in their constructors: a short call over 127.0.0.1 must leave the allocation counts of the
+// generator and detector queues at zero.
+//
+// Usage: ultrasound_watermark_allocation_test <resource_dir>
+//   resource_dir contains generator_param, generator_bin, detector_param and detector_bin
+//   Exits with SKIPPED_EXIT_CODE in builds without ENABLE_ULTRASOUND_WATERMARK_ALLOCATION_COUNTER, or if the models are
+//   Git LFS pointers in a checkout without LFS
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HostAudioDevice.hpp"
+#include "WatermarkCaller.hpp"
+#include "WatermarkCallee.hpp"
+#include "batch/WavFileStream.hpp"
+#include "tracing/AllocationCounter.hpp"
+
+using namespace ase_android;
+using namespace ase_ultrasound_watermark;
+
+namespace
+{
+    constexpr int SKIPPED_EXIT_CODE = 77;
+    constexpr int32_t RECORD_DEVICE_ID = 1;
+    constexpr int32_t CALLER_PLAY_DEVICE_ID = 2;
+    constexpr int32_t CALLEE_PLAY_DEVICE_ID = 3;
+    constexpr int INPUT_SECONDS = 3;
+    constexpr auto IDLE_TIMEOUT = std::chrono::seconds(2);
+
+    int failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    bool isLfsPointer(const std::filesystem::path &path)
+    {
+        std::ifstream file{path};
+        std::string line;
+        return std::getline(file, line) && line.starts_with("version https://git-lfs");
+    }
+
+    /// A speech-band tone for the caller to capture
+    void writeInput(const std::filesystem::path &path)
+    {
+        std::vector<int16_t> samples(static_cast<size_t>(INPUT_SECONDS) * WatermarkGenerator::INPUT_FS);
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            samples[i] = static_cast<int16_t>(8000.0 * std::sin(2.0 * std::numbers::pi * 440.0 * static_cast<double>(i) / WatermarkGenerator::INPUT_FS));
+        }
+        WavFileWriter writer{path, WatermarkGenerator::INPUT_FS, 1};
+        writer.write(samples.data(), samples.size());
+        writer.close();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "Usage: %s <resource_dir>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path resource_dir = argv[1];
+    if (!AllocationCounter::isEnabled())
+    {
+        std::printf("skipped: allocations are not counted in this build\n");
+        return SKIPPED_EXIT_CODE;
+    }
+    for (const char *model: {"generator_param", "generator_bin", "detector_param", "detector_bin"})
+    {
+        if (isLfsPointer(resource_dir / model))
+        {
+            std::printf("skipped: %s is a Git LFS pointer\n", model);
+            return SKIPPED_EXIT_CODE;
+        }
+    }
+
+    const std::filesystem::path input_path = std::filesystem::temp_directory_path() / "ultrasound_watermark_allocation_test.wav";
+    try
+    {
+        writeInput(input_path);
+        auto &registry = HostAudioDeviceRegistry::instance();
+        auto recorder_device = std::make_shared<WavFileInputDevice>(input_path, 0.0, false);
+        registry.add(RECORD_DEVICE_ID, recorder_device);
+        registry.add(CALLER_PLAY_DEVICE_ID, std::make_shared<NullAudioDevice>());
+        registry.add(CALLEE_PLAY_DEVICE_ID, std::make_shared<NullAudioDevice>());
+
+        // Lossless queues, so that every window of the input goes through both models
+        WatermarkCallee callee{resource_dir / "detector_param", resource_dir / "detector_bin", OverflowPolicy::Block};
+        WatermarkCaller caller{resource_dir / "generator_param", resource_dir / "generator_bin", OverflowPolicy::Block};
+        callee.StartServer(CALLEE_PLAY_DEVICE_ID);
+        std::string host = "127.0.0.1";
+        caller.StartCall(host, CALLER_PLAY_DEVICE_ID, RECORD_DEVICE_ID, WatermarkCaller::DefaultPilotTones());
+
+        // Run until the input is exhausted and the detector has gone quiet
+        auto last_activity = std::chrono::steady_clock::now();
+        uint64_t last_windows = 0;
+        while (!recorder_device->isExhausted() || std::chrono::steady_clock::now() - last_activity < IDLE_TIMEOUT)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            const uint64_t windows = callee.GetResultRing().writeIndex();
+            if (windows != last_windows)
+            {
+                last_windows = windows;
+                last_activity = std::chrono::steady_clock::now();
+            }
+        }
+        caller.StopCall();
+        callee.Stop();
+
+        const AsyncStageStats generator_stats = caller.GetGeneratorQueueStats();
+        const AsyncStageStats detector_stats = callee.GetDetectorQueueStats();
+        check(last_windows > 0, "the callee detected windows");
+        check(generator_stats.allocations == 0,
+              "generator worker allocated " + std::to_string(generator_stats.allocations) + " times in " +
+              std::to_string(generator_stats.allocating_blocks) + " windows");
+        check(detector_stats.allocations == 0,
+              "detector worker allocated " + std::to_string(detector_stats.allocations) + " times in " +
+              std::to_string(detector_stats.allocating_blocks) + " windows");
+        std::printf("%llu windows detected\n", static_cast<unsigned long long>(last_windows));
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::fprintf(stderr, "FAILED: %s\n", e.what());
+        ++failures;
+    }
+    std::filesystem::remove(input_path);
+
+    if (failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    std::printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
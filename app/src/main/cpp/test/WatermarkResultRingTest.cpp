@@ -0,0 +1,151 @@
+// WatermarkResultRing's seqlock protocol: in-order reads, readers lapped by the writer skipping exactly the overwritten
+// records, and a reader racing a writer on a small ring never returning a torn or out-of-order record.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "WatermarkResultRing.hpp"
+
+using namespace ase_ultrasound_watermark;
+
+namespace
+{
+    constexpr uint64_t RACE_RECORDS = 200000;
+
+    int failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+            ++failures;
+        }
+    }
+
+    /// Every field is derived from n, so that a record mixing two writes is recognized
+    WatermarkResultRecord makeRecord(uint64_t n)
+    {
+        return WatermarkResultRecord{static_cast<int64_t>(n), static_cast<int64_t>(n) * 7 + 3,
+                                     static_cast<float>(n % 1000), -static_cast<float>(n % 1000)};
+    }
+
+    bool isConsistent(const WatermarkResultRecord &record)
+    {
+        if (record.window_index < 0)
+        {
+            return false;
+        }
+        const WatermarkResultRecord expected = makeRecord(static_cast<uint64_t>(record.window_index));
+        return record.timestamp_ns == expected.timestamp_ns && record.instantaneous == expected.instantaneous &&
+               record.average == expected.average;
+    }
+
+    void testCapacity()
+    {
+        check(WatermarkResultRing{5}.capacity() == 8, "capacity rounds up to a power of two");
+        check(WatermarkResultRing{0}.capacity() == 2, "capacity is at least 2");
+        check(WatermarkResultRing{16}.capacity() == 16, "a power of two is kept");
+    }
+
+    void testSequentialReads()
+    {
+        WatermarkResultRing ring{8};
+        std::vector<WatermarkResultRecord> records(8);
+        uint64_t next = 0;
+        check(ring.read(next, records.data(), records.size()) == 0 && next == 0, "empty ring reads nothing");
+        for (uint64_t n = 0; n < 5; ++n)
+        {
+            ring.append(makeRecord(n));
+        }
+        // In batches smaller than what is available
+        size_t count = ring.read(next, records.data(), 3);
+        check(count == 3 && next == 3 && records[0].window_index == 0 && records[2].window_index == 2, "first batch in order");
+        count = ring.read(next, records.data(), records.size());
+        check(count == 2 && next == 5 && records[0].window_index == 3 && records[1].window_index == 4, "rest in order");
+        check(ring.read(next, records.data(), records.size()) == 0 && next == 5, "nothing new");
+    }
+
+    void testLappedReader()
+    {
+        WatermarkResultRing ring{8};
+        for (uint64_t n = 0; n < 3 * 8 + 5; ++n)
+        {
+            ring.append(makeRecord(n));
+        }
+        std::vector<WatermarkResultRecord> records(16);
+        uint64_t next = 2;
+        const size_t count = ring.read(next, records.data(), records.size());
+        check(count == 8 && next == ring.writeIndex(), "a lapped reader gets the last capacity records");
+        bool in_order = true;
+        for (size_t i = 0; i < count; ++i)
+        {
+            in_order &= records[i].window_index == static_cast<int64_t>(ring.writeIndex() - 8 + i) && isConsistent(records[i]);
+        }
+        check(in_order, "lapped reader's records are the newest, in order");
+    }
+
+    void testConcurrentReader()
+    {
+        WatermarkResultRing ring{8};
+        std::atomic<bool> done{false};
+        std::thread writer{[&] {
+            for (uint64_t n = 0; n < RACE_RECORDS; ++n)
+            {
+                ring.append(makeRecord(n));
+            }
+            done.store(true, std::memory_order_release);
+        }};
+
+        std::vector<WatermarkResultRecord> records(4);
+        uint64_t next = 0;
+        int64_t last = -1;
+        uint64_t received = 0;
+        uint64_t torn = 0;
+        uint64_t out_of_order = 0;
+        while (true)
+        {
+            const bool finished = done.load(std::memory_order_acquire);
+            const uint64_t start = next;
+            const size_t count = ring.read(next, records.data(), records.size());
+            for (size_t i = 0; i < count; ++i)
+            {
+                torn += isConsistent(records[i]) ? 0 : 1;
+                out_of_order += records[i].window_index > last ? 0 : 1;
+                last = records[i].window_index;
+            }
+            received += count;
+            check(next - start >= count, "the reader advances past what it returns");
+            if (finished && next == ring.writeIndex())
+            {
+                break;
+            }
+        }
+        writer.join();
+        check(torn == 0, std::to_string(torn) + " torn records");
+        check(out_of_order == 0, std::to_string(out_of_order) + " records out of order");
+        check(next == RACE_RECORDS && last == static_cast<int64_t>(RACE_RECORDS - 1), "the reader ends at the last record");
+        std::printf("concurrent reader received %llu of %llu records\n", static_cast<unsigned long long>(received),
+                    static_cast<unsigned long long>(RACE_RECORDS));
+    }
+}
+
+int main()
+{
+    testCapacity();
+    testSequentialReads();
+    testLappedReader();
+    testConcurrentReader();
+    if (failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    std::printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
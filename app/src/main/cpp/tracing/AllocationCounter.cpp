@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <pthread.h>
+#include "AllocationCounter.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    namespace
+    {
+        // A pthread key rather than thread_local: below API 29, thread_local is emulated with storage that is itself
+        // allocated with malloc, which would recurse into the wrappers
+        pthread_key_t g_counter_key;
+        pthread_once_t g_counter_key_once = PTHREAD_ONCE_INIT;
+        // Allocations made before any counter exists (static initialization included) skip the key
+        std::atomic<bool> g_counter_key_created{false};
+
+        void createCounterKey()
+        {
+            pthread_key_create(&g_counter_key, nullptr);
+            g_counter_key_created.store(true, std::memory_order_release);
+        }
+
+        AllocationCounter *currentCounter()
+        {
+            pthread_once(&g_counter_key_once, createCounterKey);
+            return static_cast<AllocationCounter *>(pthread_getspecific(g_counter_key));
+        }
+    }
+
+    AllocationCounter::AllocationCounter() : count_{0}, outer_{currentCounter()}
+    {
+        pthread_setspecific(g_counter_key, this);
+    }
+
+    AllocationCounter::~AllocationCounter()
+    {
+        pthread_setspecific(g_counter_key, outer_);
+    }
+
+    bool AllocationCounter::isEnabled()
+    {
+#ifdef ULTRASOUND_WATERMARK_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void AllocationCounter::onAllocation()
+    {
+        if (!g_counter_key_created.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        auto *counter = static_cast<AllocationCounter *>(pthread_getspecific(g_counter_key));
+        if (counter)
+        {
+            ++counter->count_;
+        }
+    }
+
+} // ase_ultrasound_watermark
+
+#ifdef ULTRASOUND_WATERMARK_COUNT_ALLOCATIONS
+// Targets of the linker's --wrap options set in CMakeLists.txt
+extern "C"
+{
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+int __real_posix_memalign(void **pointer, size_t alignment, size_t size);
+void *__real_memalign(size_t alignment, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    ase_ultrasound_watermark::AllocationCounter::onAllocation();
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    ase_ultrasound_watermark::AllocationCounter::onAllocation();
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    ase_ultrasound_watermark::AllocationCounter::onAllocation();
+    return __real_realloc(pointer, size);
+}
+
+int __wrap_posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+    ase_ultrasound_watermark::AllocationCounter::onAllocation();
+    return __real_posix_memalign(pointer, alignment, size);
+}
+
+void *__wrap_memalign(size_t alignment, size_t size)
+{
+    ase_ultrasound_watermark::AllocationCounter::onAllocation();
+    return __real_memalign(alignment, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size)
+{
+    ase_ultrasound_watermark::AllocationCounter::onAllocation();
+    return __real_aligned_alloc(alignment, size);
+}
+}
+#endif
+
+#if defined(ULTRASOUND_WATERMARK_COUNT_ALLOCATIONS) && !defined(__ANDROID__)
+// On Android libc++ is linked in statically, so its operator new already calls the wrapped malloc. On host it lives in
+// the shared libstdc++ instead, so it is replaced here with one that does
+namespace
+{
+    void *allocateOrThrow(size_t size)
+    {
+        void *pointer = std::malloc(size == 0 ? 1 : size);
+        if (!pointer)
+        {
+            throw std::bad_alloc();
+        }
+        return pointer;
+    }
+
+    void *allocateAlignedOrThrow(size_t size, std::align_val_t alignment)
+    {
+        void *pointer = nullptr;
+        if (posix_memalign(&pointer, std::max(static_cast<size_t>(alignment), sizeof(void *)), size == 0 ? 1 : size) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        return pointer;
+    }
+}
+
+void *operator new(size_t size)
+{
+    return allocateOrThrow(size);
+}
+
+void *operator new[](size_t size)
+{
+    return allocateOrThrow(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return allocateAlignedOrThrow(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocateAlignedOrThrow(size, alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return allocateAlignedOrThrow(size, alignment);
+    }
+    catch (const std::bad_alloc &)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return operator new(size, alignment, std::nothrow);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+#endif
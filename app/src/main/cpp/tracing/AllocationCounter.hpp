@@ -0,0 +1,50 @@
+#ifndef ULTRASOUNDWATERMARK_ALLOCATIONCOUNTER_HPP
+#define ULTRASOUNDWATERMARK_ALLOCATIONCOUNTER_HPP
+
+#include <cstdint>
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Counts the heap allocations made by the thread that created it, for as long as it exists, e.g. to check that a
+     * worker runs each window without touching the allocator.
+     *
+     * Every allocation made through malloc, calloc, realloc, posix_memalign, memalign or aligned_alloc by code linked
+     * into the library is counted, which covers operator new and the DSP core. This works by wrapping those
+     * functions at link time (ULTRASOUND_WATERMARK_COUNT_ALLOCATIONS); without it isEnabled() is false and counts stay 0.
+     * Threads without a counter only pay for a check of a thread-specific slot per allocation.
+     *
+     * Counters nest: while an inner one exists, the allocations are counted there only. Create and destroy on the same
+     * thread, innermost first.
+     */
+    class AllocationCounter
+    {
+    public:
+        AllocationCounter();
+
+        AllocationCounter(const AllocationCounter &) = delete;
+
+        AllocationCounter &operator=(const AllocationCounter &) = delete;
+
+        ~AllocationCounter();
+
+        /// Allocations counted so far. Only meaningful on the thread that created the counter
+        [[nodiscard]] int64_t count() const
+        {
+            return count_;
+        }
+
+        /// Whether allocations are counted at all in this build
+        static bool isEnabled();
+
+        /// Called by the allocation wrappers
+        static void onAllocation();
+
+    private:
+        int64_t count_;
+        AllocationCounter *const outer_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_ALLOCATIONCOUNTER_HPP
@@ -0,0 +1,95 @@
+#ifndef ULTRASOUNDWATERMARK_CAPTURETIMELINE_HPP
+#define ULTRASOUNDWATERMARK_CAPTURETIMELINE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Maps stream positions (cumulative frame counts) to monotonic capture timestamps.
+     *
+     * A single writer appends one checkpoint per captured block: the position just past the block and its capture time.
+     * Any number of readers may look up the capture time of a position concurrently. Both sides are lock-free.
+     * Only the most recent CAPACITY checkpoints are kept; older positions are reported as unknown.
+     */
+    class CaptureTimeline
+    {
+    public:
+        static constexpr size_t CAPACITY = 1024;
+
+        CaptureTimeline()
+        {
+            reset();
+        }
+
+        /// Writer side. end_position is the position just past the captured block
+        void append(int64_t end_position, int64_t capture_time_ns)
+        {
+            const uint64_t index = count_.load(std::memory_order_relaxed);
+            Checkpoint &checkpoint = checkpoints_[index & (CAPACITY - 1)];
+            // Invalidate first so that readers never pair the new time with the old position
+            checkpoint.end_position.store(INVALID_POSITION, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            checkpoint.capture_time_ns.store(capture_time_ns, std::memory_order_relaxed);
+            checkpoint.end_position.store(end_position, std::memory_order_release);
+            count_.store(index + 1, std::memory_order_release);
+        }
+
+        /**
+         * Capture time of the block containing the frame just before position, i.e. of the newest frame of a
+         * block ending at position.
+         */
+        [[nodiscard]] std::optional<int64_t> find(int64_t position) const
+        {
+            const uint64_t count = count_.load(std::memory_order_acquire);
+            std::optional<int64_t> result;
+            // Walk from newest to oldest and remember the oldest checkpoint that still covers position
+            for (uint64_t i = 0; i < std::min<uint64_t>(count, CAPACITY); ++i)
+            {
+                const Checkpoint &checkpoint = checkpoints_[(count - 1 - i) & (CAPACITY - 1)];
+                const int64_t end_position = checkpoint.end_position.load(std::memory_order_acquire);
+                const int64_t capture_time_ns = checkpoint.capture_time_ns.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (end_position == INVALID_POSITION || end_position != checkpoint.end_position.load(std::memory_order_relaxed))
+                {
+                    break; // Overwritten while reading
+                }
+                if (end_position < position)
+                {
+                    break;
+                }
+                result = capture_time_ns;
+            }
+            return result;
+        }
+
+        /// Not thread-safe. Call while neither side is active
+        void reset()
+        {
+            for (auto &checkpoint: checkpoints_)
+            {
+                checkpoint.end_position.store(INVALID_POSITION, std::memory_order_relaxed);
+                checkpoint.capture_time_ns.store(0, std::memory_order_relaxed);
+            }
+            count_.store(0, std::memory_order_release);
+        }
+
+    private:
+        static constexpr int64_t INVALID_POSITION = -1;
+
+        struct Checkpoint
+        {
+            std::atomic<int64_t> end_position;
+            std::atomic<int64_t> capture_time_ns;
+        };
+
+        std::array<Checkpoint, CAPACITY> checkpoints_;
+        std::atomic<uint64_t> count_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_CAPTURETIMELINE_HPP
@@ -0,0 +1,60 @@
+#ifndef ULTRASOUNDWATERMARK_FIRSTBLOCKPROBE_HPP
+#define ULTRASOUNDWATERMARK_FIRSTBLOCKPROBE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ase/stream/AudioDataStreamBase.hpp>
+#include "LatencyTracer.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * A consumer that records how long after arm() a stage emitted its first block, e.g. to time call setup up to
+     * the first packet sent. Like LatencyTapStream, it does not forward samples; attach it before the regular consumers.
+     */
+    template<typename SAMPLE_T>
+    class FirstBlockProbe : public ase::AudioDataStreamBase<SAMPLE_T>
+    {
+    public:
+        FirstBlockProbe(int sample_rate, int channels)
+                : ase::AudioDataStreamBase<SAMPLE_T>{sample_rate, channels},
+                  armed_at_ns_{NOT_ARMED},
+                  elapsed_ns_{NOT_SEEN}
+        {
+        }
+
+        /// Start timing from start_ns (LatencyTracer::nowNanoseconds() timebase). The next block stops it
+        void arm(int64_t start_ns)
+        {
+            elapsed_ns_.store(NOT_SEEN, std::memory_order_relaxed);
+            armed_at_ns_.store(start_ns, std::memory_order_release);
+        }
+
+        void consume(const SAMPLE_T *samples, size_t size) override
+        {
+            const int64_t armed_at = armed_at_ns_.load(std::memory_order_acquire);
+            if (armed_at == NOT_ARMED)
+            {
+                return;
+            }
+            elapsed_ns_.store(LatencyTracer::nowNanoseconds() - armed_at, std::memory_order_relaxed);
+            armed_at_ns_.store(NOT_ARMED, std::memory_order_relaxed);
+        }
+
+        /// Time from arm() to the first block, -1 until it arrives
+        [[nodiscard]] int64_t getElapsedNanoseconds() const
+        {
+            return elapsed_ns_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        constexpr static int64_t NOT_ARMED = INT64_MIN;
+        constexpr static int64_t NOT_SEEN = -1;
+
+        std::atomic<int64_t> armed_at_ns_;
+        std::atomic<int64_t> elapsed_ns_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_FIRSTBLOCKPROBE_HPP
@@ -0,0 +1,129 @@
+#ifndef ULTRASOUNDWATERMARK_LATENCYHISTOGRAM_HPP
+#define ULTRASOUNDWATERMARK_LATENCYHISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Lock-free log-linear latency histogram with microsecond resolution.
+     * Each power of two is split into SUB_BUCKETS linear buckets, so quantiles are accurate to about 6%.
+     * record() is wait-free and safe to call from realtime threads.
+     */
+    class LatencyHistogram
+    {
+    public:
+        struct Summary
+        {
+            int64_t count;
+            int64_t p50_us;
+            int64_t p90_us;
+            int64_t p99_us;
+            int64_t max_us;
+        };
+
+        LatencyHistogram()
+        {
+            reset();
+        }
+
+        void record(int64_t latency_ns)
+        {
+            const int64_t latency_us = std::max<int64_t>(latency_ns / 1000, 0);
+            buckets_[bucketIndex(static_cast<uint64_t>(latency_us))].fetch_add(1, std::memory_order_relaxed);
+            int64_t max = max_us_.load(std::memory_order_relaxed);
+            while (latency_us > max && !max_us_.compare_exchange_weak(max, latency_us, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        [[nodiscard]] Summary summarize() const
+        {
+            std::array<int64_t, NUM_BUCKETS> counts{};
+            int64_t total = 0;
+            for (size_t i = 0; i < NUM_BUCKETS; ++i)
+            {
+                counts[i] = buckets_[i].load(std::memory_order_relaxed);
+                total += counts[i];
+            }
+            // Bucket upper bounds may exceed the largest value actually recorded
+            const int64_t max = max_us_.load(std::memory_order_relaxed);
+            return Summary{total,
+                           std::min(quantile(counts, total, 0.5), max),
+                           std::min(quantile(counts, total, 0.9), max),
+                           std::min(quantile(counts, total, 0.99), max),
+                           max};
+        }
+
+        void reset()
+        {
+            for (auto &bucket: buckets_)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            max_us_.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr unsigned SUB_BUCKET_BITS = 4;
+        static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+        // Up to 2^32 us (over an hour). Anything above lands in the last bucket
+        static constexpr unsigned MAX_EXPONENT = 32;
+        static constexpr size_t NUM_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        std::array<std::atomic<int64_t>, NUM_BUCKETS> buckets_;
+        std::atomic<int64_t> max_us_;
+
+        static size_t bucketIndex(uint64_t value)
+        {
+            if (value < SUB_BUCKETS)
+            {
+                return static_cast<size_t>(value);
+            }
+            const unsigned exponent = std::bit_width(value) - 1; // >= SUB_BUCKET_BITS
+            const auto sub_bucket = static_cast<size_t>((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+            const size_t index = (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+            return std::min(index, NUM_BUCKETS - 1);
+        }
+
+        /// Upper bound of the values mapped to bucket index
+        static int64_t bucketUpperBound(size_t index)
+        {
+            if (index < SUB_BUCKETS)
+            {
+                return static_cast<int64_t>(index);
+            }
+            const size_t exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+            const size_t sub_bucket = index % SUB_BUCKETS;
+            const int64_t base = int64_t{1} << exponent;
+            const int64_t width = base >> SUB_BUCKET_BITS;
+            return base + static_cast<int64_t>(sub_bucket + 1) * width - 1;
+        }
+
+        static int64_t quantile(const std::array<int64_t, NUM_BUCKETS> &counts, int64_t total, double q)
+        {
+            if (total == 0)
+            {
+                return 0;
+            }
+            const auto rank = static_cast<int64_t>(q * static_cast<double>(total - 1)) + 1;
+            int64_t seen = 0;
+            for (size_t i = 0; i < NUM_BUCKETS; ++i)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                {
+                    return bucketUpperBound(i);
+                }
+            }
+            return bucketUpperBound(NUM_BUCKETS - 1);
+        }
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_LATENCYHISTOGRAM_HPP
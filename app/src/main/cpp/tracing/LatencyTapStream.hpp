@@ -0,0 +1,66 @@
+#ifndef ULTRASOUNDWATERMARK_LATENCYTAPSTREAM_HPP
+#define ULTRASOUNDWATERMARK_LATENCYTAPSTREAM_HPP
+
+#include <functional>
+#include <string>
+#include <ase/stream/AudioDataStreamBase.hpp>
+#include "LatencyTracer.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * A consumer attached next to the regular consumers of a stage. It does not copy or forward samples,
+     * it only counts the frames the stage emits and records their latency.
+     * In Capture mode it first records the capture time of each block into the tracer's timeline,
+     * so its own histogram only counts captured blocks at close to zero latency.
+     *
+     * Attach a tap before the regular consumers of a stage: consumers run synchronously in attachment order,
+     * and a tap attached after them would also measure everything downstream.
+     */
+    template<typename SAMPLE_T>
+    class LatencyTapStream : public ase::AudioDataStreamBase<SAMPLE_T>
+    {
+        using base = ase::AudioDataStreamBase<SAMPLE_T>;
+    public:
+        enum class Mode
+        {
+            Capture,
+            Measure
+        };
+
+        /**
+         * @param skipped_frames Optional. Frames dropped upstream of this tap (e.g. AsyncStreamStage::getDroppedFrames),
+         * added to the tap's own frame count so that positions stay aligned with the capture timeline
+         */
+        LatencyTapStream(LatencyTracer &tracer, const std::string &stage, int sample_rate, int channels, Mode mode,
+                         std::function<int64_t()> skipped_frames = {})
+                : ase::AudioDataStreamBase<SAMPLE_T>{sample_rate, channels},
+                  tracer_{tracer},
+                  histogram_{tracer.stage(stage)},
+                  mode_{mode},
+                  skipped_frames_{std::move(skipped_frames)},
+                  position_frames_{0}
+        {
+        }
+
+        void consume(const SAMPLE_T *samples, size_t size) override
+        {
+            position_frames_ += static_cast<int64_t>(size / base::_num_channels);
+            if (mode_ == Mode::Capture)
+            {
+                tracer_.timeline().append(position_frames_, LatencyTracer::nowNanoseconds());
+            }
+            tracer_.record(histogram_, skipped_frames_ ? position_frames_ + skipped_frames_() : position_frames_);
+        }
+
+    private:
+        LatencyTracer &tracer_;
+        LatencyHistogram &histogram_;
+        const Mode mode_;
+        const std::function<int64_t()> skipped_frames_;
+        int64_t position_frames_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_LATENCYTAPSTREAM_HPP
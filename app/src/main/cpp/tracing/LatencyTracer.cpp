@@ -0,0 +1,56 @@
+#include <chrono>
+#include "LatencyTracer.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    LatencyHistogram &LatencyTracer::stage(const std::string &name)
+    {
+        std::lock_guard lock{mutex_};
+        for (auto &[stage_name, histogram]: stages_)
+        {
+            if (stage_name == name)
+            {
+                return *histogram;
+            }
+        }
+        stages_.emplace_back(name, std::make_unique<LatencyHistogram>());
+        return *stages_.back().second;
+    }
+
+    void LatencyTracer::record(LatencyHistogram &histogram, int64_t position) const
+    {
+        const auto capture_time_ns = timeline_.find(position);
+        if (capture_time_ns)
+        {
+            histogram.record(nowNanoseconds() - *capture_time_ns);
+        }
+    }
+
+    std::vector<LatencyTracer::StageLatency> LatencyTracer::snapshot() const
+    {
+        std::lock_guard lock{mutex_};
+        std::vector<StageLatency> result;
+        result.reserve(stages_.size());
+        for (const auto &[stage_name, histogram]: stages_)
+        {
+            result.push_back(StageLatency{stage_name, histogram->summarize()});
+        }
+        return result;
+    }
+
+    void LatencyTracer::reset()
+    {
+        std::lock_guard lock{mutex_};
+        for (auto &[stage_name, histogram]: stages_)
+        {
+            histogram->reset();
+        }
+        timeline_.reset();
+    }
+
+    int64_t LatencyTracer::nowNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+} // ase_ultrasound_watermark
@@ -0,0 +1,61 @@
+#ifndef ULTRASOUNDWATERMARK_LATENCYTRACER_HPP
+#define ULTRASOUNDWATERMARK_LATENCYTRACER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "CaptureTimeline.hpp"
+#include "LatencyHistogram.hpp"
+
+namespace ase_ultrasound_watermark
+{
+    /**
+     * Per-pipeline latency tracing.
+     *
+     * Samples are identified by their position (cumulative frame count) in the stream. The first stage records when
+     * each position was captured in the CaptureTimeline, and every later stage records, for the newest position it
+     * has emitted, the time since capture into its own histogram. Stage latencies are therefore cumulative from
+     * capture; the difference between two stages is the cost of the stages in between.
+     */
+    class LatencyTracer
+    {
+    public:
+        struct StageLatency
+        {
+            std::string stage;
+            LatencyHistogram::Summary latency;
+        };
+
+        /**
+         * Get or create the histogram of a stage. Create stages while setting up the pipeline, not from realtime threads.
+         * The returned reference stays valid for the lifetime of the tracer.
+         */
+        LatencyHistogram &stage(const std::string &name);
+
+        CaptureTimeline &timeline()
+        {
+            return timeline_;
+        }
+
+        /// Record the latency of the frame just before position into histogram. Lock-free
+        void record(LatencyHistogram &histogram, int64_t position) const;
+
+        /// Latency summaries of all stages, in the order they were created
+        [[nodiscard]] std::vector<StageLatency> snapshot() const;
+
+        /// Clear all histograms and the timeline. Call while the pipeline is not running
+        void reset();
+
+        static int64_t nowNanoseconds();
+
+    private:
+        mutable std::mutex mutex_;
+        std::vector<std::pair<std::string, std::unique_ptr<LatencyHistogram>>> stages_;
+        CaptureTimeline timeline_;
+    };
+
+} // ase_ultrasound_watermark
+
+#endif //ULTRASOUNDWATERMARK_LATENCYTRACER_HPP
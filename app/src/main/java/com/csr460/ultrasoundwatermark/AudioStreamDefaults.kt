@@ -0,0 +1,48 @@
+package com.csr460.ultrasoundwatermark
+
+import android.content.Context
+import android.media.AudioManager
+import android.os.Build
+import java.io.File
+
+/**
+ * Passes the device's native output rate and burst size, as reported by [AudioManager], to the native audio streams,
+ * and tells them where to keep the stream profiles that suit this device.
+ *
+ * Streams open at the native rate and convert to and from the models' rate themselves, which keeps the low-latency
+ * paths available. AAudio finds the native rate on its own; OpenSL ES streams only know it from here, so call
+ * [initialize] once before starting a [WatermarkCaller] or [WatermarkCallee].
+ *
+ * Each stream starts on the lowest-latency profile and falls back to a more forgiving one when it glitches. The
+ * fallbacks are kept in the app's no-backup directory, so that later sessions start on the profile that held up,
+ * until the OS is updated or [resetStreamProfiles] is called. See [StreamStats] for what each stream ended up with.
+ */
+object AudioStreamDefaults {
+    private const val STREAM_PROFILES_FILE = "stream_profiles"
+
+    init {
+        System.loadLibrary("ultrasound_watermark")
+    }
+
+    fun initialize(context: Context) {
+        val audioManager = context.getSystemService(Context.AUDIO_SERVICE) as AudioManager
+        val sampleRate = audioManager.getProperty(AudioManager.PROPERTY_OUTPUT_SAMPLE_RATE)?.toIntOrNull() ?: 0
+        val framesPerBurst = audioManager.getProperty(AudioManager.PROPERTY_OUTPUT_FRAMES_PER_BUFFER)?.toIntOrNull() ?: 0
+        nativeSetDefaultStreamValues(sampleRate, framesPerBurst)
+        nativeOpenStreamProfileStore(File(context.noBackupFilesDir, STREAM_PROFILES_FILE).absolutePath, Build.FINGERPRINT)
+    }
+
+    /** Let every stream try the lowest-latency profile again from its next start. */
+    fun resetStreamProfiles() {
+        nativeClearStreamProfiles()
+    }
+
+    @JvmStatic
+    private external fun nativeSetDefaultStreamValues(sampleRate: Int, framesPerBurst: Int)
+
+    @JvmStatic
+    private external fun nativeOpenStreamProfileStore(path: String, fingerprint: String)
+
+    @JvmStatic
+    private external fun nativeClearStreamProfiles()
+}
@@ -0,0 +1,11 @@
+package com.csr460.ultrasoundwatermark
+
+/** Setup time of the current (or last) call of a [WatermarkCaller]. */
+data class CallStartupStats(
+    /** Whether the call was started from standby. */
+    val fromStandby: Boolean,
+    /** Time spent in startCall. */
+    val setupNanos: Long,
+    /** Time from startCall until the first watermarked packet was sent, -1 until it is. */
+    val firstPacketNanos: Long
+)
@@ -0,0 +1,93 @@
+package com.csr460.ultrasoundwatermark
+
+import android.content.Context
+import android.content.res.AssetManager
+import java.nio.ByteBuffer
+
+/**
+ * The param and bin files of a model, loaded without copying them to storage first. Uncompressed APK resources and
+ * assets are mapped from the APK, but the native models only load from paths, so each file is copied once into an
+ * in-memory file when the source is created. Any number of [WatermarkCaller]s or [WatermarkCallee]s can be created
+ * from one source; they load during construction, so the source can be released right after.
+ */
+class ModelSource private constructor(nativePtr: Long) {
+    internal var nativePtr: Long = nativePtr
+        private set
+
+    fun release() {
+        nativeDelete(nativePtr)
+        nativePtr = 0
+    }
+
+    companion object {
+        init {
+            System.loadLibrary("ultrasound_watermark")
+        }
+
+        fun fromFiles(paramPath: String, binPath: String): ModelSource =
+            ModelSource(nativeFromFiles(paramPath, binPath))
+
+        /** Map raw resources from the APK to copy them. Falls back to reading them if they were stored compressed. */
+        fun fromRawResources(context: Context, paramResourceId: Int, binResourceId: Int): ModelSource {
+            val resources = context.resources
+            val param = try {
+                resources.openRawResourceFd(paramResourceId)
+            } catch (e: Exception) {
+                null
+            }
+            val bin = try {
+                resources.openRawResourceFd(binResourceId)
+            } catch (e: Exception) {
+                null
+            }
+            if (param == null || bin == null) {
+                param?.close()
+                bin?.close()
+                return fromBuffers(
+                    resources.openRawResource(paramResourceId).use { ByteBuffer.wrap(it.readBytes()) },
+                    resources.openRawResource(binResourceId).use { ByteBuffer.wrap(it.readBytes()) }
+                )
+            }
+            // The mappings outlive the descriptors
+            return param.use {
+                bin.use {
+                    ModelSource(
+                        nativeFromFileRanges(
+                            param.parcelFileDescriptor.fd, param.startOffset, param.length,
+                            bin.parcelFileDescriptor.fd, bin.startOffset, bin.length
+                        )
+                    )
+                }
+            }
+        }
+
+        fun fromAssets(assets: AssetManager, paramName: String, binName: String): ModelSource =
+            ModelSource(nativeFromAssets(assets, paramName, binName))
+
+        /** Load from memory, e.g. a downloaded model. Heap buffers are copied into direct ones first. */
+        fun fromBuffers(param: ByteBuffer, bin: ByteBuffer): ModelSource =
+            ModelSource(nativeFromBuffers(param.toDirect(), bin.toDirect()))
+
+        private fun ByteBuffer.toDirect(): ByteBuffer {
+            if (isDirect && position() == 0 && limit() == capacity()) {
+                return this
+            }
+            val source = duplicate()
+            return ByteBuffer.allocateDirect(source.remaining()).put(source).apply { flip() }
+        }
+
+        @JvmStatic
+        private external fun nativeFromFiles(paramPath: String, binPath: String): Long
+        @JvmStatic
+        private external fun nativeFromFileRanges(
+            paramFd: Int, paramOffset: Long, paramLength: Long,
+            binFd: Int, binOffset: Long, binLength: Long
+        ): Long
+        @JvmStatic
+        private external fun nativeFromAssets(assets: AssetManager, paramName: String, binName: String): Long
+        @JvmStatic
+        private external fun nativeFromBuffers(param: ByteBuffer, bin: ByteBuffer): Long
+        @JvmStatic
+        private external fun nativeDelete(nativePtr: Long)
+    }
+}
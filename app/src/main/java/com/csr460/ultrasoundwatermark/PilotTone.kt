@@ -0,0 +1,25 @@
+package com.csr460.ultrasoundwatermark
+
+/**
+ * A tone of the pilot signal a [WatermarkCaller] synthesizes, see [WatermarkCaller.startCall]. [amplitude] is the
+ * peak relative to full scale; the amplitudes of a tone set should add up to at most 1 to not clip.
+ */
+data class PilotTone(val frequencyHz: Float, val amplitude: Float) {
+    companion object {
+        init {
+            System.loadLibrary("ultrasound_watermark")
+        }
+
+        /** The tones the callee's detector listens for. */
+        val DEFAULT: List<PilotTone> by lazy { fromPairs(nativeDefaultPilotTones()) }
+
+        internal fun toPairs(tones: List<PilotTone>): FloatArray =
+            tones.flatMap { listOf(it.frequencyHz, it.amplitude) }.toFloatArray()
+
+        private fun fromPairs(pairs: FloatArray): List<PilotTone> =
+            pairs.toList().chunked(2) { PilotTone(it[0], it[1]) }
+
+        @JvmStatic
+        private external fun nativeDefaultPilotTones(): FloatArray
+    }
+}
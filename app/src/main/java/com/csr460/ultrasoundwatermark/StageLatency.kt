@@ -0,0 +1,14 @@
+package com.csr460.ultrasoundwatermark
+
+/**
+ * Latency of one pipeline stage, measured from the moment the corresponding audio was captured on the caller.
+ * Quantiles are in microseconds and have roughly 6% resolution.
+ */
+data class StageLatency(
+    val stage: String,
+    val count: Long,
+    val p50Micros: Long,
+    val p90Micros: Long,
+    val p99Micros: Long,
+    val maxMicros: Long
+)
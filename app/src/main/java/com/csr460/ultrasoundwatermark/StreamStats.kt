@@ -0,0 +1,32 @@
+package com.csr460.ultrasoundwatermark
+
+/**
+ * Profile and glitch statistics of one native audio stream since it was last started.
+ *
+ * Streams start on the lowest-latency profile the device has kept up with and fall back by themselves when it
+ * glitches, see [AudioStreamDefaults]. Jitter is how far the time between data callbacks strays from the audio they
+ * carry, in microseconds with roughly 6% resolution.
+ */
+data class StreamStats(
+    val input: Boolean,
+    val deviceId: Int,
+    /** The profile granted, which may be less than the one asked for. */
+    val lowLatency: Boolean,
+    val exclusive: Boolean,
+    val sampleRate: Int,
+    /** Underruns (output) or overruns (input), -1 if the audio API does not count them. */
+    val xruns: Int,
+    val callbacks: Long,
+    /** Callbacks that came more than a callback period late. */
+    val lateCallbacks: Long,
+    /**
+     * Late callbacks that came after the stream's buffer must have run dry (or full, for input). These are the
+     * glitches a stream falls back on when [xruns] is -1.
+     */
+    val stalledCallbacks: Long,
+    val jitterP50Micros: Long,
+    val jitterP99Micros: Long,
+    val jitterMaxMicros: Long,
+    /** Profiles given up for glitching since the stream started. */
+    val fallbacks: Int
+)
@@ -0,0 +1,41 @@
+package com.csr460.ultrasoundwatermark
+
+/**
+ * CPU affinity and priority of a [WatermarkCaller]'s or [WatermarkCallee]'s native threads: the inference worker
+ * running the generator or detector, and the KCP I/O thread, which also decodes on the callee.
+ *
+ * Masks have bit n set for CPU n; 0 keeps the affinity the thread inherits. Nice values run from -20 (highest
+ * priority) to 19; [KEEP_NICE] keeps the inherited one. Construction fails with [WatermarkNativeException] if the
+ * system does not permit a policy.
+ */
+data class ThreadConfig(
+    val inferenceCpuMask: Long = 0,
+    val inferenceNice: Int = KEEP_NICE,
+    val networkCpuMask: Long = 0,
+    val networkNice: Int = KEEP_NICE
+) {
+    companion object {
+        init {
+            System.loadLibrary("ultrasound_watermark")
+        }
+
+        const val KEEP_NICE = Int.MIN_VALUE
+
+        /** Leave every thread as it is created. */
+        val DEFAULT = ThreadConfig()
+
+        private val cpuMasks: LongArray by lazy { nativeDetectCpuMasks() }
+
+        /** Every CPU of the device. */
+        val allCores: Long get() = cpuMasks[0]
+
+        /** CPUs faster than the slowest cluster; all of them on processors with a single kind of core. */
+        val performanceCores: Long get() = cpuMasks[1]
+
+        /** CPUs of the slowest cluster. */
+        val efficiencyCores: Long get() = cpuMasks[2]
+
+        @JvmStatic
+        private external fun nativeDetectCpuMasks(): LongArray
+    }
+}
@@ -4,11 +4,20 @@ fun interface OnWatermarkResultsListener {
     fun onWatermarkResults(instantaneous: Float, average: Float)
 }
 
-class WatermarkCallee(paramPath: String, modelPath: String) {
+class WatermarkCallee {
     private var nativePtr: Long = 0
 
-    init {
-        nativePtr = nativeCreate(paramPath, modelPath)
+    constructor(paramPath: String, modelPath: String, threadConfig: ThreadConfig = ThreadConfig.DEFAULT) {
+        nativePtr = with(threadConfig) {
+            nativeCreate(paramPath, modelPath, inferenceCpuMask, inferenceNice, networkCpuMask, networkNice)
+        }
+    }
+
+    /** Load the detector from [model], which can be released afterwards. */
+    constructor(model: ModelSource, threadConfig: ThreadConfig = ThreadConfig.DEFAULT) {
+        nativePtr = with(threadConfig) {
+            nativeCreateFromModel(model.nativePtr, inferenceCpuMask, inferenceNice, networkCpuMask, networkNice)
+        }
     }
 
     fun startServer(playDeviceId: Int) {
@@ -16,22 +25,67 @@ class WatermarkCallee(paramPath: String, modelPath: String) {
     }
 
     fun setOnWatermarkResultsCallback(listener: OnWatermarkResultsListener) {
-        nativeSetOnWatermarkResultsCallback(nativePtr, listener)
+        setOnWatermarkResultsCallback(0f, listener)
     }
 
+    /**
+     * Deliver at most [maxRateHz] results per second, 0 for all of them. Results in between are merged, keeping the
+     * highest instantaneous probability and the latest average. The listener runs on a native dispatcher thread.
+     */
+    fun setOnWatermarkResultsCallback(maxRateHz: Float, listener: OnWatermarkResultsListener) {
+        nativeSetOnWatermarkResultsCallback(nativePtr, listener, maxRateHz)
+    }
+
+    /** Stop detecting. Stays in standby if [enterStandby] was called. */
     fun stop() {
         nativeStop(nativePtr)
     }
 
+    /**
+     * Keep the KCP server bound, the player open and the pipeline wired between calls, discarding what arrives, so
+     * that a [startServer] with the same device starts at once.
+     */
+    fun enterStandby(playDeviceId: Int) {
+        nativeEnterStandby(nativePtr, playDeviceId)
+    }
+
+    fun exitStandby() {
+        nativeExitStandby(nativePtr)
+    }
+
+    /**
+     * Every detection result, copied out of native memory in batches rather than by a JNI call per result.
+     * Valid until [release].
+     */
+    fun openResultRing(): WatermarkResultRing = WatermarkResultRing(nativeGetResultRing(nativePtr))
+
+    /** Per-stage latency histograms since the last start, in pipeline order. */
+    fun getLatencyReport(): Array<StageLatency> = nativeGetLatencyReport(nativePtr) ?: emptyArray()
+
+    /** The player stream, since the server started. */
+    fun getStreamStats(): Array<StreamStats> = nativeGetStreamStats(nativePtr) ?: emptyArray()
+
     fun release() {
         nativeDelete(nativePtr)
         nativePtr = 0
     }
 
-    private external fun nativeCreate(paramPath: String, modelPath: String): Long
+    private external fun nativeCreate(
+        paramPath: String, modelPath: String,
+        inferenceCpuMask: Long, inferenceNice: Int, networkCpuMask: Long, networkNice: Int
+    ): Long
+    private external fun nativeCreateFromModel(
+        modelPtr: Long,
+        inferenceCpuMask: Long, inferenceNice: Int, networkCpuMask: Long, networkNice: Int
+    ): Long
     private external fun nativeStartServer(nativePtr: Long, playDeviceId: Int)
-    private external fun nativeSetOnWatermarkResultsCallback(nativePtr: Long, callback: OnWatermarkResultsListener)
+    private external fun nativeSetOnWatermarkResultsCallback(nativePtr: Long, callback: OnWatermarkResultsListener, maxRateHz: Float)
     private external fun nativeStop(nativePtr: Long)
+    private external fun nativeEnterStandby(nativePtr: Long, playDeviceId: Int)
+    private external fun nativeExitStandby(nativePtr: Long)
+    private external fun nativeGetLatencyReport(nativePtr: Long): Array<StageLatency>?
+    private external fun nativeGetStreamStats(nativePtr: Long): Array<StreamStats>?
+    private external fun nativeGetResultRing(nativePtr: Long): Long
     private external fun nativeDelete(nativePtr: Long)
 
     companion object {
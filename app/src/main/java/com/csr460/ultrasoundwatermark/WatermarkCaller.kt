@@ -1,28 +1,91 @@
 package com.csr460.ultrasoundwatermark
 
-class WatermarkCaller(paramPath: String, modelPath: String) {
+class WatermarkCaller {
     private var nativePtr: Long = 0
 
-    init {
-        nativePtr = nativeCreate(paramPath, modelPath)
+    constructor(paramPath: String, modelPath: String, threadConfig: ThreadConfig = ThreadConfig.DEFAULT) {
+        nativePtr = with(threadConfig) {
+            nativeCreate(paramPath, modelPath, inferenceCpuMask, inferenceNice, networkCpuMask, networkNice)
+        }
+    }
+
+    /** Load the generator from [model], which can be released afterwards. */
+    constructor(model: ModelSource, threadConfig: ThreadConfig = ThreadConfig.DEFAULT) {
+        nativePtr = with(threadConfig) {
+            nativeCreateFromModel(model.nativePtr, inferenceCpuMask, inferenceNice, networkCpuMask, networkNice)
+        }
     }
 
     fun startCall(host: String, playDeviceId: Int, recordDeviceId: Int, signalPath: String) {
         nativeStartCall(nativePtr, host, playDeviceId, recordDeviceId, signalPath)
     }
 
+    /**
+     * Start a call playing [pilotTones] synthesized in the player's callback instead of a signal file.
+     * Saves keeping the signal in memory, but takes about 60 times the CPU time of looping a file.
+     * Throws [WatermarkNativeException] if a frequency is not below half the sample rate or there are too many tones.
+     */
+    fun startCall(host: String, playDeviceId: Int, recordDeviceId: Int, pilotTones: List<PilotTone> = PilotTone.DEFAULT) {
+        nativeStartCallWithTones(nativePtr, host, playDeviceId, recordDeviceId, PilotTone.toPairs(pilotTones))
+    }
+
+    /** Change the tones of a call started with pilot tones. Tones that stay keep playing without a glitch. */
+    fun setPilotTones(pilotTones: List<PilotTone>) {
+        nativeSetPilotTones(nativePtr, PilotTone.toPairs(pilotTones))
+    }
+
+    fun preloadSignal(signalPath: String) {
+        nativePreloadSignal(nativePtr, signalPath)
+    }
+
+    /** Stop the call. Stays in standby if [enterStandby] was called. */
     fun stopCall() {
         nativeStopCall(nativePtr)
     }
 
+    /**
+     * Keep the audio streams open, the KCP client connected and the pipeline wired between calls, so that a
+     * [startCall] with the same host and devices starts at once. The microphone stays open until [exitStandby].
+     */
+    fun enterStandby(host: String, playDeviceId: Int, recordDeviceId: Int) {
+        nativeEnterStandby(nativePtr, host, playDeviceId, recordDeviceId)
+    }
+
+    fun exitStandby() {
+        nativeExitStandby(nativePtr)
+    }
+
+    fun getCallStartupStats(): CallStartupStats? = nativeGetCallStartupStats(nativePtr)
+
+    /** Per-stage latency histograms since the last start, in pipeline order. */
+    fun getLatencyReport(): Array<StageLatency> = nativeGetLatencyReport(nativePtr) ?: emptyArray()
+
+    /** The recorder and pilot player streams, since they last started. */
+    fun getStreamStats(): Array<StreamStats> = nativeGetStreamStats(nativePtr) ?: emptyArray()
+
     fun release() {
         nativeDelete(nativePtr)
         nativePtr = 0
     }
 
-    private external fun nativeCreate(paramPath: String, modelPath: String): Long
+    private external fun nativeCreate(
+        paramPath: String, modelPath: String,
+        inferenceCpuMask: Long, inferenceNice: Int, networkCpuMask: Long, networkNice: Int
+    ): Long
+    private external fun nativeCreateFromModel(
+        modelPtr: Long,
+        inferenceCpuMask: Long, inferenceNice: Int, networkCpuMask: Long, networkNice: Int
+    ): Long
     private external fun nativeStartCall(nativePtr: Long, host: String, playDeviceId: Int, recordDeviceId: Int, signalPath: String)
+    private external fun nativeStartCallWithTones(nativePtr: Long, host: String, playDeviceId: Int, recordDeviceId: Int, tonePairs: FloatArray)
+    private external fun nativeSetPilotTones(nativePtr: Long, tonePairs: FloatArray)
+    private external fun nativePreloadSignal(nativePtr: Long, signalPath: String)
     private external fun nativeStopCall(nativePtr: Long)
+    private external fun nativeEnterStandby(nativePtr: Long, host: String, playDeviceId: Int, recordDeviceId: Int)
+    private external fun nativeExitStandby(nativePtr: Long)
+    private external fun nativeGetCallStartupStats(nativePtr: Long): CallStartupStats?
+    private external fun nativeGetLatencyReport(nativePtr: Long): Array<StageLatency>?
+    private external fun nativeGetStreamStats(nativePtr: Long): Array<StreamStats>?
     private external fun nativeDelete(nativePtr: Long)
 
     companion object {
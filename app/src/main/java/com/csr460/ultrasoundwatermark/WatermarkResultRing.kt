@@ -0,0 +1,63 @@
+package com.csr460.ultrasoundwatermark
+
+/** One detection result from [WatermarkResultRing]. */
+data class WatermarkResult(
+    /**
+     * Window position in the received stream, counting windows the detector skipped. Starts from 0 when the server is
+     * set up; starts from standby carry on counting.
+     */
+    val windowIndex: Long,
+    /** When the result was produced, in the [System.nanoTime] timebase. */
+    val timestampNanos: Long,
+    val instantaneous: Float,
+    val average: Float
+)
+
+/**
+ * Reader of the callee's native detection history. Each [readNew] copies every new result out in one JNI call, which
+ * follows the lock-free protocol documented in WatermarkResultRing.hpp with the atomics it needs; plain reads from
+ * Kotlin would have no acquire ordering.
+ *
+ * Each reader keeps its own position and is not thread-safe. The reader is only valid until the callee is released.
+ */
+class WatermarkResultRing(private val nativeRing: Long) {
+    val capacity: Int = nativeCapacity(nativeRing)
+    private val cursor = LongArray(1)
+    // Window index and timestamp, then instantaneous and average probability, of each result copied out
+    private val longFields = LongArray(2 * capacity)
+    private val floatFields = FloatArray(2 * capacity)
+
+    /** Results overwritten before this reader got to them. */
+    var lostResults = 0L
+        private set
+
+    /** Results written since the last call, oldest first. At most [capacity] of them. */
+    fun readNew(): List<WatermarkResult> {
+        val startIndex = cursor[0]
+        val count = nativeRead(nativeRing, cursor, longFields, floatFields)
+        lostResults += cursor[0] - startIndex - count
+        return List(count) { i ->
+            WatermarkResult(longFields[2 * i], longFields[2 * i + 1], floatFields[2 * i], floatFields[2 * i + 1])
+        }
+    }
+
+    /** Skip the results written so far, e.g. before watching a new session. */
+    fun skipToLatest() {
+        cursor[0] = nativeWriteIndex(nativeRing)
+    }
+
+    private companion object {
+        @JvmStatic
+        external fun nativeCapacity(nativeRing: Long): Int
+
+        @JvmStatic
+        external fun nativeWriteIndex(nativeRing: Long): Long
+
+        /**
+         * Copy the results from cursor[0] on and advance it past them and past any that were overwritten.
+         * Returns the number of results copied.
+         */
+        @JvmStatic
+        external fun nativeRead(nativeRing: Long, cursor: LongArray, longFields: LongArray, floatFields: FloatArray): Int
+    }
+}
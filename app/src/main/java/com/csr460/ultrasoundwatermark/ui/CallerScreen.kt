@@ -50,6 +50,10 @@ fun CallerScreen(viewModel: MainViewModel) {
                 Spacer(modifier = Modifier.width(8.dp))
                 Text("Calling...")
             }
+            state.timeToFirstPacketMillis?.let {
+                Spacer(modifier = Modifier.height(8.dp))
+                Text("First packet after %.1f ms".format(it))
+            }
         }
     }
 }
\ No newline at end of file
@@ -2,21 +2,28 @@ package com.csr460.ultrasoundwatermark.ui
 
 import android.app.Application
 import android.content.Context
-import android.content.pm.PackageManager
 import androidx.lifecycle.AndroidViewModel
 import androidx.lifecycle.viewModelScope
+import com.csr460.ultrasoundwatermark.AudioStreamDefaults
+import com.csr460.ultrasoundwatermark.ModelSource
+import com.csr460.ultrasoundwatermark.PilotTone
 import com.csr460.ultrasoundwatermark.R
+import com.csr460.ultrasoundwatermark.ThreadConfig
 import com.csr460.ultrasoundwatermark.WatermarkCaller
 import com.csr460.ultrasoundwatermark.WatermarkCallee
 import com.csr460.ultrasoundwatermark.WatermarkNativeException
+import com.csr460.ultrasoundwatermark.WatermarkResult
+import com.csr460.ultrasoundwatermark.WatermarkResultRing
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.Job
+import kotlinx.coroutines.cancelAndJoin
+import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.launch
-import java.io.File
-import java.io.FileOutputStream
-import java.io.InputStream
+import kotlinx.coroutines.runBlocking
 import java.net.Inet4Address
 import java.net.Inet6Address
 import java.net.NetworkInterface
@@ -34,11 +41,17 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
 
     private var watermarkCaller: WatermarkCaller? = null
     private var watermarkCallee: WatermarkCallee? = null
+    private var resultRing: WatermarkResultRing? = null
+    private var resultPolling: Job? = null
 
     // Callee State
     private val _calleeState = MutableStateFlow(CalleeScreenState())
     val calleeState: StateFlow<CalleeScreenState> = _calleeState.asStateFlow()
 
+    // Full detection result stream of the current session, newest last
+    private val _resultHistory = MutableStateFlow<List<WatermarkResult>>(emptyList())
+    val resultHistory: StateFlow<List<WatermarkResult>> = _resultHistory.asStateFlow()
+
     // Caller State
     private val _callerState = MutableStateFlow(CallerScreenState())
     val callerState: StateFlow<CallerScreenState> = _callerState.asStateFlow()
@@ -55,80 +68,28 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
 
     private fun initialize() {
         val context = getApplication<Application>().applicationContext
-        val lastVersionCode = getAppLastVersionCode(context)
-        val currentVersionCode = getAppCurrentVersionCode(context)
-
-
-        copyRawResources(context)
-        setAppLastVersionCode(context, currentVersionCode)
-
-
-        val callerParamPath = File(context.cacheDir, "generator_param").absolutePath
-        val callerModelPath = File(context.cacheDir, "generator_bin").absolutePath
-        val calleeParamPath = File(context.cacheDir, "detector_param").absolutePath
-        val calleeModelPath = File(context.cacheDir, "detector_bin").absolutePath
+        AudioStreamDefaults.initialize(context)
 
-        watermarkCaller = WatermarkCaller(callerParamPath, callerModelPath)
-        watermarkCallee = WatermarkCallee(calleeParamPath, calleeModelPath).apply {
-            setOnWatermarkResultsCallback { instantaneous, average ->
-                _calleeState.value = _calleeState.value.copy(
-                    instantaneousProbability = instantaneous,
-                    averageProbability = average
-                )
+        // The models are mapped from the APK and copied once into memory. Instances load them while constructed
+        val generatorModel = ModelSource.fromRawResources(context, R.raw.generator_param, R.raw.generator_bin)
+        val detectorModel = ModelSource.fromRawResources(context, R.raw.detector_param, R.raw.detector_bin)
+        // Keep inference off the little cores, where the scheduler tends to put it and windows miss their deadline
+        val threadConfig = ThreadConfig(inferenceCpuMask = ThreadConfig.performanceCores)
+        try {
+            // The pilot is synthesized during calls, so there is no signal to load
+            watermarkCaller = WatermarkCaller(generatorModel, threadConfig)
+            watermarkCallee = WatermarkCallee(detectorModel, threadConfig).also {
+                resultRing = it.openResultRing()
             }
+        } finally {
+            generatorModel.release()
+            detectorModel.release()
         }
         loadIpAddress()
         loadHostname()
         _initState.value = InitState.Ready
     }
 
-    private fun copyRawResources(context: Context) {
-        val rawResourceIds = mapOf(
-            R.raw.generator_param to "generator_param",
-            R.raw.generator_bin to "generator_bin",
-            R.raw.detector_param to "detector_param",
-            R.raw.detector_bin to "detector_bin",
-            R.raw.multitone to "multitone.wav"
-        )
-        rawResourceIds.forEach { (resId, filename) ->
-            copyRawResourceToFile(context, resId, File(context.cacheDir, filename))
-        }
-    }
-
-    private fun copyRawResourceToFile(context: Context, resourceId: Int, file: File) {
-        val inputStream: InputStream = context.resources.openRawResource(resourceId)
-        val outputStream = FileOutputStream(file)
-        inputStream.use { input ->
-            outputStream.use { output ->
-                input.copyTo(output)
-            }
-        }
-    }
-
-    private fun getAppLastVersionCode(context: Context): Long {
-        val prefs = context.getSharedPreferences("app_prefs", Context.MODE_PRIVATE)
-        return prefs.getLong("version_code", 0)
-    }
-
-    private fun setAppLastVersionCode(context: Context, versionCode: Long) {
-        val prefs = context.getSharedPreferences("app_prefs", Context.MODE_PRIVATE)
-        prefs.edit().putLong("version_code", versionCode).apply()
-    }
-
-    private fun getAppCurrentVersionCode(context: Context): Long {
-        return try {
-            val packageInfo = context.packageManager.getPackageInfo(context.packageName, 0)
-            if (android.os.Build.VERSION.SDK_INT >= android.os.Build.VERSION_CODES.P) {
-                packageInfo.longVersionCode
-            } else {
-                @Suppress("DEPRECATION")
-                packageInfo.versionCode.toLong()
-            }
-        } catch (e: PackageManager.NameNotFoundException) {
-            -1
-        }
-    }
-
     private fun loadIpAddress() {
         val ipv4Addresses = mutableListOf<String>()
         val ipv6Addresses = mutableListOf<String>()
@@ -156,8 +117,10 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
     fun startCallee() {
         viewModelScope.launch(Dispatchers.IO) {
             try {
+                watermarkCallee?.enterStandby(0)
                 watermarkCallee?.startServer(0)
                 _calleeState.value = _calleeState.value.copy(isListening = true)
+                startResultPolling()
             } catch (e: WatermarkNativeException) {
                 _initState.value = InitState.Error(e.message ?: "Unknown native error")
             }
@@ -167,6 +130,8 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
     fun stopCallee() {
         viewModelScope.launch(Dispatchers.IO) {
             try {
+                // The poller must be done with the ring before the callee stops or is released
+                resultPolling?.cancelAndJoin()
                 watermarkCallee?.stop()
                 _calleeState.value = _calleeState.value.copy(isListening = false)
             } catch (e: WatermarkNativeException) {
@@ -175,6 +140,28 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
         }
     }
 
+    /** Read the results in batches from the native ring, updating the state once per batch instead of per result. */
+    private suspend fun startResultPolling() {
+        val ring = resultRing ?: return
+        // A reader is not thread-safe, so the previous poller must have finished before the ring is touched here
+        resultPolling?.cancelAndJoin()
+        ring.skipToLatest()
+        _resultHistory.value = emptyList()
+        resultPolling = viewModelScope.launch(Dispatchers.Default) {
+            while (isActive) {
+                val results = ring.readNew()
+                results.lastOrNull()?.let { latest ->
+                    _calleeState.value = _calleeState.value.copy(
+                        instantaneousProbability = latest.instantaneous,
+                        averageProbability = latest.average
+                    )
+                    _resultHistory.value = (_resultHistory.value + results).takeLast(RESULT_HISTORY_SIZE)
+                }
+                delay(RESULT_POLL_INTERVAL_MS)
+            }
+        }
+    }
+
     private fun loadHostname() {
         val context = getApplication<Application>().applicationContext
         val prefs = context.getSharedPreferences("app_prefs", Context.MODE_PRIVATE)
@@ -192,10 +179,12 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
     fun startCaller() {
         viewModelScope.launch(Dispatchers.IO) {
             try {
-                val context = getApplication<Application>().applicationContext
-                val signalPath = File(context.cacheDir, "multitone.wav").absolutePath
-                watermarkCaller?.startCall(_callerState.value.hostname, 0, 0, signalPath)
-                _callerState.value = _callerState.value.copy(isCalling = true)
+                val host = _callerState.value.hostname
+                // Stay in standby between calls, so that only the first call pays for opening streams and connecting
+                watermarkCaller?.enterStandby(host, 0, 0)
+                watermarkCaller?.startCall(host, 0, 0, PilotTone.DEFAULT)
+                _callerState.value = _callerState.value.copy(isCalling = true, timeToFirstPacketMillis = null)
+                awaitFirstPacket()
             } catch (e: WatermarkNativeException) {
                 _initState.value = InitState.Error(e.message ?: "Unknown native error")
             }
@@ -213,11 +202,33 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
         }
     }
 
+    private suspend fun awaitFirstPacket() {
+        val deadline = System.nanoTime() + FIRST_PACKET_TIMEOUT_MS * 1_000_000
+        while (System.nanoTime() < deadline) {
+            val stats = watermarkCaller?.getCallStartupStats() ?: return
+            if (stats.firstPacketNanos >= 0) {
+                _callerState.value = _callerState.value.copy(timeToFirstPacketMillis = stats.firstPacketNanos / 1e6f)
+                return
+            }
+            delay(FIRST_PACKET_POLL_INTERVAL_MS)
+        }
+    }
+
     override fun onCleared() {
         super.onCleared()
+        // Wait for the poller to stop reading the ring, which the callee frees
+        runBlocking { resultPolling?.cancelAndJoin() }
+        resultRing = null
         watermarkCaller?.release()
         watermarkCallee?.release()
     }
+
+    private companion object {
+        const val RESULT_POLL_INTERVAL_MS = 50L
+        const val RESULT_HISTORY_SIZE = 600
+        const val FIRST_PACKET_POLL_INTERVAL_MS = 5L
+        const val FIRST_PACKET_TIMEOUT_MS = 2000L
+    }
 }
 
 data class CalleeScreenState(
@@ -231,5 +242,6 @@ data class CalleeScreenState(
 
 data class CallerScreenState(
     val isCalling: Boolean = false,
-    val hostname: String = "localhost"
+    val hostname: String = "localhost",
+    val timeToFirstPacketMillis: Float? = null
 )
\ No newline at end of file